@@ -67,6 +67,8 @@ struct CitContext {
 	int is_local_socket;	/* set to 1 if client is on unix domain sock */
 	/* Redirect this session's output to a memory buffer? */
 	StrBuf *redirect_buffer;		/* the buffer */
+	int redirect_count_only;		/* ...or only count the bytes? */
+	long redirect_count;			/* the count */
 	StrBuf *StatusMessage;
 #ifdef HAVE_OPENSSL
 	SSL *ssl;
@@ -107,6 +109,8 @@ struct CitContext {
 	FILE *download_fp;	/* Fields relating to file transfer */
 	size_t download_fp_total;
 	char download_desired_section[128];
+	long download_range_start;	/* DLAT: part of the section the client wants */
+	long download_range_len;
 	FILE *upload_fp;
 	char upl_file[256];
 	char upl_path[PATH_MAX];
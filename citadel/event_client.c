@@ -1115,6 +1115,61 @@ eNextState EvConnectSock(AsyncIO *IO,
 	return IO->NextState;
 }
 
+/*
+ * Attach an already connected socket (i.e. one we kept around in a
+ * connection pool) to this IO context, and start talking on it.
+ */
+eNextState EvAttachSock(AsyncIO *IO,
+			int fd,
+			double first_rw_timeout,
+			int ReadFirst)
+{
+	SetEVState(IO, eIOConnNow);
+	become_session(IO->CitContext);
+
+	if (ReadFirst) {
+		IO->NextState = eReadMessage;
+	}
+	else {
+		IO->NextState = eSendReply;
+	}
+
+	IO->SendBuf.fd = IO->RecvBuf.fd = fd;
+
+	ev_io_init(&IO->recv_event, IO_recv_callback, IO->RecvBuf.fd, EV_READ);
+	IO->recv_event.data = IO;
+	ev_io_init(&IO->send_event, IO_send_callback, IO->SendBuf.fd, EV_WRITE);
+	IO->send_event.data = IO;
+
+	ev_timer_init(&IO->conn_fail, IO_connfail_callback, first_rw_timeout, 0);
+	IO->conn_fail.data = IO;
+	ev_timer_init(&IO->rw_timeout, IO_Timeout_callback, first_rw_timeout,0);
+	IO->rw_timeout.data = IO;
+
+	EV_syslog(LOG_DEBUG, "EVENT: reusing connected socket %d\n", fd);
+	set_start_callback(event_base, IO, 0);
+	return IO->NextState;
+}
+
+/*
+ * Stop watching the socket of this IO context, and hand it to the caller
+ * instead of closing it; the IO context won't touch it anymore.
+ */
+int EvDetachSock(AsyncIO *IO)
+{
+	int fd = IO->SendBuf.fd;
+
+	StopClientWatchers(IO, 0);
+	IO->SendBuf.fd = IO->RecvBuf.fd = 0;
+	FlushStrBuf(IO->SendBuf.Buf);
+	IO->SendBuf.ReadWritePointer = NULL;
+	FlushStrBuf(IO->RecvBuf.Buf);
+	IO->RecvBuf.ReadWritePointer = NULL;
+
+	EV_syslog(LOG_DEBUG, "EVENT: detached socket %d\n", fd);
+	return fd;
+}
+
 void SetNextTimeout(AsyncIO *IO, double timeout)
 {
 	IO->rw_timeout.repeat = timeout;
@@ -295,6 +295,11 @@ eNextState EvConnectSock(AsyncIO *IO,
 			 double conn_timeout,
 			 double first_rw_timeout,
 			 int ReadFirst);
+eNextState EvAttachSock(AsyncIO *IO,
+			int fd,
+			double first_rw_timeout,
+			int ReadFirst);
+int EvDetachSock(AsyncIO *IO);
 void IO_postdns_callback(struct ev_loop *loop, ev_idle *watcher, int revents);
 
 int QueueQuery(ns_type Type,
@@ -302,6 +307,7 @@ int QueueQuery(ns_type Type,
 	       AsyncIO *IO,
 	       DNSQueryParts *QueryParts,
 	       IO_CallBack PostDNS);
+long GetDNSQueryCount(void);
 
 void QueueGetHostByName(AsyncIO *IO,
 			const char *Hostname,
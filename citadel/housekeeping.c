@@ -20,6 +20,7 @@
 #include "room_ops.h"
 #include "internet_addressing.h"
 #include "journaling.h"
+#include "msgbase.h"
 
 void check_sched_shutdown(void) {
 	if ((ScheduledShutdown == 1) && (ContextList == NULL)) {
@@ -113,7 +114,6 @@ void do_housekeeping(void) {
 	}
 
 	/* First, do the "as often as needed" stuff... */
-	JournalRunQueue();
 	PerformSessionHooks(EVT_HOUSE);
 
 	/* Then, do the "once per minute" stuff... */
@@ -42,6 +42,7 @@ extern char file_citadel_urlshorteners[PATH_MAX];
 extern char file_lmtp_socket[PATH_MAX];
 extern char file_lmtp_unfiltered_socket[PATH_MAX];
 extern char file_arcq[PATH_MAX];
+extern char file_jnlq[PATH_MAX];
 extern char file_citadel_socket[PATH_MAX];
 extern char file_citadel_admin_socket[PATH_MAX];
 extern char file_mail_aliases[PATH_MAX];
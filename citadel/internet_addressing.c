@@ -109,7 +109,7 @@ void utf8ify_rfc822_string(char *buf) {
 	if (illegal_non_rfc2047_encoding) {
 		const char *default_header_charset = "iso-8859-1";
 		if ( (strcasecmp(default_header_charset, "UTF-8")) && (strcasecmp(default_header_charset, "us-ascii")) ) {
-			ctdl_iconv_open("UTF-8", default_header_charset, &ic);
+			ctdl_iconv_acquire("UTF-8", default_header_charset, &ic);
 			if (ic != (iconv_t)(-1) ) {
 				ibuf = malloc(1024);
 				isav = ibuf;
@@ -122,7 +122,7 @@ void utf8ify_rfc822_string(char *buf) {
 				osav[1024-obuflen] = 0;
 				strcpy(buf, osav);
 				free(osav);
-				iconv_close(ic);
+				ctdl_iconv_release(&ic);
 				free(isav);
 			}
 		}
@@ -211,7 +211,7 @@ void utf8ify_rfc822_string(char *buf) {
 			ibuflen = strlen(istr);
 		}
 
-		ctdl_iconv_open("UTF-8", charset, &ic);
+		ctdl_iconv_acquire("UTF-8", charset, &ic);
 		if (ic != (iconv_t)(-1) ) {
 			obuflen = 1024;
 			obuf = (char *) malloc(obuflen);
@@ -231,7 +231,7 @@ void utf8ify_rfc822_string(char *buf) {
 			snprintf(newbuf, sizeof newbuf, "%s%s%s", buf, osav, end);
 			strcpy(buf, newbuf);
 			free(osav);
-			iconv_close(ic);
+			ctdl_iconv_release(&ic);
 		}
 		else {
 			end = start;
@@ -283,8 +283,8 @@ struct spamstrings_t *spamstrings = NULL;
  * Return nonzero if the supplied name is an alias for this host.
  */
 int CtdlHostAlias(char *fqdn) {
-	int config_lines;
-	int i;
+	const char *Pos;
+	const char *LinePos;
 	char buf[256];
 	char host[256], type[256];
 	int found = 0;
@@ -296,11 +296,11 @@ int CtdlHostAlias(char *fqdn) {
 	if (!strcasecmp(fqdn, CtdlGetConfigStr("c_nodename"))) return(hostalias_localhost);
 	if (inetcfg == NULL) return(hostalias_nomatch);
 
-	config_lines = num_tokens(inetcfg, '\n');
-	for (i=0; i<config_lines; ++i) {
-		extract_token(buf, inetcfg, i, '\n', sizeof buf);
-		extract_token(host, buf, 0, '|', sizeof host);
-		extract_token(type, buf, 1, '|', sizeof type);
+	Pos = inetcfg;
+	while (extract_next_token(buf, &Pos, '\n', sizeof buf) >= 0) {
+		LinePos = buf;
+		extract_next_token(host, &LinePos, '|', sizeof host);
+		extract_next_token(type, &LinePos, '|', sizeof type);
 
 		found = 0;
 
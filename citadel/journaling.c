@@ -13,6 +13,8 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <sys/time.h>
 #include <libcitadel.h>
 
 #include "ctdl_module.h"
@@ -22,18 +24,202 @@
 #include "user_ops.h"
 #include "serv_vcard.h"			/* Needed for vcard_getuser and extract_inet_email_addrs */
 #include "internet_addressing.h"
+#include "threads.h"
+#include "context.h"
 #include "journaling.h"
 
-struct jnlq *jnlq = NULL;	/* journal queue */
+/*
+ * The journal queue.  Messages to be journalized are appended at the tail by
+ * whoever saved them, and taken off the head by the journal writer thread.
+ * Every queued item is also appended to file_jnlq, and marked done there once
+ * it has been journalized, so nothing is lost if we go down in between.
+ *
+ * JournalQueueMutex protects the in-memory queue and is only ever held
+ * briefly; file_jnlq is written under JournalFileMutex, so nobody waits for
+ * the disk while holding up the queue.  If both are needed, take
+ * JournalFileMutex first.
+ */
+static struct jnlq *jnlq = NULL;		/* head of the journal queue */
+static struct jnlq *jnlq_tail = NULL;
+static int jnlq_inflight = 0;			/* being persisted, not queued yet */
+static pthread_mutex_t JournalQueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t JournalQueueCond = PTHREAD_COND_INITIALIZER;	/* work arrived */
+static pthread_cond_t JournalSpaceCond = PTHREAD_COND_INITIALIZER;	/* room in queue */
+static pthread_mutex_t JournalFileMutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *jnlfp = NULL;			/* our persistent copy of the queue */
+static long jnlq_seq = 0;
+static int jnlq_loaded = 0;
+static int JournalWriterRunning = 0;
+static int JournalWriterExit = 0;		/* finish the queue, then exit */
+static int JournalWriterAbort = 0;		/* exit after the current message */
+
+JournalQueueStats JournalStats;
+
+
+/*
+ * Append a string to the persistent queue.  NULL is stored as length -1.
+ */
+static void jnlq_put_str(const char *str)
+{
+	long len = (str == NULL) ? -1L : (long) strlen(str);
+
+	fwrite(&len, sizeof(long), 1, jnlfp);
+	if (len > 0) {
+		fwrite(str, len, 1, jnlfp);
+	}
+}
+
+
+/*
+ * Read back a string written by jnlq_put_str().  Returns 0 on success.
+ */
+static int jnlq_get_str(FILE *fp, char **str)
+{
+	long len;
+
+	*str = NULL;
+	if (fread(&len, sizeof(long), 1, fp) != 1) return(-1);
+	if (len < 0) return(0);
+	*str = malloc(len + 1);
+	if (*str == NULL) return(-1);
+	if ((len > 0) && (fread(*str, len, 1, fp) != 1)) {
+		free(*str);
+		*str = NULL;
+		return(-1);
+	}
+	(*str)[len] = 0;
+	return(0);
+}
+
+
+static void jnlq_load_persisted(void);
+
+/*
+ * Open file_jnlq for appending if it isn't open yet; the first time
+ * around, pick up what our previous incarnation left there.
+ * Call with JournalFileMutex held.
+ */
+static int jnlq_open(void)
+{
+	if (!jnlq_loaded) {
+		jnlq_loaded = 1;
+		jnlq_load_persisted();
+	}
+	if (jnlfp == NULL) {
+		jnlfp = fopen(file_jnlq, "ab+");
+		if (jnlfp == NULL) {
+			syslog(LOG_ERR, "journal: cannot open %s: %s", file_jnlq, strerror(errno));
+			return(-1);
+		}
+		chown(file_jnlq, CTDLUID, (-1));
+		chmod(file_jnlq, 0600);
+	}
+	return(0);
+}
+
+
+/*
+ * Write a queue item (or, with done set, the fact that it's journalized)
+ * to file_jnlq.  It isn't safe on disk until jnlq_sync() says so.
+ * Call with JournalFileMutex held.
+ */
+static void jnlq_persist(struct jnlq *jptr, int done)
+{
+	long hdr[3];
+
+	if (jnlq_open() != 0) return;
+
+	hdr[0] = JNLQ_MAGIC;
+	hdr[1] = jptr->seq;
+	hdr[2] = done;
+	fwrite(hdr, sizeof(long), 3, jnlfp);
+	if (!done) {
+		fwrite(&jptr->num_local, sizeof(int), 1, jnlfp);
+		fwrite(&jptr->num_ignet, sizeof(int), 1, jnlfp);
+		fwrite(&jptr->num_internet, sizeof(int), 1, jnlfp);
+		jnlq_put_str(jptr->recp_local);
+		jnlq_put_str(jptr->recp_ignet);
+		jnlq_put_str(jptr->recp_internet);
+		jnlq_put_str(jptr->from);
+		jnlq_put_str(jptr->node);
+		jnlq_put_str(jptr->rfca);
+		jnlq_put_str(jptr->subj);
+		jnlq_put_str(jptr->msgn);
+		jnlq_put_str(jptr->rfc822);
+	}
+}
+
+
+/*
+ * Flush what jnlq_persist() wrote all the way to the disk.
+ * Call with JournalFileMutex held.
+ */
+static void jnlq_sync(void)
+{
+	if (jnlfp == NULL) return;
+
+	if ((fflush(jnlfp) != 0) || (fsync(fileno(jnlfp)) != 0)) {
+		syslog(LOG_ERR, "journal: cannot write %s: %s", file_jnlq, strerror(errno));
+	}
+}
+
+
+/*
+ * Free a queue item.
+ */
+static void jnlq_free(struct jnlq *jptr)
+{
+	free(jptr->recp_local);
+	free(jptr->recp_ignet);
+	free(jptr->recp_internet);
+	free(jptr->from);
+	free(jptr->node);
+	free(jptr->rfca);
+	free(jptr->subj);
+	free(jptr->msgn);
+	free(jptr->rfc822);
+	free(jptr);
+}
+
+
+/*
+ * Append an item to the in-memory queue and wake up the writer.
+ * Call with JournalQueueMutex held.
+ */
+static void jnlq_append(struct jnlq *jptr)
+{
+	jptr->next = NULL;
+	if (jnlq_tail == NULL) {
+		jnlq = jptr;
+	}
+	else {
+		jnlq_tail->next = jptr;
+	}
+	jnlq_tail = jptr;
+
+	++JournalStats.Queued;
+	JournalStats.QueuedBytes += jptr->size;
+	if (JournalStats.Queued > JournalStats.HighWater) {
+		JournalStats.HighWater = JournalStats.Queued;
+	}
+	pthread_cond_signal(&JournalQueueCond);
+}
+
 
 /*
  * Hand off a copy of a message to be journalized.
+ *
+ * If the journal writer is falling behind, we make the caller wait (up to
+ * JOURNAL_QUEUE_MAX_WAIT seconds) before queueing more; the item is never
+ * dropped, it's on disk either way.
  */
 void JournalBackgroundSubmit(struct CtdlMessage *msg,
 			StrBuf *saved_rfc822_version,
 			recptypes *recps) {
 
 	struct jnlq *jptr = NULL;
+	struct timeval tv_start, tv_end;
+	struct timespec deadline;
 
 	/* Avoid double journaling! */
 	if (!CM_IsEmpty(msg, eJournal)) {
@@ -47,19 +233,62 @@ void JournalBackgroundSubmit(struct CtdlMessage *msg,
 		return;
 	}
 	memset(jptr, 0, sizeof(struct jnlq));
-	if (recps != NULL) memcpy(&jptr->recps, recps, sizeof(recptypes));
+
+	/* The recipient lists belong to our caller, who will free them. */
+	if (recps != NULL) {
+		jptr->num_local = recps->num_local;
+		jptr->num_ignet = recps->num_ignet;
+		jptr->num_internet = recps->num_internet;
+		if (recps->recp_local != NULL) jptr->recp_local = strdup(recps->recp_local);
+		if (recps->recp_ignet != NULL) jptr->recp_ignet = strdup(recps->recp_ignet);
+		if (recps->recp_internet != NULL) jptr->recp_internet = strdup(recps->recp_internet);
+	}
 	if (!CM_IsEmpty(msg, eAuthor)) jptr->from = strdup(msg->cm_fields[eAuthor]);
 	if (!CM_IsEmpty(msg, eNodeName)) jptr->node = strdup(msg->cm_fields[eNodeName]);
 	if (!CM_IsEmpty(msg, erFc822Addr)) jptr->rfca = strdup(msg->cm_fields[erFc822Addr]);
 	if (!CM_IsEmpty(msg, eMsgSubject)) jptr->subj = strdup(msg->cm_fields[eMsgSubject]);
 	if (!CM_IsEmpty(msg, emessageId)) jptr->msgn = strdup(msg->cm_fields[emessageId]);
+	jptr->size = StrLength(saved_rfc822_version);
 	jptr->rfc822 = SmashStrBuf(&saved_rfc822_version);
 
-	/* Add to the queue */
-	begin_critical_section(S_JOURNAL_QUEUE);
-	jptr->next = jnlq;
-	jnlq = jptr;
-	end_critical_section(S_JOURNAL_QUEUE);
+	pthread_mutex_lock(&JournalQueueMutex);
+
+	/* Back pressure: wait for the writer to make some room. */
+	if ( (JournalWriterRunning)
+	   && ( (JournalStats.Queued >= JOURNAL_QUEUE_MAX_MSGS)
+	      || (JournalStats.QueuedBytes >= JOURNAL_QUEUE_MAX_BYTES) ) ) {
+		++JournalStats.Waits;
+		gettimeofday(&tv_start, NULL);
+		deadline.tv_sec = tv_start.tv_sec + JOURNAL_QUEUE_MAX_WAIT;
+		deadline.tv_nsec = tv_start.tv_usec * 1000;
+		while ( (JournalWriterRunning)
+		      && (!server_shutting_down)
+		      && ( (JournalStats.Queued >= JOURNAL_QUEUE_MAX_MSGS)
+			 || (JournalStats.QueuedBytes >= JOURNAL_QUEUE_MAX_BYTES) ) ) {
+			if (pthread_cond_timedwait(&JournalSpaceCond, &JournalQueueMutex, &deadline) == ETIMEDOUT) {
+				++JournalStats.WaitTimeouts;
+				break;
+			}
+		}
+		gettimeofday(&tv_end, NULL);
+		JournalStats.WaitUsec +=
+			(tv_end.tv_sec - tv_start.tv_sec) * 1000000L +
+			(tv_end.tv_usec - tv_start.tv_usec);
+	}
+	++jnlq_inflight;	/* so the writer doesn't truncate file_jnlq under us */
+	pthread_mutex_unlock(&JournalQueueMutex);
+
+	pthread_mutex_lock(&JournalFileMutex);
+	jnlq_open();
+	jptr->seq = ++jnlq_seq;
+	jnlq_persist(jptr, 0);
+	jnlq_sync();
+	pthread_mutex_unlock(&JournalFileMutex);
+
+	pthread_mutex_lock(&JournalQueueMutex);
+	--jnlq_inflight;
+	jnlq_append(jptr);
+	pthread_mutex_unlock(&JournalQueueMutex);
 }
 
 
@@ -94,12 +323,12 @@ void local_to_inetemail(char *inetemail, char *localuser, size_t inetemail_len)
 
 
 /*
- * Called by JournalRunQueue() to send an individual message.
+ * Called by the journal writer to send an individual message to the
+ * (already validated) journal destination.
  */
-void JournalRunQueueMsg(struct jnlq *jmsg) {
+void JournalRunQueueMsg(struct jnlq *jmsg, recptypes *journal_recps) {
 
 	struct CtdlMessage *journal_msg = NULL;
-	recptypes *journal_recps = NULL;
 	StrBuf *message_text = NULL;
 	char mime_boundary[256];
 	long mblen;
@@ -111,7 +340,6 @@ void JournalRunQueueMsg(struct jnlq *jmsg) {
 
 	if (jmsg == NULL)
 		return;
-	journal_recps = validate_recipients(CtdlGetConfigStr("c_journal_dest"), NULL, 0);
 	if (journal_recps != NULL) {
 
 		if (  (journal_recps->num_local > 0)
@@ -221,9 +449,9 @@ void JournalRunQueueMsg(struct jnlq *jmsg) {
 				HKEY(">\r\n"
 				     "Recipients:\r\n"), 0);
 
-			if (jmsg->recps.num_local > 0) {
-				for (i=0; i<jmsg->recps.num_local; ++i) {
-					extract_token(recipient, jmsg->recps.recp_local,
+			if (jmsg->num_local > 0) {
+				for (i=0; i<jmsg->num_local; ++i) {
+					extract_token(recipient, jmsg->recp_local,
 							i, '|', sizeof recipient);
 					local_to_inetemail(inetemail, recipient, sizeof inetemail);
 					StrBufAppendPrintf(message_text, 
@@ -231,18 +459,18 @@ void JournalRunQueueMsg(struct jnlq *jmsg) {
 				}
 			}
 
-			if (jmsg->recps.num_ignet > 0) {
-				for (i=0; i<jmsg->recps.num_ignet; ++i) {
-					extract_token(recipient, jmsg->recps.recp_ignet,
+			if (jmsg->num_ignet > 0) {
+				for (i=0; i<jmsg->num_ignet; ++i) {
+					extract_token(recipient, jmsg->recp_ignet,
 							i, '|', sizeof recipient);
 					StrBufAppendPrintf(message_text, 
 							   "	%s\r\n", recipient);
 				}
 			}
 
-			if (jmsg->recps.num_internet > 0) {
-				for (i=0; i<jmsg->recps.num_internet; ++i) {
-					extract_token(recipient, jmsg->recps.recp_internet,
+			if (jmsg->num_internet > 0) {
+				for (i=0; i<jmsg->num_internet; ++i) {
+					extract_token(recipient, jmsg->recp_internet,
 							i, '|', sizeof recipient);
 					StrBufAppendPrintf(message_text, 
 						"	%s\r\n", recipient);
@@ -284,30 +512,263 @@ void JournalRunQueueMsg(struct jnlq *jmsg) {
 			CtdlSubmitMsg(journal_msg, journal_recps, "", 0);
 			CM_Free(journal_msg);
 		}
+	}
+}
 
-		free_recipients(journal_recps);
+
+/*
+ * Load whatever was left in file_jnlq by our previous incarnation back into
+ * the queue.  Items which made it into the journal are marked done there.
+ * Called by jnlq_open() with JournalFileMutex held.
+ */
+static void jnlq_load_persisted(void)
+{
+	FILE *fp;
+	struct jnlq *jptr;
+	struct jnlq *prev;
+	long hdr[3];
+	int ok;
+
+	fp = fopen(file_jnlq, "rb");
+	if (fp == NULL) {
+		return;
 	}
 
-	/* We are responsible for freeing this memory. */
-	free(jmsg);
+	pthread_mutex_lock(&JournalQueueMutex);
+	while (fread(hdr, sizeof(long), 3, fp) == 3) {
+		if (hdr[0] != JNLQ_MAGIC) {
+			syslog(LOG_ERR, "journal: %s is corrupt; salvaged what we could", file_jnlq);
+			break;
+		}
+		if (hdr[1] > jnlq_seq) {
+			jnlq_seq = hdr[1];
+		}
+
+		if (hdr[2]) {		/* done; take it off the queue */
+			for (prev = NULL, jptr = jnlq; jptr != NULL; prev = jptr, jptr = jptr->next) {
+				if (jptr->seq == hdr[1]) break;
+			}
+			if (jptr != NULL) {
+				if (prev == NULL) jnlq = jptr->next;
+				else prev->next = jptr->next;
+				if (jnlq_tail == jptr) jnlq_tail = prev;
+				--JournalStats.Queued;
+				JournalStats.QueuedBytes -= jptr->size;
+				jnlq_free(jptr);
+			}
+			continue;
+		}
+
+		jptr = (struct jnlq *)malloc(sizeof(struct jnlq));
+		memset(jptr, 0, sizeof(struct jnlq));
+		jptr->seq = hdr[1];
+		ok = (fread(&jptr->num_local, sizeof(int), 1, fp) == 1)
+			&& (fread(&jptr->num_ignet, sizeof(int), 1, fp) == 1)
+			&& (fread(&jptr->num_internet, sizeof(int), 1, fp) == 1)
+			&& (jnlq_get_str(fp, &jptr->recp_local) == 0)
+			&& (jnlq_get_str(fp, &jptr->recp_ignet) == 0)
+			&& (jnlq_get_str(fp, &jptr->recp_internet) == 0)
+			&& (jnlq_get_str(fp, &jptr->from) == 0)
+			&& (jnlq_get_str(fp, &jptr->node) == 0)
+			&& (jnlq_get_str(fp, &jptr->rfca) == 0)
+			&& (jnlq_get_str(fp, &jptr->subj) == 0)
+			&& (jnlq_get_str(fp, &jptr->msgn) == 0)
+			&& (jnlq_get_str(fp, &jptr->rfc822) == 0);
+		if (!ok) {		/* we went down while writing this one */
+			jnlq_free(jptr);
+			break;
+		}
+		jptr->size = (jptr->rfc822 != NULL) ? strlen(jptr->rfc822) : 0;
+		jnlq_append(jptr);
+		++JournalStats.Replayed;
+	}
+	fclose(fp);
+
+	/* start over with a clean file containing only what's still pending */
+	if (jnlfp != NULL) {
+		fclose(jnlfp);
+		jnlfp = NULL;
+	}
+	unlink(file_jnlq);
+	for (jptr = jnlq; jptr != NULL; jptr = jptr->next) {
+		jnlq_persist(jptr, 0);
+	}
+	jnlq_sync();
+
+	if (JournalStats.Replayed > 0) {
+		syslog(LOG_INFO, "journal: %ld messages from the last run still need to be journalized",
+		       JournalStats.Queued);
+	}
+	pthread_mutex_unlock(&JournalQueueMutex);
 }
 
 
 /*
- * Run the queue.
+ * The journal writer thread.  It takes the queue in batches of up to
+ * JOURNAL_BATCH_SIZE, so the journal destination is looked up once per
+ * batch, and file_jnlq is emptied whenever the queue runs dry.  When told
+ * to exit, it finishes the queue first unless told to abort.
  */
-void JournalRunQueue(void) {
-	struct jnlq *jptr = NULL;
+void *journal_writer_thread(void *arg)
+{
+	struct CitContext journal_CC;
+	struct jnlq *batch;
+	struct jnlq *done;
+	struct jnlq *jptr;
+	recptypes *journal_recps;
+	struct timespec wakeup;
+	time_t last_stats = time(NULL);
+	long last_journaled = 0;
+	int n;
+
+	CtdlFillSystemContext(&journal_CC, "journal");
+	become_session(&journal_CC);
+
+	pthread_mutex_lock(&JournalFileMutex);
+	jnlq_open();
+	pthread_mutex_unlock(&JournalFileMutex);
+
+	while (!JournalWriterAbort) {
+
+		pthread_mutex_lock(&JournalQueueMutex);
+		while ((jnlq == NULL) && (!JournalWriterExit)) {
+			wakeup.tv_sec = time(NULL) + 1;
+			wakeup.tv_nsec = 0;
+			pthread_cond_timedwait(&JournalQueueCond, &JournalQueueMutex, &wakeup);
+		}
+		if (jnlq == NULL) {		/* told to exit, and nothing left */
+			pthread_mutex_unlock(&JournalQueueMutex);
+			break;
+		}
+
+		/* cut off a batch from the head of the queue */
+		batch = jnlq;
+		for (n = 1, jptr = jnlq; (jptr->next != NULL) && (n < JOURNAL_BATCH_SIZE); ++n) {
+			jptr = jptr->next;
+		}
+		jnlq = jptr->next;
+		jptr->next = NULL;
+		if (jnlq == NULL) jnlq_tail = NULL;
+		pthread_mutex_unlock(&JournalQueueMutex);
+
+		done = NULL;
+		journal_recps = validate_recipients(CtdlGetConfigStr("c_journal_dest"), NULL, 0);
+		while ((batch != NULL) && (!JournalWriterAbort)) {
+			jptr = batch;
+			batch = batch->next;
+
+			JournalRunQueueMsg(jptr, journal_recps);
+			jptr->next = done;
+			done = jptr;
+
+			pthread_mutex_lock(&JournalQueueMutex);
+			--JournalStats.Queued;
+			JournalStats.QueuedBytes -= jptr->size;
+			++JournalStats.Journaled;
+			pthread_cond_broadcast(&JournalSpaceCond);
+			pthread_mutex_unlock(&JournalQueueMutex);
+		}
+		if (journal_recps != NULL) {
+			free_recipients(journal_recps);
+		}
+
+		/* Mark what we did as done, and start over if nothing else is pending. */
+		pthread_mutex_lock(&JournalFileMutex);
+		for (jptr = done; jptr != NULL; jptr = jptr->next) {
+			jnlq_persist(jptr, 1);
+		}
+		jnlq_sync();
+		pthread_mutex_lock(&JournalQueueMutex);
+		if ((jnlq == NULL) && (jnlq_inflight == 0) && (batch == NULL) && (jnlfp != NULL)) {
+			if (ftruncate(fileno(jnlfp), 0) != 0) {
+				syslog(LOG_ERR, "journal: cannot truncate %s: %s", file_jnlq, strerror(errno));
+			}
+		}
+		pthread_mutex_unlock(&JournalQueueMutex);
+		pthread_mutex_unlock(&JournalFileMutex);
+
+		while (done != NULL) {
+			jptr = done;
+			done = done->next;
+			jnlq_free(jptr);
+		}
 
-	while (jnlq != NULL) {
-		begin_critical_section(S_JOURNAL_QUEUE);
-		if (jnlq != NULL) {
-			jptr = jnlq;
-			jnlq = jnlq->next;
+		/* aborted halfway through; the rest stays in file_jnlq for next time */
+		while (batch != NULL) {
+			jptr = batch;
+			batch = batch->next;
+			jnlq_free(jptr);
 		}
-		end_critical_section(S_JOURNAL_QUEUE);
-		JournalRunQueueMsg(jptr);
+
+		pthread_mutex_lock(&JournalQueueMutex);
+		if ( (time(NULL) - last_stats >= 60) && (JournalStats.Journaled != last_journaled) ) {
+			syslog(LOG_INFO,
+			       "journal: %ld journalized, %ld pending (%ld bytes, high water %ld), "
+			       "submitters throttled %ld times for %ld ms (%ld timeouts)",
+			       JournalStats.Journaled, JournalStats.Queued, JournalStats.QueuedBytes,
+			       JournalStats.HighWater, JournalStats.Waits,
+			       JournalStats.WaitUsec / 1000, JournalStats.WaitTimeouts);
+			last_stats = time(NULL);
+			last_journaled = JournalStats.Journaled;
+		}
+		pthread_mutex_unlock(&JournalQueueMutex);
 	}
+
+	pthread_mutex_lock(&JournalFileMutex);
+	if (jnlfp != NULL) {
+		fclose(jnlfp);
+		jnlfp = NULL;
+	}
+	pthread_mutex_unlock(&JournalFileMutex);
+
+	pthread_mutex_lock(&JournalQueueMutex);
+	JournalWriterRunning = 0;
+	pthread_cond_broadcast(&JournalSpaceCond);
+	pthread_mutex_unlock(&JournalQueueMutex);
+	syslog(LOG_DEBUG, "journal: writer exiting, %ld messages left for next time", JournalStats.Queued);
+	return(NULL);
 }
 
 
+/*
+ * Start the journal writer.  Called once threading is up.
+ */
+void JournalStartWriter(void)
+{
+	JournalWriterExit = 0;
+	JournalWriterAbort = 0;
+	JournalWriterRunning = 1;
+	CtdlThreadCreate(journal_writer_thread);
+}
+
+
+/*
+ * Tell the journal writer to journalize what's still queued and exit, and
+ * wait for it.  If that takes longer than 30 seconds, it stops after the
+ * message it's working on, and the rest stays in file_jnlq for the next
+ * start.  Either way it's gone before we return, so it won't touch the
+ * database while we close it.
+ */
+void JournalStopWriter(void)
+{
+	int countdown = 30;
+
+	pthread_mutex_lock(&JournalQueueMutex);
+	JournalWriterExit = 1;
+	pthread_cond_signal(&JournalQueueCond);
+	pthread_mutex_unlock(&JournalQueueMutex);
+
+	while ((JournalWriterRunning) && (countdown-- > 0)) {
+		syslog(LOG_DEBUG, "Waiting %d seconds for the journal writer to finish %ld messages",
+		       countdown, JournalStats.Queued);
+		usleep(1000000);
+	}
+
+	if (JournalWriterRunning) {
+		syslog(LOG_INFO, "journal: leaving %ld messages for the next start", JournalStats.Queued);
+		JournalWriterAbort = 1;
+		while (JournalWriterRunning) {
+			usleep(100000);
+		}
+	}
+}
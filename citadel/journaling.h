@@ -1,6 +1,13 @@
 struct jnlq {
 	struct jnlq *next;
-	recptypes recps;
+	long seq;		/* our record number in file_jnlq */
+	long size;		/* strlen(rfc822), for the queue limits */
+	int num_local;
+	int num_ignet;
+	int num_internet;
+	char *recp_local;
+	char *recp_ignet;
+	char *recp_internet;
 	char *from;
 	char *node;
 	char *rfca;
@@ -9,8 +16,28 @@ struct jnlq {
 	char *rfc822;
 };
 
+#define JNLQ_MAGIC		0x4a4e4c51L
+#define JOURNAL_BATCH_SIZE	32		/* messages per writer batch */
+#define JOURNAL_QUEUE_MAX_MSGS	1000		/* throttle submitters beyond this many... */
+#define JOURNAL_QUEUE_MAX_BYTES	(64*1024*1024)	/* ...or this many bytes queued */
+#define JOURNAL_QUEUE_MAX_WAIT	10		/* but don't hold them up longer than this (seconds) */
+
+typedef struct _JournalQueueStats {
+	long Queued;		/* messages waiting to be journalized */
+	long QueuedBytes;
+	long HighWater;		/* the most we ever had queued */
+	long Journaled;		/* messages journalized since startup */
+	long Replayed;		/* left over from the last run */
+	long Waits;		/* submitters throttled because the queue was full */
+	long WaitTimeouts;	/* ...and then gave up waiting */
+	long WaitUsec;		/* time they spent waiting */
+} JournalQueueStats;
+
+extern JournalQueueStats JournalStats;
+
 void JournalBackgroundSubmit(struct CtdlMessage *msg,
                         StrBuf *saved_rfc822_version,
                         recptypes *recps);
-void JournalRunQueueMsg(struct jnlq *jmsg);
-void JournalRunQueue(void);
+void JournalRunQueueMsg(struct jnlq *jmsg, recptypes *journal_recps);
+void JournalStartWriter(void);
+void JournalStopWriter(void);
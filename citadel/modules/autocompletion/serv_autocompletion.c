@@ -49,9 +49,9 @@ char *n_to_fn(char *value) {
 
 
 /*
- * Back end for cmd_auto()
+ * Back end for cmd_auto(); the partial comes compiled, we're called once per vCard.
  */
-void hunt_for_autocomplete(long msgnum, char *search_string) {
+void hunt_for_autocomplete(long msgnum, const CasePattern *search_pattern) {
 	struct CtdlMessage *msg;
 	struct vCard *v;
 	char *value = NULL;
@@ -71,7 +71,7 @@ void hunt_for_autocomplete(long msgnum, char *search_string) {
 	 *     Display Name <user@domain.org>
 	 */
 	value = vcard_get_prop(v, "fn", 0, 0, 0);
-	if (value != NULL) if (bmstrcasestr(value, search_string)) {
+	if (value != NULL) if (CasePatternFind(search_pattern, value, -1)) {
 		value2 = vcard_get_prop(v, "email", 1, 0, 0);
 		if (value2 == NULL) value2 = "";
 		cprintf("%s <%s>\n", value, value2);
@@ -85,7 +85,7 @@ void hunt_for_autocomplete(long msgnum, char *search_string) {
 	 *     Display Name <user@domain.org>
 	 */
 	value = vcard_get_prop(v, "n", 0, 0, 0);
-	if (value != NULL) if (bmstrcasestr(value, search_string)) {
+	if (value != NULL) if (CasePatternFind(search_pattern, value, -1)) {
 
 		value2 = vcard_get_prop(v, "email", 1, 0, 0);
 		if (value2 == NULL) value2 = "";
@@ -101,7 +101,7 @@ void hunt_for_autocomplete(long msgnum, char *search_string) {
 	 */
 	i = 0;
 	while (value = vcard_get_prop(v, "email", 1, i++, 0), value != NULL) {
-		if (bmstrcasestr(value, search_string)) {
+		if (CasePatternFind(search_pattern, value, -1)) {
 			if (vcard_get_prop(v, "fn", 0, 0, 0)) {
 				cprintf("%s <%s>\n", vcard_get_prop(v, "fn", 0, 0, 0), value);
 			}
@@ -130,6 +130,7 @@ void hunt_for_autocomplete(long msgnum, char *search_string) {
 void cmd_auto(char *argbuf) {
 	char hold_rm[ROOMNAMELEN];
 	char search_string[256];
+	CasePattern *search_pattern;
 	long *msglist = NULL;
 	int num_msgs = 0;
 	long *fts_msgs = NULL;
@@ -198,11 +199,13 @@ void cmd_auto(char *argbuf) {
 	/*
 	 * Now output the ones that look interesting
 	 */
+	search_pattern = NewCasePattern(search_string, -1);
 	if (num_msgs > 0) for (i=0; i<num_msgs; ++i) {
 		if (msglist[i] != 0) {
-			hunt_for_autocomplete(msglist[i], search_string);
+			hunt_for_autocomplete(msglist[i], search_pattern);
 		}
 	}
+	FreeCasePattern(&search_pattern);
 	
 	cprintf("000\n");
 	if (strcmp(CC->room.QRname, hold_rm)) {
@@ -329,6 +329,11 @@ void DestructCAres(AsyncIO *IO)
 }
 
 
+/* if set, we ask this server instead of the ones in resolv.conf; for tests and benchmarks. */
+static struct in_addr DNSServer;
+static unsigned short DNSServerPort = 0;	/* 0 for the default */
+static int HaveDNSServer = 0;
+
 void InitC_ares_dns(AsyncIO *IO)
 {
 	int optmask = 0;
@@ -339,6 +344,18 @@ void InitC_ares_dns(AsyncIO *IO)
 		optmask |= ARES_OPT_SOCK_STATE_CB;
 		IO->DNS.Options.sock_state_cb = SockStateCb;
 		IO->DNS.Options.sock_state_cb_data = IO;
+		if (HaveDNSServer) {
+			/* ares_destroy_options() frees this one. */
+			IO->DNS.Options.servers = (struct in_addr *) malloc(sizeof(struct in_addr));
+			memcpy(IO->DNS.Options.servers, &DNSServer, sizeof(struct in_addr));
+			IO->DNS.Options.nservers = 1;
+			optmask |= ARES_OPT_SERVERS;
+			if (DNSServerPort != 0) {
+				IO->DNS.Options.udp_port = DNSServerPort;
+				IO->DNS.Options.tcp_port = DNSServerPort;
+				optmask |= ARES_OPT_UDP_PORT | ARES_OPT_TCP_PORT;
+			}
+		}
 		ares_init_options(&IO->DNS.Channel, &IO->DNS.Options, optmask);
 	}
 	IO->DNS.Query->DNSStatus = 0;
@@ -369,6 +386,14 @@ DNStimeouttrigger_callback(struct ev_loop *loop, ev_timer *watcher, int revents)
 	}
 }
 
+/* number of lookups we've sent out; only ever modified in the event loop. */
+long DNSQueryCount = 0;
+
+long GetDNSQueryCount(void)
+{
+	return DNSQueryCount;
+}
+
 void QueueGetHostByNameDone(void *Ctx,
 			    int status,
 			    int timeouts,
@@ -402,6 +427,7 @@ void QueueGetHostByName(AsyncIO *IO,
 {
 
 	EV_DNS_syslog(LOG_DEBUG, "C-ARES: %s\n", __FUNCTION__);
+	DNSQueryCount ++;
 	IO->DNS.SourcePort = 0;
 
 	IO->DNS.Query = QueryParts;
@@ -442,6 +468,7 @@ int QueueQuery(ns_type Type,
 	int length, family;
 	char address_b[sizeof(struct in6_addr)];
 
+	DNSQueryCount ++;
 	IO->DNS.SourcePort = 0;
 
 	IO->DNS.Query = QueryParts;
@@ -632,8 +659,27 @@ void EnableDebugCAres(const int n)
 
 CTDL_MODULE_INIT(c_ares_client)
 {
+	char *pstr;
+	char addr[64];
+	char *port;
+
 	if (!threading)
 	{
+		pstr = getenv("CITSERVER_dns_server");
+		if ((pstr != NULL) && (*pstr != '\0')) {
+			safestrncpy(addr, pstr, sizeof addr);	/* address[:port] */
+			port = strchr(addr, ':');
+			if (port != NULL) {
+				*port++ = '\0';
+				DNSServerPort = atoi(port);
+			}
+			HaveDNSServer = inet_aton(addr, &DNSServer);
+			if (HaveDNSServer)
+				syslog(LOG_INFO, "c-ares: asking only %s\n", pstr);
+			else
+				syslog(LOG_WARNING, "c-ares: CITSERVER_dns_server=%s isn't an IPv4 address\n", pstr);
+		}
+
 		CtdlRegisterDebugFlagHook(HKEY("cares"), EnableDebugCAres, &DebugCAres);
 		int r = ares_library_init(ARES_LIB_INIT_ALL);
 		if (0 != r) {
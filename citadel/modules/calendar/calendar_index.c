@@ -0,0 +1,375 @@
+/*
+ * Time range index over the events in calendar rooms, so we don't have to
+ * parse every single VEVENT in a room to find the ones of a given week.
+ *
+ * The index is a cache and nothing more: whenever we query it, we check it
+ * against the room's message list, forget messages which went away, and
+ * index the ones we haven't seen yet.  Saving or deleting a message doesn't
+ * touch the index at all: a message can land in several rooms at once, and
+ * rewriting a room's whole index for every one of them costs more than
+ * catching up once at the next query.
+ *
+ * Copyright (c) 1987-2015 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "ctdl_module.h"
+
+#include <libical/ical.h>
+
+#include "msgbase.h"
+#include "room_ops.h"
+#include "ical_dezonify.h"
+#include "calendar_index.h"
+
+
+typedef struct _calindex {
+	struct cal_occurrence *occ;
+	int num;
+	int alloc;
+} calindex;
+
+
+static void calindex_append(calindex *idx, long msgnum, time_t start, time_t end)
+{
+	if (idx->num >= idx->alloc) {
+		idx->alloc = (idx->alloc == 0) ? 64 : idx->alloc * 2;
+		idx->occ = realloc(idx->occ, idx->alloc * sizeof(struct cal_occurrence));
+	}
+	idx->occ[idx->num].msgnum = msgnum;
+	idx->occ[idx->num].start = start;
+	idx->occ[idx->num].end = end;
+	idx->num++;
+}
+
+
+static int calindex_cmp(const void *v1, const void *v2)
+{
+	const struct cal_occurrence *o1 = (const struct cal_occurrence *) v1;
+	const struct cal_occurrence *o2 = (const struct cal_occurrence *) v2;
+
+	if (o1->msgnum > o2->msgnum) return(1);
+	if (o1->msgnum < o2->msgnum) return(-1);
+	if (o1->start > o2->start) return(1);
+	if (o1->start < o2->start) return(-1);
+	return(0);
+}
+
+
+/*
+ * Convert a DATE-TIME of property p into a time_t, honoring its TZID.
+ */
+static time_t calindex_timet(icalcomponent *top, icalproperty *p, struct icaltimetype t)
+{
+	icaltimezone *zone = NULL;
+
+	if (icaltime_is_utc(t)) {
+		zone = icaltimezone_get_utc_timezone();
+	}
+	else {
+		zone = icalcomponent_get_timezone(top,
+			icalparameter_get_tzid(
+				icalproperty_get_first_parameter(p, ICAL_TZID_PARAMETER)
+			)
+		);
+		if (!zone) {
+			zone = get_default_icaltimezone();
+		}
+	}
+	return icaltime_as_timet_with_zone(t, zone);
+}
+
+
+/*
+ * Add the occurrences of one VEVENT to the index.
+ */
+static void calindex_expand_vevent(calindex *idx, long msgnum, icalcomponent *top, icalcomponent *vevent)
+{
+	icalproperty *p, *dtstart_p, *rrule;
+	struct icaltimetype dtstart, t;
+	struct icaldatetimeperiodtype rdate;
+	icalrecur_iterator *ritr = NULL;
+	time_t start, length = 0;
+	int num_recur = 0;
+
+	dtstart_p = icalcomponent_get_first_property(vevent, ICAL_DTSTART_PROPERTY);
+	if (dtstart_p == NULL) return;
+	dtstart = icalproperty_get_dtstart(dtstart_p);
+	if (icaltime_is_null_time(dtstart)) return;
+	start = calindex_timet(top, dtstart_p, dtstart);
+
+	p = icalcomponent_get_first_property(vevent, ICAL_DTEND_PROPERTY);
+	if (p != NULL) {
+		length = calindex_timet(top, p, icalproperty_get_dtend(p)) - start;
+	}
+	else {
+		p = icalcomponent_get_first_property(vevent, ICAL_DURATION_PROPERTY);
+		if (p != NULL) {
+			length = icaldurationtype_as_int(icalproperty_get_duration(p));
+		}
+	}
+	if (length < 0) length = 0;
+
+	rrule = icalcomponent_get_first_property(vevent, ICAL_RRULE_PROPERTY);
+	if (rrule != NULL) {
+		ritr = icalrecur_iterator_new(icalproperty_get_rrule(rrule), dtstart);
+	}
+
+	if (ritr == NULL) {
+		calindex_append(idx, msgnum, start, start + length);
+	}
+	else {
+		while (t = icalrecur_iterator_next(ritr), !icaltime_is_null_time(t)) {
+			start = calindex_timet(top, dtstart_p, t);
+			if (num_recur >= CALINDEX_MAX_RECUR) {
+				/* There is more to come; we don't keep the details. */
+				calindex_append(idx, msgnum, start, CALINDEX_FOREVER);
+				break;
+			}
+			calindex_append(idx, msgnum, start, start + length);
+			++num_recur;
+		}
+		icalrecur_iterator_free(ritr);
+	}
+
+	for (p = icalcomponent_get_first_property(vevent, ICAL_RDATE_PROPERTY);
+	     p != NULL;
+	     p = icalcomponent_get_next_property(vevent, ICAL_RDATE_PROPERTY))
+	{
+		rdate = icalproperty_get_rdate(p);
+		if (!icaltime_is_null_time(rdate.time)) {
+			start = calindex_timet(top, p, rdate.time);
+			calindex_append(idx, msgnum, start, start + length);
+		}
+		else if (!icalperiodtype_is_null_period(rdate.period)) {
+			calindex_append(idx, msgnum,
+					calindex_timet(top, p, rdate.period.start),
+					calindex_timet(top, p, rdate.period.end));
+		}
+	}
+}
+
+
+static void calindex_expand_cal(calindex *idx, long msgnum, icalcomponent *cal)
+{
+	icalcomponent *c;
+
+	if (icalcomponent_isa(cal) == ICAL_VEVENT_COMPONENT) {
+		calindex_expand_vevent(idx, msgnum, cal, cal);
+		return;
+	}
+	for (c = icalcomponent_get_first_component(cal, ICAL_VEVENT_COMPONENT);
+	     c != NULL;
+	     c = icalcomponent_get_next_component(cal, ICAL_VEVENT_COMPONENT))
+	{
+		calindex_expand_vevent(idx, msgnum, cal, c);
+	}
+}
+
+
+/*
+ * Mime parser callback: grab the first calendar object of the message.
+ */
+static void calindex_locate_part(char *name, char *filename, char *partnum, char *disp,
+				 void *content, char *cbtype, char *cbcharset, size_t length,
+				 char *encoding, char *cbid, void *cbuserdata)
+{
+	icalcomponent **cal = (icalcomponent **) cbuserdata;
+
+	if (*cal != NULL) return;
+	if (  (strcasecmp(cbtype, "text/calendar"))
+	   && (strcasecmp(cbtype, "application/ics")) ) {
+		return;
+	}
+	*cal = icalcomponent_new_from_string(content);
+}
+
+
+/*
+ * Index one message.  If it doesn't hold any events, we still remember that
+ * we have seen it.
+ */
+static void calindex_expand_message(calindex *idx, long msgnum, struct CtdlMessage *msg)
+{
+	icalcomponent *cal = NULL;
+	int num_before = idx->num;
+
+	if ((msg != NULL) && (!CM_IsEmpty(msg, eMesageText))) {
+		mime_parser(CM_RANGE(msg, eMesageText),
+			    *calindex_locate_part,
+			    NULL, NULL,
+			    (void *) &cal,
+			    0
+		);
+	}
+	if (cal != NULL) {
+		calindex_expand_cal(idx, msgnum, cal);
+		icalcomponent_free(cal);
+	}
+	if (idx->num == num_before) {
+		calindex_append(idx, msgnum, 0, 0);
+	}
+}
+
+
+static int calindex_load(struct ctdlroom *qrbuf, calindex *idx)
+{
+	struct cdbdata *cdbci;
+
+	memset(idx, 0, sizeof(calindex));
+	cdbci = cdb_fetch(CDB_CALINDEX, &qrbuf->QRnumber, sizeof(long));
+	if (cdbci == NULL) {
+		return(0);
+	}
+	idx->occ = (struct cal_occurrence *) cdbci->ptr;
+	cdbci->ptr = NULL;	/* we own this memory now */
+	idx->num = idx->alloc = cdbci->len / sizeof(struct cal_occurrence);
+	cdb_free(cdbci);
+	return(1);
+}
+
+
+static void calindex_store(struct ctdlroom *qrbuf, calindex *idx)
+{
+	cdb_store(CDB_CALINDEX, &qrbuf->QRnumber, (int)sizeof(long),
+		  idx->occ, (int)(idx->num * sizeof(struct cal_occurrence)));
+}
+
+
+/*
+ * Bring the index in line with the room's message list.  Returns nonzero if
+ * anything changed.
+ */
+static int calindex_sync(struct ctdlroom *qrbuf, calindex *idx)
+{
+	struct cdbdata *cdbfr;
+	struct CtdlMessage *msg;
+	calindex synced;
+	long *msglist = NULL;
+	int num_msgs = 0;
+	int changed = 0;
+	int i, j = 0;
+
+	cdbfr = cdb_fetch(CDB_MSGLISTS, &qrbuf->QRnumber, sizeof(long));
+	if (cdbfr != NULL) {
+		msglist = (long *) cdbfr->ptr;
+		num_msgs = cdbfr->len / sizeof(long);
+	}
+
+	memset(&synced, 0, sizeof(calindex));
+	for (i = 0; i < num_msgs; ++i) {
+		while ((j < idx->num) && (idx->occ[j].msgnum < msglist[i])) {
+			++j;
+			changed = 1;
+		}
+		if ((j < idx->num) && (idx->occ[j].msgnum == msglist[i])) {
+			while ((j < idx->num) && (idx->occ[j].msgnum == msglist[i])) {
+				calindex_append(&synced, msglist[i], idx->occ[j].start, idx->occ[j].end);
+				++j;
+			}
+		}
+		else {
+			msg = CtdlFetchMessage(msglist[i], 1, 1);
+			calindex_expand_message(&synced, msglist[i], msg);
+			if (msg != NULL) CM_Free(msg);
+			changed = 1;
+		}
+	}
+	if (j < idx->num) {
+		changed = 1;
+	}
+	if (cdbfr != NULL) {
+		cdb_free(cdbfr);
+	}
+
+	if (idx->occ != NULL) free(idx->occ);
+	*idx = synced;
+	if (idx->num > 1) {
+		qsort(idx->occ, idx->num, sizeof(struct cal_occurrence), calindex_cmp);
+	}
+	return(changed);
+}
+
+
+/*
+ * Figure out the time span covered by all occurrences of an event.  If there
+ * is nothing to figure out, you get everything.
+ */
+void calindex_event_span(icalcomponent *cal, time_t *lower_bound, time_t *upper_bound)
+{
+	calindex idx;
+	int i;
+
+	memset(&idx, 0, sizeof(calindex));
+	calindex_expand_cal(&idx, 0, cal);
+
+	*lower_bound = 0;
+	*upper_bound = CALINDEX_FOREVER;
+	for (i = 0; i < idx.num; ++i) {
+		if ((i == 0) || (idx.occ[i].start < *lower_bound))
+			*lower_bound = idx.occ[i].start;
+		if ((i == 0) || (idx.occ[i].end > *upper_bound))
+			*upper_bound = idx.occ[i].end;
+	}
+	if (idx.occ != NULL) free(idx.occ);
+}
+
+
+/*
+ * Find the messages in the current room which have an event occurring between
+ * lower_bound and upper_bound.  The caller has to free *msgnums.
+ */
+int calindex_query(time_t lower_bound, time_t upper_bound, long **msgnums)
+{
+	struct CitContext *CCC = CC;
+	calindex idx;
+	int num_found = 0;
+	int i;
+
+	*msgnums = NULL;
+	calindex_load(&CCC->room, &idx);
+	if (calindex_sync(&CCC->room, &idx)) {
+		calindex_store(&CCC->room, &idx);
+	}
+
+	for (i = 0; i < idx.num; ++i) {
+		struct cal_occurrence *o = &idx.occ[i];
+
+		if ((o->start == 0) && (o->end == 0))
+			continue;
+		if ((o->start - CALINDEX_SLOP >= upper_bound) || (o->end <= lower_bound - CALINDEX_SLOP))
+			continue;
+		if ((num_found > 0) && ((*msgnums)[num_found - 1] == o->msgnum))
+			continue;
+		*msgnums = realloc(*msgnums, (num_found + 1) * sizeof(long));
+		(*msgnums)[num_found++] = o->msgnum;
+	}
+	if (idx.occ != NULL) free(idx.occ);
+	return(num_found);
+}
+
+
+/*
+ * Like CtdlForEachMessage(), but only for the messages in the current room
+ * which have events between lower_bound and upper_bound.
+ */
+void calindex_for_each(time_t lower_bound, time_t upper_bound,
+		       ForEachMsgCallback CallBack, void *userdata)
+{
+	long *msgnums = NULL;
+	int num_msgs;
+	int i;
+
+	num_msgs = calindex_query(lower_bound, upper_bound, &msgnums);
+	for (i = 0; i < num_msgs; ++i) {
+		CallBack(msgnums[i], userdata);
+	}
+	if (msgnums != NULL) free(msgnums);
+}
@@ -0,0 +1,41 @@
+/*
+ * Time range index over the events in calendar rooms.
+ *
+ * Copyright (c) 1987-2015 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * For every room that has been asked for a time range, CDB_CALINDEX holds an
+ * array of occurrences, sorted by message number.  Messages without any VEVENT
+ * get one entry with start == end == 0, so we know we have seen them.
+ * Recurrences are expanded up to CALINDEX_MAX_RECUR occurrences; if the rule
+ * goes on beyond that, the last entry is open ended.
+ */
+struct cal_occurrence {
+	long msgnum;
+	time_t start;
+	time_t end;
+};
+
+#define CALINDEX_MAX_RECUR	250
+#define CALINDEX_FOREVER	((time_t)LONG_MAX)
+
+/*
+ * We don't care much about time zones and all-day events in here; every
+ * occurrence is widened by a day on each side, and callers check the real
+ * thing once they have the candidates.
+ */
+#define CALINDEX_SLOP		86400L
+
+void calindex_event_span(icalcomponent *cal, time_t *lower_bound, time_t *upper_bound);
+int calindex_query(time_t lower_bound, time_t upper_bound, long **msgnums);
+void calindex_for_each(time_t lower_bound, time_t upper_bound,
+		       ForEachMsgCallback CallBack, void *userdata);
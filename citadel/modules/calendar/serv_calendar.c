@@ -27,6 +27,7 @@
 #include "euidindex.h"
 #include "ical_dezonify.h"
 #include "config.h"
+#include "calendar_index.h"
 
 
 
@@ -1177,6 +1178,7 @@ void ical_hunt_for_conflicts_backend(long msgnum, void *data) {
  */
 void ical_hunt_for_conflicts(icalcomponent *cal) {
 	char hold_rm[ROOMNAMELEN];
+	time_t lower_bound, upper_bound;
 
 	strcpy(hold_rm, CC->room.QRname);	/* save current room */
 
@@ -1188,9 +1190,9 @@ void ical_hunt_for_conflicts(icalcomponent *cal) {
 
 	cprintf("%d Conflicting events:\n", LISTING_FOLLOWS);
 
-	CtdlForEachMessage(MSGS_ALL, 0, NULL,
-		NULL,
-		NULL,
+	/* Only look at the events which occur somewhere near this one */
+	calindex_event_span(cal, &lower_bound, &upper_bound);
+	calindex_for_each(lower_bound, upper_bound,
 		ical_hunt_for_conflicts_backend,
 		(void *) cal
 	);
@@ -1533,9 +1535,9 @@ void ical_freebusy(char *who) {
 	}
 	icalcomponent_add_property(fb, icalproperty_new_organizer(buf));
 
-	/* Add busy time from events */
+	/* Add busy time from events; nobody asks for last year's */
 	syslog(LOG_DEBUG, "Adding busy time from events\n");
-	CtdlForEachMessage(MSGS_ALL, 0, NULL, NULL, NULL, ical_freebusy_backend, (void *)fb );
+	calindex_for_each(time(NULL) - FREEBUSY_PAST, CALINDEX_FOREVER, ical_freebusy_backend, (void *)fb );
 
 	/* If values for DTSTART and DTEND are still not present, set them
 	 * to yesterday and tomorrow as default values.
@@ -1835,6 +1837,34 @@ void ical_putics(void)
 }
 
 
+/*
+ * List the messages in the current room which have an event occurring
+ * between lower_bound and upper_bound.  Clients still have to look at the
+ * events themselves; we only promise not to leave anything out.
+ */
+void ical_range(time_t lower_bound, time_t upper_bound)
+{
+	long *msgnums = NULL;
+	int num_msgs;
+	int i;
+
+	if (CtdlDoIHavePermissionToReadMessagesInThisRoom() != om_ok) {
+		cprintf("%d Higher access required.\n", ERROR + HIGHER_ACCESS_REQUIRED);
+		return;
+	}
+	if (upper_bound <= 0) {
+		upper_bound = CALINDEX_FOREVER;
+	}
+
+	num_msgs = calindex_query(lower_bound, upper_bound, &msgnums);
+	cprintf("%d %d events\n", LISTING_FOLLOWS, num_msgs);
+	for (i = 0; i < num_msgs; ++i) {
+		cprintf("%ld\n", msgnums[i]);
+	}
+	cprintf("000\n");
+	if (msgnums != NULL) free(msgnums);
+}
+
 /*
  * All Citadel calendar commands from the client come through here.
  */
@@ -1904,6 +1934,11 @@ void cmd_ical(char *argbuf)
 		return;
 	}
 
+	if (!strcasecmp(subcmd, "range")) {
+		ical_range(extract_long(argbuf, 1), extract_long(argbuf, 2));
+		return;
+	}
+
 	cprintf("%d Invalid subcommand\n", ERROR + CMD_NOT_SUPPORTED);
 }
 
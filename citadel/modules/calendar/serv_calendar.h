@@ -35,3 +35,6 @@ struct cit_ical {
 
 #define CIT_ICAL CC->CIT_ICAL
 #define MAX_RECUR 1000
+
+/* How far back free/busy lists look */
+#define FREEBUSY_PAST (86400L * 31)
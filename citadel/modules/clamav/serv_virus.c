@@ -21,7 +21,9 @@
  *  
  */
 
-#define CLAMD_PORT       "3310"
+#define CLAMD_PORT       3310
+/* clamd wants INSTREAM data in chunks, each prefixed by its length */
+#define CLAMD_CHUNK_SIZE 32768
 
 #include "sysdep.h"
 #include <stdlib.h>
@@ -48,6 +50,9 @@
 #include <string.h>
 #include <limits.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <libcitadel.h>
 #include "citadel.h"
 #include "server.h"
@@ -60,142 +65,107 @@
 #include "msgbase.h"
 #include "internet_addressing.h"
 #include "domain.h"
-#include "clientsocket.h"
 
 
 #include "ctdl_module.h"
+#include "../scanclient/scanclient.h"
 
 
 
 /*
- * Connect to the clamd server and scan a message.
+ * Queue up the INSTREAM request for clamd.  We keep our connections to
+ * clamd in an IDSESSION, so it will take more than one of these.
  */
-int clamd(struct CtdlMessage *msg, recptypes *recp) {
-	int sock = (-1);
-	int streamsock = (-1);
-	char clamhosts[SIZ];
-	int num_clamhosts;
-	char buf[SIZ];
-        char hostbuf[SIZ];
-        char portbuf[SIZ];
-	int is_virus = 0;
-	int clamhost;
-	StrBuf *msgtext;
-	CitContext *CCC;
-
-	/* Don't care if you're logged in.  You can still spread viruses.
-	 */
-	/* if (CC->logged_in) return(0); */
-
-	/* See if we have any clamd hosts configured */
-	num_clamhosts = get_hosts(clamhosts, "clamav");
-	if (num_clamhosts < 1) return(0);
-
-	/* Try them one by one until we get a working one */
-        for (clamhost=0; clamhost<num_clamhosts; ++clamhost) {
-                extract_token(buf, clamhosts, clamhost, '|', sizeof buf);
-                syslog(LOG_INFO, "Connecting to clamd at <%s>\n", buf);
-
-                /* Assuming a host:port entry */ 
-                extract_token(hostbuf, buf, 0, ':', sizeof hostbuf);
-                if (extract_token(portbuf, buf, 1, ':', sizeof portbuf)==-1)
-                  /* Didn't specify a port so we'll try the psuedo-standard 3310 */
-                  sock = sock_connect(hostbuf, CLAMD_PORT);
-                else
-                  /* Port specified lets try connecting to it! */
-                  sock = sock_connect(hostbuf, portbuf);
-
-                if (sock >= 0) syslog(LOG_DEBUG, "Connected!\n");
-        }
-
-	if (sock < 0) {
-		/* If the service isn't running, just pass the mail
-		 * through.  Potentially throwing away mails isn't good.
-		 */
-		return(0);
-	}
-	CCC=CC;
-	CCC->SBuf.Buf = NewStrBuf();
-	CCC->sMigrateBuf = NewStrBuf();
-	CCC->SBuf.ReadWritePointer = NULL;
-
-	/* Command */
-	syslog(LOG_DEBUG, "Transmitting STREAM command\n");
-	sprintf(buf, "STREAM\r\n");
-	sock_write(&sock, buf, strlen(buf));
-
-	syslog(LOG_DEBUG, "Waiting for PORT number\n");
-        if (sock_getln(&sock, buf, sizeof buf) < 0) {
-                goto bail;
-        }
-
-        syslog(LOG_DEBUG, "<%s\n", buf);
-	if (strncasecmp(buf, "PORT", 4)!=0) {
-	        goto bail;
+void clamd_prepare(ScanJob *Job, int NewSession)
+{
+	StrBuf *Buf = Job->IO.SendBuf.Buf;
+	const char *pch = ChrPtr(Job->MsgText);
+	long len = StrLength(Job->MsgText);
+	long chunk;
+	uint32_t netlen;
+
+	if (NewSession)
+		StrBufAppendBufPlain(Buf, HKEY("nIDSESSION\n"), 0);
+	StrBufAppendBufPlain(Buf, HKEY("nINSTREAM\n"), 0);
+
+	while (len > 0) {
+		chunk = (len > CLAMD_CHUNK_SIZE) ? CLAMD_CHUNK_SIZE : len;
+		netlen = htonl(chunk);
+		StrBufAppendBufPlain(Buf, (const char *)&netlen, sizeof(netlen), 0);
+		StrBufAppendBufPlain(Buf, pch, chunk, 0);
+		pch += chunk;
+		len -= chunk;
 	}
 
-        /* Should have received a port number to connect to */
-	extract_token(portbuf, buf, 1, ' ', sizeof portbuf);
-
-	/* Attempt to establish connection to STREAM socket */
-        streamsock = sock_connect(hostbuf, portbuf);
+	/* a zero length chunk tells clamd that we're done. */
+	netlen = 0;
+	StrBufAppendBufPlain(Buf, (const char *)&netlen, sizeof(netlen), 0);
+}
 
-	if (streamsock < 0) {
-		/* If the service isn't running, just pass the mail
-		 * through.  Potentially throwing away mails isn't good.
-		 */
-		FreeStrBuf(&CCC->SBuf.Buf);
-		FreeStrBuf(&CCC->sMigrateBuf);
-		return(0);
-        }
-	else {
-	        syslog(LOG_DEBUG, "STREAM socket connected!\n");
+/*
+ * Parse the answer, which will look like "1: stream: OK" or
+ * "1: stream: Eicar-Test-Signature FOUND" in a session.
+ */
+eNextState clamd_read_reply(ScanJob *Job)
+{
+	const char *pch = ChrPtr(Job->IO.IOBuf);
+	long len;
+
+	while (isdigit(*pch))
+		pch ++;
+	if (*pch == ':')
+		pch ++;
+	while (isspace(*pch))
+		pch ++;
+	len = strlen(pch);
+
+	Job->Reply = NewStrBufPlain(pch, len);
+	if (strncasecmp(pch, "stream: OK", 10) == 0) {
+		Job->Verdict = eScanClean;
+		Job->KeepConn = 1;
 	}
-
-
-
-	/* Message */
-	CC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
-	CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, 0);
-	msgtext = CC->redirect_buffer;
-	CC->redirect_buffer = NULL;
-
-	sock_write(&streamsock, SKEY(msgtext));
-	FreeStrBuf(&msgtext);
-
-	/* Close the streamsocket connection; this tells clamd
-	 * that we're done.
-	 */
-	if (streamsock != -1)
-		close(streamsock);
-	
-	/* Response */
-	syslog(LOG_DEBUG, "Awaiting response\n");
-        if (sock_getln(&sock, buf, sizeof buf) < 0) {
-                goto bail;
-        }
-        syslog(LOG_DEBUG, "<%s\n", buf);
-	if (strncasecmp(buf, "stream: OK", 10)!=0) {
-		is_virus = 1;
+	else if ((len > 5) && (strcasecmp(pch + len - 5, "FOUND") == 0)) {
+		Job->Verdict = eScanReject;
+		Job->KeepConn = 1;
 	}
-
-	if (is_virus) {
-		CM_SetField(msg, eErrorMsg, HKEY("message rejected by virus filter"));
+	else {
+		/* clamd won't talk to us on this session anymore. */
+		syslog(LOG_WARNING, "clamd: unexpected answer: %s\n", pch);
+		Job->Verdict = eScanUnknown;
+		Job->KeepConn = 0;
 	}
+	return eTerminateConnection;
+}
 
-bail:	close(sock);
-	FreeStrBuf(&CCC->SBuf.Buf);
-	FreeStrBuf(&CCC->sMigrateBuf);
-	return(is_virus);
+int clamd_apply(struct CtdlMessage *msg, eScanVerdict Verdict, StrBuf *Reply)
+{
+	if (Verdict != eScanReject)
+		return(0);
+
+	syslog(LOG_INFO, "clamd: %s\n", ChrPtr(Reply));
+	CM_SetField(msg, eErrorMsg, HKEY("message rejected by virus filter"));
+	return(1);
 }
 
+/* Don't care if you're logged in.  You can still spread viruses. */
+static const ScanBackend ClamdBackend = {
+	"clamd",
+	"clamav",
+	CLAMD_PORT,
+	1,
+	NULL,
+	clamd_prepare,
+	clamd_read_reply,
+	clamd_apply
+};
+
 
 
 CTDL_MODULE_INIT(virus)
 {
 	if (!threading)
 	{
-		CtdlRegisterMessageHook(clamd, EVT_SMTPSCAN);
+		CtdlRegisterScanBackend(&ClamdBackend);
 	}
 	
 	/* return our module name for the log */
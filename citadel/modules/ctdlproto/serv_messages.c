@@ -259,6 +259,250 @@ void cmd_msgs(char *cmdbuf)
 	cprintf("000\n");
 }
 
+/*
+ * Back end for the MSGB command: state kept across one batch of summaries.
+ */
+typedef struct _msg_batch {
+	HashList *Wanted;		/* msgnums the client sent us, NULL for all */
+	HashList *Fields;		/* headers the client wants to see */
+	HashPos *p;
+	char types[SIZ];		/* content types we send inline, comma separated */
+	int found_part;
+	int found_type;
+	StrBuf *buffer;
+} msg_batch;
+
+static int batch_type_wanted(msg_batch *Batch, const char *cbtype)
+{
+	char one_type[256];
+	int i, n;
+
+	n = num_tokens(Batch->types, ',');
+	for (i = 0; i < n; i++) {
+		extract_token(one_type, Batch->types, i, ',', sizeof one_type);
+		striplt(one_type);
+		if (!strcasecmp(one_type, cbtype))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Mime parser callbacks for the MSGB command: remember the outermost content
+ * type, and spew the first part matching one of the types the client asked for.
+ */
+void batch_premultipart(char *name, char *filename, char *partnum, char *disp,
+			void *content, char *cbtype, char *cbcharset, size_t length,
+			char *encoding, char *cbid, void *cbuserdata)
+{
+	msg_batch *Batch = (msg_batch *) cbuserdata;
+
+	if (Batch->found_type)
+		return;
+	Batch->found_type = 1;
+	cprintf("ctyp=%s\n", cbtype);
+}
+
+void batch_part(char *name, char *filename, char *partnum, char *disp,
+		void *content, char *cbtype, char *cbcharset, size_t length,
+		char *encoding, char *cbid, void *cbuserdata)
+{
+	msg_batch *Batch = (msg_batch *) cbuserdata;
+
+	if (!Batch->found_type) {
+		Batch->found_type = 1;
+		cprintf("ctyp=%s\n", cbtype);
+	}
+	if (Batch->found_part || !batch_type_wanted(Batch, cbtype))
+		return;
+
+	Batch->found_part = 1;
+	cprintf("blob=%s|%s|%s|%ld\n", partnum, cbtype, cbcharset, (long)length);
+	client_write(content, length);
+	cprintf("\n");
+}
+
+/*
+ * Back end for the MSGB command: append one mnemonic=value line.  Our
+ * framing is one line per field, so line breaks in the value (folded
+ * headers, or whatever some client stored there) become blanks.
+ */
+static void batch_append_field(StrBuf *Buf, const char *mnemonic, const char *val, long len)
+{
+	long start, i;
+
+	StrBufAppendBufPlain(Buf, mnemonic, 4, 0);
+	StrBufAppendBufPlain(Buf, HKEY("="), 0);
+	start = StrLength(Buf);
+	StrBufAppendBufPlain(Buf, val, len, 0);
+	for (i = start; i < StrLength(Buf); i++) {
+		if ((ChrPtr(Buf)[i] == '\r') || (ChrPtr(Buf)[i] == '\n'))
+			StrBufPeek(Buf, NULL, i, ' ');
+	}
+	StrBufAppendBufPlain(Buf, HKEY("\n"), 0);
+}
+
+/*
+ * Back end for the MSGB command: output the summary of one message.
+ */
+void batch_summary(long msgnum, void *userdata)
+{
+	msg_batch *Batch = (msg_batch *) userdata;
+	struct CtdlMessage *msg;
+	const char *k;
+	long len;
+	void *v;
+	int with_body;
+
+	if (Batch->Wanted != NULL) {
+		if (!GetHash(Batch->Wanted, LKEY(msgnum), &v))
+			return;
+	}
+
+	with_body = !IsEmptyStr(Batch->types);
+	msg = CtdlFetchMessage(msgnum, with_body, 1);
+	if (msg == NULL)
+		return;
+
+	StrBufPrintf(Batch->buffer, "msgn=%ld\n", msgnum);
+	if (!CM_IsEmpty(msg, eExclusiveID))
+		batch_append_field(Batch->buffer, "exti", CM_KEY(msg, eExclusiveID));
+	else
+		batch_append_field(Batch->buffer, "exti", HKEY(""));
+	if (!CM_IsEmpty(msg, eTimestamp))
+		batch_append_field(Batch->buffer, "time", CM_KEY(msg, eTimestamp));
+	else
+		batch_append_field(Batch->buffer, "time", HKEY("0"));
+
+	RewindHashPos(Batch->Fields, Batch->p, 0);
+	while (GetNextHashPos(Batch->Fields, Batch->p, &len, &k, &v)) {
+		eMsgField f = (eMsgField) v;
+
+		if (CM_IsEmpty(msg, f))
+			continue;
+
+		/* like MSG0, we don't tell who wrote an anonymous message. */
+		if ((f == eAuthor) && !is_room_aide() &&
+		    ((msg->cm_anon_type == MES_ANONONLY) || (msg->cm_anon_type == MES_ANONOPT)))
+		{
+			if (msg->cm_anon_type == MES_ANONONLY)
+				batch_append_field(Batch->buffer, msgkeys[f], HKEY("****"));
+			else
+				batch_append_field(Batch->buffer, msgkeys[f], HKEY("anonymous"));
+			continue;
+		}
+		batch_append_field(Batch->buffer, msgkeys[f], CM_KEY(msg, f));
+	}
+
+	if (with_body && !CM_IsEmpty(msg, eMesageText)) {
+		StrBufAppendPrintf(Batch->buffer, "size=%ld\n", msg->cm_lengths[eMesageText]);
+		cputbuf(Batch->buffer);
+		Batch->found_part = 0;
+		Batch->found_type = 0;
+		mime_parser(CM_RANGE(msg, eMesageText),
+			    *batch_part,
+			    *batch_premultipart,
+			    NULL,
+			    (void *) Batch,
+			    0
+		);
+	}
+	else {
+		cputbuf(Batch->buffer);
+	}
+	CM_Free(msg);
+}
+
+/*
+ * cmd_msgb()  -  output summaries for a batch of messages in this room
+ *
+ * MSGB which|ref|content types|header mnemonics
+ *
+ * 'which' and 'ref' select messages like MSGS does; 'which' may also be SET,
+ * in which case the client sends the message numbers it is interested in,
+ * one per line, terminated by 000.  For each message we send a block of
+ * mnemonic=value lines, starting with msgn= and followed by exti=, time= and
+ * the requested headers (line breaks in their values are sent as blanks,
+ * and "text" is not a header).  If content types were given, size= and ctyp= of
+ * the message follow, and the first MIME part matching one of these types is
+ * sent as blob=partnum|type|charset|length, followed by exactly length bytes
+ * and a newline.  This saves clients a MSG0 or MSG4 round trip per message.
+ */
+void cmd_msgb(char *cmdbuf)
+{
+	int mode = 0;
+	long cm_ref;
+	long i;
+	char which[16];
+	char buf[256];
+	char fields[SIZ];
+	msg_batch Batch;
+
+	if (CtdlAccessCheck(ac_logged_in_or_guest)) return;
+
+	memset(&Batch, 0, sizeof(msg_batch));
+	extract_token(which, cmdbuf, 0, '|', sizeof which);
+	cm_ref = extract_long(cmdbuf, 1);
+	extract_token(Batch.types, cmdbuf, 2, '|', sizeof Batch.types);
+	extract_token(fields, cmdbuf, 3, '|', sizeof fields);
+
+	Batch.Fields = NewHash(1, lFlathash);
+	for (i = 0; i < num_tokens(fields, ','); i++) {
+		eMsgField f;
+
+		extract_token(buf, fields, i, ',', sizeof buf);
+		striplt(buf);
+		/* the message text isn't a header; that's what the content types are for. */
+		if ((strlen(buf) == 4) && GetFieldFromMnemonic(&f, buf) && (f != eMesageText))
+		{
+			Put(Batch.Fields, LKEY(i), (void*)f, reference_free_handler);
+		}
+	}
+	Batch.p = GetNewHashPos(Batch.Fields, 0);
+
+	strcat(which, "   ");
+	if (!strncasecmp(which, "SET", 3)) {
+		mode = MSGS_ALL;
+		cm_ref = 0;
+		unbuffer_output();
+		cprintf("%d Send list of message numbers\n", START_CHAT_MODE);
+		Batch.Wanted = NewHash(1, lFlathash);
+		while(client_getln(buf, sizeof buf) >= 0 && strcmp(buf,"000")) {
+			long msgnum = atol(buf);
+
+			if (msgnum > 0)
+				Put(Batch.Wanted, LKEY(msgnum), NULL, reference_free_handler);
+		}
+		buffer_output();
+	}
+	else {
+		if (!strncasecmp(which, "OLD", 3))
+			mode = MSGS_OLD;
+		else if (!strncasecmp(which, "NEW", 3))
+			mode = MSGS_NEW;
+		else if (!strncasecmp(which, "FIRST", 5))
+			mode = MSGS_FIRST;
+		else if (!strncasecmp(which, "LAST", 4))
+			mode = MSGS_LAST;
+		else if (!strncasecmp(which, "GT", 2))
+			mode = MSGS_GT;
+		else if (!strncasecmp(which, "LT", 2))
+			mode = MSGS_LT;
+		else
+			mode = MSGS_ALL;
+		cprintf("%d  \n", LISTING_FOLLOWS);
+	}
+
+	Batch.buffer = NewStrBufPlain(NULL, SIZ);
+	CtdlForEachMessage(mode, cm_ref, NULL, NULL, NULL, batch_summary, &Batch);
+	cprintf("000\n");
+
+	DeleteHashPos(&Batch.p);
+	DeleteHash(&Batch.Fields);
+	DeleteHash(&Batch.Wanted);
+	FreeStrBuf(&Batch.buffer);
+}
+
 /*
  * display a message (mode 0 - Citadel proprietary)
  */
@@ -389,7 +633,15 @@ void cmd_dlat(char *cmdbuf)
 	extract_token(desired_section, cmdbuf, 1, '|', sizeof desired_section);
 	safestrncpy(CC->download_desired_section, desired_section,
 		sizeof CC->download_desired_section);
+
+	/* Optionally, only a byte range of the section */
+	CC->download_range_start = extract_long(cmdbuf, 2);
+	CC->download_range_len = extract_long(cmdbuf, 3);
+
 	CtdlOutputMsg(msgid, MT_SPEW_SECTION, 0, 1, 1, NULL, 0, NULL, NULL, NULL);
+
+	CC->download_range_start = 0;
+	CC->download_range_len = 0;
 }
 
 /*
@@ -884,6 +1136,7 @@ CTDL_MODULE_INIT(ctdl_message)
 	if (!threading) {
 
 		CtdlRegisterProtoHook(cmd_msgs, "MSGS", "Output a list of messages in the current room");
+		CtdlRegisterProtoHook(cmd_msgb, "MSGB", "Output summaries for a batch of messages in the current room");
 		CtdlRegisterProtoHook(cmd_msg0, "MSG0", "Output a message in plain text format");
 		CtdlRegisterProtoHook(cmd_msg2, "MSG2", "Output a message in RFC822 format");
 		CtdlRegisterProtoHook(cmd_msg3, "MSG3", "Output a message in raw format (deprecated)");
@@ -1099,6 +1099,25 @@ void cmd_stat(char *gargs)
 }
 
 
+/*
+ * cmd_rlst()  -  tell the client whether its cached room and floor lists are still good.
+ *                The reply only means something when compared to an earlier one.
+ */
+void cmd_rlst(char *gargs)
+{
+	long roomgen, visitgen;
+
+	if (CtdlAccessCheck(ac_logged_in_or_guest)) return;
+	CtdlGetRoomListGeneration(CC->user.usernum, &roomgen, &visitgen);
+	cprintf("%d %ld|%ld|%ld|%ld\n",
+		CIT_OK,
+		(long)server_startup_time,
+		CC->user.usernum,
+		roomgen,
+		visitgen);
+}
+
+
 
 
 /*****************************************************************************/
@@ -1116,6 +1135,7 @@ CTDL_MODULE_INIT(rooms)
 		CtdlRegisterProtoHook(cmd_lprm, "LPRM", "List public rooms");
 		CtdlRegisterProtoHook(cmd_goto, "GOTO", "Goto a named room");
 		CtdlRegisterProtoHook(cmd_stat, "STAT", "Get mtime of the current room");
+		CtdlRegisterProtoHook(cmd_rlst, "RLST", "Get change stamp of the room list");
 		CtdlRegisterProtoHook(cmd_whok, "WHOK", "List users who know this room");
 		CtdlRegisterProtoHook(cmd_rdir, "RDIR", "List files in room directory");
 		CtdlRegisterProtoHook(cmd_getr, "GETR", "Get room parameters");
@@ -744,6 +744,303 @@ void cmd_lout(char *argbuf)
 }
 
 
+/*
+ * PARK and RSUM let a client that fronts many users (like webcit) share a
+ * few connections among them: PARK files the login of this session away
+ * under a token and leaves the connection logged out, RSUM takes it up
+ * again on whatever connection comes along. Only what's needed to carry
+ * on is kept, not a whole CitContext; no login / logout hooks are run.
+ */
+#define PARKED_SESSION_TIMEOUT 3600
+
+typedef struct ParkedSession {
+	long usernum;
+	time_t parked;
+	time_t previous_login;
+	int is_master;
+	int curr_view;
+	int disable_exp;
+	unsigned cs_flags;
+	char roomname[ROOMNAMELEN];
+	char cs_host[64];
+	char cs_addr[64];
+	char cs_clientname[32];
+	char cs_inet_email[128];
+	char cs_inet_other_emails[1024];
+	char cs_inet_fn[128];
+	char fake_username[USERNAME_SIZE];
+	char fake_hostname[64];
+	char fake_roomname[ROOMNAMELEN];
+	char preferred_formats[256];
+	char *ldap_dn;
+	struct ExpressMessage *FirstExpressMessage;
+} ParkedSession;
+
+static HashList *ParkedSessions = NULL;		/* protected by S_SESSION_TABLE */
+static time_t ParkedSessionsSwept = 0;
+
+void DeleteParkedSession(void *vPS)
+{
+	ParkedSession *PS = (ParkedSession*) vPS;
+	struct ExpressMessage *ptr;
+
+	while (PS->FirstExpressMessage != NULL) {
+		ptr = PS->FirstExpressMessage->next;
+		if (PS->FirstExpressMessage->text != NULL)
+			free(PS->FirstExpressMessage->text);
+		free(PS->FirstExpressMessage);
+		PS->FirstExpressMessage = ptr;
+	}
+	if (PS->ldap_dn != NULL)
+		free(PS->ldap_dn);
+	free(PS);
+}
+
+/*
+ * drop the ones nobody came back for; call with S_SESSION_TABLE held.
+ */
+static void SweepParkedSessions(time_t now)
+{
+	HashPos *at;
+	long len;
+	const char *Key;
+	void *vPS;
+	StrBuf *Expired;
+	StrBuf *Token;
+	const char *Pos = NULL;
+
+	Expired = NewStrBuf();
+	at = GetNewHashPos(ParkedSessions, 0);
+	while (GetNextHashPos(ParkedSessions, at, &len, &Key, &vPS)) {
+		if (now - ((ParkedSession*)vPS)->parked > PARKED_SESSION_TIMEOUT) {
+			StrBufAppendBufPlain(Expired, Key, len, 0);
+			StrBufAppendBufPlain(Expired, HKEY("|"), 0);
+		}
+	}
+
+	Token = NewStrBuf();
+	while (StrBufHaveNextToken(Expired, &Pos)) {
+		StrBufExtract_NextToken(Token, Expired, &Pos, '|');
+		if (GetHashPosFromKey(ParkedSessions, SKEY(Token), at))
+			DeleteEntryFromHash(ParkedSessions, at);
+	}
+	DeleteHashPos(&at);
+	FreeStrBuf(&Token);
+	FreeStrBuf(&Expired);
+	ParkedSessionsSwept = now;
+}
+
+/*
+ * The token is all it takes to become this user, so it has to be
+ * unguessable; without /dev/urandom we don't hand out any.
+ * Returns 0 on success.
+ */
+static int MakeParkToken(char *token, size_t n)
+{
+	unsigned char rnd[16];
+	FILE *urandom;
+	size_t i;
+	int ok;
+
+	urandom = fopen("/dev/urandom", "r");
+	if (urandom == NULL) {
+		return(-1);
+	}
+	ok = (fread(rnd, sizeof rnd, 1, urandom) == 1);
+	fclose(urandom);
+	if (!ok) {
+		return(-1);
+	}
+
+	for (i = 0; (i < sizeof rnd) && (i * 2 + 2 < n); ++i)
+		snprintf(&token[i * 2], 3, "%02x", rnd[i]);
+	return(0);
+}
+
+/*
+ * PARK - file our login away, answer with the token to resume it.
+ */
+void cmd_park(char *argbuf)
+{
+	struct CitContext *CCC = CC;
+	ParkedSession *PS;
+	char token[33];
+	time_t now;
+
+	if (CtdlAccessCheck(ac_logged_in)) {
+		return;
+	}
+	if ((CCC->download_fp != NULL) || (CCC->upload_fp != NULL)) {
+		cprintf("%d You have a file transfer open.\n", ERROR + RESOURCE_BUSY);
+		return;
+	}
+
+	memset(token, 0, sizeof token);
+	if (MakeParkToken(token, sizeof token) != 0) {
+		syslog(LOG_ERR, "user_ops: PARK: cannot read /dev/urandom: %s", strerror(errno));
+		cprintf("%d Cannot park this session.\n", ERROR + INTERNAL_ERROR);
+		return;
+	}
+
+	PS = (ParkedSession*) malloc(sizeof(ParkedSession));
+	memset(PS, 0, sizeof(ParkedSession));
+	now = time(NULL);
+	PS->usernum = CCC->user.usernum;
+	PS->parked = now;
+	PS->previous_login = CCC->previous_login;
+	PS->is_master = CCC->is_master;
+	PS->curr_view = CCC->curr_view;
+	PS->disable_exp = CCC->disable_exp;
+	PS->cs_flags = CCC->cs_flags;
+	safestrncpy(PS->roomname, CCC->room.QRname, sizeof PS->roomname);
+	safestrncpy(PS->cs_host, CCC->cs_host, sizeof PS->cs_host);
+	safestrncpy(PS->cs_addr, CCC->cs_addr, sizeof PS->cs_addr);
+	safestrncpy(PS->cs_clientname, CCC->cs_clientname, sizeof PS->cs_clientname);
+	safestrncpy(PS->cs_inet_email, CCC->cs_inet_email, sizeof PS->cs_inet_email);
+	safestrncpy(PS->cs_inet_other_emails, CCC->cs_inet_other_emails, sizeof PS->cs_inet_other_emails);
+	safestrncpy(PS->cs_inet_fn, CCC->cs_inet_fn, sizeof PS->cs_inet_fn);
+	safestrncpy(PS->fake_username, CCC->fake_username, sizeof PS->fake_username);
+	safestrncpy(PS->fake_hostname, CCC->fake_hostname, sizeof PS->fake_hostname);
+	safestrncpy(PS->fake_roomname, CCC->fake_roomname, sizeof PS->fake_roomname);
+	safestrncpy(PS->preferred_formats, CCC->preferred_formats, sizeof PS->preferred_formats);
+	PS->ldap_dn = CCC->ldap_dn;
+	CCC->ldap_dn = NULL;
+
+	begin_critical_section(S_SESSION_TABLE);
+	PS->FirstExpressMessage = CCC->FirstExpressMessage;
+	CCC->FirstExpressMessage = NULL;
+	Put(ParkedSessions, token, strlen(token), PS, DeleteParkedSession);
+	if (now - ParkedSessionsSwept > 60)
+		SweepParkedSessions(now);
+	end_critical_section(S_SESSION_TABLE);
+
+	/* now leave the connection the way a fresh one is. */
+	CCC->logged_in = 0;
+	memset(&CCC->user, 0, sizeof(struct ctdluser));
+	memset(&CCC->room, 0, sizeof(struct ctdlroom));
+	CCC->curr_user[0] = 0;
+	CCC->is_master = 0;
+	CCC->curr_view = 0;
+	CCC->cs_flags = 0;
+	CCC->cs_inet_email[0] = 0;
+	CCC->cs_inet_other_emails[0] = 0;
+	CCC->cs_inet_fn[0] = 0;
+	CCC->fake_username[0] = 0;
+	CCC->fake_hostname[0] = 0;
+	CCC->fake_roomname[0] = 0;
+	if (CCC->cached_msglist != NULL) {
+		free(CCC->cached_msglist);
+		CCC->cached_msglist = NULL;
+	}
+	CCC->cached_num_msgs = 0;
+
+	cprintf("%d %s\n", CIT_OK, token);
+}
+
+/*
+ * RSUM <token> - take up a login parked with PARK on any connection.
+ */
+void cmd_rsum(char *argbuf)
+{
+	struct CitContext *CCC = CC;
+	ParkedSession *PS = NULL;
+	struct ExpressMessage *ptr;
+	HashPos *at;
+	void *vPS;
+	char token[64];
+	long len;
+	int ra;
+
+	if (CCC->logged_in) {
+		cprintf("%d Already logged in.\n", ERROR + ALREADY_LOGGED_IN);
+		return;
+	}
+
+	len = extract_token(token, argbuf, 0, '|', sizeof token);
+
+	/* a token is good for one RSUM; the next PARK hands out a new one. */
+	begin_critical_section(S_SESSION_TABLE);
+	if ((len > 0) && GetHash(ParkedSessions, token, len, &vPS) && (vPS != NULL)) {
+		PS = (ParkedSession*) malloc(sizeof(ParkedSession));
+		memcpy(PS, vPS, sizeof(ParkedSession));
+		((ParkedSession*)vPS)->ldap_dn = NULL;
+		((ParkedSession*)vPS)->FirstExpressMessage = NULL;
+		at = GetNewHashPos(ParkedSessions, 0);
+		if (GetHashPosFromKey(ParkedSessions, token, len, at))
+			DeleteEntryFromHash(ParkedSessions, at);
+		DeleteHashPos(&at);
+	}
+	end_critical_section(S_SESSION_TABLE);
+
+	if ((PS == NULL) || (time(NULL) - PS->parked > PARKED_SESSION_TIMEOUT)) {
+		cprintf("%d No such session.\n", ERROR + NO_SUCH_USER);
+		if (PS != NULL)
+			DeleteParkedSession(PS);
+		return;
+	}
+	if ((CtdlGetUserByNumber(&CCC->user, PS->usernum) != 0) ||
+	    (CCC->user.axlevel == AxDeleted))
+	{
+		memset(&CCC->user, 0, sizeof(struct ctdluser));
+		cprintf("%d No such user.\n", ERROR + NO_SUCH_USER);
+		DeleteParkedSession(PS);
+		return;
+	}
+
+	safestrncpy(CCC->curr_user, CCC->user.fullname, sizeof CCC->curr_user);
+	CCC->previous_login = PS->previous_login;
+	CCC->is_master = PS->is_master;
+	CCC->disable_exp = PS->disable_exp;
+	CCC->cs_flags = PS->cs_flags;
+	safestrncpy(CCC->cs_host, PS->cs_host, sizeof CCC->cs_host);
+	safestrncpy(CCC->cs_addr, PS->cs_addr, sizeof CCC->cs_addr);
+	safestrncpy(CCC->cs_clientname, PS->cs_clientname, sizeof CCC->cs_clientname);
+	safestrncpy(CCC->cs_inet_email, PS->cs_inet_email, sizeof CCC->cs_inet_email);
+	safestrncpy(CCC->cs_inet_other_emails, PS->cs_inet_other_emails, sizeof CCC->cs_inet_other_emails);
+	safestrncpy(CCC->cs_inet_fn, PS->cs_inet_fn, sizeof CCC->cs_inet_fn);
+	safestrncpy(CCC->fake_username, PS->fake_username, sizeof CCC->fake_username);
+	safestrncpy(CCC->fake_hostname, PS->fake_hostname, sizeof CCC->fake_hostname);
+	safestrncpy(CCC->fake_roomname, PS->fake_roomname, sizeof CCC->fake_roomname);
+	safestrncpy(CCC->preferred_formats, PS->preferred_formats, sizeof CCC->preferred_formats);
+	if (CCC->ldap_dn != NULL)
+		free(CCC->ldap_dn);
+	CCC->ldap_dn = PS->ldap_dn;
+	PS->ldap_dn = NULL;
+
+	begin_critical_section(S_SESSION_TABLE);
+	if (CCC->FirstExpressMessage == NULL) {
+		CCC->FirstExpressMessage = PS->FirstExpressMessage;
+	}
+	else {
+		for (ptr = CCC->FirstExpressMessage; ptr->next != NULL; ptr = ptr->next);
+		ptr->next = PS->FirstExpressMessage;
+	}
+	PS->FirstExpressMessage = NULL;
+	end_critical_section(S_SESSION_TABLE);
+
+	CCC->logged_in = 1;
+
+	/*
+	 * back into the room we left; a fresh copy, it may have seen new
+	 * messages.  We may have been kicked out of it, or it may have gone
+	 * private, while we were parked; then it's the lobby, as at login.
+	 */
+	ra = 0;
+	if (CtdlGetRoom(&CCC->room, PS->roomname) == 0) {
+		CtdlRoomAccess(&CCC->room, &CCC->user, &ra, NULL);
+	}
+	if ((ra & (UA_KNOWN | UA_GOTOALLOWED)) != 0) {
+		CCC->curr_view = PS->curr_view;
+	}
+	else {
+		CtdlUserGoto(CtdlGetConfigStr("c_baseroom"), 0, 0, NULL, NULL, NULL, NULL);
+	}
+	DeleteParkedSession(PS);
+
+	logged_in_response();
+}
+
+
 /*****************************************************************************/
 /*                      MODULE INITIALIZATION STUFF                          */
 /*****************************************************************************/
@@ -752,10 +1049,13 @@ void cmd_lout(char *argbuf)
 CTDL_MODULE_INIT(serv_user)
 {
 	if (!threading) {
+		ParkedSessions = NewHash(1, NULL);
 		CtdlRegisterProtoHook(cmd_user, "USER", "Submit username for login");
 		CtdlRegisterProtoHook(cmd_pass, "PASS", "Complete login by submitting a password");
 		CtdlRegisterProtoHook(cmd_quit, "QUIT", "log out and disconnect from server");
 		CtdlRegisterProtoHook(cmd_lout, "LOUT", "log out but do not disconnect from server");
+		CtdlRegisterProtoHook(cmd_park, "PARK", "park this login, so it can be resumed on another connection");
+		CtdlRegisterProtoHook(cmd_rsum, "RSUM", "resume a parked login");
 		CtdlRegisterProtoHook(cmd_creu, "CREU", "Create User");
 		CtdlRegisterProtoHook(cmd_setp, "SETP", "Set the password for an account");
 		CtdlRegisterProtoHook(cmd_getu, "GETU", "Get User parameters");
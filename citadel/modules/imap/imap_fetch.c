@@ -133,8 +133,6 @@ void imap_fetch_rfc822(long msgnum, const char *whichfmt) {
 	const char *ptr = NULL;
 	size_t headers_size, text_size, total_size;
 	size_t bytes_to_send = 0;
-	struct MetaData smi;
-	int need_to_rewrite_metadata = 0;
 	int need_body = 0;
 
 	/* Determine whether this particular fetch operation requires
@@ -146,17 +144,13 @@ void imap_fetch_rfc822(long msgnum, const char *whichfmt) {
 		need_body = 1;
 	}
 
-	/* If this is an RFC822.SIZE fetch, first look in the message's
-	 * metadata record to see if we've saved that information.
+	/* An RFC822.SIZE fetch comes out of the message's metadata record
+	 * (measured and saved there if it's missing); no need to load the
+	 * message for that.
 	 */
 	if (!strcasecmp(whichfmt, "RFC822.SIZE")) {
-		GetMetaData(&smi, msgnum);
-		if (smi.meta_rfc822_length > 0L) {
-			IAPrintf("RFC822.SIZE %ld", smi.meta_rfc822_length);
-			return;
-		}
-		need_to_rewrite_metadata = 1;
-		need_body = 1;
+		IAPrintf("RFC822.SIZE %ld", CtdlGetRFC822Length(msgnum));
+		return;
 	}
 	
 	/* Cache the most recent RFC822 FETCH because some clients like to
@@ -193,11 +187,6 @@ void imap_fetch_rfc822(long msgnum, const char *whichfmt) {
 		CCC->redirect_buffer = NULL;
 		Imap->cached_rfc822_msgnum = msgnum;
 		Imap->cached_rfc822_withbody = need_body;
-		if ( (need_to_rewrite_metadata) && 
-		     (StrLength(Imap->cached_rfc822) > 0) ) {
-			smi.meta_rfc822_length = StrLength(Imap->cached_rfc822);
-			PutMetaData(&smi);
-		}
 	}
 
 	/*
@@ -240,12 +229,7 @@ void imap_fetch_rfc822(long msgnum, const char *whichfmt) {
 		    ", total=" SIZE_T_FMT,
 		    headers_size, text_size, total_size);
 
-	if (!strcasecmp(whichfmt, "RFC822.SIZE")) {
-		IAPrintf("RFC822.SIZE " SIZE_T_FMT, total_size);
-		return;
-	}
-
-	else if (!strcasecmp(whichfmt, "RFC822")) {
+	if (!strcasecmp(whichfmt, "RFC822")) {
 		ptr = ChrPtr(Imap->cached_rfc822);
 		bytes_to_send = total_size;
 	}
@@ -271,7 +255,7 @@ void imap_fetch_rfc822(long msgnum, const char *whichfmt) {
  * client.  FIXME we can handle parts like "2" and "2.1" and even "2.MIME"
  * but we still can't handle "2.HEADER" (which might not be a problem).
  *
- * Note: mime_parser() was called with dont_decode set to 1, so we have the
+ * Note: we get the part as it is in the message, so we have the
  * luxury of simply spewing without having to re-encode.
  */
 void imap_load_part(char *name, char *filename, char *partnum, char *disp,
@@ -329,6 +313,48 @@ void imap_load_part(char *name, char *filename, char *partnum, char *disp,
 }
 
 
+/*
+ * Find the part the client asked for with the streaming MIME parser; parts
+ * in front of it are skipped without being looked at, and we stop as soon
+ * as we have it.  Then spew it through imap_load_part().
+ */
+static void imap_load_part_stream(struct CtdlMessage *msg, StrBuf *section)
+{
+	MimeStreamParser *P;
+	MimePartInfo *Info;
+	eMimeEvent Event;
+	const char *Data;
+	char mimebuf2[SIZ];
+	long len;
+
+	P = NewMimeStreamParser();
+	MimeStreamFeed(P, CM_KEY(msg, eMesageText));
+	MimeStreamDone(P);
+	while (((Event = MimeStreamNext(P, &Info)) != eMimeEnd) &&
+	       (Event != eMimeNeedMore))
+	{
+		if (Event != eMimePart)
+			continue;
+		snprintf(mimebuf2, sizeof mimebuf2, "%s.MIME", Info->PartNum);
+		if (strcasecmp(Info->PartNum, ChrPtr(section)) &&
+		    strcasecmp(mimebuf2, ChrPtr(section)))
+			continue;
+
+		/* the whole message is there, so the body comes in one piece */
+		len = MimeStreamRawBody(P, &Data);
+		if (len <= 0) {
+			Data = "";
+			len = 0;
+		}
+		imap_load_part(Info->Name, Info->Filename, Info->PartNum, Info->Disposition,
+			       (void *)Data, Info->ContentType, Info->Charset, len,
+			       Info->Encoding, Info->Id, section);
+		break;
+	}
+	FreeMimeStreamParser(&P);
+}
+
+
 /* 
  * Called by imap_fetch_envelope() to output the "From" field.
  * This is in its own function because its logic is kind of complex.  We
@@ -745,14 +771,10 @@ void imap_fetch_body(long msgnum, ConstStr item, int is_peek) {
 
 	/*
 	 * Anything else must be a part specifier.
-	 * (Note value of 1 passed as 'dont_decode' so client gets it encoded)
+	 * (The client gets it encoded, just as it is in the message)
 	 */
 	else {
-		mime_parser(CM_RANGE(msg, eMesageText),
-			    *imap_load_part, NULL, NULL,
-			    section,
-			    1
-			);
+		imap_load_part_stream(msg, section);
 	}
 
 	if (loading_body_now) {
@@ -58,6 +58,18 @@
 #include "genstamp.h"
 
 
+/*
+ * The search strings get compiled the first time a message needs them;
+ * patterns[] runs parallel to itemlist[] and lives as long as the command.
+ */
+static const CasePattern *imap_search_pattern(ConstStr *itemlist, CasePattern **patterns, int pos) {
+	if (patterns[pos] == NULL) {
+		patterns[pos] = NewCasePattern(itemlist[pos].Key, itemlist[pos].len);
+	}
+	return patterns[pos];
+}
+
+
 /*
  * imap_do_search() calls imap_do_search_msg() to search an individual
  * message after it has been fetched from the disk.  This function returns
@@ -68,7 +80,7 @@
  * be loaded only if one or more search criteria require it.
  */
 int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
-			int num_items, ConstStr *itemlist, int is_uid) {
+			int num_items, ConstStr *itemlist, CasePattern **patterns, int is_uid) {
 
 	citimap *Imap = IMAP;
 	int match = 0;
@@ -121,7 +133,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 		if (msg != NULL) {
 			fieldptr = rfc822_fetch_field(msg->cm_fields[eMesageText], "Bcc");
 			if (fieldptr != NULL) {
-				if (bmstrcasestr(fieldptr, itemlist[pos+1].Key)) {
+				if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), fieldptr, -1)) {
 					match = 1;
 				}
 				free(fieldptr);
@@ -162,7 +174,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 				need_to_free_msg = 1;
 			}
 			if (msg != NULL) {
-				if (bmstrcasestr(msg->cm_fields[eMesageText], itemlist[pos+1].Key)) {
+				if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, eMesageText))) {
 					match = 1;
 				}
 			}
@@ -179,14 +191,14 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 		if (msg != NULL) {
 			fieldptr = msg->cm_fields[eCarbonCopY];
 			if (fieldptr != NULL) {
-				if (bmstrcasestr(fieldptr, itemlist[pos+1].Key)) {
+				if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), fieldptr, -1)) {
 					match = 1;
 				}
 			}
 			else {
 				fieldptr = rfc822_fetch_field(msg->cm_fields[eMesageText], "Cc");
 				if (fieldptr != NULL) {
-					if (bmstrcasestr(fieldptr, itemlist[pos+1].Key)) {
+					if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), fieldptr, -1)) {
 						match = 1;
 					}
 					free(fieldptr);
@@ -223,10 +235,10 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 			need_to_free_msg = 1;
 		}
 		if (msg != NULL) {
-			if (bmstrcasestr(msg->cm_fields[eAuthor], itemlist[pos+1].Key)) {
+			if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, eAuthor))) {
 				match = 1;
 			}
-			if (bmstrcasestr(msg->cm_fields[erFc822Addr], itemlist[pos+1].Key)) {
+			if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, erFc822Addr))) {
 				match = 1;
 			}
 		}
@@ -252,7 +264,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 	
 			fieldptr = rfc822_fetch_field(ChrPtr(CC->redirect_buffer), itemlist[pos+1].Key);
 			if (fieldptr != NULL) {
-				if (bmstrcasestr(fieldptr, itemlist[pos+2].Key)) {
+				if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+2), fieldptr, -1)) {
 					match = 1;
 				}
 				free(fieldptr);
@@ -409,7 +421,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 			need_to_free_msg = 1;
 		}
 		if (msg != NULL) {
-			if (bmstrcasestr(msg->cm_fields[eMsgSubject], itemlist[pos+1].Key)) {
+			if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, eMsgSubject))) {
 				match = 1;
 			}
 		}
@@ -423,7 +435,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 		}
 		if (msg != NULL) {
 			for (i='A'; i<='Z'; ++i) {
-				if (bmstrcasestr(msg->cm_fields[i], itemlist[pos+1].Key)) {
+				if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, i))) {
 					match = 1;
 				}
 			}
@@ -437,7 +449,7 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 			need_to_free_msg = 1;
 		}
 		if (msg != NULL) {
-			if (bmstrcasestr(msg->cm_fields[eRecipient], itemlist[pos+1].Key)) {
+			if (CasePatternFind(imap_search_pattern(itemlist, patterns, pos+1), CM_KEY(msg, eRecipient))) {
 				match = 1;
 			}
 		}
@@ -515,11 +527,11 @@ int imap_do_search_msg(int seq, struct CtdlMessage *supplied_msg,
 
 		if (is_or) {
 			match = (match || imap_do_search_msg(seq, msg,
-				num_items - pos, &itemlist[pos], is_uid));
+				num_items - pos, &itemlist[pos], &patterns[pos], is_uid));
 		}
 		else {
 			match = (match && imap_do_search_msg(seq, msg,
-				num_items - pos, &itemlist[pos], is_uid));
+				num_items - pos, &itemlist[pos], &patterns[pos], is_uid));
 		}
 
 	}
@@ -542,6 +554,7 @@ void imap_do_search(int num_items, ConstStr *itemlist, int is_uid) {
 	long *fts_msgs = NULL;
 	int is_in_list = 0;
 	int num_results = 0;
+	CasePattern **patterns;
 
 	/* Strip parentheses.  We realize that this method will not work
 	 * in all cases, but it seems to work with all currently available
@@ -595,12 +608,13 @@ void imap_do_search(int num_items, ConstStr *itemlist, int is_uid) {
 	}
 
 	/* Now go through the messages and apply all search criteria. */
+	patterns = (CasePattern **) calloc(num_items, sizeof(CasePattern *));
 	buffer_output();
 	IAPuts("* SEARCH ");
 	if (Imap->num_msgs > 0)
 	 for (i = 0; i < Imap->num_msgs; ++i)
 	  if (Imap->flags[i] & IMAP_SELECTED) {
-		if (imap_do_search_msg(i+1, NULL, num_items, itemlist, is_uid)) {
+		if (imap_do_search_msg(i+1, NULL, num_items, itemlist, patterns, is_uid)) {
 			if (num_results != 0) {
 				IAPuts(" ");
 			}
@@ -615,6 +629,11 @@ void imap_do_search(int num_items, ConstStr *itemlist, int is_uid) {
 	}
 	IAPuts("\r\n");
 	unbuffer_output();
+
+	for (i = 0; i < num_items; ++i) {
+		FreeCasePattern(&patterns[i]);
+	}
+	free(patterns);
 }
 
 
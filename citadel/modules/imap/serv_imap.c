@@ -202,8 +202,7 @@ void imap_set_seen_flags(int first_msg)
 	citimap *Imap = IMAP;
 	visit vbuf;
 	int i;
-	int num_sets;
-	int s;
+	const char *SetPos, *RangePos;
 	char setstr[64], lostr[64], histr[64];
 	long lo, hi;
 
@@ -220,13 +219,11 @@ void imap_set_seen_flags(int first_msg)
 	 * Do the "\Seen" flag.
 	 * (Any message not "\Seen" is considered "\Recent".)
 	 */
-	num_sets = num_tokens(vbuf.v_seen, ',');
-	for (s=0; s<num_sets; ++s) {
-		extract_token(setstr, vbuf.v_seen, s, ',', sizeof setstr);
-
-		extract_token(lostr, setstr, 0, ':', sizeof lostr);
-		if (num_tokens(setstr, ':') >= 2) {
-			extract_token(histr, setstr, 1, ':', sizeof histr);
+	SetPos = vbuf.v_seen;
+	while (extract_next_token(setstr, &SetPos, ',', sizeof setstr) >= 0) {
+		RangePos = setstr;
+		extract_next_token(lostr, &RangePos, ':', sizeof lostr);
+		if (extract_next_token(histr, &RangePos, ':', sizeof histr) >= 0) {
 			if (!strcmp(histr, "*")) {
 				snprintf(histr, sizeof histr, "%ld", LONG_MAX);
 			}
@@ -246,13 +243,11 @@ void imap_set_seen_flags(int first_msg)
 	}
 
 	/* Do the ANSWERED flag */
-	num_sets = num_tokens(vbuf.v_answered, ',');
-	for (s=0; s<num_sets; ++s) {
-		extract_token(setstr, vbuf.v_answered, s, ',', sizeof setstr);
-
-		extract_token(lostr, setstr, 0, ':', sizeof lostr);
-		if (num_tokens(setstr, ':') >= 2) {
-			extract_token(histr, setstr, 1, ':', sizeof histr);
+	SetPos = vbuf.v_answered;
+	while (extract_next_token(setstr, &SetPos, ',', sizeof setstr) >= 0) {
+		RangePos = setstr;
+		extract_next_token(lostr, &RangePos, ':', sizeof lostr);
+		if (extract_next_token(histr, &RangePos, ':', sizeof histr) >= 0) {
 			if (!strcmp(histr, "*")) {
 				snprintf(histr, sizeof histr, "%ld", LONG_MAX);
 			}
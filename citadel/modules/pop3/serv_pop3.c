@@ -168,9 +168,6 @@ void pop3_user(char *argbuf)
  */
 void pop3_add_message(long msgnum, void *userdata)
 {
-	struct CitContext *CCC = CC;
-	struct MetaData smi;
-
 	++POP3->num_msgs;
 	if (POP3->num_msgs < 2) POP3->msgs = malloc(sizeof(struct pop3msg));
 	else POP3->msgs = realloc(POP3->msgs, 
@@ -180,25 +177,10 @@ void pop3_add_message(long msgnum, void *userdata)
 
 	/* We need to know the length of this message when it is printed in
 	 * RFC822 format.  Perhaps we have cached this length in the message's
-	 * metadata record.  If so, great; if not, measure it and then cache
-	 * it for next time.
+	 * metadata record.  If so, great; if not, CtdlGetRFC822Length()
+	 * measures it and caches it for next time.
 	 */
-	GetMetaData(&smi, msgnum);
-	if (smi.meta_rfc822_length <= 0L) {
-		CCC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
-
-		CtdlOutputMsg(msgnum,
-			      MT_RFC822,
-			      HEADERS_ALL,
-			      0, 1, NULL,
-			      SUPPRESS_ENV_TO,
-			      NULL, NULL, NULL);
-
-		smi.meta_rfc822_length = StrLength(CCC->redirect_buffer);
-		FreeStrBuf(&CCC->redirect_buffer); /* TODO: WHEW, all this for just knowing the length???? */
-		PutMetaData(&smi);
-	}
-	POP3->msgs[POP3->num_msgs-1].rfc822_length = smi.meta_rfc822_length;
+	POP3->msgs[POP3->num_msgs-1].rfc822_length = CtdlGetRFC822Length(msgnum);
 }
 
 
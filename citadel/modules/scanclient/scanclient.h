@@ -0,0 +1,91 @@
+/*
+ * Shared client for content scanners (clamd, spamd) which are consulted
+ * before we accept a message via SMTP.
+ *
+ * Copyright (c) 2016 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SCANCLIENT_H__
+#define __SCANCLIENT_H__
+
+#include "event_client.h"
+
+/* how long may all scanners of one message take together (seconds) */
+#define SCAN_TIMEOUT_BUDGET	30
+/* connect timeout for one scanner host (seconds) */
+#define SCAN_CONN_TIMEOUT	5
+/* a pooled connection has this long to answer before we try a fresh one (seconds) */
+#define SCAN_REUSE_TIMEOUT	5
+/* don't reuse pooled connections which idled longer than this (seconds) */
+#define SCAN_POOL_MAX_IDLE	20
+/* keep at most this many idle connections per scanner host */
+#define SCAN_POOL_MAX_CONNS	8
+
+typedef enum _eScanVerdict {
+	eScanUnknown,	/* scanner unreachable, timed out or failed; let it pass */
+	eScanClean,
+	eScanReject,	/* the scanner doesn't want this message */
+	eScanTag	/* the scanner wants to modify, but not reject it */
+} eScanVerdict;
+
+typedef struct ScanJob ScanJob;
+typedef struct ScanRequest ScanRequest;
+
+/*
+ * Filter:    runs on the SMTP worker; return 0 to not scan this message.
+ * Prepare:   runs in the event loop; put the request into Job->IO.SendBuf.
+ *            NewSession is set if this is a fresh connection.
+ * ReadReply: runs in the event loop for each line in Job->IO.IOBuf;
+ *            set Job->Verdict / Job->Reply, return eReadMore if you need
+ *            more lines, eTerminateConnection once you're done.
+ * Apply:     runs on the SMTP worker once the verdict is in; returns the
+ *            value for the EVT_SMTPSCAN hook (nonzero rejects).
+ */
+typedef int (*ScanFilter)(struct CtdlMessage *msg, recptypes *recp);
+typedef void (*ScanPrepare)(ScanJob *Job, int NewSession);
+typedef eNextState (*ScanReadReply)(ScanJob *Job);
+typedef int (*ScanApply)(struct CtdlMessage *msg, eScanVerdict Verdict, StrBuf *Reply);
+
+typedef struct _ScanBackend {
+	const char *Name;	/* for the logs */
+	char *HostType;		/* get_hosts() key in the internet config */
+	unsigned short DefaultPort;
+	int Persistent;		/* may connections be reused for the next message? */
+	ScanFilter Filter;
+	ScanPrepare Prepare;
+	ScanReadReply ReadReply;
+	ScanApply Apply;
+} ScanBackend;
+
+struct ScanJob {
+	AsyncIO IO;
+
+	ScanRequest *Request;
+	const ScanBackend *Backend;
+	int Slot;
+
+	ParsedURL *Hosts;	/* all configured hosts for this backend */
+	ParsedURL *CurrHost;	/* the one we're talking to */
+	int Reused;		/* connection came out of the pool */
+	int Retried;		/* we've already retried with a new connection */
+	ev_tstamp Deadline;	/* SCAN_TIMEOUT_BUDGET runs out; nothing after that */
+	ev_tstamp AttemptDeadline; /* when the current connection times out */
+	int KeepConn;		/* the backend says we may pool this connection */
+	int State;		/* backends reply parser state; 0 on each connect */
+
+	const StrBuf *MsgText;	/* rendered message; shared with other jobs */
+	eScanVerdict Verdict;
+	StrBuf *Reply;
+};
+
+void CtdlRegisterScanBackend(const ScanBackend *Backend);
+
+#endif /* __SCANCLIENT_H__ */
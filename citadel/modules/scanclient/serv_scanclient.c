@@ -0,0 +1,669 @@
+/*
+ * Shared client for content scanners (clamd, spamd) which are consulted
+ * before we accept a message via SMTP.
+ *
+ * Scanner modules register a ScanBackend describing their protocol; we
+ * register the one EVT_SMTPSCAN hook, render the message once, and hand
+ * one job per backend to the event loop, so all scanners run in parallel
+ * and none of the socket IO happens on the SMTP worker.  The worker only
+ * waits for the verdicts, and never longer than SCAN_TIMEOUT_BUDGET.
+ * Connections to scanners which can handle several requests on one
+ * connection (clamd sessions) are kept in a pool for the next message.
+ *
+ * Copyright (c) 2016 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "sysdep.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <libcitadel.h>
+#include "citadel.h"
+#include "server.h"
+#include "citserver.h"
+#include "support.h"
+#include "config.h"
+#include "msgbase.h"
+#include "domain.h"
+#include "ctdl_module.h"
+#include "event_client.h"
+#include "scanclient.h"
+
+int ScanClientDebugEnabled = 0;
+
+#define DBGLOG(LEVEL) if ((LEVEL != LOG_DEBUG) || (ScanClientDebugEnabled != 0))
+
+#define EVSC_syslog(LEVEL, FORMAT, ...)					\
+	DBGLOG(LEVEL) syslog(LEVEL,					\
+			     "%s[%ld]CC[%d]SCAN[%s]: " FORMAT,		\
+			     IOSTR, IO->ID, CCID, Job->Backend->Name,	\
+			     __VA_ARGS__)
+
+#define EVSCM_syslog(LEVEL, FORMAT)					\
+	DBGLOG(LEVEL) syslog(LEVEL,					\
+			     "%s[%ld]CC[%d]SCAN[%s]: " FORMAT,		\
+			     IOSTR, IO->ID, CCID, Job->Backend->Name)
+
+#define SCAN_syslog(LEVEL, FORMAT, ...)				\
+	DBGLOG(LEVEL) syslog(LEVEL, "SCAN: " FORMAT, __VA_ARGS__)
+
+#define SCANM_syslog(LEVEL, FORMAT)				\
+	DBGLOG(LEVEL) syslog(LEVEL, "SCAN: " FORMAT)
+
+
+#define MAX_SCAN_BACKENDS 8
+
+static const ScanBackend *ScanBackends[MAX_SCAN_BACKENDS];
+static int nScanBackends = 0;
+
+typedef struct _ScanResult {
+	const ScanBackend *Backend;
+	int Done;
+	eScanVerdict Verdict;
+	StrBuf *Reply;
+} ScanResult;
+
+/*
+ * One of these exists per scanned message; it is shared by the SMTP
+ * worker waiting for the verdicts and all jobs in the event loop.  The
+ * last one to let go of it frees it, since the worker may give up on
+ * slow scanners before they are done.
+ */
+struct ScanRequest {
+	pthread_mutex_t Mutex;	/* protects everything below */
+	pthread_cond_t Cond;	/* signalled whenever a job finishes */
+	int RefCount;
+	int Pending;
+	StrBuf *MsgText;
+	ScanResult Results[MAX_SCAN_BACKENDS];
+};
+
+
+void CtdlRegisterScanBackend(const ScanBackend *Backend)
+{
+	if (nScanBackends >= MAX_SCAN_BACKENDS) {
+		syslog(LOG_ERR, "SCAN: too many scan backends; ignoring %s\n", Backend->Name);
+		return;
+	}
+	ScanBackends[nScanBackends++] = Backend;
+	syslog(LOG_DEBUG, "SCAN: registered scan backend %s\n", Backend->Name);
+}
+
+
+/*****************************************************************************/
+/*                     CONNECTION POOL                                       */
+/*****************************************************************************/
+/*
+ * Idle connections to scanners, keyed by host:port.
+ * Only ever touched from within the event loop, so it needs no locking.
+ */
+typedef struct _ScanPoolConn {
+	int fd;
+	ev_tstamp IdleSince;
+} ScanPoolConn;
+
+typedef struct _ScanPoolHost {
+	int n;
+	ScanPoolConn Conns[SCAN_POOL_MAX_CONNS];
+} ScanPoolHost;
+
+HashList *ScanPool = NULL;
+
+static long ScanPoolKey(ParsedURL *Url, char *Key, size_t KeySize)
+{
+	return snprintf(Key, KeySize, "%s:%u", Url->Host, Url->Port);
+}
+
+/*
+ * drop connections which idled too long; clamd hangs up on them anyways.
+ */
+static void ScanPoolExpire(ScanPoolHost *Host, ev_tstamp Now)
+{
+	int i, j;
+
+	for (i = 0, j = 0; i < Host->n; i++) {
+		if (Now - Host->Conns[i].IdleSince > SCAN_POOL_MAX_IDLE) {
+			close(Host->Conns[i].fd);
+		}
+		else {
+			Host->Conns[j++] = Host->Conns[i];
+		}
+	}
+	Host->n = j;
+}
+
+static int ScanPoolGet(const char *Key, long KeyLen, ev_tstamp Now)
+{
+	ScanPoolHost *Host;
+	void *vHost;
+	char ch;
+	int fd;
+	int rc;
+
+	if (!GetHash(ScanPool, Key, KeyLen, &vHost) || (vHost == NULL))
+		return -1;
+	Host = (ScanPoolHost *) vHost;
+
+	ScanPoolExpire(Host, Now);
+	while (Host->n > 0) {
+		Host->n --;
+		fd = Host->Conns[Host->n].fd;
+
+		/* the scanner may have hung up on us meanwhile */
+		rc = recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+		if ((rc < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			return fd;
+
+		SCAN_syslog(LOG_DEBUG, "discarding stale connection %d to %s\n", fd, Key);
+		close(fd);
+	}
+	return -1;
+}
+
+static void ScanPoolPut(const char *Key, long KeyLen, int fd, ev_tstamp Now)
+{
+	ScanPoolHost *Host;
+	void *vHost;
+
+	if (!GetHash(ScanPool, Key, KeyLen, &vHost) || (vHost == NULL)) {
+		Host = (ScanPoolHost *) malloc(sizeof(ScanPoolHost));
+		memset(Host, 0, sizeof(ScanPoolHost));
+		Put(ScanPool, Key, KeyLen, Host, NULL);
+	}
+	else {
+		Host = (ScanPoolHost *) vHost;
+	}
+
+	ScanPoolExpire(Host, Now);
+	if (Host->n >= SCAN_POOL_MAX_CONNS) {
+		close(fd);
+		return;
+	}
+	Host->Conns[Host->n].fd = fd;
+	Host->Conns[Host->n].IdleSince = Now;
+	Host->n ++;
+}
+
+void ScanPoolShutdown(void)
+{
+	ScanPoolHost *Host;
+	HashPos *It;
+	const char *Key;
+	void *vHost;
+	long len;
+	int i;
+
+	It = GetNewHashPos(ScanPool, 0);
+	while (GetNextHashPos(ScanPool, It, &len, &Key, &vHost)) {
+		Host = (ScanPoolHost *) vHost;
+		for (i = 0; i < Host->n; i++)
+			close(Host->Conns[i].fd);
+		Host->n = 0;
+	}
+	DeleteHashPos(&It);
+	DeleteHash(&ScanPool);
+}
+
+
+/*****************************************************************************/
+/*                     REQUESTS & JOBS                                       */
+/*****************************************************************************/
+
+static void ScanRequestRelease(ScanRequest *Req)
+{
+	int RefCount;
+	int i;
+
+	pthread_mutex_lock(&Req->Mutex);
+	RefCount = --Req->RefCount;
+	pthread_mutex_unlock(&Req->Mutex);
+
+	if (RefCount > 0)
+		return;
+
+	for (i = 0; i < MAX_SCAN_BACKENDS; i++)
+		FreeStrBuf(&Req->Results[i].Reply);
+	FreeStrBuf(&Req->MsgText);
+	pthread_cond_destroy(&Req->Cond);
+	pthread_mutex_destroy(&Req->Mutex);
+	free(Req);
+}
+
+static void DeleteScanJob(ScanJob *Job)
+{
+	/* ConnectMe points into our host list; it's not ours to free. */
+	Job->IO.ConnectMe = NULL;
+	FreeURL(&Job->Hosts);
+	FreeStrBuf(&Job->Reply);
+	FreeAsyncIOContents(&Job->IO);
+	free(Job);
+}
+
+/*
+ * report our verdict to the waiting worker and go away.
+ */
+static void ScanJobFinish(ScanJob *Job)
+{
+	ScanRequest *Req = Job->Request;
+	ScanResult *Res = &Req->Results[Job->Slot];
+
+	pthread_mutex_lock(&Req->Mutex);
+	Res->Verdict = Job->Verdict;
+	Res->Reply = Job->Reply;
+	Job->Reply = NULL;
+	Res->Done = 1;
+	Req->Pending --;
+	pthread_cond_signal(&Req->Cond);
+	pthread_mutex_unlock(&Req->Mutex);
+
+	ScanRequestRelease(Req);
+	DeleteScanJob(Job);
+}
+
+/*
+ * getaddrinfo() the scanner hosts which aren't IP addresses already.
+ */
+static int ScanResolveHost(ParsedURL *Url)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+
+	if (Url->IsIP)
+		return 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ((getaddrinfo(Url->Host, NULL, &hints, &res) != 0) || (res == NULL))
+		return 0;
+
+	memset(&Url->Addr, 0, sizeof(Url->Addr));
+	if (res->ai_family == AF_INET6) {
+		memcpy(&Url->Addr, res->ai_addr, sizeof(struct sockaddr_in6));
+		Url->Addr.sin6_port = htons(Url->Port);
+		Url->IPv6 = 1;
+	}
+	else {
+		struct sockaddr_in *addr = (struct sockaddr_in *) &Url->Addr;
+
+		memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+		addr->sin_port = htons(Url->Port);
+		Url->IPv6 = 0;
+	}
+	freeaddrinfo(res);
+	return 1;
+}
+
+static ScanJob *NewScanJob(const ScanBackend *Backend, const char *hosts, int nHosts)
+{
+	ScanJob *Job;
+	ParsedURL *Url;
+	StrBuf *One;
+	char buf[SIZ];
+	int i;
+
+	Job = (ScanJob *) malloc(sizeof(ScanJob));
+	memset(Job, 0, sizeof(ScanJob));
+	Job->Backend = Backend;
+
+	/* ParseURL() prepends; walk backwards to keep the configured order. */
+	One = NewStrBuf();
+	for (i = nHosts - 1; i >= 0; i--) {
+		extract_token(buf, hosts, i, '|', sizeof buf);
+		if (IsEmptyStr(buf))
+			continue;
+		StrBufPlain(One, buf, -1);
+		Url = NULL;
+		if (!ParseURL(&Url, One, Backend->DefaultPort))
+			continue;
+		if (!ScanResolveHost(Url)) {
+			SCAN_syslog(LOG_WARNING, "%s: can't resolve <%s>\n", Backend->Name, Url->Host);
+			FreeURL(&Url);
+			continue;
+		}
+		Url->Next = Job->Hosts;
+		Job->Hosts = Url;
+	}
+	FreeStrBuf(&One);
+
+	if (Job->Hosts == NULL) {
+		free(Job);
+		return NULL;
+	}
+	Job->CurrHost = Job->Hosts;
+	return Job;
+}
+
+
+/*****************************************************************************/
+/*                     EVENT LOOP SIDE                                       */
+/*****************************************************************************/
+
+/*
+ * Each connection only gets what's left of our budget; a pooled one gets
+ * even less, so there's time left for a fresh one if it turns out stale.
+ */
+eNextState ScanJobConnect(ScanJob *Job, int UsePool)
+{
+	AsyncIO *IO = &Job->IO;
+	char Key[SIZ];
+	long KeyLen;
+	ev_tstamp Now = ev_time();
+	ev_tstamp Remaining = Job->Deadline - Now;
+	int fd = -1;
+
+	if (Remaining < 1.0) {
+		EVSCM_syslog(LOG_WARNING, "out of time; passing message.\n");
+		Job->Verdict = eScanUnknown;
+		return eAbort;
+	}
+
+	FlushStrBuf(IO->SendBuf.Buf);
+	IO->SendBuf.ReadWritePointer = NULL;
+	FlushStrBuf(IO->RecvBuf.Buf);
+	IO->RecvBuf.ReadWritePointer = NULL;
+	Job->KeepConn = 0;
+	Job->State = 0;
+	Job->Verdict = eScanUnknown;
+	FreeStrBuf(&Job->Reply);
+
+	IO->ConnectMe = Job->CurrHost;
+	if (Job->Backend->Persistent && UsePool) {
+		KeyLen = ScanPoolKey(Job->CurrHost, Key, sizeof Key);
+		fd = ScanPoolGet(Key, KeyLen, IO->Now);
+	}
+	Job->Reused = (fd > 0);
+
+	Job->Backend->Prepare(Job, !Job->Reused);
+
+	if (Job->Reused) {
+		if (Remaining > SCAN_REUSE_TIMEOUT)
+			Remaining = SCAN_REUSE_TIMEOUT;
+		Job->AttemptDeadline = Now + Remaining;
+		EVSC_syslog(LOG_DEBUG, "reusing connection to %s:%u\n",
+			    Job->CurrHost->Host, Job->CurrHost->Port);
+		return EvAttachSock(IO, fd, Remaining, 0);
+	}
+
+	Job->AttemptDeadline = Now + Remaining;
+	EVSC_syslog(LOG_INFO, "connecting to %s:%u\n",
+		    Job->CurrHost->Host, Job->CurrHost->Port);
+	return EvConnectSock(IO,
+			     (Remaining < SCAN_CONN_TIMEOUT) ? Remaining : SCAN_CONN_TIMEOUT,
+			     Remaining,
+			     0);
+}
+
+eNextState ScanJobStart(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+
+	return ScanJobConnect(Job, 1);
+}
+
+eNextState ScanJobSendDone(AsyncIO *IO)
+{
+	return eReadMessage;
+}
+
+eNextState ScanJobReadDone(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+	char Key[SIZ];
+	long KeyLen;
+	eNextState rc;
+	int fd;
+
+	EVSC_syslog(LOG_DEBUG, "< %s\n", ChrPtr(IO->IOBuf));
+	rc = Job->Backend->ReadReply(Job);
+
+	if ((rc == eTerminateConnection) &&
+	    Job->KeepConn &&
+	    Job->Backend->Persistent)
+	{
+		KeyLen = ScanPoolKey(Job->CurrHost, Key, sizeof Key);
+		fd = EvDetachSock(IO);
+		ScanPoolPut(Key, KeyLen, fd, IO->Now);
+	}
+	return rc;
+}
+
+eNextState ScanJobTerminate(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+
+	EVSC_syslog(LOG_DEBUG, "done; verdict %d\n", Job->Verdict);
+	ScanJobFinish(Job);
+	return eAbort;
+}
+
+/*
+ * The event loop sends EOF and read / write errors here too, right away;
+ * those we tell from a real timeout by the clock.
+ */
+eNextState ScanJobTimeout(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+	int Dropped = (IO->Now < Job->AttemptDeadline - 0.5);
+
+	/* pooled connection went stale under our feet; try a fresh one. */
+	if (Job->Reused && !Job->Retried) {
+		EVSC_syslog(LOG_DEBUG, "pooled connection %s; reconnecting\n",
+			    (Dropped) ? "was closed" : "didn't answer");
+		Job->Retried = 1;
+		return ScanJobConnect(Job, 0);
+	}
+
+	/* a fresh one that hung up on us; maybe the next host is better. */
+	if (Dropped && (Job->CurrHost->Next != NULL)) {
+		EVSC_syslog(LOG_INFO, "%s:%u closed the connection; trying the next one\n",
+			    Job->CurrHost->Host, Job->CurrHost->Port);
+		Job->CurrHost = Job->CurrHost->Next;
+		return ScanJobConnect(Job, 1);
+	}
+
+	EVSC_syslog(LOG_WARNING, "%s:%u %s; passing message.\n",
+		    Job->CurrHost->Host, Job->CurrHost->Port,
+		    (Dropped) ? "closed the connection" : "didn't answer in time");
+	Job->Verdict = eScanUnknown;
+	return eAbort;
+}
+
+eNextState ScanJobConnFail(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+
+	EVSC_syslog(LOG_INFO, "connecting %s:%u failed\n",
+		    Job->CurrHost->Host, Job->CurrHost->Port);
+
+	Job->CurrHost = Job->CurrHost->Next;
+	if (Job->CurrHost != NULL)
+		return ScanJobConnect(Job, 1);
+
+	/* If the service isn't running, just pass the mail
+	 * through.  Potentially throwing away mails isn't good.
+	 */
+	Job->Verdict = eScanUnknown;
+	return eAbort;
+}
+
+eNextState ScanJobDNSFail(AsyncIO *IO)
+{
+	return eAbort;
+}
+
+eNextState ScanJobShutdown(AsyncIO *IO)
+{
+	ScanJob *Job = (ScanJob *) IO->Data;
+
+	Job->Verdict = eScanUnknown;
+	return eAbort;
+}
+
+
+/*****************************************************************************/
+/*                     SMTP WORKER SIDE                                      */
+/*****************************************************************************/
+
+/*
+ * EVT_SMTPSCAN hook: dispatch the message to all interested scanners at
+ * once, wait for their verdicts within our time budget, and apply them.
+ */
+int scan_message(struct CtdlMessage *msg, recptypes *recp)
+{
+	const ScanBackend *Backend;
+	ScanJob *Jobs[MAX_SCAN_BACKENDS];
+	eScanVerdict Verdicts[MAX_SCAN_BACKENDS];
+	StrBuf *Replies[MAX_SCAN_BACKENDS];
+	ScanRequest *Req;
+	struct timespec Deadline;
+	char hosts[SIZ];
+	int nHosts;
+	int nJobs = 0;
+	int retval = 0;
+	int i;
+
+	if (nScanBackends == 0)
+		return 0;
+
+	/* figure out who wants to see this message */
+	for (i = 0; i < nScanBackends; i++) {
+		Backend = ScanBackends[i];
+		if ((Backend->Filter != NULL) && !Backend->Filter(msg, recp))
+			continue;
+
+		nHosts = get_hosts(hosts, Backend->HostType);
+		if (nHosts < 1)
+			continue;
+
+		Jobs[nJobs] = NewScanJob(Backend, hosts, nHosts);
+		if (Jobs[nJobs] != NULL)
+			nJobs ++;
+	}
+	if (nJobs == 0)
+		return 0;
+
+	Req = (ScanRequest *) malloc(sizeof(ScanRequest));
+	memset(Req, 0, sizeof(ScanRequest));
+	pthread_mutex_init(&Req->Mutex, NULL);
+	pthread_cond_init(&Req->Cond, NULL);
+	Req->RefCount = nJobs + 1;
+	Req->Pending = nJobs;
+
+	/* Render the message once; all scanners read the same copy. */
+	CC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
+	CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, 0);
+	Req->MsgText = CC->redirect_buffer;
+	CC->redirect_buffer = NULL;
+
+	for (i = 0; i < nJobs; i++) {
+		ScanJob *Job = Jobs[i];
+
+		Job->Request = Req;
+		Job->Slot = i;
+		Job->MsgText = Req->MsgText;
+		Job->Deadline = ev_time() + SCAN_TIMEOUT_BUDGET;
+		Req->Results[i].Backend = Job->Backend;
+
+		InitIOStruct(&Job->IO,
+			     Job,
+			     eSendReply,
+			     NULL,
+			     ScanJobDNSFail,
+			     ScanJobSendDone,
+			     ScanJobReadDone,
+			     ScanJobTerminate,
+			     ScanJobTerminate,
+			     ScanJobConnFail,
+			     ScanJobTimeout,
+			     ScanJobShutdown);
+		safestrncpy(((CitContext *)Job->IO.CitContext)->cs_host,
+			    Job->Backend->Name,
+			    sizeof(((CitContext *)Job->IO.CitContext)->cs_host));
+
+		if (QueueEventContext(&Job->IO, ScanJobStart) == eAbort) {
+			/* event loop is going down; nobody will scan this. */
+			ScanJobFinish(Job);
+		}
+	}
+
+	/* Now wait for the verdicts, but not forever. */
+	clock_gettime(CLOCK_REALTIME, &Deadline);
+	Deadline.tv_sec += SCAN_TIMEOUT_BUDGET;
+
+	pthread_mutex_lock(&Req->Mutex);
+	while (Req->Pending > 0) {
+		if (pthread_cond_timedwait(&Req->Cond, &Req->Mutex, &Deadline) == ETIMEDOUT)
+			break;
+	}
+	if (Req->Pending > 0) {
+		SCAN_syslog(LOG_WARNING,
+			    "%d of %d scanners didn't answer within %ds; passing message.\n",
+			    Req->Pending, nJobs, SCAN_TIMEOUT_BUDGET);
+	}
+	for (i = 0; i < nJobs; i++) {
+		Replies[i] = NULL;
+		Verdicts[i] = eScanUnknown;
+		if (Req->Results[i].Done) {
+			Verdicts[i] = Req->Results[i].Verdict;
+			Replies[i] = Req->Results[i].Reply;
+			Req->Results[i].Reply = NULL;
+		}
+	}
+	pthread_mutex_unlock(&Req->Mutex);
+
+	for (i = 0; i < nJobs; i++) {
+		retval += Req->Results[i].Backend->Apply(msg, Verdicts[i], Replies[i]);
+		FreeStrBuf(&Replies[i]);
+	}
+
+	ScanRequestRelease(Req);
+	return retval;
+}
+
+
+void ScanClientDebugEnable(const int n)
+{
+	ScanClientDebugEnabled = n;
+}
+
+CTDL_MODULE_INIT(scanclient)
+{
+	if (!threading)
+	{
+		ScanPool = NewHash(1, NULL);
+		CtdlRegisterDebugFlagHook(HKEY("scanclient"), ScanClientDebugEnable, &ScanClientDebugEnabled);
+		CtdlRegisterMessageHook(scan_message, EVT_SMTPSCAN);
+		CtdlRegisterEVCleanupHook(ScanPoolShutdown);
+	}
+
+	/* return our module name for the log */
+	return "scanclient";
+}
@@ -254,6 +254,18 @@ eNextState Terminate(AsyncIO *IO)
 }
 eNextState FinalizeMessageSend(SmtpOutMsg *Msg)
 {
+	switch (Msg->MyQEntry->Status) {
+	case 2:
+		SMTPQStats.Delivered ++;
+		break;
+	case 5:
+		SMTPQStats.PermFail ++;
+		break;
+	default:
+		SMTPQStats.TempFail ++;
+		break;
+	}
+
 	/* hand over to DB Queue */
 	return EventQueueDBOperation(&Msg->IO, FinalizeMessageSend_DB, 0);
 }
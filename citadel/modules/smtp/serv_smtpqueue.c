@@ -58,6 +58,7 @@
 #include <string.h>
 #include <limits.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <libcitadel.h>
@@ -88,7 +89,7 @@ struct CitContext smtp_queue_CC;
 pthread_mutex_t ActiveQItemsLock;
 HashList *ActiveQItems  = NULL;
 HashList *QItemHandlers = NULL;
-const unsigned short DefaultMXPort = 25;
+unsigned short DefaultMXPort = 25;
 int max_sessions_for_outbound_smtp = 500; /* how many sessions might be active till we stop adding more smtp jobs */
 int ndelay_count = 50; /* every n queued messages we will sleep... */
 int delay_msec = 5000; /* this many seconds. */
@@ -96,6 +97,7 @@ int delay_msec = 5000; /* this many seconds. */
 static const long MaxRetry = SMTP_RETRY_INTERVAL * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2 * 2;
 int MsgCount            = 0;
 int run_queue_now       = 0;	/* Set to 1 to ignore SMTP send retry times */
+SMTPQueueStats SMTPQStats;
 
 void RegisterQItemHandler(const char *Key, long Len, QItemHandler H)
 {
@@ -1111,7 +1113,13 @@ void smtp_do_procmsg(long msgnum, void *userdata) {
 void smtp_do_queue(void) {
 	int num_processed = 0;
 	int num_activated = 0;
+	struct rusage start, end;
 
+#ifdef RUSAGE_THREAD
+	getrusage(RUSAGE_THREAD, &start);
+#else
+	getrusage(RUSAGE_SELF, &start);
+#endif
 	pthread_setspecific(MyConKey, (void *)&smtp_queue_CC);
 	SMTPCM_syslog(LOG_DEBUG, "processing outbound queue");
 
@@ -1133,6 +1141,17 @@ void smtp_do_queue(void) {
 			     num_processed, num_activated);
 	}
 
+#ifdef RUSAGE_THREAD
+	getrusage(RUSAGE_THREAD, &end);
+#else
+	getrusage(RUSAGE_SELF, &end);
+#endif
+	SMTPQStats.QueueRuns ++;
+	SMTPQStats.QueueRunUsec +=
+		(end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000L +
+		(end.ru_utime.tv_usec - start.ru_utime.tv_usec) +
+		(end.ru_stime.tv_sec - start.ru_stime.tv_sec) * 1000000L +
+		(end.ru_stime.tv_usec - start.ru_stime.tv_usec);
 }
 
 
@@ -1196,6 +1215,18 @@ void cmd_smtp(char *argbuf) {
 		return;
 	}
 
+	else if (!strcasecmp(cmd, "stats")) {
+		cprintf("%d SMTP queue statistics\n", LISTING_FOLLOWS);
+		cprintf("delivered|%ld\n", SMTPQStats.Delivered);
+		cprintf("tempfail|%ld\n", SMTPQStats.TempFail);
+		cprintf("permfail|%ld\n", SMTPQStats.PermFail);
+		cprintf("queueruns|%ld\n", SMTPQStats.QueueRuns);
+		cprintf("queuerunusec|%ld\n", SMTPQStats.QueueRunUsec);
+		cprintf("dnsqueries|%ld\n", GetDNSQueryCount());
+		cprintf("000\n");
+		return;
+	}
+
 	else {
 		cprintf("%d Invalid command.\n", ERROR + ILLEGAL_VALUE);
 	}
@@ -1285,6 +1316,10 @@ CTDL_MODULE_INIT(smtp_queu)
 		if ((pstr != NULL) && (*pstr != '\0'))
 			delay_msec = atol(pstr) * 1000; /* this many seconds. */
 
+		pstr = getenv("CITSERVER_smtp_mx_port");
+		if ((pstr != NULL) && (*pstr != '\0'))
+			DefaultMXPort = atoi(pstr); /* talk to MX hosts here instead of port 25; for benchmarks. */
+
 		CtdlRegisterMessageHook(smtp_aftersave, EVT_AFTERSAVE);
 
 		CtdlFillSystemContext(&smtp_queue_CC, "SMTP_Send");
@@ -22,7 +22,7 @@
 /*****************************************************************************/
 
 #define MaxAttempts 15
-extern const unsigned short DefaultMXPort;
+extern unsigned short DefaultMXPort;
 
 typedef struct _mailq_entry {
 	StrBuf *Recipient;
@@ -84,3 +84,18 @@ StrBuf *SerializeQueueItem(OneQueItem *MyQItem);
 void    smtpq_do_bounce(OneQueItem *MyQItem, StrBuf *OMsgTxt, ParsedURL *Relay);
 
 int CheckQEntryIsBounce(MailQEntry *ThisItem);
+
+/*
+ * Counters for the "SMTP stats" command, so delivery throughput can be
+ * measured from the outside.  The delivery counters are only modified in
+ * the event loop, the queue run counters only by the queue run.
+ */
+typedef struct _smtp_queue_stats {
+	long Delivered;		/* recipients with status 2 */
+	long TempFail;		/* attempts ending in status 3 or 4 */
+	long PermFail;		/* recipients with status 5 */
+	long QueueRuns;
+	long QueueRunUsec;	/* CPU time spent running the queue */
+} SMTPQueueStats;
+
+extern SMTPQueueStats SMTPQStats;
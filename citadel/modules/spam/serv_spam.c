@@ -15,7 +15,7 @@
  * GNU General Public License for more details.
  */
 
-#define SPAMASSASSIN_PORT       "783"
+#define SPAMASSASSIN_PORT       783
 
 #include "sysdep.h"
 #include <stdlib.h>
@@ -58,83 +58,77 @@
 
 
 #include "ctdl_module.h"
+#include "../scanclient/scanclient.h"
 
 
 
 /*
- * Connect to the SpamAssassin server and scan a message.
+ * For users who have authenticated to this server we never want to
+ * apply spam filtering, because presumably they're trustworthy.
  */
-int spam_assassin(struct CtdlMessage *msg, recptypes *recp) {
-	int sock = (-1);
-	char sahosts[SIZ];
-	int num_sahosts;
-	char buf[SIZ];
-	int is_spam = 0;
-	int sa;
-	StrBuf *msgtext;
-	CitContext *CCC=CC;
-
-	/* For users who have authenticated to this server we never want to
-	 * apply spam filtering, because presumably they're trustworthy.
-	 */
-	if (CC->logged_in) return(0);
-
-	/* See if we have any SpamAssassin hosts configured */
-	num_sahosts = get_hosts(sahosts, "spamassassin");
-	if (num_sahosts < 1) return(0);
-
-	/* Try them one by one until we get a working one */
-        for (sa=0; sa<num_sahosts; ++sa) {
-                extract_token(buf, sahosts, sa, '|', sizeof buf);
-                syslog(LOG_INFO, "Connecting to SpamAssassin at <%s>\n", buf);
-                sock = sock_connect(buf, SPAMASSASSIN_PORT);
-                if (sock >= 0) syslog(LOG_DEBUG, "Connected!\n");
-        }
-
-	if (sock < 0) {
-		/* If the service isn't running, just pass the mail
-		 * through.  Potentially throwing away mails isn't good.
-		 */
-		return(0);
+int spam_filter(struct CtdlMessage *msg, recptypes *recp)
+{
+	return (CC->logged_in == 0);
+}
+
+/*
+ * spamd takes one request per connection; the Content-length
+ * tells it where the message ends, so we don't need to shut down
+ * our end of the connection.
+ */
+void spam_prepare(ScanJob *Job, int NewSession)
+{
+	StrBuf *Buf = Job->IO.SendBuf.Buf;
+
+	StrBufPrintf(Buf,
+		     "CHECK SPAMC/1.2\r\n"
+		     "Content-length: %ld\r\n"
+		     "\r\n",
+		     (long)StrLength(Job->MsgText));
+	StrBufAppendBuf(Buf, Job->MsgText, 0);
+}
+
+/*
+ * The answer looks like:
+ *   SPAMD/1.1 0 EX_OK
+ *   Spam: True ; 15 / 5
+ */
+eNextState spam_read_reply(ScanJob *Job)
+{
+	const char *buf = ChrPtr(Job->IO.IOBuf);
+
+	if (Job->State == 0) {
+		if (strncasecmp(buf, "SPAMD", 5)) {
+			syslog(LOG_WARNING, "spamd: unexpected answer: %s\n", buf);
+			return eTerminateConnection;
+		}
+		Job->State = 1;
+		return eReadMore;
 	}
 
-	CCC->SBuf.Buf = NewStrBuf();
-	CCC->sMigrateBuf = NewStrBuf();
-	CCC->SBuf.ReadWritePointer = NULL;
-
-	/* Command */
-	syslog(LOG_DEBUG, "Transmitting command\n");
-	sprintf(buf, "CHECK SPAMC/1.2\r\n\r\n");
-	sock_write(&sock, buf, strlen(buf));
-
-	/* Message */
-	CCC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
-	CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, 0);
-	msgtext = CC->redirect_buffer;
-	CC->redirect_buffer = NULL;
-
-	sock_write(&sock, SKEY(msgtext));
-	FreeStrBuf(&msgtext);
-
-	/* Close one end of the socket connection; this tells SpamAssassin
-	 * that we're done.
-	 */
-	if (sock != -1)
-		sock_shutdown(sock, SHUT_WR);
-	
-	/* Response */
-	syslog(LOG_DEBUG, "Awaiting response\n");
-        if (sock_getln(&sock, buf, sizeof buf) < 0) {
-                goto bail;
-        }
-        syslog(LOG_DEBUG, "<%s\n", buf);
-	if (strncasecmp(buf, "SPAMD", 5)) {
-		goto bail;
+	if (!strncasecmp(buf, "Spam:", 5)) {
+		Job->Reply = NewStrBufDup(Job->IO.IOBuf);
+		if (!strncasecmp(buf, "Spam: True", 10))
+			Job->Verdict = eScanReject;
+		else
+			Job->Verdict = eScanClean;
+		return eTerminateConnection;
 	}
-        if (sock_getln(&sock, buf, sizeof buf) < 0) {
-                goto bail;
-        }
-        syslog(LOG_DEBUG, "<%s\n", buf);
+
+	/* end of headers, but no verdict. */
+	if (*buf == '\0')
+		return eTerminateConnection;
+
+	return eReadMore;
+}
+
+int spam_apply(struct CtdlMessage *msg, eScanVerdict Verdict, StrBuf *Reply)
+{
+	char buf[SIZ];
+
+	if (Reply == NULL)
+		return(0);
+
         syslog(LOG_DEBUG, "c_spam_flag_only setting %d\n", CtdlGetConfigInt("c_spam_flag_only"));
         if (CtdlGetConfigInt("c_spam_flag_only")) {
 		int headerlen;
@@ -146,13 +140,13 @@ int spam_assassin(struct CtdlMessage *msg, recptypes *recp) {
 
                 syslog(LOG_DEBUG, "flag spam code used");
 
-                extract_token(sastatus, buf, 1, ' ', sizeof sastatus);
-                extract_token(sascore, buf, 3, ' ', sizeof sascore);
-                extract_token(saoutof, buf, 5, ' ', sizeof saoutof);
+                extract_token(sastatus, ChrPtr(Reply), 1, ' ', sizeof sastatus);
+                extract_token(sascore, ChrPtr(Reply), 3, ' ', sizeof sascore);
+                extract_token(saoutof, ChrPtr(Reply), 5, ' ', sizeof saoutof);
 
 		memcpy(buf, HKEY("X-Spam-Level: "));
 		cur = buf + 14;
-		for (numscore = atoi(sascore); numscore>0; numscore--)
+		for (numscore = atoi(sascore); (numscore > 0) && (cur - buf < 64); numscore--)
 			*(cur++) = '*';
 		*cur = '\0';
 
@@ -162,31 +156,35 @@ int spam_assassin(struct CtdlMessage *msg, recptypes *recp) {
 				     sastatus, sascore, saoutof);
 
 		CM_PrependToField(msg, eMesageText, buf, headerlen);
-
-	} else {
-                syslog(LOG_DEBUG, "reject spam code used");
-		if (!strncasecmp(buf, "Spam: True", 10)) {
-			is_spam = 1;
-		}
-
-		if (is_spam) {
-			CM_SetField(msg, eErrorMsg, HKEY("message rejected by spam filter"));
-		}
+		return(0);
 	}
 
-bail:	close(sock);
-	FreeStrBuf(&CCC->SBuf.Buf);
-	FreeStrBuf(&CCC->sMigrateBuf);
-	return(is_spam);
+        syslog(LOG_DEBUG, "reject spam code used");
+	if (Verdict == eScanReject) {
+		CM_SetField(msg, eErrorMsg, HKEY("message rejected by spam filter"));
+		return(1);
+	}
+	return(0);
 }
 
+static const ScanBackend SpamdBackend = {
+	"spamd",
+	"spamassassin",
+	SPAMASSASSIN_PORT,
+	0,
+	spam_filter,
+	spam_prepare,
+	spam_read_reply,
+	spam_apply
+};
+
 
 
 CTDL_MODULE_INIT(spam)
 {
 	if (!threading)
 	{
-		CtdlRegisterMessageHook(spam_assassin, EVT_SMTPSCAN);
+		CtdlRegisterScanBackend(&SpamdBackend);
 	}
 	
 	/* return our module name for the log */
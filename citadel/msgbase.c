@@ -15,6 +15,7 @@
 
 #include <stdio.h>
 #include <regex.h>
+#include <sched.h>
 #include <libcitadel.h>
 
 #include "md5.h"
@@ -1035,6 +1036,122 @@ void list_this_suff(char *name, char *filename, char *partnum, char *disp,
 }
 
 
+typedef int (*MimeWriteFunc)(const char *buf, size_t len, void *userdata);
+
+/*
+ * Count what a base64 encoded part decodes to, without decoding it.
+ */
+static size_t mime_base64_decoded_length(const char *content, size_t length)
+{
+	const unsigned char *p = (const unsigned char *) content;
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++i) {
+		if (isalnum(p[i]) || (p[i] == '+') || (p[i] == '/'))
+			++n;
+	}
+	return (n / 4) * 3 + ((n % 4 > 1) ? (n % 4) - 1 : 0);
+}
+
+
+/*
+ * The MIME parser hands us the parts undecoded (dont_decode); find out how long
+ * the decoded part is.  Encodings we can't stream are decoded into *decoded, and
+ * the caller has to free it.  Returns -1 for encodings we don't know.
+ */
+static long mime_part_length(char *content, size_t length, char *encoding, char **decoded)
+{
+	size_t bytes_decoded = 0;
+	int rc;
+
+	*decoded = NULL;
+	if (!strcasecmp(encoding, "base64")) {
+		return (long) mime_base64_decoded_length(content, length);
+	}
+	rc = mime_decode_now(content, length, encoding, decoded, &bytes_decoded);
+	if (rc < 0) {
+		return(-1);
+	}
+	if (rc == 0) {
+		return (long) length;
+	}
+	return (long) bytes_decoded;
+}
+
+
+/*
+ * Decode bytes [start, start + count) of a MIME part and hand them to Write()
+ * a block at a time, so we never need the whole decoded part in memory.
+ * Returns 0, or -1 if Write() failed.
+ */
+static int mime_stream_decoded(char *content, size_t length, char *encoding, char *decoded,
+			       size_t start, size_t count,
+			       MimeWriteFunc Write, void *userdata)
+{
+	IOBuffer Target;
+	vStreamT *SC;
+	const char *Err = NULL;
+	size_t pos = 0;
+	size_t this_block;
+	size_t from, to;
+	int rc = 0;
+
+	if (count == 0) {
+		return(0);
+	}
+
+	/* Not encoded, or already decoded: just pick the bytes. */
+	if ((decoded != NULL) || (strcasecmp(encoding, "base64"))) {
+		return Write(((decoded != NULL) ? decoded : content) + start, count, userdata);
+	}
+
+	SC = StrBufNewStreamContext(eBase64Decode, &Err);
+	if (SC == NULL) {
+		syslog(LOG_ERR, "mime_stream_decoded(): %s\n", (Err != NULL) ? Err : "");
+		return(-1);
+	}
+	memset(&Target, 0, sizeof(IOBuffer));
+	Target.Buf = NewStrBufPlain(NULL, SIZ * 4);
+
+	while ((length > 0) && (pos < start + count) && (rc == 0)) {
+		this_block = (length > SIZ * 4) ? SIZ * 4 : length;
+		StrBufStreamTranscode(eBase64Decode, &Target, NULL, content, this_block, SC,
+				      (this_block == length) ? STREAM_LAST : STREAM_MORE, &Err);
+		content += this_block;
+		length -= this_block;
+
+		/* Whatever of this block lies within the range goes out. */
+		from = (start > pos) ? start - pos : 0;
+		to = StrLength(Target.Buf);
+		if (pos + to > start + count) {
+			to = start + count - pos;
+		}
+		if (from < to) {
+			rc = Write(ChrPtr(Target.Buf) + from, to - from, userdata);
+		}
+		pos += StrLength(Target.Buf);
+		FlushStrBuf(Target.Buf);
+	}
+
+	FreeStrBuf(&Target.Buf);
+	StrBufDestroyStreamContext(eBase64Decode, &SC, &Err);
+	return(rc);
+}
+
+
+static int mime_write_file(const char *buf, size_t len, void *userdata)
+{
+	return (fwrite(buf, len, 1, (FILE *) userdata) == 1) ? 0 : -1;
+}
+
+
+static int mime_write_client(const char *buf, size_t len, void *userdata)
+{
+	return (client_write(buf, (int) len) < 0) ? -1 : 0;
+}
+
+
 /*
  * Callback function for mime parser that opens a section for downloading
  * we use serv_files function here: 
@@ -1045,6 +1162,8 @@ void mime_download(char *name, char *filename, char *partnum, char *disp,
 		   char *encoding, char *cbid, void *cbuserdata)
 {
 	int rv = 0;
+	long total;
+	char *decoded = NULL;
 	CitContext *CCC = MyContext();
 
 	/* Silently go away if there's already a download open. */
@@ -1055,17 +1174,25 @@ void mime_download(char *name, char *filename, char *partnum, char *disp,
 		(!IsEmptyStr(partnum) && (!strcasecmp(CCC->download_desired_section, partnum)))
 	||	(!IsEmptyStr(cbid) && (!strcasecmp(CCC->download_desired_section, cbid)))
 	) {
+		total = mime_part_length(content, length, encoding, &decoded);
+		if (total < 0) {
+			return;		/* unknown encoding; it's as if it wasn't there */
+		}
+
 		CCC->download_fp = tmpfile();
 		if (CCC->download_fp == NULL) {
 			MSG_syslog(LOG_EMERG, "mime_download(): Couldn't write: %s\n",
 				    strerror(errno));
 			cprintf("%d cannot open temporary file: %s\n",
 				ERROR + INTERNAL_ERROR, strerror(errno));
+			if (decoded != NULL) free(decoded);
 			return;
 		}
 	
-		rv = fwrite(content, length, 1, CCC->download_fp);
-		if (rv <= 0) {
+		rv = mime_stream_decoded(content, length, encoding, decoded, 0, total,
+					 mime_write_file, CCC->download_fp);
+		if (decoded != NULL) free(decoded);
+		if (rv < 0) {
 			MSG_syslog(LOG_EMERG, "mime_download(): Couldn't write: %s\n",
 				   strerror(errno));
 			cprintf("%d unable to write tempfile.\n",
@@ -1086,26 +1213,49 @@ void mime_download(char *name, char *filename, char *partnum, char *disp,
 /*
  * Callback function for mime parser that outputs a section all at once.
  * We can specify the desired section by part number *or* content-id.
+ * The part is decoded while it goes out, and if the client asked for a byte
+ * range (download_range_start / download_range_len), only that is sent; the
+ * total size and the offset are appended to the status line.
  */
 void mime_spew_section(char *name, char *filename, char *partnum, char *disp,
 		   void *content, char *cbtype, char *cbcharset, size_t length,
 		   char *encoding, char *cbid, void *cbuserdata)
 {
 	int *found_it = (int *)cbuserdata;
+	char *decoded = NULL;
+	long total;
+	long start;
+	long count;
 
 	if (
 		(!IsEmptyStr(partnum) && (!strcasecmp(CC->download_desired_section, partnum)))
 	||	(!IsEmptyStr(cbid) && (!strcasecmp(CC->download_desired_section, cbid)))
 	) {
+		total = mime_part_length(content, length, encoding, &decoded);
+		if (total < 0) {
+			return;		/* unknown encoding; it's as if it wasn't there */
+		}
+
+		start = CC->download_range_start;
+		if ((start < 0) || (start > total))
+			start = total;
+		count = total - start;
+		if ((CC->download_range_len > 0) && (CC->download_range_len < count))
+			count = CC->download_range_len;
+
 		*found_it = 1;
-		cprintf("%d %d|-1|%s|%s|%s\n",
+		cprintf("%d %d|-1|%s|%s|%s|%ld|%ld\n",
 			BINARY_FOLLOWS,
-			(int)length,
+			(int)count,
 			filename,
 			cbtype,
-			cbcharset
+			cbcharset,
+			total,
+			start
 		);
-		client_write(content, length);
+		mime_stream_decoded(content, length, encoding, decoded, start, count,
+				    mime_write_client, NULL);
+		if (decoded != NULL) free(decoded);
 	}
 }
 
@@ -2144,7 +2294,7 @@ int CtdlOutputPreLoadedMsg(
 		} else {
 			/* Parse the message text component */
 			mime_parser(CM_RANGE(TheMessage, eMesageText),
-				    *mime_download, NULL, NULL, NULL, 0);
+				    *mime_download, NULL, NULL, NULL, 1);
 			/* If there's no file open by this time, the requested
 			 * section wasn't found, so print an error
 			 */
@@ -2171,7 +2321,7 @@ int CtdlOutputPreLoadedMsg(
 			int found_it = 0;
 
 			mime_parser(CM_RANGE(TheMessage, eMesageText),
-				    *mime_spew_section, NULL, NULL, (void *)&found_it, 0);
+				    *mime_spew_section, NULL, NULL, (void *)&found_it, 1);
 			/* If section wasn't found, print an error
 			 */
 			if (!found_it) {
@@ -2347,6 +2497,262 @@ DONE:	/* now we're done */
 	return(om_ok);
 }
 
+
+/*
+ * Measure how many bytes a message takes when rendered as RFC822.  The
+ * rendered text is only counted by client_write() as it goes by, so we
+ * don't need a copy of the whole message (attachments and all) in memory.
+ */
+long CtdlMeasureRFC822Length(struct CtdlMessage *msg, int flags)
+{
+	struct CitContext *CCC = CC;
+	StrBuf *saved_redirect_buffer;
+	int saved_redirect_count_only;
+	long saved_redirect_count;
+	long len;
+
+	/* we may be nested inside of somebody else's redirect */
+	saved_redirect_buffer = CCC->redirect_buffer;
+	saved_redirect_count_only = CCC->redirect_count_only;
+	saved_redirect_count = CCC->redirect_count;
+
+	CCC->redirect_buffer = NULL;
+	CCC->redirect_count_only = 1;
+	CCC->redirect_count = 0;
+
+	CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, flags);
+	len = CCC->redirect_count;
+
+	CCC->redirect_buffer = saved_redirect_buffer;
+	CCC->redirect_count_only = saved_redirect_count_only;
+	CCC->redirect_count = saved_redirect_count;
+
+	return(len);
+}
+
+
+/*
+ * Return the RFC822 length of a message as POP3 and IMAP present it.
+ * Usually this comes straight out of the message's metadata record; if
+ * it isn't there (messages from older versions of the server), measure
+ * it and cache it for next time.  Returns 0 if there is no such message.
+ */
+long CtdlGetRFC822Length(long msgnum)
+{
+	struct MetaData smi;
+	struct CtdlMessage *msg;
+	long len;
+
+	GetMetaData(&smi, msgnum);
+	if (smi.meta_rfc822_length > 0L) {
+		return(smi.meta_rfc822_length);
+	}
+
+	msg = CtdlFetchMessage(msgnum, 1, 1);
+	if (msg == NULL) {
+		return(0L);
+	}
+	len = CtdlMeasureRFC822Length(msg, SUPPRESS_ENV_TO);
+	CM_Free(msg);
+
+	if (len > 0L) {
+		begin_critical_section(S_SUPPMSGMAIN);
+		GetMetaData(&smi, msgnum);
+		smi.meta_rfc822_length = len;
+		PutMetaData(&smi);
+		end_critical_section(S_SUPPMSGMAIN);
+	}
+	return(len);
+}
+
+
+/*
+ * Background job: fill in the RFC822 length of messages whose metadata
+ * doesn't have it yet, so POP3 and IMAP never have to render a message
+ * just to tell the client how big it is.
+ *
+ * Only messages that existed when the job first ran can lack it; anything
+ * newer was measured when it was submitted.  So the first run stores the
+ * highest message number there was at the time in "MMrfc822end", and
+ * "MMrfc822len" remembers how far we got.  Once the two meet there is
+ * nothing left to do, ever.
+ */
+struct rfc822len_backfill {
+	long lowest;		/* skip messages up to here (already checked) */
+	long highest;		/* ...and above here (measured at submit) */
+	long *msgnums;
+	int num_msgs;
+	int num_alloc;
+};
+
+static pthread_mutex_t BackfillMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t BackfillCond = PTHREAD_COND_INITIALIZER;
+static int BackfillRunning = 0;
+static int BackfillExit = 0;
+
+void rfc822len_backfill_room(struct ctdlroom *qrbuf, void *data)
+{
+	struct rfc822len_backfill *bf = (struct rfc822len_backfill *) data;
+	struct cdbdata *cdbfr;
+	long *msglist;
+	int num_msgs;
+	int i;
+
+	cdbfr = cdb_fetch(CDB_MSGLISTS, &qrbuf->QRnumber, sizeof(long));
+	if (cdbfr == NULL) {
+		return;
+	}
+	msglist = (long *) cdbfr->ptr;
+	num_msgs = cdbfr->len / sizeof(long);
+	for (i = 0; i < num_msgs; ++i) {
+		if ((msglist[i] <= bf->lowest) || (msglist[i] > bf->highest)) {
+			continue;
+		}
+		if (bf->num_msgs >= bf->num_alloc) {
+			bf->num_alloc = (bf->num_alloc == 0) ? 1024 : bf->num_alloc * 2;
+			bf->msgnums = realloc(bf->msgnums, bf->num_alloc * sizeof(long));
+		}
+		bf->msgnums[bf->num_msgs++] = msglist[i];
+	}
+	cdb_free(cdbfr);
+}
+
+/*
+ * Sleep between two slices; returns nonzero if we're asked to stop instead.
+ */
+static int rfc822len_backfill_pause(int seconds)
+{
+	struct timespec wakeup;
+	int stop;
+
+	wakeup.tv_sec = time(NULL) + seconds;
+	wakeup.tv_nsec = 0;
+	pthread_mutex_lock(&BackfillMutex);
+	if ((!BackfillExit) && (!server_shutting_down)) {
+		pthread_cond_timedwait(&BackfillCond, &BackfillMutex, &wakeup);
+	}
+	stop = ((BackfillExit) || (server_shutting_down));
+	pthread_mutex_unlock(&BackfillMutex);
+	return(stop);
+}
+
+/*
+ * The backfill gets a thread of its own, so it never holds up housekeeping.
+ * It works in slices of RFC822LEN_BACKFILL_TIME seconds, pausing
+ * RFC822LEN_BACKFILL_PAUSE seconds between them and yielding after every
+ * message, so it only gets the time nobody else wants.  Once everything is
+ * measured the thread exits; it isn't even started again after that.
+ */
+void *rfc822len_backfill_thread(void *arg)
+{
+	struct CitContext backfill_CC;
+	struct rfc822len_backfill bf;
+	struct MetaData smi;
+	time_t deadline;
+	long done_through;
+	int num_measured = 0;
+	int stop = 0;
+	int i, j;
+
+	CtdlFillSystemContext(&backfill_CC, "rfc822len");
+	become_session(&backfill_CC);
+
+	memset(&bf, 0, sizeof bf);
+	if (CtdlGetConfigStr("MMrfc822end") == NULL) {
+		CtdlSetConfigLong("MMrfc822end", CtdlGetConfigLong("MMhighest"));
+	}
+	bf.lowest = CtdlGetConfigLong("MMrfc822len");
+	bf.highest = CtdlGetConfigLong("MMrfc822end");
+	done_through = bf.highest;
+
+	if (bf.lowest < bf.highest) {
+		CtdlForEachRoom(rfc822len_backfill_room, &bf);
+	}
+
+	if (bf.num_msgs > 0) {
+		bf.num_msgs = sort_msglist(bf.msgnums, bf.num_msgs);
+		for (i = 0, j = 0; i < bf.num_msgs; ++i) {	/* purge dups */
+			if ((j == 0) || (bf.msgnums[i] != bf.msgnums[j - 1])) {
+				bf.msgnums[j++] = bf.msgnums[i];
+			}
+		}
+		bf.num_msgs = j;
+
+		deadline = time(NULL) + RFC822LEN_BACKFILL_TIME;
+		for (i = 0; i < bf.num_msgs; ++i) {
+			if ((BackfillExit) || (server_shutting_down)) {
+				stop = 1;
+			}
+			else if (time(NULL) >= deadline) {
+				/* remember how far we got, in case we're stopped while pausing */
+				CtdlSetConfigLong("MMrfc822len", bf.msgnums[i] - 1);
+				stop = rfc822len_backfill_pause(RFC822LEN_BACKFILL_PAUSE);
+				deadline = time(NULL) + RFC822LEN_BACKFILL_TIME;
+			}
+			if (stop) {
+				done_through = bf.msgnums[i] - 1;
+				break;
+			}
+			GetMetaData(&smi, bf.msgnums[i]);
+			if (smi.meta_rfc822_length <= 0L) {
+				CtdlGetRFC822Length(bf.msgnums[i]);
+				++num_measured;
+			}
+			sched_yield();
+		}
+		free(bf.msgnums);
+	}
+
+	if (num_measured > 0) {
+		syslog(LOG_DEBUG, "msgbase: measured RFC822 length of %d messages, done through %ld",
+		       num_measured, done_through);
+	}
+	if (done_through > bf.lowest) {
+		CtdlSetConfigLong("MMrfc822len", done_through);
+	}
+	if (done_through >= bf.highest) {
+		syslog(LOG_DEBUG, "msgbase: RFC822 length backfill is complete");
+	}
+
+	pthread_mutex_lock(&BackfillMutex);
+	BackfillRunning = 0;
+	pthread_mutex_unlock(&BackfillMutex);
+	return(NULL);
+}
+
+
+/*
+ * Start the backfill thread, unless there's nothing (left) to do.
+ */
+void CtdlStartRFC822LengthBackfill(void)
+{
+	if (	(CtdlGetConfigStr("MMrfc822end") != NULL)
+		&& (CtdlGetConfigLong("MMrfc822len") >= CtdlGetConfigLong("MMrfc822end"))
+	) {
+		return;
+	}
+	BackfillExit = 0;
+	BackfillRunning = 1;
+	CtdlThreadCreate(rfc822len_backfill_thread);
+}
+
+
+/*
+ * Stop the backfill thread; it saves how far it got and picks up from
+ * there next time the server starts.
+ */
+void CtdlStopRFC822LengthBackfill(void)
+{
+	pthread_mutex_lock(&BackfillMutex);
+	BackfillExit = 1;
+	pthread_cond_signal(&BackfillCond);
+	pthread_mutex_unlock(&BackfillMutex);
+
+	while (BackfillRunning) {
+		usleep(100000);
+	}
+}
+
 /*
  * Save one or more message pointers into a specified room
  * (Returns 0 for success, nonzero for failure)
@@ -2457,7 +2863,7 @@ int CtdlSaveMsgPointersInRoom(char *roomname, long newmsgidlist[], int num_newms
 
 	/* Update the highest-message pointer and unlock the room. */
 	CCC->room.QRhighest = highest_msg;
-	CtdlPutRoomLock(&CCC->room);
+	CtdlPutRoomHighestLock(&CCC->room);
 
 	/* Perform replication checks if necessary */
 	if ( (DoesThisRoomNeedEuidIndexing(&CCC->room)) && (do_repl_check) ) {
@@ -2732,6 +3138,357 @@ void ReplicationChecks(struct CtdlMessage *msg) {
 
 
 
+/*
+ * Local mail may go to thousands of users at once (think of an all-staff
+ * mail), and the sender is waiting for us.  So we resolve all recipients
+ * first, merge the pointers into MBOX_BATCH_SIZE mailboxes per room lock,
+ * adjust the reference count once, walk the session table once, and leave
+ * the EVT_AFTERUSRMBOXSAVE hooks to a thread of their own.
+ */
+#define MBOX_BATCH_SIZE 64
+
+typedef struct _mbox_target {
+	long usernum;
+	char fullname[USERNAME_SIZE];
+	char roomname[ROOMNAMELEN];
+	struct ctdlroom qrbuf;
+	int saved;
+} mbox_target;
+
+/*
+ * The mailbox save hooks queue, and the thread which works it off.
+ */
+static struct mbox_save_notify *msnq = NULL;
+static struct mbox_save_notify *msnq_tail = NULL;
+static pthread_mutex_t MboxSaveMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t MboxSaveCond = PTHREAD_COND_INITIALIZER;
+static int MboxSaveNotifierRunning = 0;
+static int MboxSaveNotifierExit = 0;		/* finish the queue, then exit */
+static int MboxSaveNotifierAbort = 0;		/* exit after the current recipient */
+
+static int mbox_target_cmp(const void *a, const void *b)
+{
+	const mbox_target *ta = (const mbox_target *) a;
+	const mbox_target *tb = (const mbox_target *) b;
+
+	if (ta->usernum < tb->usernum) return(-1);
+	if (ta->usernum > tb->usernum) return(1);
+	return(0);
+}
+
+/*
+ * Add msgid to the message list of the room in t->qrbuf.  Caller holds S_ROOMS.
+ */
+static int mbox_merge_pointer(mbox_target *t, long msgid)
+{
+	struct CitContext *CCC = CC;
+	struct cdbdata *cdbfr;
+	long *msglist = NULL;
+	int num_msgs = 0;
+	int i;
+
+	cdbfr = cdb_fetch(CDB_MSGLISTS, &t->qrbuf.QRnumber, sizeof(long));
+	if (cdbfr != NULL) {
+		msglist = (long *) cdbfr->ptr;
+		cdbfr->ptr = NULL;	/* we own this memory now */
+		num_msgs = cdbfr->len / sizeof(long);
+		cdb_free(cdbfr);
+	}
+
+	/* It is absolutely taboo to have more than one reference to the
+	 * same message in a room.
+	 */
+	for (i = 0; i < num_msgs; ++i) {
+		if (msglist[i] == msgid) {
+			free(msglist);
+			return(0);
+		}
+	}
+
+	msglist = realloc(msglist, sizeof(long) * (num_msgs + 1));
+	if (msglist == NULL) {
+		MSGM_syslog(LOG_ALERT, "ERROR: can't realloc message list!\n");
+		return(0);
+	}
+	msglist[num_msgs++] = msgid;
+
+	/* New messages normally are the highest ones; only sort if not. */
+	if ((num_msgs > 1) && (msglist[num_msgs - 2] > msgid)) {
+		num_msgs = sort_msglist(msglist, num_msgs);
+	}
+
+	cdb_store(CDB_MSGLISTS, &t->qrbuf.QRnumber, (int)sizeof(long),
+		  msglist, (int)(num_msgs * sizeof(long)));
+	t->qrbuf.QRhighest = msglist[num_msgs - 1];
+	free(msglist);
+	return(1);
+}
+
+/*
+ * Make a copy of the message in the recipients' mailboxes and bump the
+ * reference count.
+ */
+void CtdlSaveMsgInLocalMailboxes(struct CtdlMessage *msg, recptypes *recps, long msgid)
+{
+	struct CitContext *CCC = CC;
+	struct mbox_save_notify *nptr;
+	struct ctdluser userbuf;
+	struct CitContext *ptr;
+	mbox_target *targets;
+	mbox_target key;
+	char recipient[SIZ];
+	StrBuf *Delivered;
+	int ntargets = 0;
+	int nunknown = 0;
+	int nsaved = 0;
+	int ntokens;
+	int i, j, batch_end;
+
+	ntokens = num_tokens(recps->recp_local, '|');
+	targets = (mbox_target *) malloc(sizeof(mbox_target) * ntokens);
+	if (targets == NULL) {
+		MSGM_syslog(LOG_ALERT, "ERROR: can't allocate mailbox list!\n");
+		return;
+	}
+
+	/* Resolve them all first. */
+	for (i = 0; i < ntokens; ++i) {
+		extract_token(recipient, recps->recp_local, i, '|', sizeof recipient);
+		MSG_syslog(LOG_DEBUG, "Delivering private local mail to <%s>\n", recipient);
+		if (CtdlGetUser(&userbuf, recipient) == 0) {
+			memset(&targets[ntargets], 0, sizeof(mbox_target));
+			targets[ntargets].usernum = userbuf.usernum;
+			safestrncpy(targets[ntargets].fullname, userbuf.fullname,
+				    sizeof targets[ntargets].fullname);
+			CtdlMailboxName(targets[ntargets].roomname,
+					sizeof targets[ntargets].roomname,
+					&userbuf, MAILROOM);
+			++ntargets;
+		}
+		else {
+			MSG_syslog(LOG_DEBUG, "No user <%s>\n", recipient);
+			++nunknown;
+		}
+	}
+
+	/* Sorting by user number also lets us drop duplicates. */
+	qsort(targets, ntargets, sizeof(mbox_target), mbox_target_cmp);
+	for (i = 0, j = 0; i < ntargets; ++i) {
+		if ((j == 0) || (targets[j - 1].usernum != targets[i].usernum)) {
+			if (i != j) memcpy(&targets[j], &targets[i], sizeof(mbox_target));
+			++j;
+		}
+	}
+	ntargets = j;
+
+	/* Merge the pointers, one room lock per batch of mailboxes. */
+	for (i = 0; i < ntargets; i = batch_end) {
+		batch_end = ((i + MBOX_BATCH_SIZE) < ntargets) ? (i + MBOX_BATCH_SIZE) : ntargets;
+
+		begin_critical_section(S_ROOMS);
+		for (j = i; j < batch_end; ++j) {
+			if (CtdlGetRoom(&targets[j].qrbuf, targets[j].roomname) != 0) {
+				MSG_syslog(LOG_ERR, "No such room <%s>\n", targets[j].roomname);
+				continue;
+			}
+			if (mbox_merge_pointer(&targets[j], msgid)) {
+				CtdlPutRoomHighest(&targets[j].qrbuf);
+				targets[j].saved = 1;
+				++nsaved;
+			}
+		}
+		end_critical_section(S_ROOMS);
+
+		/* Submit these rooms for processing by hooks */
+		for (j = i; j < batch_end; ++j) {
+			if (targets[j].saved) {
+				PerformRoomHooks(&targets[j].qrbuf);
+			}
+		}
+	}
+
+	if (nsaved > 0) {
+		AdjRefCount(msgid, nsaved);
+	}
+	if (nunknown > 0) {
+		CtdlSaveMsgPointerInRoom(CtdlGetConfigStr("c_aideroom"), msgid, 0, msg);
+	}
+
+	/* One walk through the session table for all of them. */
+	begin_critical_section(S_SESSION_TABLE);
+	for (ptr = ContextList; ptr != NULL; ptr = ptr->next) {
+		key.usernum = ptr->user.usernum;
+		if (bsearch(&key, targets, ntargets, sizeof(mbox_target), mbox_target_cmp) != NULL) {
+			ptr->newmail += 1;
+		}
+	}
+	end_critical_section(S_SESSION_TABLE);
+
+	/* The hooks want to know about every recipient; hand them off. */
+	if (nsaved > 0) {
+		Delivered = NewStrBufPlain(NULL, nsaved * 32);
+		for (i = 0; i < ntargets; ++i) {
+			if (!targets[i].saved)
+				continue;
+			if (StrLength(Delivered) > 0)
+				StrBufAppendBufPlain(Delivered, HKEY("|"), 0);
+			StrBufAppendBufPlain(Delivered, targets[i].fullname, -1, 0);
+		}
+
+		nptr = (struct mbox_save_notify *) malloc(sizeof(struct mbox_save_notify));
+		memset(nptr, 0, sizeof(struct mbox_save_notify));
+		nptr->msg = CM_Duplicate(msg);
+		if (recps->bounce_to != NULL)
+			nptr->bounce_to = strdup(recps->bounce_to);
+		nptr->recipients = SmashStrBuf(&Delivered);
+
+		pthread_mutex_lock(&MboxSaveMutex);
+		if (msnq_tail != NULL)
+			msnq_tail->next = nptr;
+		else
+			msnq = nptr;
+		msnq_tail = nptr;
+		pthread_cond_signal(&MboxSaveCond);
+		pthread_mutex_unlock(&MboxSaveMutex);
+	}
+
+	free(targets);
+}
+
+static void MboxSaveFree(struct mbox_save_notify *nptr)
+{
+	CM_Free(nptr->msg);
+	free(nptr->bounce_to);
+	free(nptr->recipients);
+	free(nptr);
+}
+
+
+/*
+ * Run the EVT_AFTERUSRMBOXSAVE hooks for the mailboxes we've saved to,
+ * one recipient at a time, just like they expect it.
+ */
+static void MboxSaveNotify(struct mbox_save_notify *nptr)
+{
+	recptypes recps;
+	char recipient[SIZ];
+	int ntokens;
+	int i;
+
+	memset(&recps, 0, sizeof(recptypes));
+	recps.recptypes_magic = RECPTYPES_MAGIC;
+	recps.num_local = 1;
+	recps.recp_local = recipient;
+	recps.bounce_to = nptr->bounce_to;
+
+	ntokens = num_tokens(nptr->recipients, '|');
+	for (i = 0; (i < ntokens) && (!MboxSaveNotifierAbort); ++i) {
+		extract_token(recipient, nptr->recipients, i, '|', sizeof recipient);
+		PerformMessageHooks(nptr->msg, &recps, EVT_AFTERUSRMBOXSAVE);
+	}
+	if (i < ntokens) {
+		syslog(LOG_INFO, "mailbox hooks: skipping %d recipients of message %s",
+		       ntokens - i,
+		       CM_IsEmpty(nptr->msg, emessageId) ? "" : nptr->msg->cm_fields[emessageId]);
+	}
+	MboxSaveFree(nptr);
+}
+
+
+/*
+ * The mailbox save hooks (extnotify and friends) may take their time, like
+ * submitting messages of their own.  They get a thread of their own, so
+ * neither the sender nor the housekeeper has to wait for them.
+ */
+void *mboxsave_notifier_thread(void *arg)
+{
+	struct CitContext mboxsave_CC;
+	struct mbox_save_notify *nptr;
+
+	CtdlFillSystemContext(&mboxsave_CC, "mboxsave");
+	become_session(&mboxsave_CC);
+
+	pthread_mutex_lock(&MboxSaveMutex);
+	while (!MboxSaveNotifierAbort) {
+		if (msnq == NULL) {
+			struct timespec wakeup;
+
+			if (MboxSaveNotifierExit)
+				break;
+			wakeup.tv_sec = time(NULL) + 1;
+			wakeup.tv_nsec = 0;
+			pthread_cond_timedwait(&MboxSaveCond, &MboxSaveMutex, &wakeup);
+			continue;
+		}
+		nptr = msnq;
+		msnq = nptr->next;
+		if (msnq == NULL)
+			msnq_tail = NULL;
+		pthread_mutex_unlock(&MboxSaveMutex);
+
+		MboxSaveNotify(nptr);
+
+		pthread_mutex_lock(&MboxSaveMutex);
+	}
+	MboxSaveNotifierRunning = 0;
+	pthread_mutex_unlock(&MboxSaveMutex);
+
+	syslog(LOG_DEBUG, "mailbox hooks: notifier exiting");
+	return(NULL);
+}
+
+
+/*
+ * Start the mailbox save hooks thread.  Called once threading is up.
+ */
+void MboxSaveStartNotifier(void)
+{
+	MboxSaveNotifierExit = 0;
+	MboxSaveNotifierAbort = 0;
+	MboxSaveNotifierRunning = 1;
+	CtdlThreadCreate(mboxsave_notifier_thread);
+}
+
+
+/*
+ * Let the mailbox save hooks thread finish its queue, and wait for it.  If
+ * that takes longer than 30 seconds, the rest of the notifications are lost;
+ * the messages themselves are in the mailboxes already.
+ */
+void MboxSaveStopNotifier(void)
+{
+	int countdown = 30;
+
+	pthread_mutex_lock(&MboxSaveMutex);
+	MboxSaveNotifierExit = 1;
+	pthread_cond_signal(&MboxSaveCond);
+	pthread_mutex_unlock(&MboxSaveMutex);
+
+	while ((MboxSaveNotifierRunning) && (countdown-- > 0)) {
+		syslog(LOG_DEBUG, "Waiting %d seconds for the mailbox hooks to finish", countdown);
+		usleep(1000000);
+	}
+
+	if (MboxSaveNotifierRunning) {
+		MboxSaveNotifierAbort = 1;
+		while (MboxSaveNotifierRunning) {
+			usleep(100000);
+		}
+	}
+
+	/* whatever is left won't run anymore */
+	pthread_mutex_lock(&MboxSaveMutex);
+	while (msnq != NULL) {
+		struct mbox_save_notify *nptr = msnq;
+
+		msnq = nptr->next;
+		MboxSaveFree(nptr);
+	}
+	msnq_tail = NULL;
+	pthread_mutex_unlock(&MboxSaveMutex);
+}
+
+
 /*
  * Save a message to disk and submit it into the delivery system.
  */
@@ -2750,7 +3507,6 @@ long CtdlSubmitMsg(struct CtdlMessage *msg,	/* message to save */
 	const char *room;
 	long newmsgid;
 	const char *mptr = NULL;
-	struct ctdluser userbuf;
 	int a, i;
 	struct MetaData smi;
 	char *collected_addresses = NULL;
@@ -2889,25 +3645,50 @@ long CtdlSubmitMsg(struct CtdlMessage *msg,	/* message to save */
 	safestrncpy(smi.meta_content_type, content_type,
 		    sizeof smi.meta_content_type);
 
+	/*
+	 * Determine whether this message qualifies for journaling.
+	 */
+	if (!CM_IsEmpty(msg, eJournal)) {
+		qualified_for_journaling = 0;
+	}
+	else {
+		if (recps == NULL) {
+			qualified_for_journaling = CtdlGetConfigInt("c_journal_pubmsgs");
+		}
+		else if (recps->num_local + recps->num_ignet + recps->num_internet > 0) {
+			qualified_for_journaling = CtdlGetConfigInt("c_journal_email");
+		}
+		else {
+			qualified_for_journaling = CtdlGetConfigInt("c_journal_pubmsgs");
+		}
+	}
+
 	/*
 	 * Measure how big this message will be when rendered as RFC822.
-	 * We do this for two reasons:
-	 * 1. We need the RFC822 length for the new metadata record, so the
-	 *    POP and IMAP services don't have to calculate message lengths
-	 *    while the user is waiting (multiplied by potentially hundreds
-	 *    or thousands of messages).
-	 * 2. If journaling is enabled, we will need an RFC822 version of the
-	 *    message to attach to the journalized copy.
+	 * We need the RFC822 length for the new metadata record, so the
+	 * POP and IMAP services don't have to calculate message lengths
+	 * while the user is waiting (multiplied by potentially hundreds
+	 * or thousands of messages).
+	 *
+	 * If we are journaling, we need an RFC822 version of the message
+	 * to attach to the journalized copy anyway, so we render it into a
+	 * buffer and take the length from there.  Otherwise we only count
+	 * the bytes and don't keep a copy of the (possibly huge) message.
 	 */
 	if (CCC->redirect_buffer != NULL) {
 		MSGM_syslog(LOG_ALERT, "CCC->redirect_buffer is not NULL during message submission!\n");
 		abort();
 	}
-	CCC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
-	CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, QP_EADDR);
-	smi.meta_rfc822_length = StrLength(CCC->redirect_buffer);
-	saved_rfc822_version = CCC->redirect_buffer;
-	CCC->redirect_buffer = NULL;
+	if (qualified_for_journaling) {
+		CCC->redirect_buffer = NewStrBufPlain(NULL, SIZ);
+		CtdlOutputPreLoadedMsg(msg, MT_RFC822, HEADERS_ALL, 0, 1, QP_EADDR);
+		smi.meta_rfc822_length = StrLength(CCC->redirect_buffer);
+		saved_rfc822_version = CCC->redirect_buffer;
+		CCC->redirect_buffer = NULL;
+	}
+	else {
+		smi.meta_rfc822_length = CtdlMeasureRFC822Length(msg, QP_EADDR);
+	}
 
 	PutMetaData(&smi);
 
@@ -2963,30 +3744,8 @@ long CtdlSubmitMsg(struct CtdlMessage *msg,	/* message to save */
 	/* If this is private, local mail, make a copy in the
 	 * recipient's mailbox and bump the reference count.
 	 */
-	if ((recps != NULL) && (recps->num_local > 0))
-	{
-		char *pch;
-		int ntokens;
-
-		pch = recps->recp_local;
-		recps->recp_local = recipient;
-		ntokens = num_tokens(pch, '|');
-		for (i=0; i<ntokens; ++i)
-		{
-			extract_token(recipient, pch, i, '|', sizeof recipient);
-			MSG_syslog(LOG_DEBUG, "Delivering private local mail to <%s>\n", recipient);
-			if (CtdlGetUser(&userbuf, recipient) == 0) {
-				CtdlMailboxName(actual_rm, sizeof actual_rm, &userbuf, MAILROOM);
-				CtdlSaveMsgPointerInRoom(actual_rm, newmsgid, 0, msg);
-				CtdlBumpNewMailCounter(userbuf.usernum);
-				PerformMessageHooks(msg, recps, EVT_AFTERUSRMBOXSAVE);
-			}
-			else {
-				MSG_syslog(LOG_DEBUG, "No user <%s>\n", recipient);
-				CtdlSaveMsgPointerInRoom(CtdlGetConfigStr("c_aideroom"), newmsgid, 0, msg);
-			}
-		}
-		recps->recp_local = pch;
+	if ((recps != NULL) && (recps->num_local > 0)) {
+		CtdlSaveMsgInLocalMailboxes(msg, recps, newmsgid);
 	}
 
 	/* Perform "after save" hooks */
@@ -3020,36 +3779,12 @@ long CtdlSubmitMsg(struct CtdlMessage *msg,	/* message to save */
 		end_critical_section(S_ATBF);
 	}
 
-	/*
-	 * Determine whether this message qualifies for journaling.
-	 */
-	if (!CM_IsEmpty(msg, eJournal)) {
-		qualified_for_journaling = 0;
-	}
-	else {
-		if (recps == NULL) {
-			qualified_for_journaling = CtdlGetConfigInt("c_journal_pubmsgs");
-		}
-		else if (recps->num_local + recps->num_ignet + recps->num_internet > 0) {
-			qualified_for_journaling = CtdlGetConfigInt("c_journal_email");
-		}
-		else {
-			qualified_for_journaling = CtdlGetConfigInt("c_journal_pubmsgs");
-		}
-	}
-
 	/*
 	 * Do we have to perform journaling?  If so, hand off the saved
-	 * RFC822 version will be handed off to the journaler for background
-	 * submit.  Otherwise, we have to free the memory ourselves.
+	 * RFC822 version to the journaler for background submit.
 	 */
 	if (saved_rfc822_version != NULL) {
-		if (qualified_for_journaling) {
-			JournalBackgroundSubmit(msg, saved_rfc822_version, recps);
-		}
-		else {
-			FreeStrBuf(&saved_rfc822_version);
-		}
+		JournalBackgroundSubmit(msg, saved_rfc822_version, recps);
 	}
 
 	if ((recps != NULL) && (recps->bounce_to == bounce_to))
@@ -3765,7 +4500,7 @@ int CtdlDeleteMessages(const char *room_name,		/* which room */
 		else
 			qrbuf.QRhighest = 0;
 	}
-	CtdlPutRoomLock(&qrbuf);
+	CtdlPutRoomHighestLock(&qrbuf);
 
 	/* Go through the messages we pulled out of the index, and decrement
 	 * their reference counts by 1.  If this is the only room the message
@@ -74,6 +74,22 @@ struct addresses_to_be_filed {
 
 extern struct addresses_to_be_filed *atbf;
 
+/*
+ * Messages saved to local mailboxes, for which the EVT_AFTERUSRMBOXSAVE
+ * hooks still have to run.  A thread of their own does this for us, so
+ * the sender doesn't have to wait for it.
+ */
+struct mbox_save_notify {
+	struct mbox_save_notify *next;
+	struct CtdlMessage *msg;	/* our own copy */
+	char *bounce_to;
+	char *recipients;		/* '|' separated local user names */
+};
+
+void CtdlSaveMsgInLocalMailboxes(struct CtdlMessage *msg, recptypes *recps, long msgid);
+void MboxSaveStartNotifier(void);
+void MboxSaveStopNotifier(void);
+
 int GetFieldFromMnemonic(eMsgField *f, const char* c);
 
 
@@ -189,6 +205,15 @@ int CtdlOutputPreLoadedMsg(struct CtdlMessage *,
 			   int crlf,		/* 0=LF, 1=CRLF */
 			   int flags		/* should the bessage be exported clean? */
 );
+long CtdlMeasureRFC822Length(struct CtdlMessage *msg, int flags);
+long CtdlGetRFC822Length(long msgnum);
+
+/* the RFC822 length backfill works this many seconds at a time... */
+#define RFC822LEN_BACKFILL_TIME		1
+/* ...then leaves the server alone for this many */
+#define RFC822LEN_BACKFILL_PAUSE	5
+void CtdlStartRFC822LengthBackfill(void);
+void CtdlStopRFC822LengthBackfill(void);
 
 
 /* values for which_set */
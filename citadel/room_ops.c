@@ -24,6 +24,46 @@
 
 struct floor *floorcache[MAXFLOORS];
 
+/*
+ * Change counters for room lists.  Clients which cache the output of LKRA,
+ * LFLR and friends ask for them with RLST and only re-list when they moved.
+ * Changes to rooms and floors bump the room counter; visits bump one of
+ * VISIT_GENERATIONS per-user counters.  Users sharing a slot only cost each
+ * other a needless reload.
+ *
+ * New or deleted messages don't bump the room counter, or it would move with
+ * every message anybody posts anywhere.  They do change the "new messages"
+ * flag of the room in everybody's LKRA, though, so clients have to re-read the
+ * list on pages which show it.  New mail also bumps the mailbox owner's visit
+ * counter, so the owner's cached lists notice it right away.
+ */
+#define VISIT_GENERATIONS 256
+static pthread_mutex_t RoomListGenerationMutex = PTHREAD_MUTEX_INITIALIZER;
+static long RoomListGeneration = 0;
+static long VisitGeneration[VISIT_GENERATIONS];
+
+void CtdlBumpRoomListGeneration(void)
+{
+	pthread_mutex_lock(&RoomListGenerationMutex);
+	++RoomListGeneration;
+	pthread_mutex_unlock(&RoomListGenerationMutex);
+}
+
+void CtdlBumpVisitGeneration(long usernum)
+{
+	pthread_mutex_lock(&RoomListGenerationMutex);
+	++VisitGeneration[labs(usernum) % VISIT_GENERATIONS];
+	pthread_mutex_unlock(&RoomListGenerationMutex);
+}
+
+void CtdlGetRoomListGeneration(long usernum, long *roomgen, long *visitgen)
+{
+	pthread_mutex_lock(&RoomListGenerationMutex);
+	*roomgen = RoomListGeneration;
+	*visitgen = VisitGeneration[labs(usernum) % VISIT_GENERATIONS];
+	pthread_mutex_unlock(&RoomListGenerationMutex);
+}
+
 /* 
  * Determine whether the currently logged in session has permission to read
  * messages in the current room.
@@ -410,10 +450,10 @@ int CtdlGetRoomLock(struct ctdlroom *qrbuf, const char *room_name)
 
 
 /*
- * b_putroom()  -  back end to putroom() and b_deleteroom()
+ * b_storeroom()  -  write or delete a room record, and nothing else
  *              (if the supplied buffer is NULL, delete the room record)
  */
-void b_putroom(struct ctdlroom *qrbuf, char *room_name)
+static void b_storeroom(struct ctdlroom *qrbuf, char *room_name)
 {
 	char lowercase_name[ROOMNAMELEN];
 	char *aptr, *bptr;
@@ -439,6 +479,17 @@ void b_putroom(struct ctdlroom *qrbuf, char *room_name)
 }
 
 
+/*
+ * b_putroom()  -  back end to putroom() and b_deleteroom()
+ *              (if the supplied buffer is NULL, delete the room record)
+ */
+void b_putroom(struct ctdlroom *qrbuf, char *room_name)
+{
+	b_storeroom(qrbuf, room_name);
+	CtdlBumpRoomListGeneration();
+}
+
+
 /* 
  * CtdlPutRoom()  -  store room data to disk
  */
@@ -465,6 +516,30 @@ void CtdlPutRoomLock(struct ctdlroom *qrbuf)
 }
 
 
+/*
+ * CtdlPutRoomHighest()  -  store room data to disk after a change to its message list.
+ *                          This leaves the room list counter alone (see above); only
+ *                          the owner of a mailbox gets told.
+ */
+void CtdlPutRoomHighest(struct ctdlroom *qrbuf)
+{
+	b_storeroom(qrbuf, qrbuf->QRname);
+	if (qrbuf->QRflags & QR_MAILBOX) {
+		CtdlBumpVisitGeneration(atol(qrbuf->QRname));
+	}
+}
+
+
+/*
+ * CtdlPutRoomHighestLock()  -  same as CtdlPutRoomHighest() but unlocks the record
+ */
+void CtdlPutRoomHighestLock(struct ctdlroom *qrbuf)
+{
+	CtdlPutRoomHighest(qrbuf);
+	end_critical_section(S_ROOMS);
+}
+
+
 /*
  * CtdlGetFloorByName()  -  retrieve the number of the named floor
  * return < 0 if not found else return floor number
@@ -609,6 +684,7 @@ void CtdlPutFloor(struct floor *flbuf, int floor_num)
 
 	cdb_store(CDB_FLOORTAB, &floor_num, sizeof(int),
 		  flbuf, sizeof(struct floor));
+	CtdlBumpRoomListGeneration();
 }
 
 
@@ -702,6 +778,13 @@ void delete_msglist(struct ctdlroom *whichroom)
 		/* Go ahead and delete it */
 		cdb_delete(CDB_MSGLISTS, &whichroom->QRnumber, sizeof(long));
 	}
+
+	/* Same for the calendar index, which most rooms don't have */
+        cdbml = cdb_fetch(CDB_CALINDEX, &whichroom->QRnumber, sizeof(long));
+        if (cdbml != NULL) {
+        	cdb_free(cdbml);
+		cdb_delete(CDB_CALINDEX, &whichroom->QRnumber, sizeof(long));
+	}
 }
 
 
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Run the outbound SMTP benchmark (utils/smtpbench.c) against a throwaway
+# citserver in a scratch directory, so the numbers are reproducible on
+# one box.  Run from the top of a built citadel tree; all arguments are
+# passed on to smtpbench, e.g.:
+#
+#   scripts/smtpbench.sh -n 1000 -m 3 -x 2 -l 20 -t 5 -f 1
+#
+# The server asks smtpbench's stub DNS server on 127.0.0.1:${DNS_PORT} for
+# everything, and delivers to MX hosts on port ${MX_PORT}; set those in the
+# environment to change them, not with -d and -p.
+#
+
+CITDIR=`pwd`
+DATADIR=`mktemp -d ${TMPDIR:-/tmp}/smtpbench.XXXXXX`
+SERVER_PID=
+DNS_PORT=${DNS_PORT:-5353}
+MX_PORT=${MX_PORT:-2525}
+
+if [ ! -x ${CITDIR}/citserver ] || [ ! -x ${CITDIR}/smtpbench ]; then
+	echo "please run 'make citserver smtpbench' first." >&2
+	exit 1
+fi
+
+# citserver drops root privileges unless told not to.
+if [ `id -u` = 0 ]; then
+	SERVER_OPTS="-r"
+fi
+
+cleanup() {
+	if [ -n "${SERVER_PID}" ]; then
+		kill ${SERVER_PID} 2>/dev/null
+		wait ${SERVER_PID} 2>/dev/null
+	fi
+	rm -rf ${DATADIR}
+}
+trap cleanup EXIT INT TERM
+
+start_server() {
+	CITSERVER_dns_server=127.0.0.1:${DNS_PORT} CITSERVER_smtp_mx_port=${MX_PORT} \
+		${CITDIR}/citserver -h ${DATADIR} ${SERVER_OPTS} >${DATADIR}/citserver.log 2>&1 &
+	SERVER_PID=$!
+
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+		if ${CITDIR}/sendcommand -h ${DATADIR} NOOP >/dev/null 2>&1; then
+			return 0
+		fi
+		sleep 1
+	done
+	echo "citserver didn't come up; see ${DATADIR}/citserver.log" >&2
+	exit 1
+}
+
+stop_server() {
+	${CITDIR}/sendcommand -h ${DATADIR} "DOWN" >/dev/null 2>&1
+	wait ${SERVER_PID} 2>/dev/null
+	SERVER_PID=
+}
+
+# First start creates the database; we only talk to the admin socket,
+# so switch off all TCP services and restart, so we don't need to be
+# able to bind them and nothing else interferes with our measurements.
+start_server
+for PORT in c_port_number c_smtp_port c_pop3_port c_imap_port c_msa_port \
+	    c_smtps_port c_pop3s_port c_imaps_port c_pftcpdict_port \
+	    c_managesieve_port c_xmpp_c2s_port c_xmpp_s2s_port c_nntp_port \
+	    c_nntps_port
+do
+	${CITDIR}/sendcommand -h ${DATADIR} "CONF PUTVAL|${PORT}|-1" >/dev/null 2>&1
+done
+stop_server
+start_server
+
+${CITDIR}/smtpbench -h ${DATADIR} -P ${SERVER_PID} -d ${DNS_PORT} -p ${MX_PORT} "$@"
+RESULT=$?
+stop_server
+exit ${RESULT}
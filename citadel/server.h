@@ -152,7 +152,6 @@ enum {
 	S_PUBLIC_CLIENTS,
 	S_FLOORCACHE,
 	S_ATBF,
-	S_JOURNAL_QUEUE,
 	S_RPLIST,
 	S_SIEVELIST,
 	S_CHKPWD,
@@ -212,6 +211,7 @@ enum {
 	CDB_USERSBYNUMBER,	/* index of users by number      */
 	CDB_OPENID,		/* associates OpenIDs with users */
 	CDB_CONFIG,		/* system configuration database */
+	CDB_CALINDEX,		/* calendar event time ranges    */
 	MAXCDB			/* total number of CDB's defined */
 };
 
@@ -419,6 +419,10 @@ int client_write(const char *buf, int nbytes)
 	}
 #endif
 //	flush_client_inbuf();
+	if (Ctx->redirect_count_only) {
+		Ctx->redirect_count += nbytes;
+		return 0;
+	}
 	if (Ctx->redirect_buffer != NULL) {
 		StrBufAppendBufPlain(Ctx->redirect_buffer,
 				     buf, nbytes, 0);
@@ -22,6 +22,8 @@
 #include "config.h"
 #include "context.h"
 #include "threads.h"
+#include "journaling.h"
+#include "msgbase.h"
 
 
 int num_workers = 0;				/* Current number of worker threads */
@@ -165,6 +167,15 @@ void go_threading(void)
 	/* Second call to module init functions now that threading is up */
 	initialise_modules(1);
 
+	/* Journaling gets its own thread so it doesn't slow down the workers */
+	JournalStartWriter();
+
+	/* So do the mailbox save hooks */
+	MboxSaveStartNotifier();
+
+	/* ...and the RFC822 length backfill, which only runs when nobody else wants the time */
+	CtdlStartRFC822LengthBackfill();
+
 	/* Begin with one worker thread.  We will expand the pool if necessary */
 	CtdlThreadCreate(worker_thread);
 
@@ -199,4 +210,8 @@ void go_threading(void)
 		);
 		usleep(1000000);
 	}
+
+	CtdlStopRFC822LengthBackfill();
+	MboxSaveStopNotifier();		/* the hooks may still journal what they send */
+	JournalStopWriter();
 }
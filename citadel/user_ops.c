@@ -23,6 +23,7 @@
 #include "citadel_ldap.h"
 #include "ctdl_module.h"
 #include "user_ops.h"
+#include "room_ops.h"
 #include "internet_addressing.h"
 
 /* These pipes are used to talk to the chkpwd daemon, which is forked during startup */
@@ -103,7 +104,7 @@ void CtdlPutUser(struct ctdluser *usbuf)
 	cdb_store(CDB_USERS,
 		  usernamekey, strlen(usernamekey),
 		  usbuf, sizeof(struct ctdluser));
-
+	CtdlBumpVisitGeneration(usbuf->usernum);
 }
 
 void CtdlPutCurrentUserLock()
@@ -227,6 +228,7 @@ void put_visit(visit *newvisit)
 	cdb_store(CDB_VISIT, IndexBuf, IndexLen,
 		  newvisit, sizeof(visit)
 	);
+	CtdlBumpVisitGeneration(newvisit->v_usernum);
 }
 
 
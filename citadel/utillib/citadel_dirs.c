@@ -59,6 +59,7 @@ char file_citadel_urlshorteners[PATH_MAX]="";
 char file_lmtp_socket[PATH_MAX]="";
 char file_lmtp_unfiltered_socket[PATH_MAX]="";
 char file_arcq[PATH_MAX]="";
+char file_jnlq[PATH_MAX]="";
 char file_citadel_socket[PATH_MAX]="";
 char file_citadel_admin_socket[PATH_MAX]="";
 char file_mail_aliases[PATH_MAX]="";
@@ -202,6 +203,11 @@ void calc_dirs_n_files(int relh, int home, const char *relhome, char  *ctdldir,
 			 "%srefcount_adjustments.dat",
 			 ctdl_autoetc_dir);
 	StripSlashes(file_arcq, 0);
+	snprintf(file_jnlq, 
+			 sizeof file_jnlq,
+			 "%sjournal_queue.dat",
+			 ctdl_autoetc_dir);
+	StripSlashes(file_jnlq, 0);
 	snprintf(file_citadel_control, 
 			 sizeof file_citadel_control,
 			 "%scitadel.control",
@@ -335,6 +341,7 @@ void calc_dirs_n_files(int relh, int home, const char *relhome, char  *ctdldir,
 	DBG_PRINT(file_lmtp_socket);
 	DBG_PRINT(file_lmtp_unfiltered_socket);
 	DBG_PRINT(file_arcq);
+	DBG_PRINT(file_jnlq);
 	DBG_PRINT(file_citadel_socket);
 	DBG_PRINT(file_mail_aliases);
 	DBG_PRINT(file_pid_file);
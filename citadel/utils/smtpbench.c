@@ -0,0 +1,940 @@
+/*
+ * Outbound SMTP delivery benchmark.
+ *
+ * We can't measure the SMTP queue against real remote MTAs, so this
+ * program plays all of them, and the DNS too: it opens one or more fake
+ * MX hosts on loopback addresses, and a stub DNS server which hands out
+ * MX records pointing at them.  It then injects n messages with m internet
+ * recipients each through the admin socket, and waits for the outbound
+ * queue to deliver them.
+ *
+ * The fake MX hosts can be told to answer slowly (-l), and to refuse a
+ * percentage of recipients temporarily (-t, 4xx) or permanently (-f, 5xx).
+ *
+ * Each message carries the time it was submitted, so when it arrives at
+ * one of our sinks we know its end-to-end delivery latency.  The sinks
+ * keep track of every recipient's fate, so a recipient that is deferred
+ * and then retried is counted once, by its final outcome.  When all
+ * recipients have either been accepted or permanently refused by a sink
+ * (or the -w timeout is over) we print deliveries/sec, p50/p99 latency,
+ * and what the server tells us via "SMTP stats" about the CPU time spent
+ * in queue runs and the number of DNS lookups.
+ *
+ * The recipients are spread over one domain per fake MX host, and there
+ * are no smarthosts, so the server resolves the MX records of each domain
+ * and the addresses of its MX hosts, as it does for real mail.  For that,
+ * the server has to be started with
+ *   CITSERVER_dns_server=127.0.0.1:<-d port>  (ask our stub for everything)
+ *   CITSERVER_smtp_mx_port=<-p port>          (MX hosts listen there, not on 25)
+ * in its environment.  The fake MX hosts listen on the -H address and the
+ * ones following it; Linux routes all of 127.0.0.0/8 to the loopback, other
+ * systems may need aliases for them.
+ *
+ * This modifies the server's internet configuration and creates a user,
+ * so only run it against a scratch server; see scripts/smtpbench.sh.
+ *
+ * Copyright (c) 2016 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <string.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "citadel.h"
+#include "include/citadel_dirs.h"
+#include <libcitadel.h>
+
+#define BENCH_USER	"smtpbench"
+#define BENCH_PASS	"smtpbench"
+#define BENCH_STAMP	"SMTPBENCH-STAMP "
+
+static int n = 100;		/* messages to inject */
+static int m = 1;		/* recipients per message */
+static int nmx = 2;		/* fake MX hosts */
+static int base_port = 2525;	/* fake MX hosts listen on this port */
+static int dns_port = 5353;	/* our stub DNS server listens here, on 127.0.0.1 */
+static int latency = 0;		/* ms before each sink reply */
+static int tempfail = 0;	/* percentage of RCPTs answered with 4xx */
+static int permfail = 0;	/* percentage of RCPTs answered with 5xx */
+static int timeout = 300;	/* seconds to wait for the queue to drain */
+static int server_pid = 0;	/* if given, we report the server's CPU time */
+static char *mx_host = "127.0.0.2";	/* first fake MX host; the others follow */
+
+#define BENCH_DOMAIN	"smtpbench.test"
+
+int serv_sock = (-1);
+
+/* what happened to a recipient so far */
+enum {
+	RCPT_PENDING,		/* not seen by a sink yet */
+	RCPT_DEFERRED,		/* got a 4xx, waiting for the retry */
+	RCPT_ACCEPTED,		/* final: the message was accepted for it */
+	RCPT_REFUSED		/* final: got a 5xx */
+};
+
+/* everything below is written by the sink threads */
+pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *rcpt_state = NULL;		/* one per recipient, indexed msgnum * m + i */
+static long sink_accepted = 0;		/* recipients in RCPT_ACCEPTED */
+static long sink_permfailed = 0;	/* recipients in RCPT_REFUSED */
+static long sink_deferred = 0;		/* recipients that saw at least one 4xx */
+static long sink_4xx = 0;		/* 4xx replies, one per attempt */
+static long sink_duplicates = 0;	/* acceptances for already final recipients */
+static long sink_connections = 0;
+static long dns_mx_queries = 0;		/* and these by the DNS stub */
+static long dns_a_queries = 0;
+static long dns_other_queries = 0;
+static long long *latencies = NULL;	/* usec, one per accepted recipient */
+static long nlatencies = 0;
+
+
+static long long now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+
+/*****************************************************************************/
+/*                     CITADEL SERVER CONNECTION                             */
+/*****************************************************************************/
+
+int uds_connectsock(char *sockpath)
+{
+	int s;
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, sockpath, sizeof addr.sun_path);
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0) {
+		fprintf(stderr, "smtpbench: Can't create socket: %s\n", strerror(errno));
+		exit(3);
+	}
+
+	if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "smtpbench: can't connect: %s\n", strerror(errno));
+		close(s);
+		exit(3);
+	}
+
+	return s;
+}
+
+/*
+ * input binary data from socket
+ */
+void serv_read(char *buf, int bytes)
+{
+	int len, rlen;
+
+	len = 0;
+	while (len < bytes) {
+		rlen = read(serv_sock, &buf[len], bytes - len);
+		if (rlen < 1) {
+			fprintf(stderr, "smtpbench: server went away\n");
+			exit(3);
+		}
+		len = len + rlen;
+	}
+}
+
+/*
+ * send binary to server
+ */
+void serv_write(const char *buf, int nbytes)
+{
+	int bytes_written = 0;
+	int retval;
+
+	while (bytes_written < nbytes) {
+		retval = write(serv_sock, &buf[bytes_written], nbytes - bytes_written);
+		if (retval < 1) {
+			fprintf(stderr, "smtpbench: server went away\n");
+			exit(3);
+		}
+		bytes_written = bytes_written + retval;
+	}
+}
+
+/*
+ * input string from socket - implemented in terms of serv_read()
+ */
+void serv_gets(char *buf)
+{
+	int i;
+
+	for (i = 0;; i++) {
+		serv_read(&buf[i], 1);
+		if (buf[i] == '\n' || i == (SIZ-1))
+			break;
+	}
+	if (i == (SIZ-1)) {
+		while (buf[i] != '\n') {
+			serv_read(&buf[i], 1);
+		}
+	}
+	buf[i] = 0;
+}
+
+void serv_puts(const char *buf)
+{
+	serv_write(buf, strlen(buf));
+	serv_write("\n", 1);
+}
+
+/*
+ * send a command, return the first digit of the answer.
+ */
+int serv_cmd(char *buf, const char *cmd)
+{
+	serv_puts(cmd);
+	serv_gets(buf);
+	return buf[0] - '0';
+}
+
+typedef struct _server_stats {
+	long delivered;		/* recipients */
+	long tempfail;		/* attempts */
+	long permfail;		/* recipients */
+	long queueruns;
+	long queuerunusec;
+	long dnsqueries;
+} server_stats;
+
+void get_server_stats(server_stats *s)
+{
+	char buf[SIZ];
+	char key[64];
+	long value;
+
+	memset(s, 0, sizeof(server_stats));
+	if (serv_cmd(buf, "SMTP stats") != 1) {
+		fprintf(stderr, "smtpbench: SMTP stats: %s\n", buf);
+		return;
+	}
+	while (serv_gets(buf), strcmp(buf, "000") != 0) {
+		extract_token(key, buf, 0, '|', sizeof key);
+		value = extract_long(buf, 1);
+		if (!strcasecmp(key, "delivered")) s->delivered = value;
+		else if (!strcasecmp(key, "tempfail")) s->tempfail = value;
+		else if (!strcasecmp(key, "permfail")) s->permfail = value;
+		else if (!strcasecmp(key, "queueruns")) s->queueruns = value;
+		else if (!strcasecmp(key, "queuerunusec")) s->queuerunusec = value;
+		else if (!strcasecmp(key, "dnsqueries")) s->dnsqueries = value;
+	}
+}
+
+/*
+ * user + system time of the server process in usec, from /proc
+ */
+long long get_server_cpu(void)
+{
+	char path[PATH_MAX];
+	char buf[SIZ];
+	char *ptr;
+	unsigned long utime = 0, stime = 0;
+	FILE *fp;
+	int i;
+
+	if (server_pid <= 0)
+		return 0;
+
+	snprintf(path, sizeof path, "/proc/%d/stat", server_pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+	if (fgets(buf, sizeof buf, fp) == NULL) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	/* the process name may contain blanks; skip it. fields 14 + 15 are what we want. */
+	ptr = strrchr(buf, ')');
+	if (ptr == NULL)
+		return 0;
+	for (i = 2; (i < 14) && (ptr != NULL); i++)
+		ptr = strchr(ptr + 1, ' ');
+	if ((ptr == NULL) || (sscanf(ptr, " %lu %lu", &utime, &stime) != 2))
+		return 0;
+
+	return (long long)(utime + stime) * 1000000LL / sysconf(_SC_CLK_TCK);
+}
+
+/*
+ * create our user, make the server deliver straight to the MX hosts, and go to our mailbox.
+ */
+void setup_server(void)
+{
+	char buf[SIZ];
+
+	serv_cmd(buf, "CREU " BENCH_USER "|" BENCH_PASS);
+	if (serv_cmd(buf, "ASUP " BENCH_USER "|" BENCH_PASS "|0|0|0|6") != 2) {
+		fprintf(stderr, "smtpbench: ASUP: %s\n", buf);
+		exit(2);
+	}
+	serv_cmd(buf, "USER " BENCH_USER);
+	if (serv_cmd(buf, "PASS " BENCH_PASS) != 2) {
+		fprintf(stderr, "smtpbench: can't log in: %s\n", buf);
+		exit(2);
+	}
+
+	/* no smarthosts, so the queue has to look up MX records */
+	if (serv_cmd(buf, "CONF PUTSYS|application/x-citadel-internet-config") != 4) {
+		fprintf(stderr, "smtpbench: CONF PUTSYS: %s\n", buf);
+		exit(2);
+	}
+	serv_puts("000");
+
+	if (serv_cmd(buf, "GOTO _MAIL_") != 2) {
+		fprintf(stderr, "smtpbench: GOTO: %s\n", buf);
+		exit(2);
+	}
+}
+
+/*
+ * Submit one message; its body tells the sink when we did so.
+ */
+void inject_message(int msgnum)
+{
+	char buf[SIZ];
+	StrBuf *Cmd;
+	int i;
+
+	Cmd = NewStrBufPlain(HKEY("ENT0 1|"));
+	for (i = 0; i < m; i++) {
+		if (i > 0)
+			StrBufAppendBufPlain(Cmd, HKEY(","), 0);
+		StrBufAppendPrintf(Cmd, "rcpt%d.%d@d%d." BENCH_DOMAIN, msgnum, i, (msgnum + i) % nmx);
+	}
+	StrBufAppendPrintf(Cmd, "|0|0|smtpbench message %d", msgnum);
+
+	if (serv_cmd(buf, ChrPtr(Cmd)) != 4) {
+		fprintf(stderr, "smtpbench: ENT0: %s\n", buf);
+		exit(2);
+	}
+	FreeStrBuf(&Cmd);
+
+	snprintf(buf, sizeof buf, BENCH_STAMP "%lld", now_usec());
+	serv_puts(buf);
+	for (i = 0; i < 15; i++) {
+		serv_puts("The point of this message is to travel through the outbound SMTP");
+		serv_puts("queue of a Citadel server, so we can see how quickly it does so.");
+	}
+	serv_puts("000");
+}
+
+
+/*****************************************************************************/
+/*                     FAKE MX HOSTS                                         */
+/*****************************************************************************/
+
+/*
+ * Which of our recipients is this RCPT command for?  -1 if it isn't ours.
+ */
+long sink_rcpt_index(const char *cmd)
+{
+	const char *pch;
+	int msgnum, i;
+
+	pch = strchr(cmd, '<');
+	if ((pch == NULL) ||
+	    (sscanf(pch + 1, "rcpt%d.%d@", &msgnum, &i) != 2) ||
+	    (msgnum < 0) || (msgnum >= n) || (i < 0) || (i >= m))
+		return -1;
+	return (long)msgnum * m + i;
+}
+
+/*
+ * A recipient got a final answer; count it unless it already had one.
+ * Must be called with sink_mutex held.
+ */
+int sink_finalize(long rcpt, char state)
+{
+	if ((rcpt_state[rcpt] == RCPT_ACCEPTED) || (rcpt_state[rcpt] == RCPT_REFUSED)) {
+		sink_duplicates ++;
+		return 0;
+	}
+	rcpt_state[rcpt] = state;
+	if (state == RCPT_ACCEPTED)
+		sink_accepted ++;
+	else
+		sink_permfailed ++;
+	return 1;
+}
+
+void sink_reply(int sock, const char *reply)
+{
+	if (latency > 0)
+		usleep(latency * 1000);
+	if ((write(sock, reply, strlen(reply)) < 0) ||
+	    (write(sock, "\r\n", 2) < 0))
+		return;
+}
+
+/*
+ * one SMTP conversation with the Citadel server
+ */
+void *sink_session(void *arg)
+{
+	int sock = (int)(long) arg;
+	StrBuf *Line, *IOBuf;
+	const char *Pos = NULL;
+	const char *Err = NULL;
+	const char *pch;
+	unsigned int seed;
+	long long stamp = 0;
+	long long arrived;
+	long *rcpts;		/* recipients we said 250 to in this transaction */
+	long rcpt;
+	int in_data = 0;
+	int nrcpts = 0;
+	int roll;
+	int i;
+
+	seed = (unsigned int) now_usec() ^ (unsigned int) sock;
+	Line = NewStrBufPlain(NULL, SIZ);
+	IOBuf = NewStrBufPlain(NULL, SIZ);
+	rcpts = malloc(sizeof(long) * m);
+
+	sink_reply(sock, "220 smtpbench ESMTP sink ready");
+	for (;;) {
+		FlushStrBuf(Line);
+		if (StrBufTCP_read_buffered_line_fast(Line, IOBuf, &Pos, &sock, 60, 1, &Err) < 0)
+			break;
+		StrBufTrim(Line);
+		pch = ChrPtr(Line);
+
+		if (in_data) {
+			if (!strcmp(pch, ".")) {
+				arrived = now_usec();
+				in_data = 0;
+				pthread_mutex_lock(&sink_mutex);
+				for (i = 0; i < nrcpts; i++) {
+					if (sink_finalize(rcpts[i], RCPT_ACCEPTED) && (stamp > 0))
+						latencies[nlatencies++] = arrived - stamp;
+				}
+				pthread_mutex_unlock(&sink_mutex);
+				nrcpts = 0;
+				sink_reply(sock, "250 2.0.0 message accepted");
+			}
+			else if (!strncmp(pch, BENCH_STAMP, sizeof(BENCH_STAMP) - 1)) {
+				stamp = atoll(pch + sizeof(BENCH_STAMP) - 1);
+			}
+			continue;
+		}
+
+		if (!strncasecmp(pch, "EHLO", 4) || !strncasecmp(pch, "HELO", 4)) {
+			sink_reply(sock, "250 smtpbench");
+		}
+		else if (!strncasecmp(pch, "MAIL", 4)) {
+			nrcpts = 0;
+			stamp = 0;
+			sink_reply(sock, "250 2.1.0 sender ok");
+		}
+		else if (!strncasecmp(pch, "RCPT", 4)) {
+			rcpt = sink_rcpt_index(pch);
+			roll = rand_r(&seed) % 100;
+			if ((rcpt < 0) || (nrcpts >= m)) {
+				sink_reply(sock, "550 5.1.1 not one of ours");
+			}
+			else if (roll < tempfail) {
+				pthread_mutex_lock(&sink_mutex);
+				sink_4xx ++;
+				if (rcpt_state[rcpt] == RCPT_PENDING) {
+					rcpt_state[rcpt] = RCPT_DEFERRED;
+					sink_deferred ++;
+				}
+				pthread_mutex_unlock(&sink_mutex);
+				sink_reply(sock, "451 4.3.0 try again later");
+			}
+			else if (roll < tempfail + permfail) {
+				pthread_mutex_lock(&sink_mutex);
+				sink_finalize(rcpt, RCPT_REFUSED);
+				pthread_mutex_unlock(&sink_mutex);
+				sink_reply(sock, "550 5.1.1 no such user");
+			}
+			else {
+				rcpts[nrcpts++] = rcpt;
+				sink_reply(sock, "250 2.1.5 recipient ok");
+			}
+		}
+		else if (!strncasecmp(pch, "DATA", 4)) {
+			in_data = 1;
+			sink_reply(sock, "354 go ahead");
+		}
+		else if (!strncasecmp(pch, "RSET", 4)) {
+			nrcpts = 0;
+			sink_reply(sock, "250 2.0.0 ok");
+		}
+		else if (!strncasecmp(pch, "NOOP", 4)) {
+			sink_reply(sock, "250 2.0.0 ok");
+		}
+		else if (!strncasecmp(pch, "QUIT", 4)) {
+			sink_reply(sock, "221 2.0.0 bye");
+			break;
+		}
+		else {
+			sink_reply(sock, "502 5.5.2 command not implemented");
+		}
+	}
+
+	if (sock >= 0)
+		close(sock);
+	free(rcpts);
+	FreeStrBuf(&Line);
+	FreeStrBuf(&IOBuf);
+	return NULL;
+}
+
+void *sink_listener(void *arg)
+{
+	int lsock = (int)(long) arg;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int sock;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (1) {
+		sock = accept(lsock, NULL, NULL);
+		if (sock < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "smtpbench: accept: %s\n", strerror(errno));
+			break;
+		}
+		pthread_mutex_lock(&sink_mutex);
+		sink_connections ++;
+		pthread_mutex_unlock(&sink_mutex);
+		if (pthread_create(&thread, &attr, sink_session, (void *)(long) sock) != 0)
+			close(sock);
+	}
+	return NULL;
+}
+
+/*
+ * the address of fake MX host i
+ */
+struct in_addr mx_addr(int i)
+{
+	struct in_addr addr;
+
+	if (!inet_aton(mx_host, &addr)) {
+		fprintf(stderr, "smtpbench: %s isn't an IPv4 address\n", mx_host);
+		exit(1);
+	}
+	addr.s_addr = htonl(ntohl(addr.s_addr) + i);
+	return addr;
+}
+
+void start_sinks(void)
+{
+	struct sockaddr_in addr;
+	pthread_t thread;
+	int lsock;
+	int on = 1;
+	int i;
+
+	for (i = 0; i < nmx; i++) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(base_port);
+		addr.sin_addr = mx_addr(i);
+
+		lsock = socket(AF_INET, SOCK_STREAM, 0);
+		setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if ((bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+		    (listen(lsock, 64) < 0))
+		{
+			fprintf(stderr, "smtpbench: can't listen on %s:%d: %s\n",
+				inet_ntoa(addr.sin_addr), base_port, strerror(errno));
+			exit(3);
+		}
+		pthread_create(&thread, NULL, sink_listener, (void *)(long) lsock);
+	}
+}
+
+
+/*****************************************************************************/
+/*                     STUB DNS SERVER                                       */
+/*****************************************************************************/
+
+/*
+ * What we know:
+ *   d<k>.smtpbench.test   MX  mx<k>, mx<k+1>, ... with falling preference
+ *   mx<j>.smtpbench.test  A   the -H address + j
+ * Other names in smtpbench.test don't exist; the two above don't have
+ * records of other types.  We refuse anything outside of smtpbench.test.
+ */
+
+#define DNS_T_A			1
+#define DNS_T_MX		15
+#define DNS_RCODE_NXDOMAIN	3
+#define DNS_RCODE_REFUSED	5
+
+/*
+ * write a name as DNS labels; returns how long they are
+ */
+int dns_put_name(unsigned char *p, const char *name)
+{
+	unsigned char *start = p;
+	size_t len;
+
+	while (*name != '\0') {
+		len = strcspn(name, ".");
+		*p++ = len;
+		memcpy(p, name, len);
+		p += len;
+		name += len;
+		if (*name == '.')
+			name++;
+	}
+	*p++ = 0;
+	return p - start;
+}
+
+/*
+ * append an answer for the name in the question
+ */
+unsigned char *dns_put_rr(unsigned char *p, int type, const unsigned char *rdata, int rdlen)
+{
+	*p++ = 0xc0; *p++ = 12;		/* pointer to the question's name */
+	*p++ = type >> 8; *p++ = type & 0xff;
+	*p++ = 0; *p++ = 1;		/* class IN */
+	*p++ = 0; *p++ = 0; *p++ = 0; *p++ = 0;	/* TTL */
+	*p++ = rdlen >> 8; *p++ = rdlen & 0xff;
+	memcpy(p, rdata, rdlen);
+	return p + rdlen;
+}
+
+/*
+ * answer one query; returns the length of the answer, 0 if there's nothing to answer.
+ */
+int dns_answer(const unsigned char *q, int qlen, unsigned char *a)
+{
+	char name[256];
+	char exchange[64];
+	unsigned char rdata[80];
+	unsigned char *p;
+	struct in_addr addr;
+	int pos = 12;
+	int nlen = 0;
+	int ancount = 0;
+	int rcode = 0;
+	int type, len, used, k, j;
+
+	/* we only take queries with one question */
+	if ((qlen < 12) || (q[2] & 0x80) || (q[4] != 0) || (q[5] != 1))
+		return 0;
+	while ((pos < qlen) && (q[pos] != 0)) {
+		len = q[pos++];
+		if ((len > 63) || (pos + len > qlen) || (nlen + len + 2 > sizeof name))
+			return 0;
+		if (nlen > 0)
+			name[nlen++] = '.';
+		for (j = 0; j < len; j++)
+			name[nlen++] = tolower(q[pos + j]);
+		pos += len;
+	}
+	name[nlen] = '\0';
+	pos += 1 + 4;			/* root label, type and class */
+	if (pos > qlen)
+		return 0;
+	type = (q[pos - 4] << 8) | q[pos - 3];
+
+	pthread_mutex_lock(&sink_mutex);
+	if (type == DNS_T_MX)
+		dns_mx_queries ++;
+	else if (type == DNS_T_A)
+		dns_a_queries ++;
+	else
+		dns_other_queries ++;
+	pthread_mutex_unlock(&sink_mutex);
+
+	/* the header and the question go back as they came */
+	memcpy(a, q, pos);
+	p = a + pos;
+
+	used = 0;
+	if ((sscanf(name, "d%d%n", &k, &used) == 1) && (!strcmp(name + used, "." BENCH_DOMAIN)) &&
+	    (k >= 0) && (k < nmx))
+	{
+		for (j = 0; (type == DNS_T_MX) && (j < nmx) && (ancount < 10); j++) {
+			rdata[0] = 0;
+			rdata[1] = 10 * (j + 1);
+			snprintf(exchange, sizeof exchange, "mx%d." BENCH_DOMAIN, (k + j) % nmx);
+			p = dns_put_rr(p, DNS_T_MX, rdata, 2 + dns_put_name(rdata + 2, exchange));
+			ancount ++;
+		}
+	}
+	else if ((sscanf(name, "mx%d%n", &k, &used) == 1) && (!strcmp(name + used, "." BENCH_DOMAIN)) &&
+		 (k >= 0) && (k < nmx))
+	{
+		if (type == DNS_T_A) {
+			addr = mx_addr(k);
+			p = dns_put_rr(p, DNS_T_A, (unsigned char *) &addr.s_addr, 4);
+			ancount ++;
+		}
+	}
+	else if ((nlen >= sizeof(BENCH_DOMAIN) - 1) && (!strcmp(name + nlen - (sizeof(BENCH_DOMAIN) - 1), BENCH_DOMAIN))) {
+		rcode = DNS_RCODE_NXDOMAIN;
+	}
+	else {
+		rcode = DNS_RCODE_REFUSED;
+	}
+
+	a[2] = 0x84 | (q[2] & 0x01);	/* an authoritative answer; recursion desired as asked */
+	a[3] = rcode;
+	a[6] = 0; a[7] = ancount;
+	a[8] = a[9] = a[10] = a[11] = 0;
+	return p - a;
+}
+
+void *dns_stub(void *arg)
+{
+	int sock = (int)(long) arg;
+	unsigned char q[512], a[1024];
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	ssize_t qlen;
+	int alen;
+
+	for (;;) {
+		fromlen = sizeof(from);
+		qlen = recvfrom(sock, q, sizeof q, 0, (struct sockaddr *) &from, &fromlen);
+		if (qlen < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "smtpbench: DNS stub: %s\n", strerror(errno));
+			break;
+		}
+		alen = dns_answer(q, qlen, a);
+		if (alen > 0)
+			sendto(sock, a, alen, 0, (struct sockaddr *) &from, fromlen);
+	}
+	return NULL;
+}
+
+void start_dns_stub(void)
+{
+	struct sockaddr_in addr;
+	pthread_t thread;
+	int sock;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(dns_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "smtpbench: can't listen on UDP port %d: %s\n", dns_port, strerror(errno));
+		exit(3);
+	}
+	pthread_create(&thread, NULL, dns_stub, (void *)(long) sock);
+}
+
+
+/*****************************************************************************/
+/*                     REPORT                                                */
+/*****************************************************************************/
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *) a;
+	long long y = *(const long long *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(long long *v, long nv, int pct)
+{
+	long i;
+
+	if (nv == 0)
+		return 0.0;
+	i = (nv * pct + 99) / 100 - 1;
+	if (i < 0) i = 0;
+	if (i >= nv) i = nv - 1;
+	return v[i] / 1000.0;
+}
+
+
+int main(int argc, char **argv)
+{
+	int a;
+	char buf[SIZ];
+	int relh = 0;
+	int home = 0;
+	char relhome[PATH_MAX] = "";
+	char ctdldir[PATH_MAX] = CTDLDIR;
+	server_stats before, after;
+	long long cpu_before, cpu_after;
+	long long t_start, t_injected, t_done;
+	long total, final;
+	double elapsed;
+	int i;
+
+	StartLibCitadel(SIZ);
+
+	while ((a = getopt(argc, argv, "h:n:m:x:p:d:H:l:t:f:w:P:")) != EOF) {
+		switch (a) {
+		case 'h':
+			relh = optarg[0] != '/';
+			if (!relh) {
+				strncpy(ctdl_home_directory, optarg, sizeof ctdl_home_directory);
+			} else {
+				strncpy(relhome, optarg, sizeof relhome);
+			}
+			home = 1;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'm':
+			m = atoi(optarg);
+			break;
+		case 'x':
+			nmx = atoi(optarg);
+			break;
+		case 'p':
+			base_port = atoi(optarg);
+			break;
+		case 'd':
+			dns_port = atoi(optarg);
+			break;
+		case 'H':
+			mx_host = optarg;
+			break;
+		case 'l':
+			latency = atoi(optarg);
+			break;
+		case 't':
+			tempfail = atoi(optarg);
+			break;
+		case 'f':
+			permfail = atoi(optarg);
+			break;
+		case 'w':
+			timeout = atoi(optarg);
+			break;
+		case 'P':
+			server_pid = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: smtpbench [-h server_dir] [-n messages] [-m recipients]\n"
+				"                 [-x mx_hosts] [-p mx_port] [-d dns_port] [-H first_mx_address]\n"
+				"                 [-l latency_ms] [-t tempfail_percent] [-f permfail_percent]\n"
+				"                 [-w timeout] [-P server_pid]\n");
+			return(1);
+		}
+	}
+	if ((n < 1) || (m < 1) || (nmx < 1) || (tempfail + permfail > 100)) {
+		fprintf(stderr, "smtpbench: invalid parameters\n");
+		return(1);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	calc_dirs_n_files(relh, home, relhome, ctdldir, 0);
+
+	total = (long) n * m;
+	latencies = malloc(sizeof(long long) * total);
+	rcpt_state = calloc(total, 1);
+	start_dns_stub();
+	start_sinks();
+
+	serv_sock = uds_connectsock(file_citadel_admin_socket);
+	serv_gets(buf);
+	if (buf[0] != '2') {
+		fprintf(stderr, "smtpbench: %s\n", buf);
+		return(2);
+	}
+	setup_server();
+
+	get_server_stats(&before);
+	cpu_before = get_server_cpu();
+	t_start = now_usec();
+
+	for (i = 0; i < n; i++)
+		inject_message(i);
+	t_injected = now_usec();
+	fprintf(stderr, "smtpbench: %d messages injected in %.2fs\n",
+		n, (t_injected - t_start) / 1000000.0);
+
+	/* Kick the queue until every recipient got its final answer. */
+	do {
+		if (serv_cmd(buf, "SMTP runqueue") != 2) {
+			fprintf(stderr, "smtpbench: SMTP runqueue: %s\n", buf);
+			return(2);
+		}
+		sleep(1);
+		pthread_mutex_lock(&sink_mutex);
+		final = sink_accepted + sink_permfailed;
+		pthread_mutex_unlock(&sink_mutex);
+	} while ((final < total) && (now_usec() - t_start < timeout * 1000000LL));
+	t_done = now_usec();
+
+	get_server_stats(&after);
+	cpu_after = get_server_cpu();
+	serv_cmd(buf, "QUIT");
+
+	pthread_mutex_lock(&sink_mutex);
+	qsort(latencies, nlatencies, sizeof(long long), cmp_ll);
+	elapsed = (t_done - t_start) / 1000000.0;
+
+	printf("messages:              %d x %d recipients, %d MX hosts\n", n, m, nmx);
+	printf("sink latency/4xx/5xx:  %dms / %d%% / %d%%\n", latency, tempfail, permfail);
+	printf("completed:             %s\n", (sink_accepted + sink_permfailed >= total) ? "yes" : "NO, timed out");
+	printf("elapsed:               %.2fs\n", elapsed);
+	printf("sink connections:      %ld\n", sink_connections);
+	printf("recipients accepted:   %ld\n", sink_accepted);
+	printf("recipients refused:    %ld\n", sink_permfailed);
+	printf("recipients deferred:   %ld (%ld 4xx replies)\n", sink_deferred, sink_4xx);
+	printf("duplicate deliveries:  %ld\n", sink_duplicates);
+	printf("deliveries/sec:        %.2f\n", (elapsed > 0) ? sink_accepted / elapsed : 0.0);
+	printf("latency p50:           %.1fms\n", percentile_ms(latencies, nlatencies, 50));
+	printf("latency p99:           %.1fms\n", percentile_ms(latencies, nlatencies, 99));
+	printf("latency max:           %.1fms\n", percentile_ms(latencies, nlatencies, 100));
+	printf("queue runs:            %ld\n", after.queueruns - before.queueruns);
+	printf("queue run cpu:         %.1fms\n", (after.queuerunusec - before.queuerunusec) / 1000.0);
+	printf("DNS lookups:           %ld (%.2f per message)\n",
+	       after.dnsqueries - before.dnsqueries, (double)(after.dnsqueries - before.dnsqueries) / n);
+	printf("stub DNS queries:      %ld MX, %ld A, %ld other\n",
+	       dns_mx_queries, dns_a_queries, dns_other_queries);
+	if (server_pid > 0)
+		printf("server cpu:            %.1fms\n", (cpu_after - cpu_before) / 1000.0);
+	printf("server delivered:      %ld recipients\n", after.delivered - before.delivered);
+	printf("server refused:        %ld recipients\n", after.permfail - before.permfail);
+	printf("server deferred:       %ld attempts\n", after.tempfail - before.tempfail);
+	pthread_mutex_unlock(&sink_mutex);
+
+	return (sink_accepted + sink_permfailed >= total) ? 0 : 4;
+}
@@ -3,16 +3,21 @@ cdecoder.c - c source to a base64 decoding algorithm implementation
 
 This is part of the libb64 project, and has been placed in the public domain.
 For details, see http://sourceforge.net/projects/libb64
+
+** NOTE: MODIFIED FOR LIBCITADEL **
+Whole groups are handed to base64_decode_bulk() in csimd.c, and
+plaintext_out may be code_in, so we can decode in place.
 */
 
 #include "b64/cdecode.h"
+#include "b64/csimd.h"
 
 int base64_decode_value(char value_in)
 {
 	static const char decoding[] = {62,-1,-1,-1,63,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
 	static const char decoding_size = sizeof(decoding);
 	value_in -= 43;
-	if (value_in < 0 || value_in > decoding_size) return -1;
+	if (value_in < 0 || value_in >= decoding_size) return -1;
 	return decoding[(int)value_in];
 }
 
@@ -27,14 +32,23 @@ int base64_decode_block(const char* code_in, const int length_in, char* plaintex
 	const char* codechar = code_in;
 	char* plainchar = plaintext_out;
 	char fragment;
+	int consumed;
 	
-	*plainchar = state_in->plainchar;
+	/* at step_a there's nothing to carry over; leave the byte alone, it may be our input */
+	if (state_in->step != step_a)
+		*plainchar = state_in->plainchar;
 	
 	switch (state_in->step)
 	{
 		while (1)
 		{
 	case step_a:
+			/* whole groups of clean input go in one go */
+			if (code_in + length_in - codechar >= 4)
+			{
+				plainchar += base64_decode_bulk(codechar, code_in + length_in - codechar, plainchar, &consumed);
+				codechar += consumed;
+			}
 			do {
 				if (codechar == code_in+length_in)
 				{
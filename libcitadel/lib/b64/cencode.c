@@ -7,10 +7,12 @@
 // ** NOTE: MODIFIED BY AJC 2016JAN22 **
 // The libb64 distribution always places a newline at the end of an encoded block.
 // We have removed that behavior.  If libb64 is updated, make that change again.
+// Whole groups of three are handed to base64_encode_bulk() in csimd.c.
 // 
 // 
 
 #include "b64/cencode.h"
+#include "b64/csimd.h"
 
 void base64_init_encodestate(base64_encodestate* state_in)
 {
@@ -32,6 +34,7 @@ int base64_encode_block(const char* plaintext_in, int length_in, char* code_out,
 	char* codechar = code_out;
 	char result;
 	char fragment;
+	int consumed;
 	
 	result = state_in->result;
 	
@@ -40,6 +43,12 @@ int base64_encode_block(const char* plaintext_in, int length_in, char* code_out,
 		while (1)
 		{
 	case step_A:
+			/* whole groups of three go in one go */
+			if (plaintextend - plainchar >= 3)
+			{
+				codechar += base64_encode_bulk(plainchar, plaintextend - plainchar, codechar, &consumed);
+				plainchar += consumed;
+			}
 			if (plainchar == plaintextend)
 			{
 				state_in->result = result;
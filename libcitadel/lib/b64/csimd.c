@@ -0,0 +1,327 @@
+/*
+csimd.c - bulk conversion paths for the libb64 block coders
+
+This is not part of the libb64 project; it was added for libcitadel.
+
+The libb64 coders walk their input one character at a time through a
+state machine, which is what we want at the edges of a chunk, in front
+of linebreaks and padding.  In between it's long runs of clean alphabet
+characters (resp. plain bytes), which we convert here:
+ - a table driven loop doing a whole group at a time, everywhere
+ - SSSE3 and AVX2 versions of it, picked at runtime if the CPU has them.
+   The vector tricks are the ones by Wojciech Mula and Alfred Klomp.
+*/
+
+#include "sysdep.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "libcitadel.h"
+#include "b64/csimd.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static const char encoding[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const signed char decoding[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+
+/*******************************************************************************
+ *                       One group at a time                                   *
+ *******************************************************************************/
+
+static int decode_scalar(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const unsigned char* pch = in;
+	const unsigned char* pche = in + (len & ~3);
+	unsigned char* pout = out;
+	int a, b, c, d;
+	unsigned long v;
+
+	while (pch < pche) {
+		a = decoding[pch[0]];
+		b = decoding[pch[1]];
+		c = decoding[pch[2]];
+		d = decoding[pch[3]];
+		if ((a | b | c | d) < 0)
+			break;
+		v = (a << 18) | (b << 12) | (c << 6) | d;
+		pout[0] = (unsigned char)(v >> 16);
+		pout[1] = (unsigned char)(v >> 8);
+		pout[2] = (unsigned char)v;
+		pch += 4;
+		pout += 3;
+	}
+	*consumed = pch - in;
+	return pout - out;
+}
+
+static int encode_scalar(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const unsigned char* pch = in;
+	const unsigned char* pche = in + len - len % 3;
+	unsigned char* pout = out;
+	unsigned long v;
+
+	while (pch < pche) {
+		v = (pch[0] << 16) | (pch[1] << 8) | pch[2];
+		pout[0] = encoding[(v >> 18) & 0x3f];
+		pout[1] = encoding[(v >> 12) & 0x3f];
+		pout[2] = encoding[(v >>  6) & 0x3f];
+		pout[3] = encoding[v & 0x3f];
+		pch += 3;
+		pout += 4;
+	}
+	*consumed = pch - in;
+	return pout - out;
+}
+
+
+#ifdef HAVE_X86_SIMD
+/*******************************************************************************
+ *                       16 / 32 characters at a time                          *
+ *******************************************************************************/
+
+/*
+ * Decoding: the high nibble of each char picks a class, the low nibble
+ * a set of classes it may be in; if both don't agree it's not ours.
+ * The class also tells the offset that takes the char to its value;
+ * '/' shares its class with '+' and gets special treatment.
+ * Then the 6-bit values are packed together and the bytes put in order.
+ */
+#define DEC_LUT_LO 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+		   0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define DEC_LUT_HI 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+		   0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define DEC_LUT_ROLL 0, 16, 19, 4, -65, -65, -71, -71, \
+		     0,  0,  0, 0,   0,   0,   0,   0
+#define DEC_PACK 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/*
+ * Encoding: spread 12 bytes over 16 lanes of 3 bytes each, cut out the
+ * 6-bit values with two multiplies, then map value ranges to offsets.
+ */
+#define ENC_SPREAD 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+#define ENC_LUT 65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0
+
+__attribute__((target("ssse3")))
+static int decode_ssse3(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const __m128i lut_lo = _mm_setr_epi8(DEC_LUT_LO);
+	const __m128i lut_hi = _mm_setr_epi8(DEC_LUT_HI);
+	const __m128i lut_roll = _mm_setr_epi8(DEC_LUT_ROLL);
+	const __m128i pack = _mm_setr_epi8(DEC_PACK);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+	const unsigned char* pch = in;
+	unsigned char* pout = out;
+	__m128i str, hi_nibbles, lo_nibbles, hi, lo, roll;
+	__m128i tmp;
+	int n, m;
+
+	while (in + len - pch >= 16) {
+		str = _mm_loadu_si128((const __m128i*)pch);
+		hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+		lo_nibbles = _mm_and_si128(str, mask_2f);
+		hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+			break;
+		roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+		str = _mm_add_epi8(str, roll);
+		str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+		str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+		tmp = _mm_shuffle_epi8(str, pack);
+		memcpy(pout, &tmp, 12);
+		pch += 16;
+		pout += 12;
+	}
+	n = decode_scalar(pch, in + len - pch, pout, &m);
+	*consumed = pch + m - in;
+	return pout + n - out;
+}
+
+__attribute__((target("ssse3")))
+static int encode_ssse3(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const __m128i spread = _mm_setr_epi8(ENC_SPREAD);
+	const __m128i lut = _mm_setr_epi8(ENC_LUT);
+	const unsigned char* pch = in;
+	unsigned char* pout = out;
+	__m128i str, t0, t1, idx;
+	int n, m;
+
+	/* we load 16 but use 12 */
+	while (in + len - pch >= 16) {
+		str = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pch), spread);
+		t0 = _mm_mulhi_epu16(_mm_and_si128(str, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		t1 = _mm_mullo_epi16(_mm_and_si128(str, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		str = _mm_or_si128(t0, t1);
+		idx = _mm_subs_epu8(str, _mm_set1_epi8(51));
+		idx = _mm_sub_epi8(idx, _mm_cmpgt_epi8(str, _mm_set1_epi8(25)));
+		str = _mm_add_epi8(str, _mm_shuffle_epi8(lut, idx));
+		_mm_storeu_si128((__m128i*)pout, str);
+		pch += 12;
+		pout += 16;
+	}
+	n = encode_scalar(pch, in + len - pch, pout, &m);
+	*consumed = pch + m - in;
+	return pout + n - out;
+}
+
+__attribute__((target("avx2")))
+static int decode_avx2(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(DEC_LUT_LO, DEC_LUT_LO);
+	const __m256i lut_hi = _mm256_setr_epi8(DEC_LUT_HI, DEC_LUT_HI);
+	const __m256i lut_roll = _mm256_setr_epi8(DEC_LUT_ROLL, DEC_LUT_ROLL);
+	const __m256i pack = _mm256_setr_epi8(DEC_PACK, DEC_PACK);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	const unsigned char* pch = in;
+	unsigned char* pout = out;
+	__m256i str, hi_nibbles, lo_nibbles, hi, lo, roll;
+	__m256i tmp;
+	int n, m;
+
+	while (in + len - pch >= 32) {
+		str = _mm256_loadu_si256((const __m256i*)pch);
+		hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+		lo_nibbles = _mm256_and_si256(str, mask_2f);
+		hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		if (!_mm256_testz_si256(lo, hi))
+			break;
+		roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+		str = _mm256_add_epi8(str, roll);
+		str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+		str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+		str = _mm256_shuffle_epi8(str, pack);
+		tmp = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		memcpy(pout, &tmp, 24);
+		pch += 32;
+		pout += 24;
+	}
+	/* not the SSE version: switching between the two is expensive */
+	n = decode_scalar(pch, in + len - pch, pout, &m);
+	*consumed = pch + m - in;
+	return pout + n - out;
+}
+
+__attribute__((target("avx2")))
+static int encode_avx2(const unsigned char* in, int len, unsigned char* out, int* consumed)
+{
+	const __m256i spread = _mm256_setr_epi8(ENC_SPREAD, ENC_SPREAD);
+	const __m256i lut = _mm256_setr_epi8(ENC_LUT, ENC_LUT);
+	const unsigned char* pch = in;
+	unsigned char* pout = out;
+	__m256i str, t0, t1, idx;
+	int n, m;
+
+	/* two lanes of 12 bytes each; the upper load reaches 4 bytes further */
+	while (in + len - pch >= 28) {
+		str = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)pch)),
+			_mm_loadu_si128((const __m128i*)(pch + 12)), 1);
+		str = _mm256_shuffle_epi8(str, spread);
+		t0 = _mm256_mulhi_epu16(_mm256_and_si256(str, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_mullo_epi16(_mm256_and_si256(str, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		str = _mm256_or_si256(t0, t1);
+		idx = _mm256_subs_epu8(str, _mm256_set1_epi8(51));
+		idx = _mm256_sub_epi8(idx, _mm256_cmpgt_epi8(str, _mm256_set1_epi8(25)));
+		str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut, idx));
+		_mm256_storeu_si256((__m256i*)pout, str);
+		pch += 24;
+		pout += 32;
+	}
+	n = encode_scalar(pch, in + len - pch, pout, &m);
+	*consumed = pch + m - in;
+	return pout + n - out;
+}
+#endif /* HAVE_X86_SIMD */
+
+
+/*******************************************************************************
+ *                       Which one to use                                      *
+ *******************************************************************************/
+
+typedef int (*b64_bulk_fn)(const unsigned char* in, int len, unsigned char* out, int* consumed);
+
+static b64_bulk_fn decode_bulk = NULL;
+static b64_bulk_fn encode_bulk = NULL;
+
+static eBase64Impl base64_best_impl(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return eBase64AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return eBase64SSSE3;
+#endif
+	return eBase64Scalar;
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief select the code path of the base64 coders; mostly there for benchmarks and tests.
+ * @param Want the implementation we'd like; eBase64Best for the fastest this CPU can do
+ * @returns the implementation we actually got; never better than the CPU can do
+ */
+eBase64Impl CtdlBase64SelectImpl(eBase64Impl Want)
+{
+	eBase64Impl Best = base64_best_impl();
+
+	if (Want > Best)
+		Want = Best;
+	switch (Want) {
+#ifdef HAVE_X86_SIMD
+	case eBase64AVX2:
+		decode_bulk = decode_avx2;
+		encode_bulk = encode_avx2;
+		break;
+	case eBase64SSSE3:
+		decode_bulk = decode_ssse3;
+		encode_bulk = encode_ssse3;
+		break;
+#endif
+	default:
+		Want = eBase64Scalar;
+		decode_bulk = decode_scalar;
+		encode_bulk = encode_scalar;
+		break;
+	}
+	return Want;
+}
+
+int base64_decode_bulk(const char* code_in, int length_in, char* plaintext_out, int* consumed)
+{
+	if (decode_bulk == NULL)
+		CtdlBase64SelectImpl(eBase64Best);
+	return decode_bulk((const unsigned char*)code_in, length_in, (unsigned char*)plaintext_out, consumed);
+}
+
+int base64_encode_bulk(const char* plaintext_in, int length_in, char* code_out, int* consumed)
+{
+	if (encode_bulk == NULL)
+		CtdlBase64SelectImpl(eBase64Best);
+	return encode_bulk((const unsigned char*)plaintext_in, length_in, (unsigned char*)code_out, consumed);
+}
@@ -0,0 +1,26 @@
+/*
+csimd.h - bulk conversion paths for the libb64 block coders
+
+This is not part of the libb64 project; it was added for libcitadel.
+The block coders hand us the runs they are about to walk one character
+at a time; we convert as much of them as we can in one go.
+*/
+
+#ifndef BASE64_CSIMD_H
+#define BASE64_CSIMD_H
+
+/*
+ * Decode complete groups of four alphabet characters; stops in front of
+ * the first group that contains anything else (whitespace, '=', junk).
+ * Returns the number of bytes written, *consumed the number of chars read.
+ * code_in and plaintext_out may be the same buffer.
+ */
+int base64_decode_bulk(const char* code_in, int length_in, char* plaintext_out, int* consumed);
+
+/*
+ * Encode complete groups of three bytes.
+ * Returns the number of chars written, *consumed the number of bytes read.
+ */
+int base64_encode_bulk(const char* plaintext_in, int length_in, char* code_out, int* consumed);
+
+#endif /* BASE64_CSIMD_H */
@@ -72,7 +72,7 @@ typedef struct Payload Payload;
 
 /**
  * @ingroup HashListData
- * @brief Hash Payload storage Structure; filled in linear.
+ * @brief Hash Payload storage Structure
  */
 struct Payload {
 	void *Data; /**< the Data belonging to this storage */
@@ -80,32 +80,81 @@ struct Payload {
 };
 
 
+typedef struct HashArena HashArena;
+typedef struct HashSlot HashSlot;
+
 /**
  * @ingroup HashListData
- * @brief Hash key element; sorted by key
+ * @brief Hash element; lives in the arena of its hash, together with its key string
+ * (unless the key is too long for that, see HASH_SLOT_MAX_SIZE).  Neither ever
+ * moves, so the key GetNextHashPos() & co hand out stays good until its item
+ * is deleted, as it did when each had its own malloc().
  */
 struct HashKey {
 	long Key;         /**< Numeric Hashkey comperator for hash sorting */
-	long Position;    /**< Pointer to a Payload struct in the Payload Aray */
+	long Position;    /**< our index in Members, which is our insertion sequence */
 	char *HashKey;    /**< the Plaintext Hashkey */
 	long HKLen;       /**< length of the Plaintext Hashkey */
-	Payload *PL;      /**< pointer to our payload for sorting */
+	HashArena *Home;  /**< the arena chunk we live in */
+	Payload PL;       /**< our payload */
+};
+
+/**
+ * @ingroup HashListData
+ * @brief a chunk of memory we hand out elements and key strings from; never moves.
+ * The room of deleted items is handed out again (see @ref HashSlot); the chunk
+ * is given back once the last item in it is deleted.
+ */
+struct HashArena {
+	HashArena *Next;  /**< the previous (fuller) chunk */
+	size_t Used;      /**< how much of Data is handed out? */
+	size_t Size;      /**< how big is Data? */
+	long nLive;       /**< how many items in here weren't deleted yet? */
+	char Data[];
 };
 
 /**
  * @ingroup HashListData
- * @brief Hash structure; holds arrays of Hashkey and Payload. 
+ * @brief what a deleted item leaves behind in its chunk.  It waits in the free
+ * list of its size for the next item that fits, so a long living hash with a
+ * lot of churn reuses its chunks instead of having a few survivors pin them.
+ */
+struct HashSlot {
+	HashSlot *Next;   /**< next free slot of our size */
+	HashSlot *Prev;   /**< previous one; NULL if we're the first */
+	HashArena *Home;  /**< the arena chunk we're part of */
+	size_t Size;      /**< how big are we? */
+};
+
+/**
+ * @ingroup HashListData
+ * @brief Hash structure
+ *
+ * Items are found via an open addressing table (Robin Hood hashing) indexed
+ * by their hash value, so Put() and GetHash() don't depend on the number of
+ * items.  Members keeps them in insertion order.  LookupTable is the order
+ * the iterators walk: sorted by hash value, or however the user sorted us.
+ * Keeping it sorted on each Put() would make building a hash quadratic, so
+ * Put() appends to it; the first nLookupSorted entries are in order, the
+ * ones behind them are not.  Before somebody walks it, we sort only those
+ * and merge them in, so a walk after k new items costs k log k + n, not
+ * n log n; the old sorted table paid n per out of order Put().
  */
 struct HashList {
-	Payload **Members;     /**< Our Payload members. This fills up linear */
-	HashKey **LookupTable; /**< Hash Lookup table. Elements point to members, and are sorted by their hashvalue */
+	HashKey **Members;     /**< all items in insertion order; deleted ones are NULL */
+	HashKey **LookupTable; /**< all items in iteration order (see nLookupSorted) */
+	HashKey **Index;       /**< open addressing table; IndexSize slots, NULL if free */
+	HashArena *Arena;      /**< where our items and their keys live */
+	HashSlot **FreeSlots;  /**< room of deleted items, one list per size; HASH_SLOT_CLASSES of them */
 	char **MyKeys;         /**< this keeps the members for a call of GetHashKeys */
 	HashFunc Algorithm;    /**< should we use an alternating algorithm to calc the hash values? */
-	long nMembersUsed;     /**< how many pointers inside of the array are used? */
-	long nLookupTableItems; /**< how many items of the lookup table are used? */
-	long MemberSize;       /**< how big is Members and LookupTable? */
+	long nMembersUsed;     /**< how many pointers inside of Members are used? */
+	long nLookupTableItems; /**< how many items do we have? */
+	long MemberSize;       /**< how big are Members and LookupTable? */
+	long IndexSize;        /**< how big is Index? always a power of two */
 	long tainted;          /**< if 0, we're hashed, else s.b. else sorted us in his own way. */
 	long uniq;             /**< are the keys going to be uniq? */
+	long nLookupSorted;    /**< how many items at the start of LookupTable are in order? */
 };
 
 /**
@@ -117,6 +166,31 @@ struct HashPos {
 	int StepWidth;        /**< small? big? forward? backward? */
 };
 
+#define HASH_INDEX_MIN_SIZE 16
+#define HASH_ARENA_MIN_SIZE 1024
+#define HASH_ARENA_MAX_SIZE (64 * 1024)
+#define HASH_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+/* items up to this many pointers big live in the arena and get recycled; bigger ones get their own malloc(). */
+#define HASH_SLOT_CLASSES 32
+#define HASH_SLOT_MAX_SIZE (HASH_SLOT_CLASSES * sizeof(void*))
+#define HASH_SLOT_CLASS(Size) ((Size) / sizeof(void*) - 1)
+#define HASH_ITEM_SIZE(HKLen) HASH_ALIGN(HASH_ALIGN(sizeof(HashKey)) + (HKLen) + 1)
+
+static void MergeLookupTable(HashList *Hash);
+
+/**
+ * @ingroup HashListPrivate
+ * @brief make sure LookupTable is in order before we walk it.
+ * Sorting it doesn't change the contents of the hash, so this is
+ * fine for our const accessors too.
+ * @param Hash the list we're about to walk
+ */
+static inline void EnsureLookupTable(const HashList *Hash)
+{
+	if (!Hash->tainted && (Hash->nLookupSorted < Hash->nLookupTableItems))
+		MergeLookupTable((HashList*) Hash);
+}
+
 
 /**
  * @ingroup HashListDebug
@@ -137,6 +211,7 @@ int PrintHash(HashList *Hash, TransitionFunc Trans, PrintHashDataFunc PrintEntry
 	if (Hash == NULL)
 		return 0;
 
+	EnsureLookupTable(Hash);
 	for (i=0; i < Hash->nLookupTableItems; i++) {
 		if (i==0) {
 			Previous = NULL;
@@ -145,14 +220,14 @@ int PrintHash(HashList *Hash, TransitionFunc Trans, PrintHashDataFunc PrintEntry
 			if (Hash->LookupTable[i - 1] == NULL)
 				Previous = NULL;
 			else
-				Previous = Hash->Members[Hash->LookupTable[i-1]->Position]->Data;
+				Previous = Hash->LookupTable[i-1]->PL.Data;
 		}
 		if (Hash->LookupTable[i] == NULL) {
 			KeyStr = "";
 			Next = NULL;
 		}
 		else {
-			Next = Hash->Members[Hash->LookupTable[i]->Position]->Data;
+			Next = Hash->LookupTable[i]->PL.Data;
 			KeyStr = Hash->LookupTable[i]->HashKey;
 		}
 
@@ -191,6 +266,7 @@ int dbg_PrintHash(HashList *Hash, PrintHashContent First, PrintHashContent Secon
 	if (Hash->MyKeys != NULL)
 		free (Hash->MyKeys);
 
+	EnsureLookupTable(Hash);
 	Hash->MyKeys = (char**) malloc(sizeof(char*) * Hash->nLookupTableItems);
 #ifdef DEBUG
 	printf("----------------------------------\n");
@@ -215,7 +291,7 @@ int dbg_PrintHash(HashList *Hash, PrintHashContent First, PrintHashContent Secon
 #ifdef DEBUG
 				bar =
 #endif
-					First(Hash->Members[Hash->LookupTable[i]->Position]->Data);
+					First(Hash->LookupTable[i]->PL.Data);
 #ifdef DEBUG
 			else 
 				bar = "";
@@ -225,7 +301,7 @@ int dbg_PrintHash(HashList *Hash, PrintHashContent First, PrintHashContent Secon
 #ifdef DEBUG
 				bla = 
 #endif 
-					Second(Hash->Members[Hash->LookupTable[i]->Position]->Data);
+					Second(Hash->LookupTable[i]->PL.Data);
 #ifdef DEBUG
 
 			else
@@ -253,29 +329,33 @@ int TestValidateHash(HashList *TestHash)
 {
 	long i;
 
-	if (TestHash->nMembersUsed != TestHash->nLookupTableItems)
+	if (TestHash->nLookupTableItems > TestHash->nMembersUsed)
 		return 1;
 
 	if (TestHash->nMembersUsed > TestHash->MemberSize)
 		return 2;
 
-	for (i=0; i < TestHash->nMembersUsed; i++)
+	EnsureLookupTable(TestHash);
+	for (i=0; i < TestHash->nLookupTableItems; i++)
 	{
 
-		if (TestHash->LookupTable[i]->Position > TestHash->nMembersUsed)
+		if (TestHash->LookupTable[i]->Position >= TestHash->nMembersUsed)
 			return 3;
 		
-		if (TestHash->Members[TestHash->LookupTable[i]->Position] == NULL)
+		if (TestHash->Members[TestHash->LookupTable[i]->Position] != TestHash->LookupTable[i])
 			return 4;
-		if (TestHash->Members[TestHash->LookupTable[i]->Position]->Data == NULL)
+		if (TestHash->LookupTable[i]->PL.Data == NULL)
 			return 5;
+		if ((!TestHash->tainted) && (i > 0) &&
+		    (TestHash->LookupTable[i - 1]->Key > TestHash->LookupTable[i]->Key))
+			return 6;
 	}
 	return 0;
 }
 
 /**
  * @ingroup HashListAccess
- * @brief instanciate a new hashlist
+ * @brief instanciate a new hashlist; its tables are allocated on the first Put.
  * @return the newly allocated list. 
  */
 HashList *NewHash(int Uniq, HashFunc F)
@@ -286,24 +366,6 @@ HashList *NewHash(int Uniq, HashFunc F)
 		return NULL;
 	memset(NewList, 0, sizeof(HashList));
 
-	NewList->Members = malloc(sizeof(Payload*) * 100);
-	if (NewList->Members == NULL)
-	{
-		free(NewList);
-		return NULL;
-	}
-	memset(NewList->Members, 0, sizeof(Payload*) * 100);
-
-	NewList->LookupTable = malloc(sizeof(HashKey*) * 100);
-	if (NewList->LookupTable == NULL)
-	{
-		free(NewList->Members);
-		free(NewList);
-		return NULL;
-	}
-	memset(NewList->LookupTable, 0, sizeof(HashKey*) * 100);
-
-	NewList->MemberSize = 100;
 	NewList->tainted = 0;
         NewList->uniq = Uniq;
 	NewList->Algorithm = F;
@@ -321,7 +383,7 @@ int GetCount(HashList *Hash)
 /**
  * @ingroup HashListPrivate
  * @brief private destructor for one hash element.
- * Crashing? go one frame up and do 'print *FreeMe->LookupTable[i]'
+ * Crashing? go one frame up and do 'print *FreeMe->Members[i]'
  * @param Data an element to free using the user provided destructor, or just plain free
  */
 static void DeleteHashPayload (Payload *Data)
@@ -343,16 +405,155 @@ void HDeleteHash(void *vHash)
 	DeleteHash(&FreeMe);
 }
 
+/**
+ * @ingroup HashListPrivate
+ * @brief take a free slot off its list
+ * @param Hash the hash whose free lists it's in
+ * @param Slot the slot
+ */
+static void UnlinkHashSlot(HashList *Hash, HashSlot *Slot)
+{
+	if (Slot->Prev != NULL)
+		Slot->Prev->Next = Slot->Next;
+	else
+		Hash->FreeSlots[HASH_SLOT_CLASS(Slot->Size)] = Slot->Next;
+	if (Slot->Next != NULL)
+		Slot->Next->Prev = Slot->Prev;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief give back an arena chunk nobody lives in anymore.
+ * Everything in it is a free slot, so we take them off their lists first.
+ * @param Hash the hash the chunk belongs to
+ * @param Home the chunk
+ * @param Except an item that was just deleted and isn't on a list yet; may be NULL
+ * @param ExceptSize how big Except is
+ */
+static void FreeHashArena(HashList *Hash, HashArena *Home, void *Except, size_t ExceptSize)
+{
+	HashArena **Link;
+	char *Pos = Home->Data;
+	char *End = Home->Data + Home->Used;
+
+	while (Pos < End)
+	{
+		if (Pos == Except) {
+			Pos += ExceptSize;
+		}
+		else {
+			UnlinkHashSlot(Hash, (HashSlot*) Pos);
+			Pos += ((HashSlot*) Pos)->Size;
+		}
+	}
+	for (Link = &Hash->Arena; *Link != NULL; Link = &(*Link)->Next)
+		if (*Link == Home) {
+			*Link = Home->Next;
+			free(Home);
+			return;
+		}
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief hand out memory from the arena of a hash.
+ * @param Hash the hash we need the memory for
+ * @param Size how much?
+ * @return the memory, or NULL
+ */
+static void *HashArenaAlloc(HashList *Hash, size_t Size)
+{
+	HashArena *NewArena;
+	size_t ArenaSize;
+	void *Ret;
+
+	if (Hash->FreeSlots == NULL) {
+		Hash->FreeSlots = (HashSlot**) calloc(HASH_SLOT_CLASSES, sizeof(HashSlot*));
+		if (Hash->FreeSlots == NULL)
+			return NULL;
+	}
+	Size = HASH_ALIGN(Size);
+	if ((Hash->Arena == NULL) ||
+	    (Hash->Arena->Size - Hash->Arena->Used < Size))
+	{
+		/** if everything in the chunk we're leaving was deleted meanwhile, it can go. */
+		if ((Hash->Arena != NULL) && (Hash->Arena->nLive == 0))
+			FreeHashArena(Hash, Hash->Arena, NULL, 0);
+
+		/** each new chunk is twice as big as the one before, up to a limit. */
+		if (Hash->Arena == NULL)
+			ArenaSize = HASH_ARENA_MIN_SIZE;
+		else if (Hash->Arena->Size < HASH_ARENA_MAX_SIZE)
+			ArenaSize = Hash->Arena->Size * 2;
+		else
+			ArenaSize = HASH_ARENA_MAX_SIZE;
+		if (ArenaSize < Size)
+			ArenaSize = Size;
+
+		NewArena = (HashArena*) malloc(sizeof(HashArena) + ArenaSize);
+		if (NewArena == NULL)
+			return NULL;
+		NewArena->Next = Hash->Arena;
+		NewArena->Used = 0;
+		NewArena->Size = ArenaSize;
+		NewArena->nLive = 0;
+		Hash->Arena = NewArena;
+	}
+	Ret = Hash->Arena->Data + Hash->Arena->Used;
+	Hash->Arena->Used += Size;
+	return Ret;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief find a home for a new item and its key.  We take the room of a
+ * deleted one of the same size if there is one, else fresh arena memory.
+ * @param Hash the hash the item goes into
+ * @param HKLen the length of its key
+ * @return the item, with Home set; or NULL
+ */
+static HashKey *NewHashItem(HashList *Hash, long HKLen)
+{
+	size_t Size = HASH_ITEM_SIZE(HKLen);
+	HashSlot *Slot;
+	HashKey *Item;
+
+	/** big ones live on their own, so they can't keep a whole chunk alive. */
+	if (Size > HASH_SLOT_MAX_SIZE) {
+		Item = (HashKey*) malloc(Size);
+		if (Item != NULL)
+			Item->Home = NULL;
+		return Item;
+	}
+
+	if ((Hash->FreeSlots != NULL) &&
+	    ((Slot = Hash->FreeSlots[HASH_SLOT_CLASS(Size)]) != NULL))
+	{
+		UnlinkHashSlot(Hash, Slot);
+		Item = (HashKey*) Slot;
+		Item->Home = Slot->Home;
+	}
+	else {
+		Item = (HashKey*) HashArenaAlloc(Hash, Size);
+		if (Item == NULL)
+			return NULL;
+		Item->Home = Hash->Arena;
+	}
+	Item->Home->nLive++;
+	return Item;
+}
+
 /**
  * @ingroup HashListAccess
  * @brief flush the members of a hashlist 
- * Crashing? do 'print *FreeMe->LookupTable[i]'
+ * Crashing? do 'print *FreeMe->Members[i]'
  * @param Hash Hash to destroy. Is NULL'ed so you are shure its done.
  */
 void DeleteHashContent(HashList **Hash)
 {
 	int i;
 	HashList *FreeMe;
+	HashArena *FreeArena;
 
 	FreeMe = *Hash;
 	if (FreeMe == NULL)
@@ -363,31 +564,37 @@ void DeleteHashContent(HashList **Hash)
 		/** get rid of our payload */
 		if (FreeMe->Members[i] != NULL)
 		{
-			DeleteHashPayload(FreeMe->Members[i]);
-			free(FreeMe->Members[i]);
-		}
-		/** delete our hashing data */
-		if (FreeMe->LookupTable[i] != NULL)
-		{
-			free(FreeMe->LookupTable[i]->HashKey);
-			free(FreeMe->LookupTable[i]);
+			DeleteHashPayload(&FreeMe->Members[i]->PL);
+			if (FreeMe->Members[i]->Home == NULL)
+				free(FreeMe->Members[i]);
 		}
 	}
+	/** the rest of our items and their keys go in one sweep */
+	while (FreeMe->Arena != NULL)
+	{
+		FreeArena = FreeMe->Arena;
+		FreeMe->Arena = FreeArena->Next;
+		free(FreeArena);
+	}
+	free(FreeMe->FreeSlots);
+	FreeMe->FreeSlots = NULL;
 	FreeMe->nMembersUsed = 0;
 	FreeMe->tainted = 0;
 	FreeMe->nLookupTableItems = 0;
-	memset(FreeMe->Members, 0, sizeof(Payload*) * FreeMe->MemberSize);
-	memset(FreeMe->LookupTable, 0, sizeof(HashKey*) * FreeMe->MemberSize);
+	FreeMe->nLookupSorted = 0;
+	if (FreeMe->Index != NULL)
+		memset(FreeMe->Index, 0, sizeof(HashKey*) * FreeMe->IndexSize);
 
 	/** did s.b. want an array of our keys? free them. */
 	if (FreeMe->MyKeys != NULL)
 		free(FreeMe->MyKeys);
+	FreeMe->MyKeys = NULL;
 }
 
 /**
  * @ingroup HashListAccess
  * @brief destroy a hashlist and all of its members
- * Crashing? do 'print *FreeMe->LookupTable[i]'
+ * Crashing? do 'print *FreeMe->Members[i]'
  * @param Hash Hash to destroy. Is NULL'ed so you are shure its done.
  */
 void DeleteHash(HashList **Hash)
@@ -401,6 +608,7 @@ void DeleteHash(HashList **Hash)
 	/** now, free our arrays... */
 	free(FreeMe->LookupTable);
 	free(FreeMe->Members);
+	free(FreeMe->Index);
 
 	/** buye bye cruel world. */	
 	free (FreeMe);
@@ -415,71 +623,194 @@ void DeleteHash(HashList **Hash)
 static int IncreaseHashSize(HashList *Hash)
 {
 	/* Ok, Our space is used up. Double the available space. */
-	Payload **NewPayloadArea;
+	HashKey **NewMembers;
 	HashKey **NewTable;
+	long NewSize;
 	
 	if (Hash == NULL)
 		return 0;
 
-	/** If we grew to much, this might be the place to rehash and shrink again.
-	if ((Hash->NMembersUsed > Hash->nLookupTableItems) && 
-	    ((Hash->NMembersUsed - Hash->nLookupTableItems) > 
-	     (Hash->nLookupTableItems / 10)))
-	{
-
-
-	}
-	*/
+	NewSize = (Hash->MemberSize == 0) ? HASH_INDEX_MIN_SIZE : Hash->MemberSize * 2;
 
-	NewPayloadArea = (Payload**) malloc(sizeof(Payload*) * Hash->MemberSize * 2);
-	if (NewPayloadArea == NULL)
+	NewMembers = (HashKey**) realloc(Hash->Members, sizeof(HashKey*) * NewSize);
+	if (NewMembers == NULL)
 		return 0;
-	NewTable = malloc(sizeof(HashKey*) * Hash->MemberSize * 2);
+	Hash->Members = NewMembers;
+
+	NewTable = (HashKey**) realloc(Hash->LookupTable, sizeof(HashKey*) * NewSize);
 	if (NewTable == NULL)
-	{
-		free(NewPayloadArea);
 		return 0;
-	}
-
-	/** double our payload area */
-	memset(&NewPayloadArea[Hash->MemberSize], 0, sizeof(Payload*) * Hash->MemberSize);
-	memcpy(NewPayloadArea, Hash->Members, sizeof(Payload*) * Hash->MemberSize);
-	free(Hash->Members);
-	Hash->Members = NewPayloadArea;
-	
-	/** double our hashtable area */
-	memset(&NewTable[Hash->MemberSize], 0, sizeof(HashKey*) * Hash->MemberSize);
-	memcpy(NewTable, Hash->LookupTable, sizeof(HashKey*) * Hash->MemberSize);
-	free(Hash->LookupTable);
 	Hash->LookupTable = NewTable;
 	
-	Hash->MemberSize *= 2;
+	Hash->MemberSize = NewSize;
 	return 1;
 }
 
+/**
+ * @ingroup HashListPrivate
+ * @brief spread our hash values over the slots of the index;
+ *  Flathash keys are mostly consecutive numbers, so we can't just mask them.
+ * @param Key the hash value
+ * @return the home slot of Key in an index of unlimited size
+ */
+static inline unsigned long IndexHome(long Key)
+{
+	uint64_t x = (uint64_t) Key;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (unsigned long) x;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief put an item into the index. Robin Hood: whoever is further away
+ *  from his home slot gets the slot, the other one moves on.
+ * @param Hash the hash to manipulate; there has to be a free slot.
+ * @param Item the item to add
+ */
+static void IndexInsert(HashList *Hash, HashKey *Item)
+{
+	unsigned long Mask = Hash->IndexSize - 1;
+	unsigned long Slot = IndexHome(Item->Key) & Mask;
+	unsigned long Dist = 0;
+	unsigned long TheirDist;
+	HashKey *Swap;
+
+	while (Hash->Index[Slot] != NULL) {
+		TheirDist = (Slot - IndexHome(Hash->Index[Slot]->Key)) & Mask;
+		if (TheirDist < Dist) {
+			Swap = Hash->Index[Slot];
+			Hash->Index[Slot] = Item;
+			Item = Swap;
+			Dist = TheirDist;
+		}
+		Slot = (Slot + 1) & Mask;
+		Dist ++;
+	}
+	Hash->Index[Slot] = Item;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief Private function to find the index slot of an item by its hash value
+ * @param Hash Our Hash to search
+ * @param HashBinKey the Hash-Number to lookup.
+ * @return the slot, or -1 if not found
+ */
+static long IndexFind(const HashList *Hash, long HashBinKey)
+{
+	unsigned long Mask;
+	unsigned long Slot;
+	unsigned long Dist = 0;
+
+	if ((Hash == NULL) || (Hash->Index == NULL))
+		return -1;
+
+	Mask = Hash->IndexSize - 1;
+	Slot = IndexHome(HashBinKey) & Mask;
+	while (Hash->Index[Slot] != NULL) {
+		if (Hash->Index[Slot]->Key == HashBinKey)
+			return Slot;
+		/** they'd have taken this slot from anybody further away than us. */
+		if (((Slot - IndexHome(Hash->Index[Slot]->Key)) & Mask) < Dist)
+			return -1;
+		Slot = (Slot + 1) & Mask;
+		Dist ++;
+	}
+	return -1;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief remove an item from the index, and close the gap it leaves
+ * @param Hash the hash to manipulate
+ * @param Item the item to remove (there may be others with the same key)
+ */
+static void IndexRemove(HashList *Hash, HashKey *Item)
+{
+	unsigned long Mask = Hash->IndexSize - 1;
+	unsigned long Slot = IndexHome(Item->Key) & Mask;
+	unsigned long Next;
+	long i;
+
+	for (i = 0; i < Hash->IndexSize; i++) {
+		if (Hash->Index[Slot] == Item)
+			break;
+		if (Hash->Index[Slot] == NULL)
+			return;
+		Slot = (Slot + 1) & Mask;
+	}
+	if (Hash->Index[Slot] != Item)
+		return;
+
+	/** move our followers one back, unless they're at home already */
+	Next = (Slot + 1) & Mask;
+	while ((Hash->Index[Next] != NULL) &&
+	       (((Next - IndexHome(Hash->Index[Next]->Key)) & Mask) != 0))
+	{
+		Hash->Index[Slot] = Hash->Index[Next];
+		Slot = Next;
+		Next = (Next + 1) & Mask;
+	}
+	Hash->Index[Slot] = NULL;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief make sure there is room in the index for one more item; keeps it at most 3/4 full.
+ * @param Hash the hash to manipulate
+ */
+static int IncreaseIndexSize(HashList *Hash)
+{
+	HashKey **OldIndex;
+	HashKey **NewIndex;
+	long OldSize;
+	long NewSize;
+	long i;
+
+	if ((Hash->Index != NULL) &&
+	    ((Hash->nLookupTableItems + 1) * 4 <= Hash->IndexSize * 3))
+		return 1;
+
+	OldIndex = Hash->Index;
+	OldSize = Hash->IndexSize;
+	NewSize = (OldSize == 0) ? HASH_INDEX_MIN_SIZE : OldSize * 2;
+
+	NewIndex = (HashKey**) malloc(sizeof(HashKey*) * NewSize);
+	if (NewIndex == NULL)
+		return 0;
+	memset(NewIndex, 0, sizeof(HashKey*) * NewSize);
+	Hash->Index = NewIndex;
+	Hash->IndexSize = NewSize;
+
+	for (i = 0; i < OldSize; i++)
+		if (OldIndex[i] != NULL)
+			IndexInsert(Hash, OldIndex[i]);
+	free(OldIndex);
+	return 1;
+}
 
 /**
  * @ingroup HashListPrivate
- * @brief private function to add a new item to / replace an existing in -  the hashlist
+ * @brief private function to add a new item to the hashlist
  * if the hash list is full, its re-alloced with double size.
  * @param Hash our hashlist to manipulate
- * @param HashPos where should we insert / replace?
+ * @param HashBinKey the hash value of HashKeyStr
  * @param HashKeyStr the Hash-String
  * @param HKLen length of HashKeyStr
  * @param Data your Payload to add
  * @param Destructor Functionpointer to free Data. if NULL, default free() is used.
  */
 static int InsertHashItem(HashList *Hash, 
-			  long HashPos, 
 			  long HashBinKey, 
 			  const char *HashKeyStr, 
 			  long HKLen, 
 			  void *Data,
 			  DeleteHashDataFunc Destructor)
 {
-	Payload *NewPayloadItem;
 	HashKey *NewHashKey;
-	char *HashKeyOrgVal;
 
 	if (Hash == NULL)
 		return 0;
@@ -488,135 +819,170 @@ static int InsertHashItem(HashList *Hash,
 	    (!IncreaseHashSize (Hash)))
 	    return 0;
 
-	NewPayloadItem = (Payload*) malloc (sizeof(Payload));
-	if (NewPayloadItem == NULL)
+	if (!IncreaseIndexSize(Hash))
 		return 0;
-	NewHashKey = (HashKey*) malloc (sizeof(HashKey));
+
+	/** the item and its key go right after each other */
+	NewHashKey = NewHashItem(Hash, HKLen);
 	if (NewHashKey == NULL)
-	{
-		free(NewPayloadItem);
-		return 0;
-	}
-	HashKeyOrgVal = (char *) malloc (HKLen + 1);
-	if (HashKeyOrgVal == NULL)
-	{
-		free(NewHashKey);
-		free(NewPayloadItem);
 		return 0;
-	}
-
 
 	/** Arrange the payload */
-	NewPayloadItem->Data = Data;
-	NewPayloadItem->Destructor = Destructor;
+	NewHashKey->PL.Data = Data;
+	NewHashKey->PL.Destructor = Destructor;
 	/** Arrange the hashkey */
 	NewHashKey->HKLen = HKLen;
-	NewHashKey->HashKey = HashKeyOrgVal;
-	memcpy (NewHashKey->HashKey, HashKeyStr, HKLen + 1);
+	NewHashKey->HashKey = ((char*) NewHashKey) + HASH_ALIGN(sizeof(HashKey));
+	memcpy (NewHashKey->HashKey, HashKeyStr, HKLen);
+	NewHashKey->HashKey[HKLen] = '\0';
 	NewHashKey->Key = HashBinKey;
-	NewHashKey->PL = NewPayloadItem;
 	/** our payload is queued at the end... */
 	NewHashKey->Position = Hash->nMembersUsed;
-	/** but if we should be sorted into a specific place... */
-	if ((Hash->nLookupTableItems != 0) && 
-	    (HashPos != Hash->nLookupTableItems) ) {
-		long ItemsAfter;
-
-		ItemsAfter = Hash->nLookupTableItems - HashPos;
-		/** make space were we can fill us in */
-		if (ItemsAfter > 0)
-		{
-			memmove(&Hash->LookupTable[HashPos + 1],
-				&Hash->LookupTable[HashPos],
-				ItemsAfter * sizeof(HashKey*));
-		} 
-	}
-	
-	Hash->Members[Hash->nMembersUsed] = NewPayloadItem;
-	Hash->LookupTable[HashPos] = NewHashKey;
+
+	IndexInsert(Hash, NewHashKey);
+	Hash->Members[Hash->nMembersUsed] = NewHashKey;
 	Hash->nMembersUsed++;
+
+	/**
+	 * We go to the end of the lookup table.  If s.b. else sorted us, that's
+	 * where we belong; if we're sorted by hash value and come after the
+	 * last one, the table stays in order.
+	 */
+	if ((Hash->nLookupSorted == Hash->nLookupTableItems) &&
+	    ((Hash->nLookupTableItems == 0) ||
+	     (Hash->LookupTable[Hash->nLookupTableItems - 1]->Key <= HashBinKey)))
+		Hash->nLookupSorted++;
+	Hash->LookupTable[Hash->nLookupTableItems] = NewHashKey;
 	Hash->nLookupTableItems++;
 	return 1;
 }
 
 /**
  * @ingroup HashListSort
- * @brief if the user has tainted the hash, but wants to insert / search items by their key
- *  we need to search linear through the array. You have been warned that this will take more time!
- * @param Hash Our Hash to manipulate
- * @param HashBinKey the Hash-Number to lookup. 
- * @return the position (most closely) matching HashBinKey (-> Caller needs to compare! )
+ * @brief sorting function to regain hash-sequence and revert tainted status;
+ *  items with the same key stay in the order they were added.
+ * @param Key1 first item
+ * @param Key2 second item
  */
-static long FindInTaintedHash(HashList *Hash, long HashBinKey)
+static int SortByHashKeys(const void *Key1, const void* Key2)
 {
-	long SearchPos;
+	HashKey *HKey1, *HKey2;
+	HKey1 = *(HashKey**) Key1;
+	HKey2 = *(HashKey**) Key2;
 
-	if (Hash == NULL)
-		return 0;
+	if (HKey1->Key != HKey2->Key)
+		return (HKey1->Key > HKey2->Key) ? 1 : -1;
+	if (HKey1->Position != HKey2->Position)
+		return (HKey1->Position > HKey2->Position) ? 1 : -1;
+	return 0;
+}
 
-	for (SearchPos = 0; SearchPos < Hash->nLookupTableItems; SearchPos ++) {
-		if (Hash->LookupTable[SearchPos]->Key == HashBinKey){
-			return SearchPos;
+/**
+ * @ingroup HashListPrivate
+ * @brief collect our items from Members into LookupTable again, and sort them by hash value.
+ * @param Hash the hash to manipulate
+ */
+static void RebuildLookupTable(HashList *Hash)
+{
+	long i, n;
+
+	for (i = 0, n = 0; i < Hash->nMembersUsed; i++)
+		if (Hash->Members[i] != NULL)
+			Hash->LookupTable[n++] = Hash->Members[i];
+	Hash->nLookupTableItems = n;
+	if (n > 1)
+		qsort(Hash->LookupTable, n, sizeof(HashKey*), SortByHashKeys);
+	Hash->nLookupSorted = n;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief sort the items Put() appended behind the ordered part of LookupTable,
+ *  and merge them in.  They were added last, so on equal hash values they
+ *  go behind the ones already there.
+ *  Usually there are only a few of them; looking at each of the sorted items
+ *  would cost us a cache miss apiece, so we look up where each new one goes,
+ *  and move the sorted ones in between as a block.
+ * @param Hash the hash to manipulate
+ */
+static void MergeLookupTable(HashList *Hash)
+{
+	HashKey **Tail;
+	long nTail, i, j, k;
+	long Lo, Hi, Mid;
+
+	nTail = Hash->nLookupTableItems - Hash->nLookupSorted;
+	Tail = (HashKey**) malloc(sizeof(HashKey*) * nTail);
+	if (Tail == NULL) {
+		qsort(Hash->LookupTable, Hash->nLookupTableItems, sizeof(HashKey*), SortByHashKeys);
+		Hash->nLookupSorted = Hash->nLookupTableItems;
+		return;
+	}
+	memcpy(Tail, &Hash->LookupTable[Hash->nLookupSorted], sizeof(HashKey*) * nTail);
+	if (nTail > 1)
+		qsort(Tail, nTail, sizeof(HashKey*), SortByHashKeys);
+
+	/** fill from the back, so we don't overwrite what we still need. */
+	i = Hash->nLookupSorted;
+	k = Hash->nLookupTableItems;
+	for (j = nTail - 1; j >= 0; j--) {
+		/** the first of the sorted ones that goes behind us */
+		Lo = 0;
+		Hi = i;
+		while (Lo < Hi) {
+			Mid = Lo + (Hi - Lo) / 2;
+			if (Hash->LookupTable[Mid]->Key > Tail[j]->Key)
+				Hi = Mid;
+			else
+				Lo = Mid + 1;
 		}
+		k -= i - Lo;
+		memmove(&Hash->LookupTable[k], &Hash->LookupTable[Lo], sizeof(HashKey*) * (i - Lo));
+		i = Lo;
+		Hash->LookupTable[--k] = Tail[j];
 	}
-	return SearchPos;
+	free(Tail);
+	Hash->nLookupSorted = Hash->nLookupTableItems;
 }
 
 /**
  * @ingroup HashListPrivate
- * @brief Private function to lookup the Item / the closest position to put it in
- * @param Hash Our Hash to manipulate
- * @param HashBinKey the Hash-Number to lookup. 
- * @return the position (most closely) matching HashBinKey (-> Caller needs to compare! )
+ * @brief Private function to find the position of an item in the lookup table
+ * @param Hash Our Hash to search
+ * @param Item the item to look for
+ * @return its position, or -1
  */
-static long FindInHash(HashList *Hash, long HashBinKey)
+static long FindInLookupTable(HashList *Hash, HashKey *Item)
 {
-	long SearchPos;
-	long StepWidth;
+	long Lo, Hi, Mid;
 
-	if (Hash == NULL)
-		return 0;
+	EnsureLookupTable(Hash);
 
-	if (Hash->tainted)
-		return FindInTaintedHash(Hash, HashBinKey);
+	/** somebody sorted us his way. we have to search linear, sorry. */
+	if (Hash->tainted) {
+		for (Mid = 0; Mid < Hash->nLookupTableItems; Mid ++)
+			if (Hash->LookupTable[Mid] == Item)
+				return Mid;
+		return -1;
+	}
 
-	SearchPos = Hash->nLookupTableItems / 2;
-	StepWidth = SearchPos / 2;
-	while ((SearchPos > 0) && 
-	       (SearchPos < Hash->nLookupTableItems)) 
-	{
-		/** Did we find it? */
-		if (Hash->LookupTable[SearchPos]->Key == HashBinKey){
-			return SearchPos;
-		}
-		/** are we Aproximating in big steps? */
-		if (StepWidth > 1){
-			if (Hash->LookupTable[SearchPos]->Key > HashBinKey)
-				SearchPos -= StepWidth;
-			else
-				SearchPos += StepWidth;
-			StepWidth /= 2;			
-		}
-		else { /** We are right next to our target, within 4 positions */
-			if (Hash->LookupTable[SearchPos]->Key > HashBinKey) {
-				if ((SearchPos > 0) && 
-				    (Hash->LookupTable[SearchPos - 1]->Key < HashBinKey))
-					return SearchPos;
-				SearchPos --;
-			}
-			else {
-				if ((SearchPos + 1 < Hash->nLookupTableItems) && 
-				    (Hash->LookupTable[SearchPos + 1]->Key > HashBinKey))
-					return SearchPos;
-				SearchPos ++;
-			}
-			StepWidth--;
-		}
+	/** find the first one with our key... */
+	Lo = 0;
+	Hi = Hash->nLookupTableItems;
+	while (Lo < Hi) {
+		Mid = Lo + (Hi - Lo) / 2;
+		if (Hash->LookupTable[Mid]->Key < Item->Key)
+			Lo = Mid + 1;
+		else
+			Hi = Mid;
 	}
-	return SearchPos;
+	/** ...and then us among them. */
+	for (Mid = Lo; (Mid < Hash->nLookupTableItems) && (Hash->LookupTable[Mid]->Key == Item->Key); Mid ++)
+		if (Hash->LookupTable[Mid] == Item)
+			return Mid;
+	return -1;
 }
 
-
 /**
  * @ingroup HashListAlgorithm
  * @brief another hashing algorithm; treat it as just a pointer to int.
@@ -716,37 +1082,21 @@ void Put(HashList *Hash, const char *HKey, long HKLen, void *Data, DeleteHashDat
 	if (Hash == NULL)
 		return;
 
-	/** first, find out were we could fit in... */
+	/** first, find out whether we're already there... */
 	HashBinKey = CalcHashKey(Hash, HKey, HKLen);
-	HashAt = FindInHash(Hash, HashBinKey);
-
-	if ((HashAt >= Hash->MemberSize) &&
-	    (!IncreaseHashSize (Hash)))
-		return;
-
-	/** oh, we're brand new... */
-	if (Hash->LookupTable[HashAt] == NULL) {
-		InsertHashItem(Hash, HashAt, HashBinKey, HKey, HKLen, Data, DeleteIt);
-	}/** Insert Before? */
-	else if (Hash->LookupTable[HashAt]->Key > HashBinKey) {
-		InsertHashItem(Hash, HashAt, HashBinKey, HKey, HKLen, Data, DeleteIt);
-	}/** Insert After? */
-	else if (Hash->LookupTable[HashAt]->Key < HashBinKey) {
-		InsertHashItem(Hash, HashAt + 1, HashBinKey, HKey, HKLen, Data, DeleteIt);
-	}
-	else { /** Ok, we have a colision. replace it. */
-		if (Hash->uniq) {
-			long PayloadPos;
-			
-			PayloadPos = Hash->LookupTable[HashAt]->Position;
-			DeleteHashPayload(Hash->Members[PayloadPos]);
-			Hash->Members[PayloadPos]->Data = Data;
-			Hash->Members[PayloadPos]->Destructor = DeleteIt;
-		}
-		else {
-			InsertHashItem(Hash, HashAt + 1, HashBinKey, HKey, HKLen, Data, DeleteIt);
+	if (Hash->uniq) {
+		HashAt = IndexFind(Hash, HashBinKey);
+		if (HashAt >= 0) { /** Ok, we have a colision. replace it. */
+			HashKey *Item = Hash->Index[HashAt];
+
+			DeleteHashPayload(&Item->PL);
+			Item->PL.Data = Data;
+			Item->PL.Destructor = DeleteIt;
+			return;
 		}
 	}
+	/** oh, we're brand new... */
+	InsertHashItem(Hash, HashBinKey, HKey, HKLen, Data, DeleteIt);
 }
 
 /**
@@ -772,18 +1122,13 @@ int GetHash(HashList *Hash, const char *HKey, long HKLen, void **Data)
 	}
 	/** first, find out were we could be... */
 	HashBinKey = CalcHashKey(Hash, HKey, HKLen);
-	HashAt = FindInHash(Hash, HashBinKey);
-	if ((HashAt < 0) || /**< Not found at the lower edge? */
-	    (HashAt >= Hash->nLookupTableItems) || /**< Not found at the upper edge? */
-	    (Hash->LookupTable[HashAt]->Key != HashBinKey)) { /**< somewhere inbetween but no match? */
+	HashAt = IndexFind(Hash, HashBinKey);
+	if (HashAt < 0) { /**< no match? */
 		*Data = NULL;
 		return 0;
 	}
 	else { /** GOTCHA! */
-		long MemberPosition;
-
-		MemberPosition = Hash->LookupTable[HashAt]->Position;
-		*Data = Hash->Members[MemberPosition]->Data;
+		*Data = Hash->Index[HashAt]->PL.Data;
 		return 1;
 	}
 }
@@ -815,6 +1160,7 @@ int GetHashKeys(HashList *Hash, char ***List)
 	if (Hash->MyKeys == NULL)
 		return 0;
 
+	EnsureLookupTable(Hash);
 	for (i=0; i < Hash->nLookupTableItems; i++)
 	{
 		Hash->MyKeys[i] = Hash->LookupTable[i]->HashKey;
@@ -899,17 +1245,75 @@ int GetHashPosFromKey(HashList *Hash, const char *HKey, long HKLen, HashPos *At)
 	}
 	/** first, find out were we could be... */
 	HashBinKey = CalcHashKey(Hash, HKey, HKLen);
-	HashAt = FindInHash(Hash, HashBinKey);
-	if ((HashAt < 0) || /**< Not found at the lower edge? */
-	    (HashAt >= Hash->nLookupTableItems) || /**< Not found at the upper edge? */
-	    (Hash->LookupTable[HashAt]->Key != HashBinKey)) { /**< somewhere inbetween but no match? */
+	HashAt = IndexFind(Hash, HashBinKey);
+	if (HashAt < 0) /**< no match? */
+		return 0;
+	HashAt = FindInLookupTable(Hash, Hash->Index[HashAt]);
+	if (HashAt < 0)
 		return 0;
-	}
 	/** GOTCHA! */
 	At->Position = HashAt;
 	return 1;
 }
 
+/**
+ * @ingroup HashListPrivate
+ * @brief Private function to give back what a deleted item left behind.
+ * Its room goes to the free list of its size, for the next item that fits.
+ * Once nobody else lives in its chunk, the whole chunk goes back; the one we
+ * currently hand out from stays, it will fill up again.
+ * @param Hash the hash the item was in
+ * @param Item the item; it's gone after this
+ */
+static void ReleaseHashItem(HashList *Hash, HashKey *Item)
+{
+	HashArena *Home = Item->Home;
+	size_t Size = HASH_ITEM_SIZE(Item->HKLen);
+	HashSlot *Slot;
+
+	if (Home == NULL) {
+		free(Item);
+		return;
+	}
+	if ((--Home->nLive == 0) && (Home != Hash->Arena)) {
+		FreeHashArena(Hash, Home, Item, Size);
+		return;
+	}
+
+	Slot = (HashSlot*) Item;
+	Slot->Home = Home;
+	Slot->Size = Size;
+	Slot->Prev = NULL;
+	Slot->Next = Hash->FreeSlots[HASH_SLOT_CLASS(Size)];
+	if (Slot->Next != NULL)
+		Slot->Next->Prev = Slot;
+	Hash->FreeSlots[HASH_SLOT_CLASS(Size)] = Slot;
+}
+
+/**
+ * @ingroup HashListPrivate
+ * @brief Private function to close the holes deleted items leave in Members.
+ * On a hash that lives long and sees a lot of churn they add up, so once
+ * they outnumber the living, we move the living together.  Only our
+ * pointers to the items move; the items and their keys stay put, and so
+ * does the iteration order.
+ * @param Hash the hash to compact
+ */
+static void CompactHash(HashList *Hash)
+{
+	long i, j;
+
+	for (i = j = 0; i < Hash->nMembersUsed; i++)
+	{
+		if (Hash->Members[i] == NULL)
+			continue;
+		Hash->Members[i]->Position = j;
+		Hash->Members[j++] = Hash->Members[i];
+	}
+	memset(&Hash->Members[j], 0, sizeof(HashKey*) * (Hash->nMembersUsed - j));
+	Hash->nMembersUsed = j;
+}
+
 /**
  * @ingroup HashListAccess
  * @brief Delete from the Hash the entry at Position
@@ -919,7 +1323,7 @@ int GetHashPosFromKey(HashList *Hash, const char *HKey, long HKLen, HashPos *At)
  */
 int DeleteEntryFromHash(HashList *Hash, HashPos *At)
 {
-	Payload *FreeMe;
+	HashKey *FreeMe;
 	if (Hash == NULL)
 		return 0;
 
@@ -933,37 +1337,27 @@ int DeleteEntryFromHash(HashList *Hash, HashPos *At)
 		return 0;
 	}
 
-	FreeMe = Hash->Members[Hash->LookupTable[At->Position]->Position];
-	Hash->Members[Hash->LookupTable[At->Position]->Position] = NULL;
-
+	EnsureLookupTable(Hash);
+	FreeMe = Hash->LookupTable[At->Position];
+	Hash->Members[FreeMe->Position] = NULL;
+	IndexRemove(Hash, FreeMe);
 
 	/** delete our hashing data */
-	if (Hash->LookupTable[At->Position] != NULL)
-	{
-		free(Hash->LookupTable[At->Position]->HashKey);
-		free(Hash->LookupTable[At->Position]);
-		if (At->Position < Hash->nLookupTableItems)
-		{
-			memmove(&Hash->LookupTable[At->Position],
-				&Hash->LookupTable[At->Position + 1],
-				(Hash->nLookupTableItems - At->Position - 1) * 
-				sizeof(HashKey*));
-
-			Hash->LookupTable[Hash->nLookupTableItems - 1] = NULL;
-		}
-		else 
-			Hash->LookupTable[At->Position] = NULL;
-		Hash->nLookupTableItems--;
-	}
+	memmove(&Hash->LookupTable[At->Position],
+		&Hash->LookupTable[At->Position + 1],
+		(Hash->nLookupTableItems - At->Position - 1) *
+		sizeof(HashKey*));
+	Hash->nLookupTableItems--;
+	Hash->nLookupSorted = Hash->nLookupTableItems;
 	/* unlock... */
 
 
-	/** get rid of our payload */
-	if (FreeMe != NULL)
-	{
-		DeleteHashPayload(FreeMe);
-		free(FreeMe);
-	}
+	/** get rid of our payload, and of the item if its arena chunk is empty now. */
+	DeleteHashPayload(&FreeMe->PL);
+	ReleaseHashItem(Hash, FreeMe);
+
+	if (Hash->nMembersUsed > 2 * Hash->nLookupTableItems + 64)
+		CompactHash(Hash);
 	return 1;
 }
 
@@ -1010,17 +1404,15 @@ void DeleteHashPos(HashPos **DelMe)
  */
 int GetNextHashPos(const HashList *Hash, HashPos *At, long *HKLen, const char **HashKey, void **Data)
 {
-	long PayloadPos;
-
 	if ((Hash == NULL) || 
 	    (At->Position >= Hash->nLookupTableItems) || 
 	    (At->Position < 0) ||
 	    (At->Position > Hash->nLookupTableItems))
 		return 0;
+	EnsureLookupTable(Hash);
 	*HKLen = Hash->LookupTable[At->Position]->HKLen;
 	*HashKey = Hash->LookupTable[At->Position]->HashKey;
-	PayloadPos = Hash->LookupTable[At->Position]->Position;
-	*Data = Hash->Members[PayloadPos]->Data;
+	*Data = Hash->LookupTable[At->Position]->PL.Data;
 
 	/* Position is NULL-Based, while Stepwidth is not... */
 	if ((At->Position % abs(At->StepWidth)) == 0)
@@ -1043,17 +1435,15 @@ int GetNextHashPos(const HashList *Hash, HashPos *At, long *HKLen, const char **
  */
 int GetHashPos(HashList *Hash, HashPos *At, long *HKLen, const char **HashKey, void **Data)
 {
-	long PayloadPos;
-
 	if ((Hash == NULL) || 
 	    (At->Position >= Hash->nLookupTableItems) || 
 	    (At->Position < 0) ||
 	    (At->Position > Hash->nLookupTableItems))
 		return 0;
+	EnsureLookupTable(Hash);
 	*HKLen = Hash->LookupTable[At->Position]->HKLen;
 	*HashKey = Hash->LookupTable[At->Position]->HashKey;
-	PayloadPos = Hash->LookupTable[At->Position]->Position;
-	*Data = Hash->Members[PayloadPos]->Data;
+	*Data = Hash->LookupTable[At->Position]->PL.Data;
 
 	return 1;
 }
@@ -1097,16 +1487,14 @@ int NextHashPos(HashList *Hash, HashPos *At)
  */
 int GetHashAt(HashList *Hash,long At, long *HKLen, const char **HashKey, void **Data)
 {
-	long PayloadPos;
-
 	if ((Hash == NULL) || 
 	    (At < 0) || 
 	    (At >= Hash->nLookupTableItems))
 		return 0;
+	EnsureLookupTable(Hash);
 	*HKLen = Hash->LookupTable[At]->HKLen;
 	*HashKey = Hash->LookupTable[At]->HashKey;
-	PayloadPos = Hash->LookupTable[At]->Position;
-	*Data = Hash->Members[PayloadPos]->Data;
+	*Data = Hash->LookupTable[At]->PL.Data;
 	return 1;
 }
 
@@ -1163,21 +1551,6 @@ static int SortByKeysRev(const void *Key1, const void* Key2)
 	return strcasecmp(HKey2->HashKey, HKey1->HashKey);
 }
 
-/**
- * @ingroup HashListSort
- * @brief sorting function to regain hash-sequence and revert tainted status
- * @param Key1 first item
- * @param Key2 second item
- */
-static int SortByHashKeys(const void *Key1, const void* Key2)
-{
-	HashKey *HKey1, *HKey2;
-	HKey1 = *(HashKey**) Key1;
-	HKey2 = *(HashKey**) Key2;
-
-	return HKey1->Key > HKey2->Key;
-}
-
 
 /**
  * @ingroup HashListSort
@@ -1191,6 +1564,7 @@ void SortByHashKey(HashList *Hash, int Order)
 {
 	if (Hash->nLookupTableItems < 2)
 		return;
+	EnsureLookupTable(Hash);
 	qsort(Hash->LookupTable, Hash->nLookupTableItems, sizeof(HashKey*), 
 	      (Order)?SortByKeys:SortByKeysRev);
 	Hash->tainted = 1;
@@ -1207,7 +1581,7 @@ void SortByHashKeyStr(HashList *Hash)
 	Hash->tainted = 0;
 	if (Hash->nLookupTableItems < 2)
 		return;
-	qsort(Hash->LookupTable, Hash->nLookupTableItems, sizeof(HashKey*), SortByHashKeys);
+	RebuildLookupTable(Hash);
 }
 
 
@@ -1219,7 +1593,7 @@ void SortByHashKeyStr(HashList *Hash)
  */
 const void *GetSearchPayload(const void *HashVoid)
 {
-	return (*(HashKey**)HashVoid)->PL->Data;
+	return (*(HashKey**)HashVoid)->PL.Data;
 }
 
 /**
@@ -1233,6 +1607,7 @@ void SortByPayload(HashList *Hash, CompareFunc SortBy)
 {
 	if (Hash->nLookupTableItems < 2)
 		return;
+	EnsureLookupTable(Hash);
 	qsort(Hash->LookupTable, Hash->nLookupTableItems, sizeof(HashKey*), SortBy);
 	Hash->tainted = 1;
 }
@@ -1351,37 +1726,39 @@ int ParseMSet(MSet **MSetList, StrBuf *MSetStr)
 int IsInMSetList(MSet *MSetList, long MsgNo)
 {
 	/* basicaly we are a ... */
-	long MemberPosition;
 	HashList *Hash = (HashList*) MSetList;
 	long HashAt;
 	long EndAt;
 	long StartAt;
+	long Lo, Hi;
 
 	if (Hash == NULL)
 		return 0;
-	if (Hash->MemberSize == 0)
+	if (Hash->nLookupTableItems == 0)
 		return 0;
-	/** first, find out were we could fit in... */
-	HashAt = FindInHash(Hash, MsgNo);
+	/** is it the start of a set? then we got it. */
+	if (IndexFind(Hash, MsgNo) >= 0)
+		return 1;
 	
+	/** else find the last set starting below it... */
+	EnsureLookupTable(Hash);
+	Lo = 0;
+	Hi = Hash->nLookupTableItems;
+	while (Lo < Hi) {
+		HashAt = Lo + (Hi - Lo) / 2;
+		if (Hash->LookupTable[HashAt]->Key < MsgNo)
+			Lo = HashAt + 1;
+		else
+			Hi = HashAt;
+	}
 	/* we're below the first entry, so not found. */
-	if (HashAt < 0)
+	if (Lo == 0)
 		return 0;
-	/* upper edge? move to last item */
-	if (HashAt >= Hash->nMembersUsed)
-		HashAt = Hash->nMembersUsed - 1;
-	/* Match? then we got it. */
-	else if (Hash->LookupTable[HashAt]->Key == MsgNo)
-		return 1;
-	/* One above possible range start? we need to move to the lower one. */ 
-	else if ((HashAt > 0) && 
-		 (Hash->LookupTable[HashAt]->Key > MsgNo))
-		HashAt -=1;
+	HashAt = Lo - 1;
 
 	/* Fetch the actual data */
 	StartAt = Hash->LookupTable[HashAt]->Key;
-	MemberPosition = Hash->LookupTable[HashAt]->Position;
-	EndAt = *(long*) Hash->Members[MemberPosition]->Data;
+	EndAt = *(long*) Hash->LookupTable[HashAt]->PL.Data;
 	if ((MsgNo >= StartAt) && (EndAt == LONG_MAX))
 		return 1;
 	/* no range? */
@@ -1394,6 +1771,7 @@ int IsInMSetList(MSet *MSetList, long MsgNo)
 }
 
 
+
 /**
  * @ingroup HashListMset
  * @brief frees a mset [redirects to @ref DeleteHash
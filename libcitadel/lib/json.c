@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "libcitadel.h"
 
@@ -150,7 +151,7 @@ JsonValue *NewJsonNull(const char *Key, long keylen)
 	Ret->Type = JSON_NULL;
 	if (Key != NULL)
 		Ret->Name = NewStrBufPlain(Key, keylen);
-	Ret->Value = NewStrBufPlain(HKEY("nulll"));
+	Ret->Value = NewStrBufPlain(HKEY("null"));
 	return Ret;
 }
 
@@ -189,78 +190,427 @@ void JsonObjectAppend(JsonValue *Array, JsonValue *Val)
 }
 
 
+/*******************************************************************************
+ *                 Streaming writer: no tree, straight into the buffer          *
+ *******************************************************************************/
 
+#define JSON_MAX_DEPTH 64
 
+struct JsonWriter {
+	StrBuf *Target;
+	long FlushAt;
+	JsonFlushFunc Flush;
+	void *FlushCtx;
+	int Depth;
+	int Error;
+	char IsObject[JSON_MAX_DEPTH];
+	char HaveMembers[JSON_MAX_DEPTH];
+};
 
-void SerializeJson(StrBuf *Target, JsonValue *Val, int FreeVal)
+static void JsonWriterInit(JsonWriter *W, StrBuf *Target, long FlushAt, JsonFlushFunc Flush, void *Ctx)
+{
+	memset(W, 0, sizeof(JsonWriter));
+	W->Target = Target;
+	W->FlushAt = FlushAt;
+	W->Flush = Flush;
+	W->FlushCtx = Ctx;
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief create a JSON writer appending to Target; you keep owning Target.
+ * @param Target the buffer to append the JSON text to
+ * @returns the new writer; free it with FreeJsonWriter()
+ */
+JsonWriter *NewJsonWriter(StrBuf *Target)
+{
+	return NewJsonStreamWriter(Target, 0, NULL, NULL);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief create a JSON writer that hands its output on while writing
+ * Whenever Target has grown to FlushAt bytes after a complete value, Flush is called
+ * with it (to send it down a socket, compress it...) and Target is emptied.
+ * @param Target the buffer to collect the JSON text in
+ * @param FlushAt hand on Target once it reached this many bytes
+ * @param Flush callback that consumes Target; returns < 0 on error
+ * @param Ctx passed through to Flush
+ * @returns the new writer; free it with FreeJsonWriter()
+ */
+JsonWriter *NewJsonStreamWriter(StrBuf *Target, long FlushAt, JsonFlushFunc Flush, void *Ctx)
+{
+	JsonWriter *W;
+
+	W = (JsonWriter*) malloc(sizeof(JsonWriter));
+	JsonWriterInit(W, Target, FlushAt, Flush, Ctx);
+	return W;
+}
+
+static int JsonWriterFinish(JsonWriter *W)
+{
+	if ((W->Flush != NULL) && (!W->Error) && (StrLength(W->Target) > 0)) {
+		if (W->Flush(W->Target, W->FlushCtx) < 0)
+			W->Error = 1;
+		FlushStrBuf(W->Target);
+	}
+	if (W->Depth != 0)
+		W->Error = 1;
+	return (W->Error) ? -1 : 0;
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief hand on the rest of the output and destroy the writer
+ * @param W the writer to free; set to NULL
+ * @returns 0 if the document was complete and all went out, -1 otherwise
+ */
+int FreeJsonWriter(JsonWriter **W)
+{
+	int rc;
+
+	if (*W == NULL)
+		return -1;
+	rc = JsonWriterFinish(*W);
+	free(*W);
+	*W = NULL;
+	return rc;
+}
+
+/*
+ * append len bytes of s escaped for a JSON string; runs without anything
+ * to escape go in one piece. With Html set <>& become entities as well,
+ * so the string may be put into innerHTML by the client unchanged.
+ */
+static void JsonEscAppend(StrBuf *Target, const char *s, long len, int Html)
+{
+	const char *run, *p, *e;
+	unsigned char ch;
+	char hex[8];
+
+	run = s;
+	e = s + len;
+	for (p = s; p < e; p++) {
+		ch = (unsigned char) *p;
+		if ((ch >= 0x20) && (ch != '"') && (ch != '\\') &&
+		    (!Html || ((ch != '<') && (ch != '>') && (ch != '&'))))
+			continue;
+
+		if (p > run)
+			StrBufAppendBufPlain(Target, run, p - run, 0);
+		switch (ch) {
+		case '"':
+			StrBufAppendBufPlain(Target, HKEY("\\\""), 0);
+			break;
+		case '\\':
+			if ((e - p >= 6) &&
+			    (*(p + 1) == 'u') &&
+			    isxdigit((unsigned char)*(p + 2)) &&
+			    isxdigit((unsigned char)*(p + 3)) &&
+			    isxdigit((unsigned char)*(p + 4)) &&
+			    isxdigit((unsigned char)*(p + 5)))
+			{ /* oh, a unicode escaper. let it pass through. */
+				StrBufAppendBufPlain(Target, p, 6, 0);
+				p += 5;
+			}
+			else
+				StrBufAppendBufPlain(Target, HKEY("\\\\"), 0);
+			break;
+		case '\n':
+			StrBufAppendBufPlain(Target, HKEY("\\n"), 0);
+			break;
+		case '\r':
+			StrBufAppendBufPlain(Target, HKEY("\\r"), 0);
+			break;
+		case '\t':
+			StrBufAppendBufPlain(Target, HKEY("\\t"), 0);
+			break;
+		case '\b':
+			StrBufAppendBufPlain(Target, HKEY("\\b"), 0);
+			break;
+		case '\f':
+			StrBufAppendBufPlain(Target, HKEY("\\f"), 0);
+			break;
+		case '<':
+			StrBufAppendBufPlain(Target, HKEY("&lt;"), 0);
+			break;
+		case '>':
+			StrBufAppendBufPlain(Target, HKEY("&gt;"), 0);
+			break;
+		case '&':
+			StrBufAppendBufPlain(Target, HKEY("&amp;"), 0);
+			break;
+		default:
+			snprintf(hex, sizeof(hex), "\\u%04x", ch);
+			StrBufAppendBufPlain(Target, hex, 6, 0);
+			break;
+		}
+		run = p + 1;
+	}
+	if (p > run)
+		StrBufAppendBufPlain(Target, run, p - run, 0);
+}
+
+/*
+ * everything that goes into a container starts here: the comma
+ * to its predecessor, and in objects the member name.
+ */
+static int JsonWriteKey(JsonWriter *W, const char *Key, long keylen)
+{
+	int Level;
+
+	if (W->Error)
+		return 0;
+	if (W->Depth == 0)
+		return 1;
+
+	Level = W->Depth - 1;
+	if (W->HaveMembers[Level])
+		StrBufAppendBufPlain(W->Target, HKEY(","), 0);
+	W->HaveMembers[Level] = 1;
+
+	if (W->IsObject[Level]) {
+		if (Key == NULL)
+			keylen = 0;
+		else if (keylen < 0)
+			keylen = strlen(Key);
+		StrBufAppendBufPlain(W->Target, HKEY("\""), 0);
+		JsonEscAppend(W->Target, Key, keylen, 0);
+		StrBufAppendBufPlain(W->Target, HKEY("\":"), 0);
+	}
+	return 1;
+}
+
+static void JsonWriterCheckFlush(JsonWriter *W)
+{
+	if ((W->Flush == NULL) || 
+	    (W->Error) ||
+	    (StrLength(W->Target) < W->FlushAt))
+		return;
+
+	if (W->Flush(W->Target, W->FlushCtx) < 0)
+		W->Error = 1;
+	FlushStrBuf(W->Target);
+}
+
+static void JsonWriteOpen(JsonWriter *W, const char *Key, long keylen, int IsObject)
+{
+	if (!JsonWriteKey(W, Key, keylen))
+		return;
+	if (W->Depth >= JSON_MAX_DEPTH) {
+		W->Error = 1;
+		return;
+	}
+	W->IsObject[W->Depth] = IsObject;
+	W->HaveMembers[W->Depth] = 0;
+	W->Depth ++;
+	StrBufAppendBufPlain(W->Target, (IsObject) ? "{" : "[", 1, 0);
+}
+
+static void JsonWriteClose(JsonWriter *W, int IsObject)
+{
+	if (W->Error)
+		return;
+	if ((W->Depth == 0) || (W->IsObject[W->Depth - 1] != IsObject)) {
+		W->Error = 1;
+		return;
+	}
+	W->Depth --;
+	StrBufAppendBufPlain(W->Target, (IsObject) ? "}" : "]", 1, 0);
+	JsonWriterCheckFlush(W);
+}
+
+/* numbers, true, false, null: no quotes, no escaping. */
+static void JsonWriteLiteral(JsonWriter *W, const char *Key, long keylen, const char *Value, long len)
+{
+	if (!JsonWriteKey(W, Key, keylen))
+		return;
+	StrBufAppendBufPlain(W->Target, Value, len, 0);
+	JsonWriterCheckFlush(W);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief open an object; Key names it if we're inside of another object, it's ignored elsewhere.
+ */
+void JsonWriteObjectStart(JsonWriter *W, const char *Key, long keylen)
+{
+	JsonWriteOpen(W, Key, keylen, 1);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief close the innermost object
+ */
+void JsonWriteObjectEnd(JsonWriter *W)
+{
+	JsonWriteClose(W, 1);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief open an array; Key names it if we're inside of an object, it's ignored elsewhere.
+ */
+void JsonWriteArrayStart(JsonWriter *W, const char *Key, long keylen)
+{
+	JsonWriteOpen(W, Key, keylen, 0);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief close the innermost array
+ */
+void JsonWriteArrayEnd(JsonWriter *W)
+{
+	JsonWriteClose(W, 0);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write a string value; NULL writes an empty string.
+ */
+void JsonWritePlainString(JsonWriter *W, const char *Key, long keylen, const char *Value, long len)
+{
+	if (!JsonWriteKey(W, Key, keylen))
+		return;
+	if ((Value != NULL) && (len < 0))
+		len = strlen(Value);
+	StrBufAppendBufPlain(W->Target, HKEY("\""), 0);
+	if (Value != NULL)
+		JsonEscAppend(W->Target, Value, len, 0);
+	StrBufAppendBufPlain(W->Target, HKEY("\""), 0);
+	JsonWriterCheckFlush(W);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write a string value; NULL writes an empty string.
+ */
+void JsonWriteString(JsonWriter *W, const char *Key, long keylen, const StrBuf *Value)
+{
+	JsonWritePlainString(W, Key, keylen, ChrPtr(Value), StrLength(Value));
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write a string value with <>& turned into HTML entities before the JSON escaping;
+ *        for strings the client puts into the page as is. NULL writes an empty string.
+ */
+void JsonWriteHtmlString(JsonWriter *W, const char *Key, long keylen, const StrBuf *Value)
+{
+	if (!JsonWriteKey(W, Key, keylen))
+		return;
+	StrBufAppendBufPlain(W->Target, HKEY("\""), 0);
+	if (Value != NULL)
+		JsonEscAppend(W->Target, ChrPtr(Value), StrLength(Value), 1);
+	StrBufAppendBufPlain(W->Target, HKEY("\""), 0);
+	JsonWriterCheckFlush(W);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write an integer value
+ */
+void JsonWriteNumber(JsonWriter *W, const char *Key, long keylen, long Number)
 {
-	void *vValue, *vPrevious;
-	JsonValue *SubVal;
+	char buf[64];
+	long len;
+
+	len = snprintf(buf, sizeof(buf), "%ld", Number);
+	JsonWriteLiteral(W, Key, keylen, buf, len);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write a floating point value
+ */
+void JsonWriteBigNumber(JsonWriter *W, const char *Key, long keylen, double Number)
+{
+	char buf[128];
+	long len;
+
+	len = snprintf(buf, sizeof(buf), "%f", Number);
+	if (len >= (long) sizeof(buf))
+		len = sizeof(buf) - 1;
+	JsonWriteLiteral(W, Key, keylen, buf, len);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write true or false
+ */
+void JsonWriteBool(JsonWriter *W, const char *Key, long keylen, int value)
+{
+	if (value)
+		JsonWriteLiteral(W, Key, keylen, HKEY("true"));
+	else
+		JsonWriteLiteral(W, Key, keylen, HKEY("false"));
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief write null
+ */
+void JsonWriteNull(JsonWriter *W, const char *Key, long keylen)
+{
+	JsonWriteLiteral(W, Key, keylen, HKEY("null"));
+}
+
+
+/*******************************************************************************
+ *                 The tree API on top of the writer                            *
+ *******************************************************************************/
+
+static void JsonWriteValue(JsonWriter *W, JsonValue *Val)
+{
+	void *vValue;
 	HashPos *It;
 	const char *Key;
 	long keylen;
+	const char *Name = NULL;
+	long nlen = 0;
 
+	if (Val->Name != NULL) {
+		Name = ChrPtr(Val->Name);
+		nlen = StrLength(Val->Name);
+	}
 
 	switch (Val->Type) {
 	case JSON_STRING:
-		StrBufAppendBufPlain(Target, HKEY("\""), 0);
-		StrECMAEscAppend(Target, Val->Value, NULL);
-		StrBufAppendBufPlain(Target, HKEY("\""), 0);
+		JsonWriteString(W, Name, nlen, Val->Value);
 		break;
 	case JSON_NUM:
-		StrBufAppendBuf(Target, Val->Value, 0);
-		break;
 	case JSON_BOOL:
-		StrBufAppendBuf(Target, Val->Value, 0);
+		JsonWriteLiteral(W, Name, nlen, ChrPtr(Val->Value), StrLength(Val->Value));
 		break;
 	case JSON_NULL:
-		StrBufAppendBuf(Target, Val->Value, 0);
+		JsonWriteNull(W, Name, nlen);
 		break;
 	case JSON_ARRAY:
-		vPrevious = NULL;
-		StrBufAppendBufPlain(Target, HKEY("["), 0);
-		It = GetNewHashPos(Val->SubValues, 0);
-		while (GetNextHashPos(Val->SubValues, 
-				      It,
-				      &keylen, &Key, 
-				      &vValue)){
-			if (vPrevious != NULL) 
-				StrBufAppendBufPlain(Target, HKEY(","), 0);
-
-			SubVal = (JsonValue*) vValue;
-			SerializeJson(Target, SubVal, 0);
-			vPrevious = vValue;
-		}
-		StrBufAppendBufPlain(Target, HKEY("]"), 0);
-		DeleteHashPos(&It);
-		break;
 	case JSON_OBJECT:
-		vPrevious = NULL;
-		StrBufAppendBufPlain(Target, HKEY("{"), 0);
+		JsonWriteOpen(W, Name, nlen, Val->Type == JSON_OBJECT);
 		It = GetNewHashPos(Val->SubValues, 0);
 		while (GetNextHashPos(Val->SubValues, 
 				      It,
 				      &keylen, &Key, 
 				      &vValue)){
-			SubVal = (JsonValue*) vValue;
-
-			if (vPrevious != NULL) {
-				StrBufAppendBufPlain(Target, HKEY(","), 0);
-			}
-			StrBufAppendBufPlain(Target, HKEY("\""), 0);
-			StrBufAppendBuf(Target, SubVal->Name, 0);
-			StrBufAppendBufPlain(Target, HKEY("\":"), 0);
-
-			SerializeJson(Target, SubVal, 0);
-			vPrevious = vValue;
+			JsonWriteValue(W, (JsonValue*) vValue);
 		}
-		StrBufAppendBufPlain(Target, HKEY("}"), 0);
 		DeleteHashPos(&It);
+		JsonWriteClose(W, Val->Type == JSON_OBJECT);
 		break;
 	}
+}
+
+void SerializeJson(StrBuf *Target, JsonValue *Val, int FreeVal)
+{
+	JsonWriter W;
+
+	JsonWriterInit(&W, Target, 0, NULL, NULL);
+	JsonWriteValue(&W, Val);
+	JsonWriterFinish(&W);
+
 	if(FreeVal) {
 		DeleteJSONValue(Val);
 	}
 }
-
-
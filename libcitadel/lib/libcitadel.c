@@ -70,6 +70,10 @@ void StartLibCitadel(size_t basesize)
 	envvar = getenv("LIBCITADEL_ZLIB_LEVEL");
 	if (envvar != NULL)
 		ZLibCompressionRatio = atol(envvar);
+
+	envvar = getenv("LIBCITADEL_STRBUF_ALLOC");
+	if ((envvar != NULL) && (strcmp(envvar, "malloc") == 0))
+		StrBufSetAllocStrategy(eStrBufMalloc);
 }
 
 void ShutDownLibCitadel(void)
@@ -181,6 +181,46 @@ void the_mime_parser(char *partnum,
 
 typedef struct StrBuf StrBuf;
 
+/*
+ * Streaming MIME parser; pulls events instead of calling back, takes its
+ * input in chunks and leaves bodies alone unless they're asked for.
+ */
+typedef struct _MimeStreamParser MimeStreamParser;
+
+typedef enum _eMimeEvent {
+	eMimeNeedMore,		/* feed more input, or call MimeStreamDone() */
+	eMimeMultipartStart,	/* a multipart or an encapsulated message opens */
+	eMimeMultipartEnd,	/* ... and closes again */
+	eMimePart,		/* a leaf part; its body may be read now */
+	eMimeEnd		/* that's all */
+} eMimeEvent;
+
+typedef struct _MimePartInfo {
+	char *PartNum;
+	char *ContentType;
+	char *Charset;
+	char *Encoding;		/* "" if it isn't a real one (7bit, 8bit, binary) */
+	char *Disposition;
+	char *Id;
+	char *Name;		/* from Content-Disposition or Content-type */
+	char *Filename;
+	long ContentLength;	/* -1 if there was no Content-length: */
+} MimePartInfo;
+
+MimeStreamParser *NewMimeStreamParser(void);
+void FreeMimeStreamParser(MimeStreamParser **P);
+/* Data has to stay valid until MimeStreamNext() & co ask for more input. */
+void MimeStreamFeed(MimeStreamParser *P, const char *Data, long len);
+void MimeStreamDone(MimeStreamParser *P);
+eMimeEvent MimeStreamNext(MimeStreamParser *P, MimePartInfo **Info);
+/*
+ * Body of the current leaf part, piece by piece: > 0 bytes at *Data, valid
+ * until the next call; 0 at the end of the part; -1 if we need more input.
+ */
+long MimeStreamRawBody(MimeStreamParser *P, const char **Data);
+/* same, but appends the decoded body to Target. */
+long MimeStreamDecodedBody(MimeStreamParser *P, StrBuf *Target);
+
 #define strof(a) #a
 #define CStrOf(a) #a, sizeof(#a) - 1
 typedef struct _ConstStr {
@@ -206,6 +246,30 @@ void HFreeStrBuf (void *VFreeMe);
 int FlushStrBuf(StrBuf *buf);
 int FLUSHStrBuf(StrBuf *buf); /* expensive but doesn't leave content behind for others to find in case of errors */
 
+/* where do StrBufs get their memory from? */
+typedef enum _eStrBufAlloc {
+	eStrBufMalloc,	/* straight from malloc() / free() */
+	eStrBufSlab	/* keep a per thread cache of freed headers and buffers, by size class */
+} eStrBufAlloc;
+void StrBufSetAllocStrategy(eStrBufAlloc Strategy);
+
+typedef struct _StrBufAllocStats {
+	long Mallocs;		/* blocks we had to get from malloc() */
+	long Reallocs;		/* buffers grown by realloc() */
+	long Frees;		/* blocks handed back to free() */
+	long SlabHits;		/* blocks taken from the slab instead of malloc() */
+	long SlabPuts;		/* blocks kept in the slab instead of free()ing them */
+	long ArenaAllocs;	/* headers and buffers carved out of a StrBufArena */
+} StrBufAllocStats;
+void StrBufGetAllocStats(StrBufAllocStats *Stats, int Reset);
+
+/* request scoped allocation: all StrBufs taken from it go away in one shot. */
+typedef struct StrBufArena StrBufArena;
+StrBufArena *NewStrBufArena(long ChunkSize);
+StrBuf *NewStrBufArenaPlain(StrBufArena *Arena, const char* ptr, int nChars);
+void FlushStrBufArena(StrBufArena *Arena);
+void FreeStrBufArena(StrBufArena **FreeMe);
+
 const char *ChrPtr(const StrBuf *Str);
 int StrLength(const StrBuf *Str);
 #define SKEY(a) ChrPtr(a), StrLength(a)
@@ -330,6 +394,8 @@ void StrBufReplaceChars(StrBuf *buf, char search, char replace);
 int CompressBuffer(StrBuf *Buf);
 void StrBufConvert(StrBuf *ConvertBuf, StrBuf *TmpBuf, void *pic);
 void ctdl_iconv_open(const char *tocode, const char *fromcode, void *pic);
+void ctdl_iconv_acquire(const char *tocode, const char *fromcode, void *pic);
+void ctdl_iconv_release(void *pic);
 void StrBuf_RFC822_2_Utf8(StrBuf *Target, 
 			  const StrBuf *DecodeMe, 
 			  const StrBuf* DefaultCharset, 
@@ -347,6 +413,11 @@ typedef enum __eStreamType {
 	eEmtyCodec
 } eStreamType;
 
+/* LastChunk of StrBufStreamTranscode() */
+#define STREAM_MORE  0
+#define STREAM_LAST  1
+#define STREAM_FLUSH 2
+
 typedef struct vStreamT vStreamT;
 vStreamT *StrBufNewStreamContext(eStreamType type, const char **Err);
 int StrBufDestroyStreamContext(eStreamType type, vStreamT **Stream, const char **Err);
@@ -427,6 +498,7 @@ void CurlPrepareURL(ParsedURL *Url);
 int safestrncpy(char *dest, const char *src, size_t n);
 int num_tokens (const char *source, char tok);
 long extract_token(char *dest, const char *source, int parmnum, char separator, int maxlen);
+long extract_next_token(char *dest, const char **Pos, char separator, int maxlen);
 long grab_token(char **dest, const char *source, int parmnum, char separator);
 int extract_int (const char *source, int parmnum);
 long extract_long (const char *source, int parmnum);
@@ -434,6 +506,22 @@ unsigned long extract_unsigned_long(const char *source, int parmnum);
 void CtdlInitBase64Table(void);
 size_t CtdlEncodeBase64(char *dest, const char *source, size_t sourcelen, int linebreaks);
 int CtdlDecodeBase64(char *dest, const char *source, size_t length);
+typedef enum _eBase64Impl {
+	eBase64Scalar,
+	eBase64SSSE3,
+	eBase64AVX2,
+	eBase64Best
+} eBase64Impl;
+eBase64Impl CtdlBase64SelectImpl(eBase64Impl Want);
+typedef enum _eScanImpl {
+	eScanScalar,
+	eScanSSE2,
+	eScanAVX2,
+	eScanBest
+} eScanImpl;
+eScanImpl CtdlScanSelectImpl(eScanImpl Want);
+const char *ctdl_memchr2(const char *s, int a, int b, size_t n);
+size_t ctdl_memcount(const char *s, int c, size_t n);
 unsigned int decode_hex(char *Source);
 int CtdlDecodeQuotedPrintable(char *decoded, char *encoded, int sourcelen);
 void StripSlashes(char *Dir, int TrailingSlash);
@@ -458,6 +546,11 @@ char *bmstrcasestr(char *text, const char *pattern);
 char *bmstrcasestr_len(char *text, size_t textlen, const char *pattern, size_t patlen);
 const char *cbmstrcasestr(const char *text, const char *pattern);
 const char *cbmstrcasestr_len(const char *text, size_t textlen, const char *pattern, size_t patlen);
+typedef struct CasePattern CasePattern;
+CasePattern *NewCasePattern(const char *Pattern, long len);
+void FreeCasePattern(CasePattern **Pattern);
+long CasePatternLen(const CasePattern *Pattern);
+const char *CasePatternFind(const CasePattern *Pattern, const char *Text, long len);
 void CtdlMakeTempFileName(char *name, int len);
 char *rfc2047encode(const char *line, long length);
 int is_msg_in_mset(const char *mset, long msgnum);
@@ -628,6 +721,42 @@ void JsonObjectAppend(JsonValue *Array, JsonValue *Val);
 void SerializeJson(StrBuf *Target, JsonValue *Val, int FreeVal);
 
 
+/*
+ * Write JSON straight into a buffer, no tree in between
+ */
+
+typedef struct JsonWriter JsonWriter;
+typedef int (*JsonFlushFunc)(StrBuf *Buf, void *Ctx);
+
+JsonWriter *NewJsonWriter(StrBuf *Target);
+
+JsonWriter *NewJsonStreamWriter(StrBuf *Target, long FlushAt, JsonFlushFunc Flush, void *Ctx);
+
+int FreeJsonWriter(JsonWriter **W);
+
+void JsonWriteObjectStart(JsonWriter *W, const char *Key, long keylen);
+
+void JsonWriteObjectEnd(JsonWriter *W);
+
+void JsonWriteArrayStart(JsonWriter *W, const char *Key, long keylen);
+
+void JsonWriteArrayEnd(JsonWriter *W);
+
+void JsonWriteString(JsonWriter *W, const char *Key, long keylen, const StrBuf *Value);
+
+void JsonWritePlainString(JsonWriter *W, const char *Key, long keylen, const char *Value, long len);
+
+void JsonWriteHtmlString(JsonWriter *W, const char *Key, long keylen, const StrBuf *Value);
+
+void JsonWriteNumber(JsonWriter *W, const char *Key, long keylen, long Number);
+
+void JsonWriteBigNumber(JsonWriter *W, const char *Key, long keylen, double Number);
+
+void JsonWriteBool(JsonWriter *W, const char *Key, long keylen, int value);
+
+void JsonWriteNull(JsonWriter *W, const char *Key, long keylen);
+
+
 
 /*
  * Citadels Wildfire implementation, see 
@@ -0,0 +1,265 @@
+/*
+ * memscan.c - delimiter search primitives for the tokenizers and line readers
+ *
+ * The protocol front ends spend a lot of their time looking for the next
+ * line end or the next separator, and counting separators; doing that one
+ * byte at a time leaves most of the memory bandwidth on the table.
+ * We look at 16 (SSE2) resp. 32 (AVX2) bytes per step where we can, and
+ * pick the widest path the CPU can do at runtime.
+ *
+ * Copyright (c) 2016 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "sysdep.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "libcitadel.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef const char *(*memchr2_fn)(const char *s, int a, int b, size_t n);
+typedef size_t (*memcount_fn)(const char *s, int c, size_t n);
+
+static memchr2_fn  memchr2_impl  = NULL;
+static memcount_fn memcount_impl = NULL;
+
+
+/*******************************************************************************
+ *                       One byte at a time                                    *
+ *******************************************************************************/
+
+static const char *memchr2_scalar(const char *s, int a, int b, size_t n)
+{
+	const char *e = s + n;
+	char ca = (char) a;
+	char cb = (char) b;
+
+	while (s < e) {
+		if ((*s == ca) || (*s == cb))
+			return s;
+		s++;
+	}
+	return NULL;
+}
+
+static size_t memcount_scalar(const char *s, int c, size_t n)
+{
+	const char *e = s + n;
+	char cc = (char) c;
+	size_t count = 0;
+
+	while (s < e) {
+		count += (*s == cc);
+		s++;
+	}
+	return count;
+}
+
+
+/*******************************************************************************
+ *                       SSE2: 16 bytes at a time                              *
+ *******************************************************************************/
+#ifdef __SSE2__
+
+static const char *memchr2_sse2(const char *s, int a, int b, size_t n)
+{
+	const char *e = s + n;
+	__m128i va = _mm_set1_epi8((char) a);
+	__m128i vb = _mm_set1_epi8((char) b);
+
+	while (e - s >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) s);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+							  _mm_cmpeq_epi8(v, vb)));
+		if (mask != 0)
+			return s + __builtin_ctz(mask);
+		s += 16;
+	}
+	return memchr2_scalar(s, a, b, e - s);
+}
+
+static size_t memcount_sse2(const char *s, int c, size_t n)
+{
+	const char *e = s + n;
+	__m128i vc = _mm_set1_epi8((char) c);
+	__m128i zero = _mm_setzero_si128();
+	__m128i total = zero;
+	uint64_t lanes[2];
+
+	while (e - s >= 16) {
+		__m128i acc = zero;
+		int rounds = 0;
+
+		/* the per byte counters wrap after 255 hits; fold them before. */
+		while ((e - s >= 16) && (rounds < 255)) {
+			__m128i v = _mm_loadu_si128((const __m128i *) s);
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, vc));
+			s += 16;
+			rounds++;
+		}
+		total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+	}
+	/* _mm_cvtsi128_si64() & co only exist on x86-64; this works on i386 too. */
+	_mm_storeu_si128((__m128i *) lanes, total);
+	return (size_t) (lanes[0] + lanes[1]) + memcount_scalar(s, c, e - s);
+}
+
+#endif /* __SSE2__ */
+
+
+/*******************************************************************************
+ *                       AVX2: 32 bytes at a time                              *
+ *******************************************************************************/
+#ifdef HAVE_X86_SIMD
+
+/* the tails go the scalar way; touching xmm registers here would cost us a transition penalty. */
+__attribute__((target("avx2")))
+static const char *memchr2_avx2(const char *s, int a, int b, size_t n)
+{
+	const char *e = s + n;
+	__m256i va = _mm256_set1_epi8((char) a);
+	__m256i vb = _mm256_set1_epi8((char) b);
+
+	while (e - s >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) s);
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+					_mm256_cmpeq_epi8(v, vb)));
+		if (mask != 0) {
+			_mm256_zeroupper();
+			return s + __builtin_ctz(mask);
+		}
+		s += 32;
+	}
+	_mm256_zeroupper();
+	return memchr2_scalar(s, a, b, e - s);
+}
+
+__attribute__((target("avx2")))
+static size_t memcount_avx2(const char *s, int c, size_t n)
+{
+	const char *e = s + n;
+	__m256i vc = _mm256_set1_epi8((char) c);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i total = zero;
+	uint64_t lanes[4];
+
+	while (e - s >= 32) {
+		__m256i acc = zero;
+		int rounds = 0;
+
+		while ((e - s >= 32) && (rounds < 255)) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) s);
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, vc));
+			s += 32;
+			rounds++;
+		}
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+	}
+	_mm256_storeu_si256((__m256i *) lanes, total);
+	_mm256_zeroupper();
+	return (size_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]) + memcount_scalar(s, c, e - s);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+/*******************************************************************************
+ *                       Dispatch                                              *
+ *******************************************************************************/
+
+static eScanImpl scan_best_impl(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return eScanAVX2;
+#endif
+#ifdef __SSE2__
+	return eScanSSE2;
+#else
+	return eScanScalar;
+#endif
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief select the code path of the delimiter scanners; mostly there for benchmarks and tests.
+ * @param Want the implementation we'd like; eScanBest for the fastest this CPU can do
+ * @returns the implementation we actually got; never better than the CPU can do
+ */
+eScanImpl CtdlScanSelectImpl(eScanImpl Want)
+{
+	eScanImpl Best = scan_best_impl();
+
+	if (Want > Best)
+		Want = Best;
+	switch (Want) {
+#ifdef HAVE_X86_SIMD
+	case eScanAVX2:
+		memchr2_impl = memchr2_avx2;
+		memcount_impl = memcount_avx2;
+		break;
+#endif
+#ifdef __SSE2__
+	case eScanSSE2:
+		memchr2_impl = memchr2_sse2;
+		memcount_impl = memcount_sse2;
+		break;
+#endif
+	default:
+		Want = eScanScalar;
+		memchr2_impl = memchr2_scalar;
+		memcount_impl = memcount_scalar;
+		break;
+	}
+	return Want;
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief find the first occurance of either of two characters; memchr() for two needles.
+ * @param s where to start searching
+ * @param a first character to look for
+ * @param b second character to look for
+ * @param n how many bytes to look at; NUL bytes are nothing special here.
+ * @returns pointer to the first a or b, NULL if there is none within n bytes
+ */
+const char *ctdl_memchr2(const char *s, int a, int b, size_t n)
+{
+	if (memchr2_impl == NULL)
+		CtdlScanSelectImpl(eScanBest);
+	return memchr2_impl(s, a, b, n);
+}
+
+/**
+ * @ingroup StrBuf
+ * @brief count the occurances of a character in a memory area
+ * @param s where to start counting
+ * @param c the character to count
+ * @param n how many bytes to look at; NUL bytes are nothing special here.
+ * @returns how often c was found
+ */
+size_t ctdl_memcount(const char *s, int c, size_t n)
+{
+	if (memcount_impl == NULL)
+		CtdlScanSelectImpl(eScanBest);
+	return memcount_impl(s, c, n);
+}
@@ -155,38 +155,44 @@ unsigned int decode_hex(char *Source) {return _decode_hex(Source);}
 /*
  * Convert "quoted-printable" to binary.  Returns number of bytes decoded.
  * according to RFC2045 section 6.7
+ * Most of the text is literal; we let memchr() find the next '=' and copy
+ * everything up to it in one go.  decoded may be encoded.
  */
 int CtdlDecodeQuotedPrintable(char *decoded, char *encoded, int sourcelen) {
 	unsigned int ch;
 	int decoded_length = 0;
 	int pos = 0;
+	const char *eq;
+	int run;
 
 	while (pos < sourcelen)
 	{
-		if (*(encoded + pos) == '=')
+		eq = memchr(encoded + pos, '=', sourcelen - pos);
+		run = (eq == NULL) ? sourcelen - pos : eq - (encoded + pos);
+		if (run > 0)
+		{
+			memmove(decoded + decoded_length, encoded + pos, run);
+			decoded_length += run;
+			pos += run;
+			continue;
+		}
+
+		pos ++;
+		if (*(encoded + pos) == '\n')
+		{
+			pos ++;
+		}
+		else if (*(encoded + pos) == '\r')
 		{
 			pos ++;
 			if (*(encoded + pos) == '\n')
-			{
-				pos ++;
-			}
-			else if (*(encoded + pos) == '\r')
-			{
-				pos ++;
-				if (*(encoded + pos) == '\n')
-					pos++;
-			}
-			else
-			{
-				ch = _decode_hex(&encoded[pos]);
-				pos += 2;
-				decoded[decoded_length++] = ch;
-			}
+				pos++;
 		}
 		else
 		{
-			decoded[decoded_length++] = encoded[pos];
-			pos += 1;
+			ch = _decode_hex(&encoded[pos]);
+			pos += 2;
+			decoded[decoded_length++] = ch;
 		}
 	}
 	decoded[decoded_length] = 0;
@@ -904,6 +910,679 @@ void mime_parser(char *content_start,
 }
 
 
+/*******************************************************************************
+ *                         Streaming MIME parser                               *
+ *******************************************************************************/
+
+/*
+ * The callback parser above wants the whole message in one piece and decodes
+ * every part it passes.  This one is pulled by the caller: MimeStreamNext()
+ * reports containers opening and closing and leaf parts with their headers;
+ * the body of a leaf is only looked at if the caller asks for it through
+ * MimeStreamRawBody() / MimeStreamDecodedBody(), else we just search for the
+ * next delimiter.  Input may arrive in chunks; while working on a chunk we
+ * point into it, only what's left over when we run dry is copied.
+ * Part numbers, names and the handling of message/rfc822 match mime_parser().
+ */
+
+#define MIME_STREAM_MAXDEPTH 32
+/* every level adds at most a '.' and the ten digits of a positive int */
+#define MIME_STREAM_PARTNUM_SIZE (MIME_STREAM_MAXDEPTH * 11 + 1)
+#define MIME_STREAM_MAXHEADERS (64 * SIZ)
+
+typedef enum _eMimeStreamState {
+	eMSHeaders,	/* collecting the header block of an entity */
+	eMSPeek,	/* got the headers of a multipart child; is it empty? */
+	eMSBody,	/* in the body of a leaf part */
+	eMSSkip,	/* preamble, epilogue; nobody wants to see it */
+	eMSDelimiter,	/* Pos is on a delimiter line of Level[DelimLevel] */
+	eMSEnd		/* out of input, close what's still open */
+} eMimeStreamState;
+
+typedef enum _eMimeStreamDecode {
+	eMSIdentity,
+	eMSBase64,
+	eMSQuotedPrintable
+} eMimeStreamDecode;
+
+typedef struct _MimeStreamLevel {
+	interesting_mime_headers *m;
+	char PartNum[MIME_STREAM_PARTNUM_SIZE];
+	int PartSeq;
+	MimePartInfo Info;
+} MimeStreamLevel;
+
+struct _MimeStreamParser {
+	const char *Win;	/* what we work on: the callers chunk or Carry */
+	long WinLen;
+	long Pos;
+	int AtLineStart;	/* Pos is at the beginning of a line */
+	int Done;		/* no more input will come */
+	StrBuf *Carry;
+
+	eMimeStreamState State;
+	MimeStreamLevel *Level[MIME_STREAM_MAXDEPTH];
+	int nLevels;
+	int DelimLevel;
+
+	StrBuf *Hdr;
+	interesting_mime_headers *m;	/* headers of the current entity */
+	char PartNum[MIME_STREAM_PARTNUM_SIZE];
+	MimePartInfo Info;
+
+	long BodyRead;
+	eMimeStreamDecode Decode;
+	vStreamT *B64;
+	char QPCarry[2];
+	int nQPCarry;
+	char *Scratch;
+	long ScratchSize;
+};
+
+MimeStreamParser *NewMimeStreamParser(void)
+{
+	MimeStreamParser *P;
+
+	P = (MimeStreamParser *) malloc(sizeof(MimeStreamParser));
+	memset(P, 0, sizeof(MimeStreamParser));
+	P->Carry = NewStrBuf();
+	P->Hdr = NewStrBuf();
+	P->m = InitInterestingMimes();
+	P->AtLineStart = 1;
+	P->State = eMSHeaders;
+	return P;
+}
+
+void FreeMimeStreamParser(MimeStreamParser **pP)
+{
+	MimeStreamParser *P;
+	const char *Err;
+	int i;
+
+	if ((pP == NULL) || (*pP == NULL))
+		return;
+	P = *pP;
+	for (i = 0; i < MIME_STREAM_MAXDEPTH; i++) {
+		if (P->Level[i] == NULL)
+			break;
+		free(P->Level[i]->m);
+		free(P->Level[i]);
+	}
+	if (P->B64 != NULL)
+		StrBufDestroyStreamContext(eBase64Decode, &P->B64, &Err);
+	FreeStrBuf(&P->Carry);
+	FreeStrBuf(&P->Hdr);
+	free(P->m);
+	free(P->Scratch);
+	free(P);
+	*pP = NULL;
+}
+
+/*
+ * Keep what we didn't consume yet; the caller may reuse its buffer once we
+ * asked for more.
+ */
+static void MimeStreamHold(MimeStreamParser *P)
+{
+	if (P->Pos >= P->WinLen) {
+		FlushStrBuf(P->Carry);
+	}
+	else if (P->Win != ChrPtr(P->Carry)) {
+		StrBufPlain(P->Carry, P->Win + P->Pos, P->WinLen - P->Pos);
+	}
+	else if (P->Pos > 0) {
+		StrBufCutLeft(P->Carry, P->Pos);
+	}
+	P->Win = ChrPtr(P->Carry);
+	P->WinLen = StrLength(P->Carry);
+	P->Pos = 0;
+}
+
+void MimeStreamFeed(MimeStreamParser *P, const char *Data, long len)
+{
+	if (P->Pos < P->WinLen) {
+		MimeStreamHold(P);
+		StrBufAppendBufPlain(P->Carry, Data, len, 0);
+		P->Win = ChrPtr(P->Carry);
+		P->WinLen = StrLength(P->Carry);
+	}
+	else {
+		FlushStrBuf(P->Carry);
+		P->Win = Data;
+		P->WinLen = len;
+		P->Pos = 0;
+	}
+}
+
+void MimeStreamDone(MimeStreamParser *P)
+{
+	P->Done = 1;
+}
+
+static inline void MimeStreamConsume(MimeStreamParser *P, long Upto)
+{
+	if (Upto > P->Pos) {
+		P->AtLineStart = P->Win[Upto - 1] == '\n';
+		P->Pos = Upto;
+	}
+}
+
+static inline long MimeStreamAvail(MimeStreamParser *P)
+{
+	return P->WinLen - P->Pos;
+}
+
+/*
+ * Is there a delimiter at Win + At (which is the start of a line)?
+ * Returns the level it belongs to, -1 if there's none, -2 if we can't tell
+ * without more input.  Like FindNextContent() we only compare the prefix.
+ */
+static int MimeStreamIsDelimiter(MimeStreamParser *P, long At)
+{
+	MimeStreamLevel *L;
+	long avail = P->WinLen - At;
+	int i;
+
+	for (i = P->nLevels - 1; i >= 0; i--) {
+		L = P->Level[i];
+		if (L->m->b[startary].len == 0)
+			continue;
+		if (avail >= L->m->b[startary].len) {
+			if (!memcmp(P->Win + At, L->m->b[startary].Key, L->m->b[startary].len))
+				return i;
+		}
+		else if (!P->Done &&
+			 !memcmp(P->Win + At, L->m->b[startary].Key, avail))
+			return -2;
+	}
+	return -1;
+}
+
+/*
+ * Find the next delimiter line from Pos on.  Returns its offset and stores
+ * where the text in front of it ends (without the line break belonging to
+ * the delimiter) to *BodyEnd.  Returns -1 if there's none yet; *BodyEnd then
+ * tells how far we're sure none starts.
+ */
+static long MimeStreamFindDelimiter(MimeStreamParser *P, long *BodyEnd, int *Level)
+{
+	const char *pch;
+	long At = P->Pos;
+	long Next;
+	long lb;
+	int n;
+
+	if (P->nLevels == 0) {
+		*BodyEnd = P->WinLen;
+		return -1;
+	}
+	if (P->AtLineStart) {
+		n = MimeStreamIsDelimiter(P, At);
+		if ((n >= 0) || (n == -2)) {
+			*BodyEnd = At;
+			*Level = n;
+			return (n >= 0) ? At : -1;
+		}
+	}
+	while (1) {
+		pch = memchr(P->Win + At, '\n', P->WinLen - At);
+		if (pch == NULL) {
+			*BodyEnd = P->WinLen;
+			/* might be the CR of the next delimiters CRLF */
+			if (!P->Done && (P->WinLen > P->Pos) &&
+			    (P->Win[P->WinLen - 1] == '\r'))
+				*BodyEnd = P->WinLen - 1;
+			return -1;
+		}
+		Next = pch - P->Win + 1;
+		lb = ((pch > P->Win + P->Pos) && (*(pch - 1) == '\r')) ? 2 : 1;
+		n = MimeStreamIsDelimiter(P, Next);
+		if (n >= 0) {
+			*BodyEnd = Next - lb;
+			*Level = n;
+			return Next;
+		}
+		if ((n == -2) || ((Next == P->WinLen) && !P->Done)) {
+			*BodyEnd = Next - lb;
+			return -1;
+		}
+		At = Next;
+	}
+}
+
+static void MimeStreamFillInfo(MimePartInfo *Info, interesting_mime_headers *m, char *PartNum)
+{
+	Info->PartNum     = PartNum;
+	Info->ContentType = m->b[content_type].Key;
+	Info->Charset     = m->b[charset].Key;
+	Info->Encoding    = m->b[encoding].Key;
+	Info->Disposition = m->b[disposition].Key;
+	Info->Id          = m->b[id].Key;
+	Info->Filename    = m->b[filename].Key;
+	Info->ContentLength = m->content_length;
+	if (m->b[content_disposition_name].len > m->b[content_type_name].len)
+		Info->Name = m->b[content_disposition_name].Key;
+	else
+		Info->Name = m->b[content_type_name].Key;
+}
+
+/*
+ * Open a container level for the current entity; its headers move over.
+ */
+static MimeStreamLevel *MimeStreamPush(MimeStreamParser *P)
+{
+	interesting_mime_headers *swap;
+	MimeStreamLevel *L;
+
+	L = P->Level[P->nLevels];
+	if (L == NULL) {
+		L = (MimeStreamLevel *) malloc(sizeof(MimeStreamLevel));
+		L->m = InitInterestingMimes();
+		P->Level[P->nLevels] = L;
+	}
+	P->nLevels ++;
+	swap = L->m;
+	L->m = P->m;
+	P->m = swap;
+	FlushInterestingMimes(P->m);
+
+	strcpy(L->PartNum, P->PartNum);
+	L->PartSeq = 0;
+	if (L->m->is_multipart)
+		L->m->b[startary].len = snprintf(L->m->b[startary].Key, SIZ, "--%s", L->m->b[boundary].Key);
+	else
+		L->m->b[startary].len = 0;
+	MimeStreamFillInfo(&L->Info, L->m, L->PartNum);
+	return L;
+}
+
+static void MimeStreamNextPartNum(MimeStreamParser *P, MimeStreamLevel *L)
+{
+	int n;
+
+	if (!IsEmptyStr(L->PartNum)) {
+		n = snprintf(P->PartNum, sizeof P->PartNum, "%s.%d", L->PartNum, ++L->PartSeq);
+	}
+	else {
+		n = snprintf(P->PartNum, sizeof P->PartNum, "%d", ++L->PartSeq);
+	}
+	/*
+	 * Can't happen with the buffer sized for MIME_STREAM_MAXDEPTH.  If it
+	 * did, a clipped number would name some other part; hand out the one of
+	 * the enclosing entity instead, like we do for anything nested deeper.
+	 */
+	if ((n < 0) || (n >= sizeof P->PartNum)) {
+		strcpy(P->PartNum, L->PartNum);
+	}
+}
+
+/*
+ * The headers of the current entity are complete; parse them like
+ * the_mime_parser() would.
+ */
+static void MimeStreamParseHeaders(MimeStreamParser *P)
+{
+	char *ptr;
+	char *enc;
+
+	FlushInterestingMimes(P->m);
+	ptr = (char *) ChrPtr(P->Hdr);
+	/* the header block ends in a blank line, so parse_MimeHeaders() won't hit the end */
+	parse_MimeHeaders(P->m, &ptr, ptr + StrLength(P->Hdr) + 1);
+	FlushStrBuf(P->Hdr);
+
+	/* Some encodings aren't really encodings */
+	enc = P->m->b[encoding].Key;
+	if (!strcasecmp(enc, "7bit") ||
+	    !strcasecmp(enc, "8bit") ||
+	    !strcasecmp(enc, "binary") ||
+	    !strcasecmp(enc, "ISO-8859-1"))
+	{
+		*enc = '\0';
+		P->m->b[encoding].len = 0;
+	}
+}
+
+/*
+ * Collect the header block; returns 1 when it's complete, 0 if we need more
+ * input, -1 if the entity ended before its headers did.
+ */
+static int MimeStreamReadHeaders(MimeStreamParser *P)
+{
+	const char *pch;
+	long len;
+	long i;
+	int n;
+
+	while (1) {
+		if (P->AtLineStart && (P->nLevels > 0)) {
+			n = MimeStreamIsDelimiter(P, P->Pos);
+			if (n == -2)
+				return 0;
+			if (n >= 0) {
+				P->DelimLevel = n;
+				return -1;
+			}
+		}
+		pch = memchr(P->Win + P->Pos, '\n', MimeStreamAvail(P));
+		if (pch == NULL) {
+			if (!P->Done)
+				return 0;
+			MimeStreamConsume(P, P->WinLen);
+			P->DelimLevel = -1;
+			return -1;
+		}
+		len = pch - (P->Win + P->Pos) + 1;
+		if (StrLength(P->Hdr) < MIME_STREAM_MAXHEADERS)
+			StrBufAppendBufPlain(P->Hdr, P->Win + P->Pos, len, 0);
+		MimeStreamConsume(P, P->Pos + len);
+
+		for (i = 0; (i < len - 1) && (*(pch - len + 1 + i) == '\r'); i++);
+		if (i == len - 1)
+			return 1;
+	}
+}
+
+/*
+ * mime_parser() drops multipart children with less than 3 bytes of body and
+ * doesn't count them; so do we.  Returns 1 if it's one of those, 0 if not,
+ * -1 if we need more input to decide.
+ */
+static int MimeStreamPeekEmpty(MimeStreamParser *P)
+{
+	long At;
+	int n;
+
+	for (At = P->Pos; At < P->Pos + 3; At++) {
+		if (At > P->WinLen)
+			return (P->Done) ? 0 : -1;
+		if ((At == P->Pos) ? !P->AtLineStart : (P->Win[At - 1] != '\n'))
+			continue;
+		if (At >= P->WinLen)
+			return (P->Done) ? 0 : -1;
+		n = MimeStreamIsDelimiter(P, At);
+		if (n == -2)
+			return -1;
+		if (n >= 0) {
+			P->DelimLevel = n;
+			MimeStreamConsume(P, At);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static eMimeEvent MimeStreamNeedMore(MimeStreamParser *P)
+{
+	if (P->Done) {
+		MimeStreamConsume(P, P->WinLen);
+		P->State = eMSEnd;
+		return eMimeEnd;
+	}
+	MimeStreamHold(P);
+	return eMimeNeedMore;
+}
+
+eMimeEvent MimeStreamNext(MimeStreamParser *P, MimePartInfo **Info)
+{
+	MimeStreamLevel *L;
+	const char *pch;
+	const char *Err;
+	long BodyEnd;
+	long Delim;
+	int n;
+
+	*Info = NULL;
+	while (1) switch (P->State)
+	{
+	case eMSHeaders:
+		n = MimeStreamReadHeaders(P);
+		if (n == 0) {
+			if (MimeStreamNeedMore(P) == eMimeNeedMore)
+				return eMimeNeedMore;
+			break;
+		}
+		if (n < 0) {
+			/* like mime_parser(), we don't report an entity without a complete header block */
+			FlushStrBuf(P->Hdr);
+			if ((P->nLevels > 0) && (P->Level[P->nLevels - 1]->m->is_multipart))
+				P->Level[P->nLevels - 1]->PartSeq --;
+			P->State = (P->DelimLevel >= 0) ? eMSDelimiter : eMSEnd;
+			break;
+		}
+		MimeStreamParseHeaders(P);
+		if ((P->nLevels > 0) && (P->Level[P->nLevels - 1]->m->is_multipart)) {
+			P->State = eMSPeek;
+			break;
+		}
+		/* fall through */
+	case eMSPeek:
+		if (P->State == eMSPeek) {
+			n = MimeStreamPeekEmpty(P);
+			if (n < 0) {
+				MimeStreamHold(P);
+				return eMimeNeedMore;
+			}
+			if (n > 0) {
+				P->Level[P->nLevels - 1]->PartSeq --;
+				P->State = eMSDelimiter;
+				break;
+			}
+		}
+		if (P->m->is_multipart && (P->nLevels < MIME_STREAM_MAXDEPTH)) {
+			L = MimeStreamPush(P);
+			P->State = eMSSkip;
+			*Info = &L->Info;
+			return eMimeMultipartStart;
+		}
+		MimeStreamFillInfo(&P->Info, P->m, fixed_partnum(P->PartNum));
+		P->BodyRead = 0;
+		P->nQPCarry = 0;
+		if (!strcasecmp(P->m->b[encoding].Key, "base64"))
+			P->Decode = eMSBase64;
+		else if (!strcasecmp(P->m->b[encoding].Key, "quoted-printable"))
+			P->Decode = eMSQuotedPrintable;
+		else
+			P->Decode = eMSIdentity;
+		if (P->Decode == eMSBase64) {
+			/* the previous one may have been left half read */
+			if (P->B64 != NULL)
+				StrBufDestroyStreamContext(eBase64Decode, &P->B64, &Err);
+			P->B64 = StrBufNewStreamContext(eBase64Decode, &Err);
+		}
+		P->State = eMSBody;
+		*Info = &P->Info;
+		return eMimePart;
+
+	case eMSBody:
+		/* nobody read an encapsulated message? then look into it. */
+		if ((P->BodyRead == 0) &&
+		    !strcasecmp(P->m->b[content_type].Key, "message/rfc822") &&
+		    (P->nLevels < MIME_STREAM_MAXDEPTH))
+		{
+			L = MimeStreamPush(P);
+			MimeStreamNextPartNum(P, L);
+			P->State = eMSHeaders;
+			*Info = &L->Info;
+			return eMimeMultipartStart;
+		}
+		P->State = eMSSkip;
+		/* fall through */
+	case eMSSkip:
+		Delim = MimeStreamFindDelimiter(P, &BodyEnd, &n);
+		if (Delim >= 0) {
+			MimeStreamConsume(P, Delim);
+			P->DelimLevel = n;
+			P->State = eMSDelimiter;
+			break;
+		}
+		MimeStreamConsume(P, BodyEnd);
+		if (MimeStreamNeedMore(P) == eMimeNeedMore)
+			return eMimeNeedMore;
+		break;
+
+	case eMSDelimiter:
+		/* a delimiter of an outer level closes everything inside of it */
+		if (P->nLevels - 1 > P->DelimLevel) {
+			L = P->Level[--P->nLevels];
+			*Info = &L->Info;
+			return eMimeMultipartEnd;
+		}
+		L = P->Level[P->DelimLevel];
+		if (!P->Done && (MimeStreamAvail(P) < L->m->b[startary].len + 2)) {
+			MimeStreamHold(P);
+			return eMimeNeedMore;
+		}
+		if ((MimeStreamAvail(P) >= L->m->b[startary].len + 2) &&
+		    (P->Win[P->Pos + L->m->b[startary].len] == '-') &&
+		    (P->Win[P->Pos + L->m->b[startary].len + 1] == '-'))
+		{
+			MimeStreamConsume(P, P->Pos + L->m->b[startary].len + 2);
+			P->nLevels --;
+			P->State = eMSSkip;
+			*Info = &L->Info;
+			return eMimeMultipartEnd;
+		}
+		pch = memchr(P->Win + P->Pos, '\n', MimeStreamAvail(P));
+		if (pch == NULL) {
+			if (MimeStreamNeedMore(P) == eMimeNeedMore)
+				return eMimeNeedMore;
+			break;
+		}
+		MimeStreamConsume(P, pch - P->Win + 1);
+		MimeStreamNextPartNum(P, L);
+		P->State = eMSHeaders;
+		break;
+
+	case eMSEnd:
+		if (P->nLevels > 0) {
+			L = P->Level[--P->nLevels];
+			*Info = &L->Info;
+			return eMimeMultipartEnd;
+		}
+		return eMimeEnd;
+	}
+}
+
+long MimeStreamRawBody(MimeStreamParser *P, const char **Data)
+{
+	long BodyEnd;
+	long Delim;
+	long len;
+	int n;
+
+	*Data = NULL;
+	if (P->State != eMSBody)
+		return 0;
+
+	Delim = MimeStreamFindDelimiter(P, &BodyEnd, &n);
+	if (BodyEnd > P->Pos) {
+		*Data = P->Win + P->Pos;
+		len = BodyEnd - P->Pos;
+		MimeStreamConsume(P, BodyEnd);
+		P->BodyRead += len;
+		return len;
+	}
+	if (Delim >= 0) {
+		MimeStreamConsume(P, Delim);
+		P->DelimLevel = n;
+		P->State = eMSDelimiter;
+		return 0;
+	}
+	if (P->Done) {
+		MimeStreamConsume(P, P->WinLen);
+		P->State = eMSEnd;
+		return 0;
+	}
+	MimeStreamHold(P);
+	return -1;
+}
+
+/*
+ * QP escapes may be cut in two by the chunking; keep the head of an
+ * incomplete one for the next round.
+ */
+static long MimeStreamDecodeQP(MimeStreamParser *P, StrBuf *Target, const char *Data, long len, int Last)
+{
+	long keep = 0;
+	long have;
+
+	have = P->nQPCarry + len;
+	if (have + 3 > P->ScratchSize) {
+		free(P->Scratch);
+		P->ScratchSize = have + SIZ;
+		P->Scratch = (char *) malloc(P->ScratchSize);
+	}
+	memcpy(P->Scratch, P->QPCarry, P->nQPCarry);
+	memcpy(P->Scratch + P->nQPCarry, Data, len);
+
+	if (!Last) {
+		if ((have > 0) && (P->Scratch[have - 1] == '='))
+			keep = 1;
+		else if ((have > 1) && (P->Scratch[have - 2] == '='))
+			keep = 2;
+	}
+	else if ((have == 1) && (P->Scratch[0] == '=')) {
+		/* a soft line break right in front of the delimiter */
+		have = 0;
+	}
+	have -= keep;
+	memcpy(P->QPCarry, P->Scratch + have, keep);
+	P->nQPCarry = keep;
+	memset(P->Scratch + have, 0, 3);
+
+	if (have == 0)
+		return 0;
+	have = CtdlDecodeQuotedPrintable(P->Scratch, P->Scratch, have);
+	StrBufAppendBufPlain(Target, P->Scratch, have, 0);
+	return have;
+}
+
+long MimeStreamDecodedBody(MimeStreamParser *P, StrBuf *Target)
+{
+	IOBuffer IOTarget;
+	const char *Data;
+	const char *Err;
+	long Before;
+	long len;
+
+	memset(&IOTarget, 0, sizeof(IOBuffer));
+	IOTarget.Buf = Target;
+	Before = StrLength(Target);
+	while (1) {
+		len = MimeStreamRawBody(P, &Data);
+		if (len == 0) {
+			/* end of the part; flush what the decoders held back */
+			if (P->Decode == eMSBase64)
+				StrBufStreamTranscode(eBase64Decode, &IOTarget, NULL, NULL, 0, P->B64, 1, &Err);
+			else if (P->Decode == eMSQuotedPrintable)
+				MimeStreamDecodeQP(P, Target, "", 0, 1);
+			P->Decode = eMSIdentity;
+		}
+		if (len <= 0) {
+			if (StrLength(Target) > Before)
+				return StrLength(Target) - Before;
+			return len;
+		}
+
+		switch (P->Decode) {
+		case eMSBase64:
+			StrBufStreamTranscode(eBase64Decode, &IOTarget, NULL, Data, len, P->B64, 0, &Err);
+			break;
+		case eMSQuotedPrintable:
+			MimeStreamDecodeQP(P, Target, Data, len, 0);
+			break;
+		case eMSIdentity:
+			StrBufAppendBufPlain(Target, Data, len, 0);
+			break;
+		}
+		if (StrLength(Target) > Before)
+			return StrLength(Target) - Before;
+	}
+}
+
+
+
 
 
 
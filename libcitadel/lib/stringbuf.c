@@ -20,6 +20,7 @@
 #include "sysdep.h"
 #include <ctype.h>
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <string.h>
@@ -150,6 +151,7 @@ struct StrBuf {
 	long BufSize;      /**< how many spcae do we optain */
 	long BufUsed;      /**< StNumber of Chars used excluding the trailing \\0 */
 	int ConstBuf;      /**< are we just a wrapper arround a static buffer and musn't we be changed? */
+	int InArena;       /**< do we or our buffer live in a @ref StrBufArena? then we musn't free() them. */
 #ifdef SIZE_DEBUG
 	long nIncreases;   /**< for profiling; cound how many times we needed more */
 	char bt [SIZ];     /**< Stacktrace of last increase */
@@ -249,6 +251,290 @@ void dbg_Init(StrBuf *Buf)
 
 #endif
 
+/*******************************************************************************
+ *                   Where StrBufs get their memory from                       *
+ *******************************************************************************/
+
+/**
+ * @defgroup StrBuf_Alloc Memory management of StrBufs
+ * @ingroup StrBuf
+ * StrBuf headers and buffers come from malloc(); but since most of them are
+ * short lived and power of two sized, each thread keeps the ones it frees in
+ * size classed slabs to hand them out again without asking malloc().
+ * Those blocks are still plain malloc() memory, so anybody may free() them,
+ * i.e. the result of @ref SmashStrBuf.
+ * Apart from that, request scoped code may carve its StrBufs out of a
+ * @ref StrBufArena, which releases them all in one shot.
+ */
+
+#define STRBUF_SLAB_MIN_SHIFT 4		/**< smallest size class: 16 bytes */
+#define STRBUF_SLAB_MAX_SHIFT 16	/**< biggest size class: 64k */
+#define STRBUF_SLAB_CLASSES (STRBUF_SLAB_MAX_SHIFT - STRBUF_SLAB_MIN_SHIFT + 1)
+#define STRBUF_SLAB_BYTES (64 * 1024)	/**< keep this many bytes per size class and thread... */
+#define STRBUF_SLAB_MIN_BLOCKS 4	/**< ...but at least this many blocks */
+
+#define STRBUF_ARENA_HDR 1		/**< the StrBuf struct lives in an arena */
+#define STRBUF_ARENA_BUF 2		/**< the buffer lives in an arena */
+
+#ifdef HAVE_TLS
+#define STRBUF_THREAD __thread
+#else
+#define STRBUF_THREAD
+#endif
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_TLS)
+#include <pthread.h>
+#define STRBUF_SLABS
+#endif
+
+typedef struct _StrBufSlab {
+	void *Free;		/**< singly linked through the first bytes of the blocks */
+	long nFree;
+} StrBufSlab;
+
+typedef struct _StrBufThreadCache {
+	StrBufSlab Class[STRBUF_SLAB_CLASSES];
+	StrBufSlab Hdrs;	/**< StrBuf structs */
+	int Registered;		/**< does our thread know to drain us when exiting? */
+} StrBufThreadCache;
+
+eStrBufAlloc StrBufAllocStrategy = eStrBufSlab;
+static STRBUF_THREAD StrBufAllocStats AllocStats;
+
+#ifdef STRBUF_SLABS
+static STRBUF_THREAD StrBufThreadCache StrBufCache;
+static pthread_key_t StrBufCacheKey;
+static pthread_once_t StrBufCacheOnce = PTHREAD_ONCE_INIT;
+
+static void StrBufSlabDrain(StrBufSlab *Slab)
+{
+	void *Block;
+
+	while (Slab->Free != NULL) {
+		Block = Slab->Free;
+		Slab->Free = *(void**) Block;
+		free(Block);
+	}
+	Slab->nFree = 0;
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief a thread goes away; give the blocks it kept back to malloc.
+ */
+static void StrBufCacheDestructor(void *vCache)
+{
+	StrBufThreadCache *Cache = (StrBufThreadCache*) vCache;
+	int i;
+
+	for (i = 0; i < STRBUF_SLAB_CLASSES; i++)
+		StrBufSlabDrain(&Cache->Class[i]);
+	StrBufSlabDrain(&Cache->Hdrs);
+	Cache->Registered = 0;
+}
+
+static void StrBufCacheKeyInit(void)
+{
+	pthread_key_create(&StrBufCacheKey, StrBufCacheDestructor);
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief find the slab of this thread for blocks of Size
+ * @param Size size of the block; only powers of two have a slab.
+ * @returns the slab, or NULL if we don't keep blocks of that size.
+ */
+static inline StrBufSlab *StrBufSlabOf(size_t Size)
+{
+	int Shift;
+
+	if ((StrBufAllocStrategy != eStrBufSlab) ||
+	    (Size & (Size - 1)) ||
+	    (Size < (1 << STRBUF_SLAB_MIN_SHIFT)) ||
+	    (Size > (1 << STRBUF_SLAB_MAX_SHIFT)))
+		return NULL;
+
+	if (!StrBufCache.Registered) {
+		pthread_once(&StrBufCacheOnce, StrBufCacheKeyInit);
+		pthread_setspecific(StrBufCacheKey, &StrBufCache);
+		StrBufCache.Registered = 1;
+	}
+	Shift = __builtin_ctzl(Size);
+	return &StrBufCache.Class[Shift - STRBUF_SLAB_MIN_SHIFT];
+}
+
+static inline long StrBufSlabMax(size_t Size)
+{
+	return (STRBUF_SLAB_BYTES / Size > STRBUF_SLAB_MIN_BLOCKS) ?
+		STRBUF_SLAB_BYTES / Size : STRBUF_SLAB_MIN_BLOCKS;
+}
+
+static inline void *StrBufSlabGet(StrBufSlab *Slab)
+{
+	void *Block;
+
+	if ((Slab == NULL) || (Slab->Free == NULL))
+		return NULL;
+	Block = Slab->Free;
+	Slab->Free = *(void**) Block;
+	Slab->nFree --;
+	AllocStats.SlabHits ++;
+	return Block;
+}
+
+static inline int StrBufSlabPut(StrBufSlab *Slab, void *Block, size_t Size)
+{
+	if ((Slab == NULL) || (Slab->nFree >= StrBufSlabMax(Size)))
+		return 0;
+	*(void**) Block = Slab->Free;
+	Slab->Free = Block;
+	Slab->nFree ++;
+	AllocStats.SlabPuts ++;
+	return 1;
+}
+
+static inline StrBufSlab *StrBufHdrSlab(void)
+{
+	if (StrBufAllocStrategy != eStrBufSlab)
+		return NULL;
+	if (!StrBufCache.Registered) {
+		pthread_once(&StrBufCacheOnce, StrBufCacheKeyInit);
+		pthread_setspecific(StrBufCacheKey, &StrBufCache);
+		StrBufCache.Registered = 1;
+	}
+	return &StrBufCache.Hdrs;
+}
+#else
+/* no thread local storage; we would need locking. */
+#define StrBufSlabOf(Size) NULL
+#define StrBufSlabGet(Slab) NULL
+#define StrBufSlabPut(Slab, Block, Size) 0
+#define StrBufHdrSlab() NULL
+#endif
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief choose where StrBufs get their memory from; blocks of either may be released by the other.
+ * @param Strategy @ref eStrBufMalloc or @ref eStrBufSlab
+ */
+void StrBufSetAllocStrategy(eStrBufAlloc Strategy)
+{
+	StrBufAllocStrategy = Strategy;
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief tell how many allocations the StrBufs of the calling thread did
+ * @param Stats will be filled with the counters
+ * @param Reset should we start counting from 0 again?
+ */
+void StrBufGetAllocStats(StrBufAllocStats *Stats, int Reset)
+{
+	if (Stats != NULL)
+		memcpy(Stats, &AllocStats, sizeof(StrBufAllocStats));
+	if (Reset)
+		memset(&AllocStats, 0, sizeof(StrBufAllocStats));
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief get a block of memory for a buffer
+ * @param Size how big?
+ */
+static inline char *StrBufMemAlloc(size_t Size)
+{
+	char *Block;
+
+	Block = (char*) StrBufSlabGet(StrBufSlabOf(Size));
+	if (Block != NULL)
+		return Block;
+	AllocStats.Mallocs ++;
+	return (char*) malloc(Size);
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief release a block of memory we got from @ref StrBufMemAlloc or malloc()
+ * @param Block the memory to release
+ * @param Size how big it is; may be less than it was allocated with.
+ */
+static inline void StrBufMemFree(char *Block, size_t Size)
+{
+	if (Block == NULL)
+		return;
+	if (StrBufSlabPut(StrBufSlabOf(Size), Block, Size))
+		return;
+	AllocStats.Frees ++;
+	free(Block);
+}
+
+static inline StrBuf *StrBufHdrAlloc(void)
+{
+	StrBuf *NewBuf;
+
+	NewBuf = (StrBuf*) StrBufSlabGet(StrBufHdrSlab());
+	if (NewBuf == NULL) {
+		AllocStats.Mallocs ++;
+		NewBuf = (StrBuf*) malloc(sizeof(StrBuf));
+		if (NewBuf == NULL)
+			return NULL;
+	}
+	NewBuf->InArena = 0;
+	return NewBuf;
+}
+
+static inline void StrBufHdrFree(StrBuf *FreeMe)
+{
+	if (FreeMe->InArena & STRBUF_ARENA_HDR) {
+		/* the arena will reclaim it, but mustn't look at the buffer anymore. */
+		FreeMe->buf = NULL;
+		FreeMe->BufSize = 0;
+		FreeMe->BufUsed = 0;
+		FreeMe->InArena = STRBUF_ARENA_HDR;
+		return;
+	}
+	if (StrBufSlabPut(StrBufHdrSlab(), FreeMe, sizeof(StrBuf)))
+		return;
+	AllocStats.Frees ++;
+	free(FreeMe);
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief let go of the buffer of Buf, if its ours
+ * @param Buf the buffer whose memory we don't need anymore
+ */
+static inline void StrBufReleaseMem(StrBuf *Buf)
+{
+	if (Buf->ConstBuf)
+		return;
+	if (Buf->InArena & STRBUF_ARENA_BUF) {
+		Buf->InArena &= ~STRBUF_ARENA_BUF;
+		return;
+	}
+	StrBufMemFree(Buf->buf, Buf->BufSize);
+}
+
+/**
+ * @ingroup StrBuf_Alloc
+ * @brief move the buffer of Buf out of its arena, so it may live longer
+ * @param Buf the buffer to set free
+ * @returns 0 if we failed to get memory
+ */
+static int StrBufUnArena(StrBuf *Buf)
+{
+	char *NewBuf;
+
+	if ((Buf == NULL) || !(Buf->InArena & STRBUF_ARENA_BUF))
+		return 1;
+	NewBuf = StrBufMemAlloc(Buf->BufSize);
+	if (NewBuf == NULL)
+		return 0;
+	memcpy(NewBuf, Buf->buf, Buf->BufUsed + 1);
+	Buf->buf = NewBuf;
+	Buf->InArena &= ~STRBUF_ARENA_BUF;
+	return 1;
+}
+
 /**
  * @ingroup StrBuf
  * @brief swaps the contents of two StrBufs
@@ -259,11 +545,22 @@ void dbg_Init(StrBuf *Buf)
 static inline void iSwapBuffers(StrBuf *A, StrBuf *B)
 {
 	StrBuf C;
+	int InArena;
+
+	/* arena buffers mustn't wander off into longer living StrBufs */
+	if ((A->InArena | B->InArena) & STRBUF_ARENA_BUF) {
+		StrBufUnArena(A);
+		StrBufUnArena(B);
+	}
+	InArena = A->InArena;
 
 	memcpy(&C, A, sizeof(*A));
 	memcpy(A, B, sizeof(*B));
 	memcpy(B, &C, sizeof(C));
 
+	/* ...while the structs stay where they are. */
+	B->InArena = A->InArena;
+	A->InArena = InArena;
 }
 
 void SwapBuffers(StrBuf *A, StrBuf *B)
@@ -322,20 +619,37 @@ static int IncreaseBuf(StrBuf *Buf, int KeepOriginal, int DestSize)
 	if (NewSize == 0)
 		return -1;
 
-	NewBuf= (char*) malloc(NewSize);
-	if (NewBuf == NULL)
-		return -1;
-
 	if (KeepOriginal && (Buf->BufUsed > 0))
 	{
-		memcpy(NewBuf, Buf->buf, Buf->BufUsed);
+		/*
+		 * if our slab has one, copying is cheaper than asking malloc;
+		 * else realloc may be able to grow it in place.
+		 */
+		NewBuf = (char*) StrBufSlabGet(StrBufSlabOf(NewSize));
+		if ((NewBuf == NULL) && (Buf->InArena & STRBUF_ARENA_BUF))
+			NewBuf = StrBufMemAlloc(NewSize);
+		if (NewBuf != NULL)
+		{
+			memcpy(NewBuf, Buf->buf, Buf->BufUsed);
+			StrBufReleaseMem(Buf);
+		}
+		else
+		{
+			AllocStats.Reallocs ++;
+			NewBuf = (char*) realloc(Buf->buf, NewSize);
+			if (NewBuf == NULL)
+				return -1;
+		}
 	}
 	else
 	{
+		NewBuf = StrBufMemAlloc(NewSize);
+		if (NewBuf == NULL)
+			return -1;
 		NewBuf[0] = '\0';
 		Buf->BufUsed = 0;
+		StrBufReleaseMem(Buf);
 	}
-	free (Buf->buf);
 	Buf->buf = NewBuf;
 	Buf->BufSize = NewSize;
 
@@ -356,8 +670,8 @@ void ReAdjustEmptyBuf(StrBuf *Buf, long ThreshHold, long NewSize)
 	if ((Buf != NULL) && 
 	    (Buf->BufUsed == 0) &&
 	    (Buf->BufSize < ThreshHold)) {
-		free(Buf->buf);
-		Buf->buf = (char*) malloc(NewSize);
+		StrBufReleaseMem(Buf);
+		Buf->buf = StrBufMemAlloc(NewSize);
 		Buf->BufUsed = 0;
 		Buf->BufSize = NewSize;
 	}
@@ -379,13 +693,13 @@ long StrBufShrinkToFit(StrBuf *Buf, int Force)
 	{
 		char *TmpBuf;
 
-		TmpBuf = (char*) malloc(Buf->BufUsed + 1);
+		TmpBuf = StrBufMemAlloc(Buf->BufUsed + 1);
 		if (TmpBuf == NULL)
 			return -1;
 
 		memcpy (TmpBuf, Buf->buf, Buf->BufUsed + 1);
+		StrBufReleaseMem(Buf);
 		Buf->BufSize = Buf->BufUsed + 1;
-		free(Buf->buf);
 		Buf->buf = TmpBuf;
 	}
 	return Buf->BufUsed;
@@ -400,14 +714,14 @@ StrBuf* NewStrBuf(void)
 {
 	StrBuf *NewBuf;
 
-	NewBuf = (StrBuf*) malloc(sizeof(StrBuf));
+	NewBuf = StrBufHdrAlloc();
 	if (NewBuf == NULL)
 		return NULL;
 
-	NewBuf->buf = (char*) malloc(BaseStrBufSize);
+	NewBuf->buf = StrBufMemAlloc(BaseStrBufSize);
 	if (NewBuf->buf == NULL)
 	{
-		free(NewBuf);
+		StrBufHdrFree(NewBuf);
 		return NULL;
 	}
 	NewBuf->buf[0] = '\0';
@@ -433,14 +747,14 @@ StrBuf* NewStrBufDup(const StrBuf *CopyMe)
 	if (CopyMe == NULL)
 		return NewStrBuf();
 
-	NewBuf = (StrBuf*) malloc(sizeof(StrBuf));
+	NewBuf = StrBufHdrAlloc();
 	if (NewBuf == NULL)
 		return NULL;
 
-	NewBuf->buf = (char*) malloc(CopyMe->BufSize);
+	NewBuf->buf = StrBufMemAlloc(CopyMe->BufSize);
 	if (NewBuf->buf == NULL)
 	{
-		free(NewBuf);
+		StrBufHdrFree(NewBuf);
 		return NULL;
 	}
 
@@ -538,7 +852,7 @@ StrBuf* NewStrBufPlain(const char* ptr, int nChars)
 	size_t Siz = BaseStrBufSize;
 	size_t CopySize;
 
-	NewBuf = (StrBuf*) malloc(sizeof(StrBuf));
+	NewBuf = StrBufHdrAlloc();
 	if (NewBuf == NULL)
 		return NULL;
 
@@ -552,14 +866,14 @@ StrBuf* NewStrBufPlain(const char* ptr, int nChars)
 
 	if (Siz == 0)
 	{
-		free(NewBuf);
+		StrBufHdrFree(NewBuf);
 		return NULL;
 	}
 
-	NewBuf->buf = (char*) malloc(Siz);
+	NewBuf->buf = StrBufMemAlloc(Siz);
 	if (NewBuf->buf == NULL)
 	{
-		free(NewBuf);
+		StrBufHdrFree(NewBuf);
 		return NULL;
 	}
 	NewBuf->BufSize = Siz;
@@ -634,7 +948,7 @@ StrBuf* _NewConstStrBuf(const char* StringConstant, size_t SizeOfStrConstant)
 {
 	StrBuf *NewBuf;
 
-	NewBuf = (StrBuf*) malloc(sizeof(StrBuf));
+	NewBuf = StrBufHdrAlloc();
 	if (NewBuf == NULL)
 		return NULL;
 	NewBuf->buf = (char*) StringConstant;
@@ -699,9 +1013,8 @@ void FreeStrBuf (StrBuf **FreeMe)
 
 	dbg_FreeStrBuf(FreeMe, 'F');
 
-	if (!(*FreeMe)->ConstBuf) 
-		free((*FreeMe)->buf);
-	free(*FreeMe);
+	StrBufReleaseMem(*FreeMe);
+	StrBufHdrFree(*FreeMe);
 	*FreeMe = NULL;
 }
 
@@ -723,8 +1036,11 @@ char *SmashStrBuf (StrBuf **SmashMe)
 	
 	dbg_FreeStrBuf(SmashMe, 'S');
 
+	/* the callee will free() it, so it has to be ours to give. */
+	if (!StrBufUnArena(*SmashMe))
+		return NULL;
 	Ret = (*SmashMe)->buf;
-	free(*SmashMe);
+	StrBufHdrFree(*SmashMe);
 	*SmashMe = NULL;
 	return Ret;
 }
@@ -743,9 +1059,207 @@ void HFreeStrBuf (void *VFreeMe)
 
 	dbg_FreeStrBuf(SmashMe, 'H');
 
-	if (!FreeMe->ConstBuf) 
-		free(FreeMe->buf);
-	free(FreeMe);
+	StrBufReleaseMem(FreeMe);
+	StrBufHdrFree(FreeMe);
+}
+
+
+/*******************************************************************************
+ *                  Request scoped StrBufs                                     *
+ *******************************************************************************/
+
+#define STRBUF_ARENA_CHUNK (16 * 1024)
+#define STRBUF_ARENA_ALIGN(a) (((a) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+typedef struct _StrBufArenaChunk {
+	struct _StrBufArenaChunk *Next;
+	long Size;
+} StrBufArenaChunk;
+
+/* the StrBufs we hand out; we need to find the ones which outgrew us again. */
+typedef struct _ArenaStrBuf {
+	struct _ArenaStrBuf *Next;
+	StrBuf Buf;
+} ArenaStrBuf;
+
+struct StrBufArena {
+	StrBufArenaChunk *Chunks;	/**< the first one is the one we're carving from */
+	char *Pos;			/**< next free byte in it */
+	char *End;
+	long ChunkSize;
+	ArenaStrBuf *Bufs;		/**< everything we handed out */
+};
+
+/**
+ * @ingroup StrBuf_DeConstructors
+ * @brief create a new arena for request scoped StrBufs
+ * @param ChunkSize how much memory to grab at once; 0 for the default
+ * @returns the arena; release it with @ref FreeStrBufArena
+ */
+StrBufArena *NewStrBufArena(long ChunkSize)
+{
+	StrBufArena *Arena;
+
+	Arena = (StrBufArena*) malloc(sizeof(StrBufArena));
+	if (Arena == NULL)
+		return NULL;
+	memset(Arena, 0, sizeof(StrBufArena));
+	Arena->ChunkSize = (ChunkSize > 0) ? ChunkSize : STRBUF_ARENA_CHUNK;
+	return Arena;
+}
+
+/**
+ * @ingroup StrBuf_DeConstructors
+ * @brief carve some memory out of an arena
+ * @param Arena the arena to take it from
+ * @param Size how much?
+ * @returns the memory, or NULL if we couldn't get a new chunk
+ */
+static void *StrBufArenaAlloc(StrBufArena *Arena, long Size)
+{
+	StrBufArenaChunk *Chunk;
+	void *Ret;
+
+	Size = STRBUF_ARENA_ALIGN(Size);
+	if (Arena->End - Arena->Pos < Size) {
+		long ChunkSize = Arena->ChunkSize;
+
+		if (ChunkSize < Size + (long)sizeof(StrBufArenaChunk))
+			ChunkSize = Size + sizeof(StrBufArenaChunk);
+		AllocStats.Mallocs ++;
+		Chunk = (StrBufArenaChunk*) malloc(ChunkSize);
+		if (Chunk == NULL)
+			return NULL;
+		Chunk->Size = ChunkSize;
+		Chunk->Next = Arena->Chunks;
+		Arena->Chunks = Chunk;
+		Arena->Pos = ((char*) Chunk) + STRBUF_ARENA_ALIGN(sizeof(StrBufArenaChunk));
+		Arena->End = ((char*) Chunk) + ChunkSize;
+	}
+	Ret = Arena->Pos;
+	Arena->Pos += Size;
+	AllocStats.ArenaAllocs ++;
+	return Ret;
+}
+
+/**
+ * @ingroup StrBuf_DeConstructors
+ * @brief create a new Buffer in an arena; it lives until the arena is flushed.
+ *  You may FreeStrBuf() it earlier, but you don't need to; don't keep it
+ *  beyond the arena though. Buffers growing too big move out on their own.
+ * @param Arena where to allocate it; if NULL, we're just @ref NewStrBufPlain
+ * @param ptr the c-string to copy; may be NULL to create a blank instance
+ * @param nChars How many chars should we copy; -1 if we should measure the length ourselves
+ * @returns the new stringbuffer
+ */
+StrBuf *NewStrBufArenaPlain(StrBufArena *Arena, const char* ptr, int nChars)
+{
+	ArenaStrBuf *NewABuf;
+	StrBuf *NewBuf;
+	size_t Siz = BaseStrBufSize;
+	size_t CopySize;
+
+	if (Arena == NULL)
+		return NewStrBufPlain(ptr, nChars);
+
+	if (nChars < 0)
+		CopySize = strlen((ptr != NULL)?ptr:"");
+	else
+		CopySize = nChars;
+
+	while ((Siz <= CopySize) && (Siz != 0))
+		Siz *= 2;
+
+	if (Siz == 0)
+		return NULL;
+
+	NewABuf = (ArenaStrBuf*) StrBufArenaAlloc(Arena, sizeof(ArenaStrBuf));
+	if (NewABuf == NULL)
+		return NULL;
+	NewBuf = &NewABuf->Buf;
+	NewBuf->InArena = STRBUF_ARENA_HDR;
+
+	/* big ones would eat up our chunks; they better come from the heap. */
+	if (Siz <= Arena->ChunkSize / 4) {
+		NewBuf->buf = (char*) StrBufArenaAlloc(Arena, Siz);
+		if (NewBuf->buf != NULL)
+			NewBuf->InArena |= STRBUF_ARENA_BUF;
+	}
+	else
+		NewBuf->buf = NULL;
+	if (NewBuf->buf == NULL)
+		NewBuf->buf = StrBufMemAlloc(Siz);
+	if (NewBuf->buf == NULL)
+		return NULL;
+
+	NewBuf->BufSize = Siz;
+	if (ptr != NULL) {
+		memcpy(NewBuf->buf, ptr, CopySize);
+		NewBuf->buf[CopySize] = '\0';
+		NewBuf->BufUsed = CopySize;
+	}
+	else {
+		NewBuf->buf[0] = '\0';
+		NewBuf->BufUsed = 0;
+	}
+	NewBuf->ConstBuf = 0;
+
+	dbg_Init(NewBuf);
+
+	NewABuf->Next = Arena->Bufs;
+	Arena->Bufs = NewABuf;
+	return NewBuf;
+}
+
+/**
+ * @ingroup StrBuf_DeConstructors
+ * @brief release all StrBufs taken from the arena in one shot; keep the arena for the next request.
+ * @param Arena the arena to flush
+ */
+void FlushStrBufArena(StrBufArena *Arena)
+{
+	StrBufArenaChunk *Chunk;
+	ArenaStrBuf *ABuf;
+
+	if (Arena == NULL)
+		return;
+
+	/* some of them outgrew us, and live on the heap now. */
+	for (ABuf = Arena->Bufs; ABuf != NULL; ABuf = ABuf->Next)
+		if (ABuf->Buf.buf != NULL)
+			StrBufReleaseMem(&ABuf->Buf);
+	Arena->Bufs = NULL;
+
+	/* we keep the first chunk we got, since we will need it again. */
+	while ((Arena->Chunks != NULL) && (Arena->Chunks->Next != NULL)) {
+		Chunk = Arena->Chunks;
+		Arena->Chunks = Chunk->Next;
+		AllocStats.Frees ++;
+		free(Chunk);
+	}
+	if (Arena->Chunks != NULL) {
+		Arena->Pos = ((char*) Arena->Chunks) + STRBUF_ARENA_ALIGN(sizeof(StrBufArenaChunk));
+		Arena->End = ((char*) Arena->Chunks) + Arena->Chunks->Size;
+	}
+}
+
+/**
+ * @ingroup StrBuf_DeConstructors
+ * @brief release an arena, and all StrBufs taken from it
+ * @param FreeMe Pointer Pointer to the arena to free
+ */
+void FreeStrBufArena(StrBufArena **FreeMe)
+{
+	if ((FreeMe == NULL) || (*FreeMe == NULL))
+		return;
+
+	FlushStrBufArena(*FreeMe);
+	if ((*FreeMe)->Chunks != NULL) {
+		AllocStats.Frees ++;
+		free((*FreeMe)->Chunks);
+	}
+	free(*FreeMe);
+	*FreeMe = NULL;
 }
 
 
@@ -1286,6 +1800,36 @@ int StrBufReplaceToken(StrBuf *Buf, long where, long HowLong,
 	return Buf->BufUsed;
 }
 
+/*
+ * where does the token starting at s end? like it always did, we also stop
+ * at a NUL byte inside of the buffer; returns e if we hit neither.
+ */
+static inline const char *StrBufTokenEnd(const char *s, const char *e, char separator)
+{
+	const char *pch;
+
+	pch = ctdl_memchr2(s, separator, '\0', e - s);
+	if (pch == NULL)
+		return e;
+	return pch;
+}
+
+/*
+ * replace the content of dest by len bytes at s; if dest can't grow (i.e. its
+ * one of the stack buffers of StrBufExtract_int and friends) we truncate.
+ */
+static int StrBufCopySpan(StrBuf *dest, const char *s, long len)
+{
+	if ((len >= dest->BufSize) &&
+	    (IncreaseBuf(dest, 0, len) < 0))
+		len = dest->BufSize - 1;
+
+	memcpy(dest->buf, s, len);
+	dest->buf[len] = '\0';
+	dest->BufUsed = len;
+	return len;
+}
+
 /**
  * @ingroup StrBuf_Tokenizer
  * @brief Counts the numbmer of tokens in a buffer
@@ -1295,22 +1839,9 @@ int StrBufReplaceToken(StrBuf *Buf, long where, long HowLong,
  */
 int StrBufNum_tokens(const StrBuf *source, char tok)
 {
-	char *pch, *pche;
-	long NTokens;
 	if ((source == NULL) || (source->BufUsed == 0))
 		return 0;
-	if ((source->BufUsed == 1) && (*source->buf == tok))
-		return 2;
-	NTokens = 1;
-	pch = source->buf;
-	pche = pch + source->BufUsed;
-	while (pch < pche)
-	{
-		if (*pch == tok)
-			NTokens ++;
-		pch ++;
-	}
-	return NTokens;
+	return ctdl_memcount(source->buf, tok, source->BufUsed) + 1;
 }
 
 /**
@@ -1386,16 +1917,10 @@ int StrBufRemove_token(StrBuf *Source, int parmnum, char separator)
 int StrBufExtract_tokenFromStr(StrBuf *dest, const char *Source, long SourceLen, int parmnum, char separator)
 {
 	const StrBuf Temp = {
-		(char*)Source,
-		SourceLen,
-		SourceLen,
-		1
-#ifdef SIZE_DEBUG
-		,
-		0,
-		"",
-		""
-#endif
+		.buf = (char*)Source,
+		.BufSize = SourceLen,
+		.BufUsed = SourceLen,
+		.ConstBuf = 1
 	};
 
 	return StrBufExtract_token(dest, &Temp, parmnum, separator);
@@ -1412,10 +1937,8 @@ int StrBufExtract_tokenFromStr(StrBuf *dest, const char *Source, long SourceLen,
  */
 int StrBufExtract_token(StrBuf *dest, const StrBuf *Source, int parmnum, char separator)
 {
-	const char *s, *e;		//* source * /
-	int len = 0;			//* running total length of extracted string * /
-	int current_token = 0;		//* token currently being processed * /
-	 
+	const char *s, *e, *te;
+
 	if (dest != NULL) {
 		dest->buf[0] = '\0';
 		dest->BufUsed = 0;
@@ -1429,42 +1952,17 @@ int StrBufExtract_token(StrBuf *dest, const StrBuf *Source, int parmnum, char se
 	s = Source->buf;
 	e = s + Source->BufUsed;
 
-	//cit_backtrace();
-	//lprintf (CTDL_DEBUG, "test >: n: %d sep: %c source: %s \n willi \n", parmnum, separator, source);
-
-	while ((s < e) && !IsEmptyStr(s)) {
-		if (*s == separator) {
-			++current_token;
-		}
-		if (len >= dest->BufSize) {
-			dest->BufUsed = len;
-			if (IncreaseBuf(dest, 1, -1) < 0) {
-				dest->BufUsed --;
-				break;
-			}
-		}
-		if ( (current_token == parmnum) && 
-		     (*s != separator)) {
-			dest->buf[len] = *s;
-			++len;
-		}
-		else if (current_token > parmnum) {
-			break;
-		}
-		++s;
+	while (parmnum > 0) {
+		te = StrBufTokenEnd(s, e, separator);
+		if ((te == e) || (*te == '\0'))
+			return(-1);
+		s = te + 1;
+		parmnum --;
 	}
-	
-	dest->buf[len] = '\0';
-	dest->BufUsed = len;
-		
-	if (current_token < parmnum) {
-		//lprintf (CTDL_DEBUG,"test <!: %s\n", dest);
-		return(-1);
-	}
-	//lprintf (CTDL_DEBUG,"test <: %d; %s\n", len, dest);
-	return(len);
-}
 
+	te = StrBufTokenEnd(s, e, separator);
+	return StrBufCopySpan(dest, s, te - s);
+}
 
 
 
@@ -1487,6 +1985,7 @@ int StrBufExtract_int(const StrBuf* Source, int parmnum, char separator)
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_token(&tmp, Source, parmnum, separator) > 0)
 		return(atoi(buf));
 	else
@@ -1511,6 +2010,7 @@ long StrBufExtract_long(const StrBuf* Source, int parmnum, char separator)
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_token(&tmp, Source, parmnum, separator) > 0)
 		return(atoi(buf));
 	else
@@ -1537,6 +2037,7 @@ unsigned long StrBufExtract_unsigned_long(const StrBuf* Source, int parmnum, cha
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_token(&tmp, Source, parmnum, separator) > 0) {
 		pnum = &buf[0];
 		if (*pnum == '-')
@@ -1593,9 +2094,9 @@ int StrBufHaveNextToken(const StrBuf *Source, const char **pStart)
 int StrBufExtract_NextToken(StrBuf *dest, const StrBuf *Source, const char **pStart, char separator)
 {
 	const char *s;          /* source */
+	const char *te;         /* end of our token */
 	const char *EndBuffer;  /* end stop of source buffer */
-	int current_token = 0;	/* token currently being processed */
-	int len = 0;		/* running total length of extracted string */
+	int len;		/* length of the extracted string */
 
 	if ((Source          == NULL) || 
 	    (Source->BufUsed == 0)      ) 
@@ -1630,52 +2131,36 @@ int StrBufExtract_NextToken(StrBuf *dest, const StrBuf *Source, const char **pSt
 	}
 
 	s = *pStart;
-	/* start to find the next token */
-	while ((s <= EndBuffer)      && 
-	       (current_token == 0) ) 
-	{
-		if (*s == separator) 
-		{
-			/* we found the next token */
-			++current_token;
-		}
-
-		if (len >= dest->BufSize) 
-		{
-			/* our Dest-buffer isn't big enough, increase it. */
-			dest->BufUsed = len;
-
-			if (IncreaseBuf(dest, 1, -1) < 0) {
-				/* WHUT? no more mem? bail out. */
-				s = EndBuffer;
-				dest->BufUsed --;
-				break;
-			}
-		}
-
-		if ( (current_token == 0 ) &&   /* are we in our target token? */
-		     (!IsEmptyStr(s)     ) &&
-		     (separator     != *s)    ) /* don't copy the token itself */
-		{
-			dest->buf[len] = *s;    /* Copy the payload */
-			++len;                  /* remember the bigger size. */
-		}
-
-		++s;
+	/* find the next separator; the NUL behind the buffer counts too. */
+	te = memchr(s, separator, EndBuffer - s + 1);
+	if (te == NULL) {
+		te = EndBuffer;
+		*pStart = StrBufNOTNULL;
 	}
-
-	/* did we reach the end? */
-	if ((s > EndBuffer)) {
-		EndBuffer = StrBufNOTNULL;
-		*pStart = EndBuffer;
+	else if (te + 1 > EndBuffer) {
+		*pStart = StrBufNOTNULL;
 	}
 	else {
-		*pStart = s;  /* remember the position for the next run */
+		*pStart = te + 1;  /* remember the position for the next run */
 	}
 
-	/* sanitize our extracted token */
-	dest->buf[len] = '\0';
-	dest->BufUsed  = len;
+	len = StrBufCopySpan(dest, s, te - s);
+
+	/* we never handed out NUL bytes inside of the token; squeeze them out. */
+	if ((len > 0) && (memchr(dest->buf, '\0', len) != NULL))
+	{
+		char *pch, *pche, *d;
+
+		pch = d = dest->buf;
+		pche = pch + len;
+		while (pch < pche) {
+			if (*pch != '\0')
+				*d++ = *pch;
+			pch ++;
+		}
+		*d = '\0';
+		len = dest->BufUsed = d - dest->buf;
+	}
 
 	return (len);
 }
@@ -1692,9 +2177,7 @@ int StrBufExtract_NextToken(StrBuf *dest, const StrBuf *Source, const char **pSt
  */
 int StrBufSkip_NTokenS(const StrBuf *Source, const char **pStart, char separator, int nTokens)
 {
-	const char *s, *EndBuffer;	//* source * /
-	int len = 0;			//* running total length of extracted string * /
-	int current_token = 0;		//* token currently being processed * /
+	const char *s, *EndBuffer;
 
 	if ((Source == NULL) || 
 	    (Source->BufUsed ==0)) {
@@ -1715,23 +2198,18 @@ int StrBufSkip_NTokenS(const StrBuf *Source, const char **pStart, char separator
 
 
 	s = *pStart;
-
-	//cit_backtrace();
-	//lprintf (CTDL_DEBUG, "test >: n: %d sep: %c source: %s \n willi \n", parmnum, separator, source);
-
-	while ((s < EndBuffer) && !IsEmptyStr(s)) {
-		if (*s == separator) {
-			++current_token;
-		}
-		if (current_token >= nTokens) {
+	for (;;) {
+		s = StrBufTokenEnd(s, EndBuffer, separator);
+		if ((s == EndBuffer) || (*s == '\0'))
 			break;
-		}
-		++s;
+		if (--nTokens <= 0)
+			break;
+		s ++;
 	}
 	*pStart = s;
 	(*pStart) ++;
 
-	return(len);
+	return(0);
 }
 
 /**
@@ -1752,6 +2230,7 @@ int StrBufExtractNext_int(const StrBuf* Source, const char **pStart, char separa
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_NextToken(&tmp, Source, pStart, separator) > 0)
 		return(atoi(buf));
 	else
@@ -1776,6 +2255,7 @@ long StrBufExtractNext_long(const StrBuf* Source, const char **pStart, char sepa
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_NextToken(&tmp, Source, pStart, separator) > 0)
 		return(atoi(buf));
 	else
@@ -1802,6 +2282,7 @@ unsigned long StrBufExtractNext_unsigned_long(const StrBuf* Source, const char *
 	tmp.BufSize = 64;
 	tmp.BufUsed = 0;
 	tmp.ConstBuf = 1;
+	tmp.InArena = 0;
 	if (StrBufExtract_NextToken(&tmp, Source, pStart, separator) > 0) {
 		pnum = &buf[0];
 		if (*pnum == '-')
@@ -2119,7 +2600,10 @@ void StrBufBase64Append(StrBuf *OutBuf, const StrBuf *In, const char *PlainIn, l
 	if (len == 0) 
 		return;
 
-	ExpectLen = ((len * 134) / 100) + OutBuf->BufUsed;
+	/* 4 chars per started group of 3, a CRLF per 51 bytes, and the '\0' */
+	ExpectLen = ((len + 2) / 3) * 4 + OutBuf->BufUsed + 1;
+	if (linebreaks)
+		ExpectLen += (len / 51 + 1) * 2;
 
 	if (ExpectLen > OutBuf->BufSize)
 		if (IncreaseBuf(OutBuf, 1, ExpectLen) < ExpectLen)
@@ -2805,7 +3289,16 @@ int StrBufDecodeBase64(StrBuf *Buf)
 	if (Buf == NULL)
 		return -1;
 
-	xferbuf = (char*) malloc(Buf->BufSize);
+	if (!Buf->ConstBuf) {
+		/* the decoder never writes ahead of where it reads. */
+		siz = CtdlDecodeBase64(Buf->buf,
+				       Buf->buf,
+				       Buf->BufUsed);
+		Buf->BufUsed = siz;
+		return siz;
+	}
+
+	xferbuf = StrBufMemAlloc(Buf->BufSize);
 	if (xferbuf == NULL)
 		return -1;
 
@@ -2813,7 +3306,7 @@ int StrBufDecodeBase64(StrBuf *Buf)
 	siz = CtdlDecodeBase64(xferbuf,
 			       Buf->buf,
 			       Buf->BufUsed);
-	free(Buf->buf);
+	StrBufReleaseMem(Buf);
 	Buf->buf = xferbuf;
 	Buf->BufUsed = siz;
 
@@ -2848,17 +3341,26 @@ typedef struct __z_enc_stream {
 
 vStreamT *StrBufNewStreamContext(eStreamType type, const char **Err)
 {
-	base64_decodestate *state;;
 	*Err = NULL;
 
 	switch (type)
 	{
 	case eBase64Decode:
-	case eBase64Encode:
+	{
+		base64_decodestate *state;
+
 		state = (base64_decodestate*) malloc(sizeof(base64_decodestate));
 		base64_init_decodestate(state);
 		return (vStreamT*) state;
-		break;
+	}
+	case eBase64Encode:
+	{
+		base64_encodestate *state;
+
+		state = (base64_encodestate*) malloc(sizeof(base64_encodestate));
+		base64_init_encodestate(state);
+		return (vStreamT*) state;
+	}
 	case eZLibDecode:
 	{
 
@@ -2887,21 +3389,12 @@ vStreamT *StrBufNewStreamContext(eStreamType type, const char **Err)
 
 		stream = (z_enc_stream *) malloc(sizeof(z_enc_stream));
 		memset(stream, 0, sizeof(z_enc_stream));
-		stream->OutBuf.BufSize = 4*SIZ; /// todo 64
-		stream->OutBuf.buf = (char*)malloc(stream->OutBuf.BufSize);
-		/* write gzip header */
-		stream->OutBuf.BufUsed = snprintf
-			(stream->OutBuf.buf,
-			 stream->OutBuf.BufSize, 
-			 "%c%c%c%c%c%c%c%c%c%c",
-			 gz_magic[0], gz_magic[1], Z_DEFLATED,
-			 0 /*flags */ , 0, 0, 0, 0 /*time */ , 0 /* xflags */ ,
-			 OS_CODE);
 
+		/* + 16: let zlib write the gzip header and trailer (crc and length) for us */
 		err = deflateInit2(&stream->zstream,
 				   ZLibCompressionRatio,
 				   Z_DEFLATED,
-				   -MAX_WBITS,
+				   MAX_WBITS + 16,
 				   DEF_MEM_LEVEL,
 				   Z_DEFAULT_STRATEGY);
 		if (err != Z_OK) {
@@ -2942,6 +3435,8 @@ int StrBufDestroyStreamContext(eStreamType type, vStreamT **vStream, const char
 		(void)inflateEnd(&stream->zstream);
 		free(stream->OutBuf.buf);
 		free(stream);
+		*vStream = NULL;
+		break;
 	}
 	case eZLibEncode:
 	{
@@ -2962,6 +3457,45 @@ int StrBufDestroyStreamContext(eStreamType type, vStreamT **vStream, const char
 	return rc;
 }
 
+/*
+ * the codecs take their input either from an IOBuffer or from pIn / pInLen
+ */
+static inline void StreamTranscodeInput(IOBuffer *In, const char **pIn, long *pInLen)
+{
+	if (In == NULL)
+		return;
+	if (In->ReadWritePointer != NULL) {
+		*pIn = In->ReadWritePointer;
+		*pInLen = In->Buf->BufUsed - (In->ReadWritePointer - In->Buf->buf);
+	}
+	else {
+		*pIn = In->Buf->buf;
+		*pInLen = In->Buf->BufUsed;
+	}
+}
+
+static inline void StreamTranscodeConsumed(IOBuffer *In)
+{
+	if (In == NULL)
+		return;
+	FlushStrBuf(In->Buf);
+	In->ReadWritePointer = NULL;
+}
+
+/**
+ * @ingroup StrBuf_DeEnCoder
+ * @brief feed the next piece of a stream through a codec
+ * @param type which codec; must match the one vStream was created for
+ * @param Target the output is appended to Target->Buf
+ * @param In take the input from In->Buf; NULL to use pIn / pInLen instead
+ * @param pIn plain input, if In is NULL
+ * @param pInLen length of pIn
+ * @param vStream the codec state from StrBufNewStreamContext()
+ * @param LastChunk STREAM_MORE while there's more to come; STREAM_LAST at the end of the stream;
+ *        STREAM_FLUSH to get all output up to here now (zlib), so it can be sent while the stream goes on
+ * @param Err set to a reason on error
+ * @returns 0 if all input was consumed, 1 if you need to call again, < 0 on error
+ */
 int StrBufStreamTranscode(eStreamType type, IOBuffer *Target, IOBuffer *In, const char* pIn, long pInLen, vStreamT *vStream, int LastChunk, const char **Err)
 {
 	int rc = 0;
@@ -2969,121 +3503,96 @@ int StrBufStreamTranscode(eStreamType type, IOBuffer *Target, IOBuffer *In, cons
 	{
 	case eBase64Encode:
 	{
-		/// TODO
-/*
-		// base64_decodestate *state = (base64_decodestate*)vStream;
+		base64_encodestate *state = (base64_encodestate *)vStream;
 		long ExpectLen;
-		
-		if (In != NULL)
-		{
-			pIn = In->buf;
-			pInLen = In->BufUsed;
-		}
-		if ((In == NULL) || (vStream == NULL))
-			return;
-		
-		ExpectLen = (pInLen / 4) * 3;
 
-		if (Target->BufSize - Target->BufUsed < ExpectLen)
-		{
-			IncreaseBuf(Target, 1, Target->BufUsed + ExpectLen + 1);
-		}
+		if ((Target == NULL) || (vStream == NULL))
+			return -1;
+		StreamTranscodeInput(In, &pIn, &pInLen);
+
+		/* 4 chars per 3 bytes, plus what's left in the state and the padding */
+		ExpectLen = (pInLen / 3) * 4 + 12;
+		if (Target->Buf->BufSize - Target->Buf->BufUsed < ExpectLen)
+			IncreaseBuf(Target->Buf, 1, Target->Buf->BufUsed + ExpectLen);
 
-		////	ExpectLen = base64_encode_block(pIn, pInLen, Target->buf + Target->BufUsed, state);
-		Target->BufUsed += ExpectLen;
-		Target->buf[Target->BufUsed] = '\0';
-*/
+		if ((pIn != NULL) && (pInLen > 0))
+			Target->Buf->BufUsed += base64_encode_block(pIn, pInLen, Target->Buf->buf + Target->Buf->BufUsed, state);
+		if (LastChunk) {
+			Target->Buf->BufUsed += base64_encode_blockend(Target->Buf->buf + Target->Buf->BufUsed, state, 0);
+			base64_init_encodestate(state);
+		}
+		Target->Buf->buf[Target->Buf->BufUsed] = '\0';
+		StreamTranscodeConsumed(In);
 	}
 	break;
 	case eBase64Decode:
 	{
-/*
 		base64_decodestate *state = (base64_decodestate *)vStream;
 		long ExpectLen;
-		
-		if (In != NULL)
-		{
-			pIn = In->buf;
-			pInLen = In->BufUsed;
-		}
-		if ((pIn == NULL) || (vStream == NULL))
-			return;
-		
-		ExpectLen = (pInLen / 4) * 3;
 
-		if (Target->BufSize - Target->BufUsed < ExpectLen)
-		{
-			IncreaseBuf(Target, 1, Target->BufUsed + ExpectLen + 1);
-		}
+		if ((Target == NULL) || (vStream == NULL))
+			return -1;
+		StreamTranscodeInput(In, &pIn, &pInLen);
 
-		ExpectLen = base64_decode_block(pIn, pInLen, Target->buf + Target->BufUsed, state);
-		Target->BufUsed += ExpectLen;
-		Target->buf[Target->BufUsed] = '\0';
-*/
+		ExpectLen = (pInLen / 4) * 3 + 4;
+		if (Target->Buf->BufSize - Target->Buf->BufUsed < ExpectLen)
+			IncreaseBuf(Target->Buf, 1, Target->Buf->BufUsed + ExpectLen);
+
+		if ((pIn != NULL) && (pInLen > 0))
+			Target->Buf->BufUsed += base64_decode_block(pIn, pInLen, Target->Buf->buf + Target->Buf->BufUsed, state);
+		if (LastChunk)
+			base64_init_decodestate(state);
+		Target->Buf->buf[Target->Buf->BufUsed] = '\0';
+		StreamTranscodeConsumed(In);
 	}
 	break;
 	case eZLibEncode:
 	{
 		z_enc_stream *stream = (z_enc_stream *)vStream;
-		int org_outbuf_len = stream->OutBuf.BufUsed;
-		int err;
 		unsigned int chunkavail;
+		int flush;
+		int err;
 
-		if (In->ReadWritePointer != NULL)
-		{
-			stream->zstream.next_in = (Bytef *) In->ReadWritePointer;
-			stream->zstream.avail_in = (uInt) In->Buf->BufUsed - 
-				(In->ReadWritePointer - In->Buf->buf);
-		}
-		else
-		{
-			stream->zstream.next_in = (Bytef *) In->Buf->buf;
-			stream->zstream.avail_in = (uInt) In->Buf->BufUsed;
+		if ((Target == NULL) || (vStream == NULL))
+			return -1;
+		StreamTranscodeInput(In, &pIn, &pInLen);
+
+		switch (LastChunk) {
+		case STREAM_MORE:  flush = Z_NO_FLUSH;   break;
+		case STREAM_FLUSH: flush = Z_SYNC_FLUSH; break;
+		default:           flush = Z_FINISH;     break;
 		}
-		
-		stream->zstream.next_out = (unsigned char*)stream->OutBuf.buf + stream->OutBuf.BufUsed;
-		stream->zstream.avail_out = chunkavail = (uInt) stream->OutBuf.BufSize - stream->OutBuf.BufUsed;
 
-		err = deflate(&stream->zstream,  (LastChunk) ? Z_FINISH : Z_NO_FLUSH);
+		stream->zstream.next_in = (Bytef *) pIn;
+		stream->zstream.avail_in = ((pIn != NULL) && (pInLen > 0)) ? (uInt) pInLen : 0;
 
-		stream->OutBuf.BufUsed += (chunkavail - stream->zstream.avail_out);
+		/*
+		 * deflate straight into the target; grow it as long as
+		 * zlib has more for us, so all input is consumed when we return.
+		 */
+		do {
+			if (Target->Buf->BufSize - Target->Buf->BufUsed < SIZ)
+				IncreaseBuf(Target->Buf, 1, Target->Buf->BufUsed + 4 * SIZ);
 
-		if (Target && 
-		    (LastChunk ||
-		     (stream->OutBuf.BufUsed != org_outbuf_len)
-			    ))
-		{
-			iSwapBuffers(Target->Buf, &stream->OutBuf);
-		}
+			chunkavail = (uInt) (Target->Buf->BufSize - Target->Buf->BufUsed - 1);
+			stream->zstream.next_out = (Bytef *) Target->Buf->buf + Target->Buf->BufUsed;
+			stream->zstream.avail_out = chunkavail;
 
-		if (stream->zstream.avail_in == 0)
-		{
-			FlushStrBuf(In->Buf);
-			In->ReadWritePointer = NULL;
-		}
-		else
-		{
-			if (stream->zstream.avail_in < 64)
-			{
-				memmove(In->Buf->buf,
-					In->Buf->buf + In->Buf->BufUsed - stream->zstream.avail_in,
-					stream->zstream.avail_in);
+			err = deflate(&stream->zstream, flush);
+			Target->Buf->BufUsed += chunkavail - stream->zstream.avail_out;
+		} while (((err == Z_OK) || (err == Z_BUF_ERROR)) &&
+			 ((stream->zstream.avail_in > 0) || (stream->zstream.avail_out == 0)));
+		Target->Buf->buf[Target->Buf->BufUsed] = '\0';
+		StreamTranscodeConsumed(In);
 
-				In->Buf->BufUsed = stream->zstream.avail_in;
-				In->Buf->buf[In->Buf->BufUsed] = '\0';
-			}
-			else
-			{
-				
-				In->ReadWritePointer = In->Buf->buf + 
-					(In->Buf->BufUsed - stream->zstream.avail_in);
-			}
+		if (err == Z_STREAM_END) {
+			/* ready for the next one. */
+			deflateReset(&stream->zstream);
 		}
-		rc = (LastChunk && (err != Z_FINISH));
-		if (!rc && (err != Z_OK)) {
+		else if ((err != Z_OK) && (err != Z_BUF_ERROR)) {
 			*Err = zError(err);
+			rc = -1;
 		}
-		
 	}
 	break;
 	case eZLibDecode: {
@@ -3682,6 +4191,304 @@ void  ctdl_iconv_open(const char *tocode, const char *fromcode, void *pic)
 }
 
 
+/**
+ * @defgroup StrBuf_Iconv pooled iconv descriptors
+ * @ingroup StrBuf_DeEnCoder
+ * iconv_open() loads the conversion tables, which is way more expensive
+ * than converting the one header field we usually need it for.
+ * So each thread keeps the descriptors it used last, keyed by their
+ * charsets - failed ones too, spammers like inventing charsets.
+ * Get them with @ref ctdl_iconv_acquire, hand them back with
+ * @ref ctdl_iconv_release instead of calling iconv_close().
+ */
+
+#if defined(HAVE_ICONV) && defined(STRBUF_SLABS)
+#define ICONV_POOL
+#define ICONV_POOL_SIZE 16		/**< descriptors kept per thread */
+
+typedef struct _IconvPoolEntry {
+	char tocode[32];
+	char fromcode[64];
+	iconv_t ic;			/**< (iconv_t)(-1) if iconv_open() failed */
+	int InUse;
+	unsigned long LastUse;
+} IconvPoolEntry;
+
+typedef struct _IconvPool {
+	IconvPoolEntry Entry[ICONV_POOL_SIZE];
+	int nEntries;
+	unsigned long Clock;
+	int Registered;
+} IconvPool;
+
+static STRBUF_THREAD IconvPool ThreadIconvPool;
+static pthread_key_t IconvPoolKey;
+static pthread_once_t IconvPoolOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @ingroup StrBuf_Iconv
+ * @brief a thread goes away; close the descriptors it kept.
+ */
+static void IconvPoolDestructor(void *vPool)
+{
+	IconvPool *Pool = (IconvPool*) vPool;
+	int i;
+
+	for (i = 0; i < Pool->nEntries; i++)
+		if (Pool->Entry[i].ic != (iconv_t)(-1))
+			iconv_close(Pool->Entry[i].ic);
+	Pool->nEntries = 0;
+	Pool->Registered = 0;
+}
+
+static void IconvPoolKeyInit(void)
+{
+	pthread_key_create(&IconvPoolKey, IconvPoolDestructor);
+}
+
+static IconvPool *IconvPoolGet(void)
+{
+	if (!ThreadIconvPool.Registered) {
+		pthread_once(&IconvPoolOnce, IconvPoolKeyInit);
+		pthread_setspecific(IconvPoolKey, &ThreadIconvPool);
+		ThreadIconvPool.Registered = 1;
+	}
+	return &ThreadIconvPool;
+}
+#endif
+
+/**
+ * @ingroup StrBuf_Iconv
+ * @brief like @ref ctdl_iconv_open, but reuses a descriptor this thread has opened before.
+ * You have to give it back with @ref ctdl_iconv_release
+ * @param tocode	Target encoding
+ * @param fromcode	Source encoding
+ * @param pic           anonimized pointer to iconv struct; (iconv_t)(-1) if the conversion isn't possible
+ */
+void ctdl_iconv_acquire(const char *tocode, const char *fromcode, void *pic)
+{
+#ifdef ICONV_POOL
+	IconvPool *Pool;
+	IconvPoolEntry *Entry = NULL;
+	iconv_t ic;
+	int i;
+
+	if ((strlen(tocode) >= sizeof(Entry->tocode)) ||
+	    (strlen(fromcode) >= sizeof(Entry->fromcode))) {
+		ctdl_iconv_open(tocode, fromcode, pic);
+		return;
+	}
+
+	Pool = IconvPoolGet();
+	for (i = 0; i < Pool->nEntries; i++) {
+		Entry = &Pool->Entry[i];
+		if (!Entry->InUse &&
+		    !strcasecmp(Entry->fromcode, fromcode) &&
+		    !strcasecmp(Entry->tocode, tocode))
+		{
+			Entry->LastUse = ++Pool->Clock;
+			if (Entry->ic == (iconv_t)(-1))
+				errno = EINVAL;
+			else
+				Entry->InUse = 1;
+			*(iconv_t *)pic = Entry->ic;
+			return;
+		}
+	}
+
+	ctdl_iconv_open(tocode, fromcode, &ic);
+	*(iconv_t *)pic = ic;
+
+	/* remember it in a free slot, or instead of the one we didn't need for the longest time */
+	Entry = NULL;
+	if (Pool->nEntries < ICONV_POOL_SIZE) {
+		Entry = &Pool->Entry[Pool->nEntries++];
+	}
+	else {
+		for (i = 0; i < ICONV_POOL_SIZE; i++) {
+			if (Pool->Entry[i].InUse)
+				continue;
+			if ((Entry == NULL) || (Pool->Entry[i].LastUse < Entry->LastUse))
+				Entry = &Pool->Entry[i];
+		}
+		if (Entry == NULL)
+			return; /* all of them busy; ctdl_iconv_release() will close this one. */
+		if (Entry->ic != (iconv_t)(-1))
+			iconv_close(Entry->ic);
+	}
+	memcpy(Entry->tocode, tocode, strlen(tocode) + 1);
+	memcpy(Entry->fromcode, fromcode, strlen(fromcode) + 1);
+	Entry->ic = ic;
+	Entry->InUse = (ic != (iconv_t)(-1));
+	Entry->LastUse = ++Pool->Clock;
+#else
+	ctdl_iconv_open(tocode, fromcode, pic);
+#endif
+}
+
+/**
+ * @ingroup StrBuf_Iconv
+ * @brief give back a descriptor from @ref ctdl_iconv_acquire; its conversion state is reset.
+ * @param pic           anonimized pointer to iconv struct; set to (iconv_t)(-1) afterwards.
+ */
+void ctdl_iconv_release(void *pic)
+{
+#ifdef HAVE_ICONV
+	iconv_t ic = *(iconv_t *)pic;
+#ifdef ICONV_POOL
+	IconvPool *Pool;
+	int i;
+#endif
+
+	if (ic == (iconv_t)(-1))
+		return;
+	*(iconv_t *)pic = (iconv_t)(-1);
+#ifdef ICONV_POOL
+	Pool = IconvPoolGet();
+	for (i = 0; i < Pool->nEntries; i++) {
+		if (Pool->Entry[i].InUse && (Pool->Entry[i].ic == ic)) {
+			/* back to the initial shift state, as if we had just opened it */
+			iconv(ic, NULL, NULL, NULL, NULL);
+			Pool->Entry[i].InUse = 0;
+			return;
+		}
+	}
+#endif
+	iconv_close(ic);
+#endif
+}
+
+
+/**
+ * @ingroup StrBuf_DeEnCoder
+ * @brief is this all 7 bit? we look at 8 bytes at a time.
+ */
+static inline int StrBufIsAscii(const char *pch, long len)
+{
+	const char *pche = pch + len;
+	uint64_t w;
+
+	while (pche - pch >= 8) {
+		memcpy(&w, pch, 8);
+		if (w & 0x8080808080808080ULL)
+			return 0;
+		pch += 8;
+	}
+	while (pch < pche)
+		if (*pch++ & 0x80)
+			return 0;
+	return 1;
+}
+
+/**
+ * @ingroup StrBuf_DeEnCoder
+ * @brief is this all printable 7 bit (0x20 - 0x7E)? we look at 8 bytes at a time.
+ */
+static inline int StrBufIsPrintable(const char *pch, long len)
+{
+	const char *pche = pch + len;
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	uint64_t w;
+
+	while (pche - pch >= 8) {
+		memcpy(&w, pch, 8);
+		/* any byte below 0x20, any byte above 0x7E (or 8 bit) */
+		if ((((w - ones * 0x20) & ~w) | ((w + ones * (127 - 0x7E)) | w)) & highs)
+			return 0;
+		pch += 8;
+	}
+	while (pch < pche) {
+		if ((*pch < 32) || (*pch > 126))
+			return 0;
+		pch ++;
+	}
+	return 1;
+}
+
+/**
+ * @ingroup StrBuf_DeEnCoder
+ * @brief is this valid UTF-8 by RFC 3629 (no overlong forms, no surrogates,
+ *        nothing above U+10FFFF)? iconv passes anything we accept through
+ *        unchanged. ASCII runs are skipped 8 bytes at a time.
+ */
+static int StrBufIsUtf8(const char *pchs, long len)
+{
+	const unsigned char *pch = (const unsigned char *) pchs;
+	const unsigned char *pche = pch + len;
+	unsigned char lo, hi;
+	uint64_t w;
+	int n;
+
+	while (pch < pche) {
+		while (pche - pch >= 8) {
+			memcpy(&w, pch, 8);
+			if (w & 0x8080808080808080ULL)
+				break;
+			pch += 8;
+		}
+		if (pch == pche)
+			break;
+		if (*pch < 0x80) {
+			pch ++;
+			continue;
+		}
+
+		lo = 0x80;
+		hi = 0xBF;
+		if (*pch < 0xC2)
+			return 0;
+		else if (*pch < 0xE0)
+			n = 1;
+		else if (*pch < 0xF0) {
+			n = 2;
+			if (*pch == 0xE0) lo = 0xA0;
+			if (*pch == 0xED) hi = 0x9F;
+		}
+		else if (*pch < 0xF5) {
+			n = 3;
+			if (*pch == 0xF0) lo = 0x90;
+			if (*pch == 0xF4) hi = 0x8F;
+		}
+		else
+			return 0;
+
+		if (pche - pch <= n)
+			return 0;
+		pch ++;
+		if ((*pch < lo) || (*pch > hi))
+			return 0;
+		while (--n > 0) {
+			pch ++;
+			if ((*pch < 0x80) || (*pch > 0xBF))
+				return 0;
+		}
+		pch ++;
+	}
+	return 1;
+}
+
+/**
+ * @ingroup StrBuf_DeEnCoder
+ * @brief if a text is in this charset, does converting it to UTF-8 leave it alone?
+ * @returns 2 if it's UTF-8 itself, 1 if pure ASCII text would stay, 0 if we don't know.
+ */
+static int StrBufCharsetKeepsAscii(const char *charset)
+{
+	if (!strcasecmp(charset, "utf-8") ||
+	    !strcasecmp(charset, "utf8"))
+		return 2;
+	if (!strcasecmp(charset, "us-ascii") ||
+	    !strcasecmp(charset, "ascii") ||
+	    !strncasecmp(charset, "iso-8859-", 9) ||
+	    !strncasecmp(charset, "windows-125", 11) ||
+	    !strncasecmp(charset, "cp125", 5) ||
+	    !strncasecmp(charset, "koi8-", 5))
+		return 1;
+	return 0;
+}
+
+
 /**
  * @ingroup StrBuf_DeEnCoder
  * @brief find one chunk of a RFC822 encoded string
@@ -3851,14 +4658,29 @@ inline static void DecodeSegment(StrBuf *Target,
 	else {
 		StrBufAppendBuf(ConvertBuf2, ConvertBuf, 0);
 	}
+
+	/* most of them are UTF-8 or plain ASCII already; iconv would just copy them. */
+	switch (StrBufCharsetKeepsAscii(charset)) {
+	case 2:
+		if (!StrBufIsUtf8(ConvertBuf2->buf, ConvertBuf2->BufUsed))
+			break;
+		StrBufAppendBuf(Target, ConvertBuf2, 0);
+		return;
+	case 1:
+		if (!StrBufIsAscii(ConvertBuf2->buf, ConvertBuf2->BufUsed))
+			break;
+		StrBufAppendBuf(Target, ConvertBuf2, 0);
+		return;
+	}
+
 #ifdef HAVE_ICONV
-	ctdl_iconv_open("UTF-8", charset, &ic);
+	ctdl_iconv_acquire("UTF-8", charset, &ic);
 	if (ic != (iconv_t)(-1) ) {		
 #endif
 		StrBufConvert(ConvertBuf2, ConvertBuf, &ic);
 		StrBufAppendBuf(Target, ConvertBuf2, 0);
 #ifdef HAVE_ICONV
-		iconv_close(ic);
+		ctdl_iconv_release(&ic);
 	}
 	else {
 		StrBufAppendBufPlain(Target, HKEY("(unreadable)"), 0);
@@ -3920,7 +4742,6 @@ void StrBuf_RFC822_2_Utf8(StrBuf *Target,
 #endif
 	const char *eptr;
 	int passes = 0;
-	int i;
 	int illegal_non_rfc2047_encoding = 0;
 
 
@@ -3933,24 +4754,19 @@ void StrBuf_RFC822_2_Utf8(StrBuf *Target,
 	 *  charset to UTF-8 if we see any nonprintable characters.
 	 */
 	
-	for (i=0; i<DecodeMe->BufUsed; ++i) {
-		if ((DecodeMe->buf[i] < 32) || (DecodeMe->buf[i] > 126)) {
-			illegal_non_rfc2047_encoding = 1;
-			break;
-		}
-	}
+	illegal_non_rfc2047_encoding = !StrBufIsPrintable(DecodeMe->buf, DecodeMe->BufUsed);
 
 	if ((illegal_non_rfc2047_encoding) &&
 	    (strcasecmp(ChrPtr(DefaultCharset), "UTF-8")) && 
 	    (strcasecmp(ChrPtr(DefaultCharset), "us-ascii")) )
 	{
 #ifdef HAVE_ICONV
-		ctdl_iconv_open("UTF-8", ChrPtr(DefaultCharset), &ic);
+		ctdl_iconv_acquire("UTF-8", ChrPtr(DefaultCharset), &ic);
 		if (ic != (iconv_t)(-1) ) {
 			DecodedInvalidBuf = NewStrBufDup(DecodeMe);
 			StrBufConvert(DecodedInvalidBuf, ConvertBuf, &ic);///TODO: don't void const?
 			DecodeMee = DecodedInvalidBuf;
-			iconv_close(ic);
+			ctdl_iconv_release(&ic);
 		}
 #endif
 	}
@@ -4253,8 +5069,7 @@ int CompressBuffer(StrBuf *Buf)
 			  &compressed_len,
 			  (Bytef *) Buf->buf,
 			  (uLongf) Buf->BufUsed, Z_BEST_SPEED) == Z_OK) {
-		if (!Buf->ConstBuf)
-			free(Buf->buf);
+		StrBufReleaseMem(Buf);
 		Buf->buf = compressed_data;
 		Buf->BufUsed = compressed_len;
 		Buf->BufSize = bufsize;
@@ -4404,8 +5219,7 @@ int StrBuf_write_one_chunk_callback(int fd, short event, IOBuffer *FB)
  */
 eReadState StrBufChunkSipLine(StrBuf *LineBuf, IOBuffer *FB)
 {
-	const char *aptr, *ptr, *eptr;
-	char *optr, *xptr;
+	const char *ptr, *eptr, *lptr;
 
 	if ((FB == NULL) || (LineBuf == NULL) || (LineBuf->buf == NULL))
 		return eReadFail;
@@ -4418,53 +5232,34 @@ eReadState StrBufChunkSipLine(StrBuf *LineBuf, IOBuffer *FB)
 
 	FlushStrBuf(LineBuf);
 	if (FB->ReadWritePointer == NULL)
-		ptr = aptr = FB->Buf->buf;
+		ptr = FB->Buf->buf;
 	else
-		ptr = aptr = FB->ReadWritePointer;
+		ptr = FB->ReadWritePointer;
 
-	optr = LineBuf->buf;
 	eptr = FB->Buf->buf + FB->Buf->BufUsed;
-	xptr = LineBuf->buf + LineBuf->BufSize - 1;
 
-	while ((ptr <= eptr) && 
-	       (*ptr != '\n') &&
-	       (*ptr != '\r') )
-	{
-		*optr = *ptr;
-		optr++; ptr++;
-		if (optr == xptr) {
-			LineBuf->BufUsed = optr - LineBuf->buf;
-			IncreaseBuf(LineBuf,  1, LineBuf->BufUsed + 1);
-			optr = LineBuf->buf + LineBuf->BufUsed;
-			xptr = LineBuf->buf + LineBuf->BufSize - 1;
-		}
-	}
-
-	if (ptr >= eptr) {
-		if (optr > LineBuf->buf)
-			optr --;
-		if ((*(ptr - 1) != '\r') && (*(ptr - 1) != '\n')) {
-			LineBuf->BufUsed = optr - LineBuf->buf;
-			*optr = '\0';
-			if ((FB->ReadWritePointer != NULL) && 
-			    (FB->ReadWritePointer != FB->Buf->buf))
-			{
-				/* Ok, the client application read all the data 
-				   it was interested in so far. Since there is more to read, 
-				   we now shrink the buffer, and move the rest over.
-				*/
-				StrBufCutLeft(FB->Buf, 
-					      FB->ReadWritePointer - FB->Buf->buf);
-				FB->ReadWritePointer = FB->Buf->buf;
-			}
-			return eMustReadMore;
+	lptr = ctdl_memchr2(ptr, '\r', '\n', eptr - ptr);
+	if (lptr == NULL) {
+		StrBufCopySpan(LineBuf, ptr, eptr - ptr);
+		if ((FB->ReadWritePointer != NULL) && 
+		    (FB->ReadWritePointer != FB->Buf->buf))
+		{
+			/* Ok, the client application read all the data 
+			   it was interested in so far. Since there is more to read, 
+			   we now shrink the buffer, and move the rest over.
+			*/
+			StrBufCutLeft(FB->Buf, 
+				      FB->ReadWritePointer - FB->Buf->buf);
+			FB->ReadWritePointer = FB->Buf->buf;
 		}
+		return eMustReadMore;
 	}
-	LineBuf->BufUsed = optr - LineBuf->buf;
-	*optr = '\0';       
-	if ((ptr <= eptr) && (*ptr == '\r'))
+
+	StrBufCopySpan(LineBuf, ptr, lptr - ptr);
+	ptr = lptr;
+	if ((ptr < eptr) && (*ptr == '\r'))
 		ptr ++;
-	if ((ptr <= eptr) && (*ptr == '\n'))
+	if ((ptr < eptr) && (*ptr == '\n'))
 		ptr ++;
 	
 	if (ptr < eptr) {
@@ -5002,7 +5797,7 @@ int StrBufTCP_read_buffered_line(StrBuf *Line,
 	struct timeval tv;
 
 	if (buf->BufUsed > 0) {
-		pch = strchr(buf->buf, '\n');
+		pch = memchr(buf->buf, '\n', buf->BufUsed);
 		if (pch != NULL) {
 			rlen = 0;
 			len = pch - buf->buf;
@@ -5049,9 +5844,10 @@ int StrBufTCP_read_buffered_line(StrBuf *Line,
 		}
 		else if (rlen > 0) {
 			nSuccessLess = 0;
+			/* only the new data can contain our linebreak */
+			pch = memchr(&buf->buf[buf->BufUsed], '\n', rlen);
 			buf->BufUsed += rlen;
 			buf->buf[buf->BufUsed] = '\0';
-			pch = strchr(buf->buf, '\n');
 			if ((pch == NULL) &&
 			    (buf->BufUsed + 10 > buf->BufSize) &&
 			    (IncreaseBuf(buf, 1, -1) == -1))
@@ -5125,47 +5921,18 @@ int StrBufTCP_read_buffered_line_fast(StrBuf *Line,
 	    (pos != NULL) && 
 	    (pos < IOBuf->buf + IOBuf->BufUsed)) 
 	{
-		char *pcht;
-
 		pche = IOBuf->buf + IOBuf->BufUsed;
-		pch = pos;
-		pcht = Line->buf;
-
-		while ((pch < pche) && (*pch != '\n'))
-		{
-			if (Line->BufUsed + 10 > Line->BufSize)
-			{
-				long apos;
-				apos = pcht - Line->buf;
-				*pcht = '\0';
-				IncreaseBuf(Line, 1, -1);
-				pcht = Line->buf + apos;
-			}
-			*pcht++ = *pch++;
-			Line->BufUsed++;
-			retlen++;
-		}
+		pch = memchr(pos, '\n', pche - pos);
+		if (pch == NULL)
+			pch = pche;
 
 		len = pch - pos;
 		if (len > 0 && (*(pch - 1) == '\r') )
-		{
-			retlen--;
 			len --;
-			pcht --;
-			Line->BufUsed --;
-		}
-		*pcht = '\0';
-
-		if ((pch >= pche) || (*pch == '\0'))
-		{
-			FlushStrBuf(IOBuf);
-			*Pos = NULL;
-			pch = NULL;
-			pos = 0;
-		}
+		StrBufCopySpan(Line, pos, len);
+		retlen = len;
 
-		if ((pch != NULL) && 
-		    (pch <= pche)) 
+		if (pch < pche)
 		{
 			if (pch + 1 >= pche) {
 				*Pos = NULL;
@@ -5176,8 +5943,9 @@ int StrBufTCP_read_buffered_line_fast(StrBuf *Line,
 			
 			return retlen;
 		}
-		else 
-			FlushStrBuf(IOBuf);
+		*Pos = NULL;
+		pos = NULL;
+		FlushStrBuf(IOBuf);
 	}
 
 	/* If we come here, Pos is Unset since we read everything into Line, and now go for more. */
@@ -5229,10 +5997,7 @@ int StrBufTCP_read_buffered_line_fast(StrBuf *Line,
 			
 			pche = IOBuf->buf + IOBuf->BufUsed;
 			
-			while ((pLF < pche) && (*pLF != '\n'))
-				pLF ++;
-			if ((pLF >= pche) || (*pLF == '\0'))
-				pLF = NULL;
+			pLF = memchr(pLF, '\n', pche - pLF);
 
 			if (IOBuf->BufUsed + 10 > IOBuf->BufSize)
 			{
@@ -5532,8 +6297,7 @@ int StrBufReadBLOBBuffered(StrBuf *Blob,
  */
 int StrBufSipLine(StrBuf *LineBuf, const StrBuf *Buf, const char **Ptr)
 {
-	const char *aptr, *ptr, *eptr;
-	char *optr, *xptr;
+	const char *ptr, *eptr, *lptr;
 
 	if ((Buf == NULL) ||
 	    (*Ptr == StrBufNOTNULL) ||
@@ -5546,35 +6310,25 @@ int StrBufSipLine(StrBuf *LineBuf, const StrBuf *Buf, const char **Ptr)
 
 	FlushStrBuf(LineBuf);
 	if (*Ptr==NULL)
-		ptr = aptr = Buf->buf;
+		ptr = Buf->buf;
 	else
-		ptr = aptr = *Ptr;
+		ptr = *Ptr;
 
-	optr = LineBuf->buf;
 	eptr = Buf->buf + Buf->BufUsed;
-	xptr = LineBuf->buf + LineBuf->BufSize - 1;
 
-	while ((ptr <= eptr) && 
-	       (*ptr != '\n') &&
-	       (*ptr != '\r') )
-	{
-		*optr = *ptr;
-		optr++; ptr++;
-		if (optr == xptr) {
-			LineBuf->BufUsed = optr - LineBuf->buf;
-			IncreaseBuf(LineBuf,  1, LineBuf->BufUsed + 1);
-			optr = LineBuf->buf + LineBuf->BufUsed;
-			xptr = LineBuf->buf + LineBuf->BufSize - 1;
-		}
+	lptr = ctdl_memchr2(ptr, '\r', '\n', eptr - ptr);
+	if (lptr == NULL) {
+		/* the last line isn't terminated; we went over its end. */
+		StrBufCopySpan(LineBuf, ptr, eptr - ptr);
+		*Ptr = StrBufNOTNULL;
+		return -1;
 	}
 
-	if ((ptr >= eptr) && (optr > LineBuf->buf))
-		optr --;
-	LineBuf->BufUsed = optr - LineBuf->buf;
-	*optr = '\0';       
-	if ((ptr <= eptr) && (*ptr == '\r'))
+	StrBufCopySpan(LineBuf, ptr, lptr - ptr);
+	ptr = lptr;
+	if ((ptr < eptr) && (*ptr == '\r'))
 		ptr ++;
-	if ((ptr <= eptr) && (*ptr == '\n'))
+	if ((ptr < eptr) && (*ptr == '\n'))
 		ptr ++;
 	
 	if (ptr < eptr) {
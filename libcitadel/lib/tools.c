@@ -86,76 +86,111 @@ int safestrncpy(char *dest, const char *src, size_t n)
  */
 int num_tokens(const char *source, char tok)
 {
-	int count = 1;
-	const char *ptr = source;
-
 	if (source == NULL) {
 		return (0);
 	}
 
-	while (*ptr != '\0') {
-		if (*ptr++ == tok) {
-			++count;
-		}
-	}
-	
-	return (count);
+	return (ctdl_memcount(source, tok, strlen(source)) + 1);
 }
 
 //extern void cit_backtrace(void);
 
 
+/*
+ * copy a token of len bytes to dest, truncate it to fit maxlen.
+ */
+static long copy_token(char *dest, const char *s, long len, int maxlen)
+{
+	if (maxlen < 1) {
+		return(0);
+	}
+	if (len > maxlen - 1) {
+		len = maxlen - 1;
+	}
+	memcpy(dest, s, len);
+	dest[len] = '\0';
+	return(len);
+}
+
+
 /*
  * extract_token() - a string tokenizer
  * returns -1 if not found, or length of token.
+ * If you're going to walk all tokens of a string, use extract_next_token()
+ * instead; this one has to skip all of the tokens in front of parmnum each time.
  */
 long extract_token(char *dest, const char *source, int parmnum, char separator, int maxlen)
 {
-	const char *s;			//* source * /
-	int len = 0;			//* running total length of extracted string * /
-	int current_token = 0;		//* token currently being processed * /
-
-	s = source;
+	const char *s;
+	const char *e;
 
 	if (dest == NULL) {
 		return(-1);
 	}
-
-	//cit_backtrace();
-	//lprintf (CTDL_DEBUG, "test >: n: %d sep: %c source: %s \n willi \n", parmnum, separator, source);
-	dest[0] = 0;
-
-	if (s == NULL) {
+	if (maxlen > 0) {
+		dest[0] = '\0';
+	}
+	if (source == NULL) {
 		return(-1);
 	}
-	
-	maxlen--;
 
-	while (*s) {
-		if (*s == separator) {
-			++current_token;
-		}
-		if ( (current_token == parmnum) && 
-		     (*s != separator) && 
-		     (len < maxlen) ) {
-			dest[len] = *s;
-			++len;
+	s = source;
+	if (separator == '\0') {
+		if (parmnum > 0) {
+			return(-1);
 		}
-		else if ((current_token > parmnum) || (len >= maxlen)) {
-			break;
+		return copy_token(dest, s, strlen(s), maxlen);
+	}
+
+	while (parmnum-- > 0) {
+		s = strchr(s, separator);
+		if (s == NULL) {
+			return(-1);
 		}
-		++s;
+		s++;
 	}
 
-	dest[len] = '\0';
-	if (current_token < parmnum) {
-		//lprintf (CTDL_DEBUG,"test <!: %s\n", dest);
+	e = strchr(s, separator);
+	return copy_token(dest, s, (e != NULL) ? e - s : (long)strlen(s), maxlen);
+}
+
+/*
+ * extract_next_token() - pull the tokens of a string one after another
+ * *Pos starts out at the string, and is moved behind the token we copied;
+ * after the last token it becomes NULL, and we return -1 on the next call.
+ * So you get num_tokens() tokens:
+ *
+ *	const char *Pos = source;
+ *	while (extract_next_token(buf, &Pos, '|', sizeof buf) >= 0) { ... }
+ *
+ * returns -1 if there are no more tokens, or length of token.
+ */
+long extract_next_token(char *dest, const char **Pos, char separator, int maxlen)
+{
+	const char *s;
+	const char *e = NULL;
+
+	if (dest == NULL) {
 		return(-1);
 	}
-	//lprintf (CTDL_DEBUG,"test <: %d; %s\n", len, dest);
-	return(len);
+	if (maxlen > 0) {
+		dest[0] = '\0';
+	}
+	if ((Pos == NULL) || (*Pos == NULL)) {
+		return(-1);
+	}
+
+	s = *Pos;
+	if (separator != '\0') {
+		e = strchr(s, separator);
+	}
+	if (e == NULL) {
+		*Pos = NULL;
+		return copy_token(dest, s, strlen(s), maxlen);
+	}
+	*Pos = e + 1;
+	return copy_token(dest, s, e - s, maxlen);
 }
-//*/
 
 
 /*
@@ -795,170 +830,273 @@ void generate_uuid(char *buf) {
 }
 
 /*
- * bmstrcasestr() -- case-insensitive substring search
+ * Case insensitive substring search.
+ *
+ * The needle is compiled into a CasePattern once: its bytes, both cases of
+ * its first byte, and a Boyer-Moore-Horspool skip table over the case
+ * folded alphabet.  Searching first runs the SIMD two byte scanner for
+ * either case of the first byte; if that keeps stumbling over candidates
+ * that don't match (think of a needle starting with 'e' in english text),
+ * it switches over to the skip table for the rest of the haystack.
+ * The search paths that test the same needle against thousands of
+ * messages should keep a CasePattern around instead of calling
+ * bmstrcasestr() for each of them.
  *
- * This uses the Boyer-Moore search algorithm and is therefore quite fast.
- * The code is roughly based on the strstr() replacement from 'tin' written
- * by Urs Jannsen.
+ * The skip table idea is roughly based on the strstr() replacement
+ * from 'tin' written by Urs Jannsen.
  */
-inline static char *_bmstrcasestr_len(char *text, size_t textlen, const char *pattern, size_t patlen) {
+struct CasePattern {
+	const unsigned char *Pattern;
+	long Len;
+	int First;		/* both cases of the first byte, for the scanner */
+	int FirstOther;
+	long Delta[256];	/* how far to move on, by the last byte of the window */
+	unsigned char *Copy;	/* our copy of the needle, if we made one */
+};
 
-	register unsigned char *p, *t;
-	register int i, j, *delta;
-	register size_t p1;
-	int deltaspace[256];
+/*
+ * Folding: ASCII, plus the two byte UTF-8 sequences of Latin-1 Supplement
+ * and Latin Extended-A where upper and lower case share the lead byte, so
+ * only the continuation byte differs; whether that one folds depends on
+ * the lead byte before it.  Everything else has to match exactly.
+ */
+static inline int latin_ext_a_upper(unsigned int cp)
+{
+	if ((cp & 0x3F) == 0x3F)	/* lower case would be behind the next lead byte */
+		return 0;
+	if ((cp >= 0x100) && (cp <= 0x137))
+		return ((cp & 1) == 0) && (cp != 0x130);
+	if ((cp >= 0x139) && (cp <= 0x148))
+		return (cp & 1);
+	if ((cp >= 0x14A) && (cp <= 0x177))
+		return ((cp & 1) == 0);
+	if ((cp >= 0x179) && (cp <= 0x17E))
+		return (cp & 1);
+	return 0;
+}
 
-	if (!text) return(NULL);
-	if (!pattern) return(NULL);
+static inline unsigned char case_fold(unsigned char prev, unsigned char c)
+{
+	if (c < 0x80)
+		return ((c >= 'A') && (c <= 'Z')) ? c + 0x20 : c;
+	if (c > 0xBF)
+		return c;
+	switch (prev) {
+	case 0xC3:
+		if ((c <= 0x9E) && (c != 0x97))
+			return c + 0x20;
+		break;
+	case 0xC4:
+	case 0xC5:
+		if (latin_ext_a_upper(((prev & 0x1F) << 6) | (c & 0x3F)))
+			return c + 1;
+		break;
+	}
+	return c;
+}
 
-	/* algorithm fails if pattern is empty */
-	if ((p1 = patlen) == 0)
-		return (text);
+/* the other case of c, if it has one; c itself otherwise. */
+static inline unsigned char case_other(unsigned char prev, unsigned char c)
+{
+	unsigned char f = case_fold(prev, c);
+
+	if (f != c)
+		return f;
+	if (c < 0x80)
+		return ((c >= 'a') && (c <= 'z')) ? c - 0x20 : c;
+	if (c > 0xBF)
+		return c;
+	switch (prev) {
+	case 0xC3:
+		if ((c >= 0xA0) && (c <= 0xBE) && (c != 0xB7))
+			return c - 0x20;
+		break;
+	case 0xC4:
+	case 0xC5:
+		if ((c > 0x80) && (case_fold(prev, c - 1) == c))
+			return c - 1;
+		break;
+	}
+	return c;
+}
 
-	/* code below fails (whenever i is unsigned) if pattern too long */
-	if (p1 > textlen)
-		return (NULL);
+static void CasePatternInit(CasePattern *P, const char *Pattern, long len)
+{
+	const unsigned char *p = (const unsigned char *) Pattern;
+	unsigned char prev = 0;
+	unsigned char f;
+	long i;
+
+	P->Pattern = p;
+	P->Len = len;
+	P->Copy = NULL;
+	for (i = 0; i < 256; i++)
+		P->Delta[i] = len;
+	for (i = 0; i + 1 < len; i++) {
+		f = case_fold(prev, p[i]);
+		P->Delta[f] = len - 1 - i;
+		P->Delta[case_other(prev, f)] = len - 1 - i;
+		prev = p[i];
+	}
+	if (len > 0) {
+		P->First = case_fold(0, p[0]);
+		P->FirstOther = case_other(0, P->First);
+	}
+}
 
-	/* set up deltas */
-	delta = deltaspace;
-	for (i = 0; i <= 255; i++)
-		delta[i] = p1;
-	for (p = (unsigned char *) pattern, i = p1; --i > 0;)
-		delta[tolower(*p++)] = i;
+static inline int CasePatternMatch(const CasePattern *P, const unsigned char *t)
+{
+	const unsigned char *p = P->Pattern;
+	unsigned char prev = 0;
+	long i;
+
+	for (i = 0; i < P->Len; i++) {
+		if ((p[i] != t[i]) && (case_fold(prev, p[i]) != case_fold(prev, t[i])))
+			return 0;
+		prev = p[i];
+	}
+	return 1;
+}
 
-	/*
-	 * From now on, we want patlen - 1.
-	 * In the loop below, p points to the end of the pattern,
-	 * t points to the end of the text to be tested against the
-	 * pattern, and i counts the amount of text remaining, not
-	 * including the part to be tested.
-	 */
-	p1--;
-	p = (unsigned char *) pattern + p1;
-	t = (unsigned char *) text + p1;
-	i = textlen - patlen;
-	while(1) {
-		if (tolower(p[0]) == tolower(t[0])) {
-			if (strncasecmp ((const char *)(p - p1), (const char *)(t - p1), p1) == 0) {
-				return ((char *)t - p1);
-			}
-		}
-		j = delta[tolower(t[0])];
-		if (i < j)
+static const char *CasePatternSearch(const CasePattern *P, const char *Text, size_t TextLen)
+{
+	const unsigned char *Start = (const unsigned char *) Text;
+	const unsigned char *t = Start;
+	const unsigned char *Last;
+	unsigned char prev, fl;
+	long Misses = 0;
+	long p1;
+
+	if (P->Len == 0)
+		return Text;
+	if ((size_t) P->Len > TextLen)
+		return NULL;
+	Last = Start + TextLen - P->Len;	/* the last place a match may start */
+
+	while (t <= Last) {
+		t = (const unsigned char *) ctdl_memchr2((const char *) t, P->First, P->FirstOther, Last - t + 1);
+		if (t == NULL)
+			return NULL;
+		if (CasePatternMatch(P, t))
+			return (const char *) t;
+		t++;
+		/* more than one false hit per 32 bytes; the skip table does better. */
+		if (++Misses * 32 > (t - Start) + 256)
 			break;
-		i -= j;
-		t += j;
 	}
-	return (NULL);
+
+	p1 = P->Len - 1;
+	prev = (p1 > 0) ? P->Pattern[p1 - 1] : 0;
+	fl = case_fold(prev, P->Pattern[p1]);
+	while (t <= Last) {
+		if ((case_fold(prev, t[p1]) == fl) && CasePatternMatch(P, t))
+			return (const char *) t;
+		t += P->Delta[t[p1]];
+	}
+	return NULL;
 }
 
-/*
- * bmstrcasestr() -- case-insensitive substring search
- *
- * This uses the Boyer-Moore search algorithm and is therefore quite fast.
- * The code is roughly based on the strstr() replacement from 'tin' written
- * by Urs Jannsen.
+/**
+ * @ingroup StrBuf
+ * @brief compile a needle for case insensitive searching; use it if you're going to search many haystacks for it.
+ * @param Pattern the needle
+ * @param len its length; -1 to have us strlen() it
+ * @returns the compiled pattern; free it with FreeCasePattern()
  */
-char *bmstrcasestr(char *text, const char *pattern) {
-	size_t textlen;
-	size_t patlen;
-
-	if (!text) return(NULL);
-	if (!pattern) return(NULL);
-
-	textlen = strlen (text);
-	patlen = strlen (pattern);
-
-	return _bmstrcasestr_len(text, textlen, pattern, patlen);
+CasePattern *NewCasePattern(const char *Pattern, long len)
+{
+	CasePattern *P;
+	unsigned char *Copy;
+
+	if (Pattern == NULL)
+		return NULL;
+	if (len < 0)
+		len = strlen(Pattern);
+	P = (CasePattern *) malloc(sizeof(CasePattern));
+	Copy = (unsigned char *) malloc(len + 1);
+	memcpy(Copy, Pattern, len);
+	Copy[len] = '\0';
+	CasePatternInit(P, (const char *) Copy, len);
+	P->Copy = Copy;
+	return P;
 }
 
-char *bmstrcasestr_len(char *text, size_t textlen, const char *pattern, size_t patlen) {
-	return _bmstrcasestr_len(text, textlen, pattern, patlen);
+/**
+ * @ingroup StrBuf
+ * @brief release a compiled needle
+ * @param Pattern the pattern to free; NULL'ed afterwards
+ */
+void FreeCasePattern(CasePattern **Pattern)
+{
+	if ((Pattern == NULL) || (*Pattern == NULL))
+		return;
+	free((*Pattern)->Copy);
+	free(*Pattern);
+	*Pattern = NULL;
 }
 
+/**
+ * @ingroup StrBuf
+ * @brief the length of a compiled needle
+ * @param Pattern the pattern
+ * @returns its length in bytes
+ */
+long CasePatternLen(const CasePattern *Pattern)
+{
+	if (Pattern == NULL)
+		return 0;
+	return Pattern->Len;
+}
 
-
+/**
+ * @ingroup StrBuf
+ * @brief case insensitive search for a compiled needle
+ * @param Pattern the needle, as compiled by NewCasePattern()
+ * @param Text the haystack; NULL is OK, it just contains nothing.
+ * @param len length of the haystack; -1 to have us strlen() it
+ * @returns where the needle starts in Text, NULL if it isn't there
+ */
+const char *CasePatternFind(const CasePattern *Pattern, const char *Text, long len)
+{
+	if ((Pattern == NULL) || (Text == NULL))
+		return NULL;
+	if (len < 0)
+		len = strlen(Text);
+	return CasePatternSearch(Pattern, Text, len);
+}
 
 /*
  * bmstrcasestr() -- case-insensitive substring search
  *
- * This uses the Boyer-Moore search algorithm and is therefore quite fast.
- * The code is roughly based on the strstr() replacement from 'tin' written
- * by Urs Jannsen.
+ * One shot version of the above; if you search the same needle over and
+ * over, use NewCasePattern() instead.
  */
-inline static const char *_cbmstrcasestr_len(const char *text, size_t textlen, const char *pattern, size_t patlen) {
-
-	register unsigned char *p, *t;
-	register int i, j, *delta;
-	register size_t p1;
-	int deltaspace[256];
-
+char *bmstrcasestr(char *text, const char *pattern) {
 	if (!text) return(NULL);
 	if (!pattern) return(NULL);
 
-	/* algorithm fails if pattern is empty */
-	if ((p1 = patlen) == 0)
-		return (text);
-
-	/* code below fails (whenever i is unsigned) if pattern too long */
-	if (p1 > textlen)
-		return (NULL);
-
-	/* set up deltas */
-	delta = deltaspace;
-	for (i = 0; i <= 255; i++)
-		delta[i] = p1;
-	for (p = (unsigned char *) pattern, i = p1; --i > 0;)
-		delta[tolower(*p++)] = i;
+	return bmstrcasestr_len(text, strlen(text), pattern, strlen(pattern));
+}
 
-	/*
-	 * From now on, we want patlen - 1.
-	 * In the loop below, p points to the end of the pattern,
-	 * t points to the end of the text to be tested against the
-	 * pattern, and i counts the amount of text remaining, not
-	 * including the part to be tested.
-	 */
-	p1--;
-	p = (unsigned char *) pattern + p1;
-	t = (unsigned char *) text + p1;
-	i = textlen - patlen;
-	while(1) {
-		if (tolower(p[0]) == tolower(t[0])) {
-			if (strncasecmp ((const char *)(p - p1), (const char *)(t - p1), p1) == 0) {
-				return ((char *)t - p1);
-			}
-		}
-		j = delta[tolower(t[0])];
-		if (i < j)
-			break;
-		i -= j;
-		t += j;
-	}
-	return (NULL);
+char *bmstrcasestr_len(char *text, size_t textlen, const char *pattern, size_t patlen) {
+	return (char *) cbmstrcasestr_len(text, textlen, pattern, patlen);
 }
 
-/*
- * bmstrcasestr() -- case-insensitive substring search
- *
- * This uses the Boyer-Moore search algorithm and is therefore quite fast.
- * The code is roughly based on the strstr() replacement from 'tin' written
- * by Urs Jannsen.
- */
 const char *cbmstrcasestr(const char *text, const char *pattern) {
-	size_t textlen;
-	size_t patlen;
-
 	if (!text) return(NULL);
 	if (!pattern) return(NULL);
 
-	textlen = strlen (text);
-	patlen = strlen (pattern);
-
-	return _cbmstrcasestr_len(text, textlen, pattern, patlen);
+	return cbmstrcasestr_len(text, strlen(text), pattern, strlen(pattern));
 }
 
 const char *cbmstrcasestr_len(const char *text, size_t textlen, const char *pattern, size_t patlen) {
-	return _cbmstrcasestr_len(text, textlen, pattern, patlen);
+	CasePattern P;
+
+	if (!text) return(NULL);
+	if (!pattern) return(NULL);
+
+	CasePatternInit(&P, pattern, patlen);
+	return CasePatternSearch(&P, text, textlen);
 }
 
 /*
@@ -0,0 +1,204 @@
+/*
+ * Throughput of the base64 and quoted-printable decoders, per code path,
+ * against the character at a time loops they used to be.
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/libcitadel.h"
+#include "../lib/b64/cencode.h"
+#include "../lib/b64/cdecode.h"
+
+
+/*
+ * The old way: libb64 without the bulk paths.
+ */
+static int old_decode_value(char value_in)
+{
+	static const char decoding[] = {62,-1,-1,-1,63,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
+	value_in -= 43;
+	if (value_in < 0 || value_in >= (int)sizeof(decoding)) return -1;
+	return decoding[(int)value_in];
+}
+
+static int OldDecodeBase64(char *out, const char *in, int len)
+{
+	char *pout = out;
+	int step = 0;
+	int i, v;
+
+	for (i = 0; i < len; i++) {
+		v = old_decode_value(in[i]);
+		if (v < 0)
+			continue;
+		switch (step) {
+		case 0: *pout    = (v & 0x03f) << 2; break;
+		case 1: *pout++ |= (v & 0x030) >> 4; *pout = (v & 0x00f) << 4; break;
+		case 2: *pout++ |= (v & 0x03c) >> 2; *pout = (v & 0x003) << 6; break;
+		case 3: *pout++ |= (v & 0x03f); break;
+		}
+		step = (step + 1) & 3;
+	}
+	return pout - out;
+}
+
+static int OldEncodeBase64(char *out, const char *in, int len)
+{
+	char *pout = out;
+	int i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*pout++ = base64_encode_value((in[i] & 0xfc) >> 2);
+		*pout++ = base64_encode_value(((in[i] & 0x03) << 4) | ((in[i + 1] & 0xf0) >> 4));
+		*pout++ = base64_encode_value(((in[i + 1] & 0x0f) << 2) | ((in[i + 2] & 0xc0) >> 6));
+		*pout++ = base64_encode_value(in[i + 2] & 0x3f);
+	}
+	return pout - out;
+}
+
+static int OldDecodeQuotedPrintable(char *decoded, char *encoded, int sourcelen)
+{
+	int decoded_length = 0;
+	int pos = 0;
+
+	while (pos < sourcelen)
+	{
+		if (encoded[pos] == '=')
+		{
+			pos ++;
+			if (encoded[pos] == '\n')
+				pos ++;
+			else if (encoded[pos] == '\r') {
+				pos ++;
+				if (encoded[pos] == '\n')
+					pos++;
+			}
+			else {
+				decoded[decoded_length++] = decode_hex(&encoded[pos]);
+				pos += 2;
+			}
+		}
+		else
+			decoded[decoded_length++] = encoded[pos++];
+	}
+	decoded[decoded_length] = 0;
+	return(decoded_length);
+}
+
+
+static double Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+#define MB(n, t) ((n) / (t) / (1024.0 * 1024.0))
+
+int main(int argc, char* argv[])
+{
+	static const char *Names[] = {"scalar", "SSSE3", "AVX2"};
+	long size = (argc > 1) ? atol(argv[1]) : 8 * 1024 * 1024;
+	int rounds = 10;
+	char *plain, *code, *lines, *out, *qp;
+	long ncode, nlines, nqp, i, n;
+	eBase64Impl Impl;
+	double t0, t;
+
+	StartLibCitadel(8);
+	plain = malloc(size);
+	code = malloc(size * 2);
+	lines = malloc(size * 2);
+	out = malloc(size * 2);
+	qp = malloc(size * 3 + 4);
+	srand(1);
+	for (i = 0; i < size; i++)
+		plain[i] = rand() & 0xff;
+	ncode = CtdlEncodeBase64(code, plain, size, 0);
+	nlines = CtdlEncodeBase64(lines, plain, size, 1);
+
+	/* mostly text, some of it escaped, soft linebreaks every 76 */
+	for (i = 0, nqp = 0; i < size; i++) {
+		if (nqp % 78 == 75) {
+			qp[nqp++] = '=';
+			qp[nqp++] = '\r';
+			qp[nqp++] = '\n';
+		}
+		if (i % 40 == 0)
+			nqp += sprintf(qp + nqp, "=%02X", plain[i] & 0xff);
+		else
+			qp[nqp++] = 'a' + (plain[i] & 0xff) % 26;
+	}
+	memset(qp + nqp, 0, 4);
+
+	printf("%ld bytes, MB/s of plain data\n", size);
+	printf("%-8s %10s %10s %10s\n", "", "encode", "decode", "decode/76");
+
+	t0 = Now();
+	for (n = 0; n < rounds; n++)
+		OldEncodeBase64(out, plain, size);
+	t = Now() - t0;
+	printf("%-8s %10.1f", "old", MB(size * rounds, t));
+	t0 = Now();
+	for (n = 0; n < rounds; n++)
+		OldDecodeBase64(out, code, ncode);
+	t = Now() - t0;
+	printf(" %10.1f", MB(size * rounds, t));
+	t0 = Now();
+	for (n = 0; n < rounds; n++)
+		OldDecodeBase64(out, lines, nlines);
+	t = Now() - t0;
+	printf(" %10.1f\n", MB(size * rounds, t));
+
+	for (Impl = eBase64Scalar; Impl <= eBase64AVX2; Impl++) {
+		if (CtdlBase64SelectImpl(Impl) != Impl)
+			break;
+		t0 = Now();
+		for (n = 0; n < rounds; n++)
+			CtdlEncodeBase64(out, plain, size, 0);
+		t = Now() - t0;
+		printf("%-8s %10.1f", Names[Impl], MB(size * rounds, t));
+		t0 = Now();
+		for (n = 0; n < rounds; n++)
+			CtdlDecodeBase64(out, code, ncode);
+		t = Now() - t0;
+		printf(" %10.1f", MB(size * rounds, t));
+		t0 = Now();
+		for (n = 0; n < rounds; n++)
+			CtdlDecodeBase64(out, lines, nlines);
+		t = Now() - t0;
+		printf(" %10.1f\n", MB(size * rounds, t));
+	}
+	CtdlBase64SelectImpl(eBase64Best);
+
+	printf("\nquoted-printable, MB/s of encoded data\n");
+	t0 = Now();
+	for (n = 0; n < rounds; n++)
+		OldDecodeQuotedPrintable(out, qp, nqp);
+	t = Now() - t0;
+	printf("%-8s %10.1f\n", "old", MB(nqp * rounds, t));
+	t0 = Now();
+	for (n = 0; n < rounds; n++)
+		CtdlDecodeQuotedPrintable(out, qp, nqp);
+	t = Now() - t0;
+	printf("%-8s %10.1f\n", "memchr", MB(nqp * rounds, t));
+
+	free(plain);
+	free(code);
+	free(lines);
+	free(out);
+	free(qp);
+	return 0;
+}
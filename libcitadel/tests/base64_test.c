@@ -0,0 +1,401 @@
+/*
+ *  CUnit - A Unit testing framework library for C.
+ *  Copyright (C) 2001  Anil Kumar
+ *  
+ *  This library is open source software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ */
+
+/*
+ * Feed random input to the base64 and quoted-printable coders, once per
+ * code path the CPU can run, and compare with the plain implementations
+ * they replaced.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stringbuf_test.h"
+#include "../lib/libcitadel.h"
+#include "../lib/b64/cencode.h"
+#include "../lib/b64/cdecode.h"
+
+#define NROUNDS 2000
+#define MAXLEN 700
+
+
+/*
+ * The reference: libb64 as it was, one char at a time.
+ */
+static int ref_decode_value(char value_in)
+{
+	static const char decoding[] = {62,-1,-1,-1,63,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-2,-1,-1,-1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,51};
+	value_in -= 43;
+	if (value_in < 0 || value_in >= (int)sizeof(decoding)) return -1;
+	return decoding[(int)value_in];
+}
+
+static int ref_decode(const char *in, int len, char *out)
+{
+	const char *pch = in;
+	char *pout = out;
+	int step = 0;
+	int v;
+
+	for (pch = in; pch < in + len; pch++) {
+		v = ref_decode_value(*pch);
+		if (v < 0)
+			continue;
+		switch (step) {
+		case 0: *pout    = (v & 0x03f) << 2; break;
+		case 1: *pout++ |= (v & 0x030) >> 4; *pout = (v & 0x00f) << 4; break;
+		case 2: *pout++ |= (v & 0x03c) >> 2; *pout = (v & 0x003) << 6; break;
+		case 3: *pout++ |= (v & 0x03f); break;
+		}
+		step = (step + 1) % 4;
+	}
+	return pout - out;
+}
+
+static int ref_encode(const unsigned char *in, int len, char *out)
+{
+	static const char* encoding = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char *pout = out;
+	int i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		*pout++ = encoding[in[i] >> 2];
+		*pout++ = encoding[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+		*pout++ = encoding[((in[i + 1] & 0x0f) << 2) | (in[i + 2] >> 6)];
+		*pout++ = encoding[in[i + 2] & 0x3f];
+	}
+	if (len - i == 1) {
+		*pout++ = encoding[in[i] >> 2];
+		*pout++ = encoding[(in[i] & 0x03) << 4];
+		*pout++ = '=';
+		*pout++ = '=';
+	}
+	else if (len - i == 2) {
+		*pout++ = encoding[in[i] >> 2];
+		*pout++ = encoding[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+		*pout++ = encoding[(in[i + 1] & 0x0f) << 2];
+		*pout++ = '=';
+	}
+	return pout - out;
+}
+
+static int ref_decode_qp(char *decoded, char *encoded, int sourcelen)
+{
+	unsigned int ch;
+	int decoded_length = 0;
+	int pos = 0;
+
+	while (pos < sourcelen)
+	{
+		if (*(encoded + pos) == '=')
+		{
+			pos ++;
+			if (*(encoded + pos) == '\n')
+			{
+				pos ++;
+			}
+			else if (*(encoded + pos) == '\r')
+			{
+				pos ++;
+				if (*(encoded + pos) == '\n')
+					pos++;
+			}
+			else
+			{
+				ch = decode_hex(&encoded[pos]);
+				pos += 2;
+				decoded[decoded_length++] = ch;
+			}
+		}
+		else
+		{
+			decoded[decoded_length++] = encoded[pos];
+			pos += 1;
+		}
+	}
+	decoded[decoded_length] = 0;
+	return(decoded_length);
+}
+
+
+static void RandomBytes(unsigned char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand() & 0xff;
+}
+
+/*
+ * valid base64, sometimes broken up by linebreaks, padding in odd places and junk.
+ */
+static int RandomBase64(char *buf, int maxlen)
+{
+	static const char junk[] = "\r\n\t =-.{}\x80\xff";
+	unsigned char plain[MAXLEN];
+	char clean[MAXLEN * 2];
+	int nclean, i, len;
+	int noise;
+
+	RandomBytes(plain, sizeof(plain));
+	nclean = ref_encode(plain, rand() % (maxlen / 2), clean);
+	noise = rand() % 4;
+	len = 0;
+	for (i = 0; (i < nclean) && (len < maxlen - 2); i++) {
+		if ((noise == 1) && (i % 76 == 75)) {
+			buf[len++] = '\r';
+			buf[len++] = '\n';
+		}
+		else if ((noise == 2) && (rand() % 50 == 0)) {
+			buf[len++] = junk[rand() % (sizeof(junk) - 1)];
+		}
+		else if ((noise == 3) && (rand() % 200 == 0)) {
+			buf[len++] = rand() & 0xff;
+		}
+		buf[len++] = clean[i];
+	}
+	return len;
+}
+
+static int ForEachImpl(eBase64Impl *Impl)
+{
+	if (*Impl > eBase64AVX2)
+		return 0;
+	if (CtdlBase64SelectImpl(*Impl) != *Impl) {
+		printf("(base64 code path %d not available here) ", *Impl);
+		*Impl = eBase64Best;
+		return 0;
+	}
+	return 1;
+}
+
+
+static void TestBase64Encode(void)
+{
+	unsigned char plain[MAXLEN];
+	char expect[MAXLEN * 2];
+	char got[MAXLEN * 2];
+	base64_encodestate state;
+	eBase64Impl Impl;
+	int i, len, nexpect, ngot, at, chunk;
+
+	for (Impl = eBase64Scalar; ForEachImpl(&Impl); Impl++) {
+		srand(1);
+		for (i = 0; i < NROUNDS; i++) {
+			len = rand() % MAXLEN;
+			RandomBytes(plain, len);
+			nexpect = ref_encode(plain, len, expect);
+
+			/* all at once */
+			base64_init_encodestate(&state);
+			ngot = base64_encode_block((char*)plain, len, got, &state);
+			ngot += base64_encode_blockend(got + ngot, &state, 0);
+			CU_ASSERT_EQUAL(ngot, nexpect);
+			CU_ASSERT(memcmp(got, expect, nexpect) == 0);
+
+			/* in pieces that don't care for the groups */
+			base64_init_encodestate(&state);
+			ngot = 0;
+			for (at = 0; at < len; at += chunk) {
+				chunk = 1 + rand() % 64;
+				if (chunk > len - at)
+					chunk = len - at;
+				ngot += base64_encode_block((char*)plain + at, chunk, got + ngot, &state);
+			}
+			ngot += base64_encode_blockend(got + ngot, &state, 0);
+			CU_ASSERT_EQUAL(ngot, nexpect);
+			CU_ASSERT(memcmp(got, expect, nexpect) == 0);
+		}
+	}
+	CtdlBase64SelectImpl(eBase64Best);
+}
+
+static void TestBase64Decode(void)
+{
+	char code[MAXLEN + 4];
+	char expect[MAXLEN];
+	char got[MAXLEN];
+	base64_decodestate state;
+	eBase64Impl Impl;
+	int i, len, nexpect, ngot, at, chunk;
+
+	for (Impl = eBase64Scalar; ForEachImpl(&Impl); Impl++) {
+		srand(2);
+		for (i = 0; i < NROUNDS; i++) {
+			len = RandomBase64(code, MAXLEN);
+			nexpect = ref_decode(code, len, expect);
+
+			ngot = CtdlDecodeBase64(got, code, len);
+			CU_ASSERT_EQUAL(ngot, nexpect);
+			CU_ASSERT(memcmp(got, expect, nexpect) == 0);
+
+			/* in pieces, carrying the state along */
+			base64_init_decodestate(&state);
+			ngot = 0;
+			for (at = 0; at < len; at += chunk) {
+				chunk = 1 + rand() % 64;
+				if (chunk > len - at)
+					chunk = len - at;
+				ngot += base64_decode_block(code + at, chunk, got + ngot, &state);
+			}
+			CU_ASSERT_EQUAL(ngot, nexpect);
+			CU_ASSERT(memcmp(got, expect, nexpect) == 0);
+
+			/* in place */
+			ngot = CtdlDecodeBase64(code, code, len);
+			CU_ASSERT_EQUAL(ngot, nexpect);
+			CU_ASSERT(memcmp(code, expect, nexpect) == 0);
+		}
+	}
+	CtdlBase64SelectImpl(eBase64Best);
+}
+
+static void TestStrBufBase64(void)
+{
+	unsigned char plain[MAXLEN];
+	StrBuf *Buf;
+	int i, len;
+
+	srand(3);
+	Buf = NewStrBuf();
+	for (i = 0; i < NROUNDS; i++) {
+		len = rand() % MAXLEN;
+		RandomBytes(plain, len);
+		FlushStrBuf(Buf);
+		StrBufBase64Append(Buf, NULL, (char*)plain, len, rand() & 1);
+		CU_ASSERT_EQUAL(StrBufDecodeBase64(Buf), len);
+		CU_ASSERT_EQUAL(StrLength(Buf), len);
+		CU_ASSERT(memcmp(ChrPtr(Buf), plain, len) == 0);
+	}
+	FreeStrBuf(&Buf);
+}
+
+static void TestStreamBase64(void)
+{
+	unsigned char plain[MAXLEN];
+	IOBuffer In, Encoded, Decoded;
+	vStreamT *Enc, *Dec;
+	const char *Err;
+	int i, len, at, chunk;
+
+	srand(4);
+	memset(&In, 0, sizeof(IOBuffer));
+	memset(&Encoded, 0, sizeof(IOBuffer));
+	memset(&Decoded, 0, sizeof(IOBuffer));
+	In.Buf = NewStrBuf();
+	Encoded.Buf = NewStrBuf();
+	Decoded.Buf = NewStrBuf();
+	for (i = 0; i < NROUNDS / 10; i++) {
+		len = rand() % MAXLEN;
+		RandomBytes(plain, len);
+		FlushStrBuf(Encoded.Buf);
+		FlushStrBuf(Decoded.Buf);
+		Enc = StrBufNewStreamContext(eBase64Encode, &Err);
+		Dec = StrBufNewStreamContext(eBase64Decode, &Err);
+		for (at = 0; at < len; at += chunk) {
+			chunk = 1 + rand() % 100;
+			if (chunk > len - at)
+				chunk = len - at;
+			StrBufPlain(In.Buf, (char*)plain + at, chunk);
+			StrBufStreamTranscode(eBase64Encode, &Encoded, &In, NULL, -1, Enc, at + chunk == len, &Err);
+			CU_ASSERT_EQUAL(StrLength(In.Buf), 0);
+		}
+		if (len == 0)
+			StrBufStreamTranscode(eBase64Encode, &Encoded, NULL, NULL, 0, Enc, 1, &Err);
+		CU_ASSERT_EQUAL(StrLength(Encoded.Buf), (len + 2) / 3 * 4);
+
+		StrBufStreamTranscode(eBase64Decode, &Decoded, &Encoded, NULL, -1, Dec, 1, &Err);
+		CU_ASSERT_EQUAL(StrLength(Decoded.Buf), len);
+		CU_ASSERT(memcmp(ChrPtr(Decoded.Buf), plain, len) == 0);
+
+		StrBufDestroyStreamContext(eBase64Encode, &Enc, &Err);
+		StrBufDestroyStreamContext(eBase64Decode, &Dec, &Err);
+	}
+	FreeStrBuf(&In.Buf);
+	FreeStrBuf(&Encoded.Buf);
+	FreeStrBuf(&Decoded.Buf);
+}
+
+static void TestQuotedPrintable(void)
+{
+	static const char alphabet[] = "abcXYZ 09AFaf=\r\n\t\x80\xff";
+	char code[MAXLEN + 4];
+	char expect[MAXLEN + 4];
+	char got[MAXLEN + 4];
+	int i, j, len, nexpect, ngot;
+
+	srand(5);
+	for (i = 0; i < NROUNDS; i++) {
+		len = rand() % MAXLEN;
+		for (j = 0; j < len; j++)
+			code[j] = ((rand() % 4) == 0) ?
+				alphabet[rand() % (sizeof(alphabet) - 1)] :
+				'a' + rand() % 26;
+		/* both of them look beyond a trailing '=' */
+		memset(code + len, 0, 4);
+
+		nexpect = ref_decode_qp(expect, code, len);
+		ngot = CtdlDecodeQuotedPrintable(got, code, len);
+		CU_ASSERT_EQUAL(ngot, nexpect);
+		CU_ASSERT(memcmp(got, expect, nexpect + 1) == 0);
+
+		ngot = CtdlDecodeQuotedPrintable(code, code, len);
+		CU_ASSERT_EQUAL(ngot, nexpect);
+		CU_ASSERT(memcmp(code, expect, nexpect + 1) == 0);
+	}
+}
+
+
+static void AddBase64Tests(void)
+{
+	CU_pSuite pGroup = NULL;
+	CU_pTest pTest = NULL;
+
+	pGroup = CU_add_suite("TestBase64AndQuotedPrintable", NULL, NULL);
+	pTest = CU_add_test(pGroup, "TestBase64Encode", TestBase64Encode);
+	pTest = CU_add_test(pGroup, "TestBase64Decode", TestBase64Decode);
+	pTest = CU_add_test(pGroup, "TestStrBufBase64", TestStrBufBase64);
+	pTest = CU_add_test(pGroup, "TestStreamBase64", TestStreamBase64);
+	pTest = CU_add_test(pGroup, "TestQuotedPrintable", TestQuotedPrintable);
+}
+
+
+int main(int argc, char* argv[])
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	StartLibCitadel(8);
+	CU_BOOL Run = CU_FALSE ;
+	
+	CU_set_output_filename("TestAutomated");
+	if (CU_initialize_registry()) {
+		printf("\nInitialize of test Registry failed.");
+	}
+	
+	Run = CU_TRUE ;
+	AddBase64Tests();
+	
+	if (CU_TRUE == Run) {
+		//CU_console_run_tests();
+    printf("\nTests completed with return value %d.\n", CU_basic_run_tests());
+    
+    ///CU_automated_run_tests();
+	}
+	
+	CU_cleanup_registry();
+
+	return 0;
+}
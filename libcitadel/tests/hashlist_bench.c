@@ -0,0 +1,136 @@
+/*
+ * Timings of the HashList, using nothing but its public interface, so the
+ * same program can be built against an older libcitadel to compare with:
+ *
+ *   make hashlist_bench && ./hashlist_bench > new.txt
+ *   git show <commit>:libcitadel/lib/hash.c > /tmp/old_hash.c, and link this
+ *   file with it in front of the library; ./hashlist_bench > old.txt
+ *
+ * Each line is one size, the seconds for n Put()s, n GetHash()es, one walk
+ * after all the puts, n Put()s with a walk after every 16th of them, which
+ * is what the templates do to the lists they build, and n times deleting
+ * the oldest item of a full hash and putting a new one, like the session
+ * hashes and the SMTP queue see all day.
+ *
+ * The old sorted table compared to the index + arena; gcc -O2 on x86-64,
+ * one core, with the old hash.c linked in front of the library:
+ *
+ *  old    1000 items: put   0.0005s  get   0.0002s  iterate   0.0000s  put+walk   0.0006s  churn   0.0007s
+ *  old   10000 items: put   0.0125s  get   0.0073s  iterate   0.0003s  put+walk   0.0657s  churn   0.0570s
+ *  old  100000 items: put   1.5445s  get   0.3060s  iterate   0.0155s  put+walk  34.2797s  churn   5.4226s
+ *  new    1000 items: put   0.0003s  get   0.0001s  iterate   0.0001s  put+walk   0.0004s  churn   0.0006s
+ *  new   10000 items: put   0.0067s  get   0.0010s  iterate   0.0059s  put+walk   0.0633s  churn   0.0639s
+ *  new  100000 items: put   0.1322s  get   0.0707s  iterate   0.0764s  put+walk  15.5633s  churn   4.9045s
+ *
+ * The first walk pays for sorting what the old table sorted on each Put().
+ * Churn is linear in both, because deleting moves the rest of the table up.
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../lib/libcitadel.h"
+
+#define WALK_EVERY 16
+
+static double Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static long Walk(HashList *H)
+{
+	HashPos *at;
+	const char *HKey;
+	long HKLen;
+	void *vData;
+	long n = 0;
+
+	at = GetNewHashPos(H, 0);
+	while (GetNextHashPos(H, at, &HKLen, &HKey, &vData))
+		n++;
+	DeleteHashPos(&at);
+	return n;
+}
+
+static void Bench(long n)
+{
+	HashList *H;
+	HashPos *at;
+	char Key[64];
+	void *vData;
+	long i, l, found, walked;
+	double t0, tPut, tGet, tIter, tMixed, tChurn;
+
+	H = NewHash(1, NULL);
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+		Put(H, Key, l, strdup(Key), NULL);
+	}
+	tPut = Now() - t0;
+
+	found = 0;
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+		found += GetHash(H, Key, l, &vData);
+	}
+	tGet = Now() - t0;
+
+	t0 = Now();
+	walked = Walk(H);
+	tIter = Now() - t0;
+	DeleteHash(&H);
+
+	H = NewHash(1, NULL);
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+		Put(H, Key, l, strdup(Key), NULL);
+		if ((i % WALK_EVERY) == 0)
+			Walk(H);
+	}
+	tMixed = Now() - t0;
+
+	at = GetNewHashPos(H, 0);
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+		if (GetHashPosFromKey(H, Key, l, at))
+			DeleteEntryFromHash(H, at);
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", n + i);
+		Put(H, Key, l, strdup(Key), NULL);
+	}
+	tChurn = Now() - t0;
+	DeleteHashPos(&at);
+	DeleteHash(&H);
+
+	printf("%8ld items: put %8.4fs  get %8.4fs  iterate %8.4fs  put+walk %8.4fs  churn %8.4fs%s\n",
+	       n, tPut, tGet, tIter, tMixed, tChurn,
+	       ((found != n) || (walked != n)) ? "  (MISMATCH)" : "");
+}
+
+
+int main(int argc, char* argv[])
+{
+	long n;
+
+	StartLibCitadel(8);
+	for (n = 1000; n <= ((argc > 1) ? atol(argv[1]) : 100000); n *= 10)
+		Bench(n);
+	return 0;
+}
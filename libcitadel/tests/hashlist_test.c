@@ -295,6 +295,229 @@ static void TestMSetHashlist (void)
 }
 
 
+/*
+ * put a lot of items in, out of order, and see whether we can find them all
+ * again, and iterate them in order of their keys.
+ */
+static void TestHashlistMany (void)
+{
+	HashList *H;
+	HashPos *at;
+	void *vTest;
+	long len = 0;
+	const char *Key;
+	int *val, i, n, last;
+
+	n = 10000;
+	H = NewHash(1, Flathash);
+	for (i = 0; i < n; i++)
+	{
+		int k = (i * 7919) % n;
+		val = (int*) malloc(sizeof(int));
+		*val = k;
+		Put(H, IKEY(k), val, NULL);
+	}
+	CU_ASSERT_EQUAL(GetCount(H), n);
+
+	for (i = 0; i < n; i++)
+	{
+		CU_ASSERT(GetHash(H, IKEY(i), &vTest));
+		CU_ASSERT_EQUAL(*(int*) vTest, i);
+	}
+
+	last = -1;
+	at = GetNewHashPos(H, 0);
+	while (GetNextHashPos(H, at, &len, &Key, &vTest))
+	{
+		CU_ASSERT(*(int*) vTest > last);
+		last = *(int*) vTest;
+	}
+	DeleteHashPos(&at);
+	CU_ASSERT_EQUAL(last, n - 1);
+
+	/* remove every other one; the rest has to stay reachable. */
+	for (i = 0; i < n; i += 2)
+	{
+		at = GetNewHashPos(H, 0);
+		CU_ASSERT(GetHashPosFromKey(H, IKEY(i), at));
+		DeleteEntryFromHash(H, at);
+		DeleteHashPos(&at);
+	}
+	CU_ASSERT_EQUAL(GetCount(H), n / 2);
+	for (i = 0; i < n; i++)
+		CU_ASSERT_EQUAL(GetHash(H, IKEY(i), &vTest), i & 1);
+
+	CU_ASSERT_EQUAL(TestValidateHash(H), 0);
+	DeleteHash(&H);
+}
+
+
+
+/*
+ * walk the list between out of order puts, like the templates do; each walk
+ * has to see all of them, in order of their keys.
+ */
+static void TestHashlistInterleaved (void)
+{
+	HashList *H;
+	HashPos *at;
+	void *vTest;
+	long len = 0;
+	const char *Key;
+	int *val, i, j, n, last, count;
+
+	n = 2000;
+	H = NewHash(1, Flathash);
+	for (i = 0; i < n; i++)
+	{
+		int k = (i * 7919) % n;
+		val = (int*) malloc(sizeof(int));
+		*val = k;
+		Put(H, IKEY(k), val, NULL);
+		/* a few at a time, to also merge more than one */
+		if ((i % 3) != 0)
+			continue;
+
+		last = -1;
+		count = 0;
+		at = GetNewHashPos(H, 0);
+		while (GetNextHashPos(H, at, &len, &Key, &vTest))
+		{
+			CU_ASSERT(*(int*) vTest > last);
+			last = *(int*) vTest;
+			count++;
+		}
+		DeleteHashPos(&at);
+		CU_ASSERT_EQUAL(count, i + 1);
+	}
+	CU_ASSERT_EQUAL(TestValidateHash(H), 0);
+
+	/* a sort of our own has to stick while more come in behind it */
+	SortByHashKey(H, 0);
+	for (j = n; j < n + 10; j++)
+	{
+		val = (int*) malloc(sizeof(int));
+		*val = j;
+		Put(H, IKEY(j), val, NULL);
+	}
+	CU_ASSERT_EQUAL(GetCount(H), n + 10);
+	SortByHashKeyStr(H);
+	CU_ASSERT_EQUAL(TestValidateHash(H), 0);
+	DeleteHash(&H);
+}
+
+
+
+/*
+ * keep a small set of items alive while lots come and go, like a session
+ * index would; deleted ones get cleaned up behind our back, the living have
+ * to survive that.
+ */
+static void TestHashlistChurn (void)
+{
+	HashList *H;
+	HashPos *at;
+	void *vTest;
+	long len = 0;
+	const char *Key;
+	char buf[64];
+	int *val, i, n, live;
+
+	n = 20000;
+	live = 100;
+	H = NewHash(1, NULL);
+	for (i = 0; i < n; i++)
+	{
+		val = (int*) malloc(sizeof(int));
+		*val = i;
+		snprintf(buf, sizeof(buf), "session-%d", i);
+		Put(H, buf, strlen(buf), val, NULL);
+		if (i >= live)
+		{
+			snprintf(buf, sizeof(buf), "session-%d", i - live);
+			at = GetNewHashPos(H, 0);
+			CU_ASSERT(GetHashPosFromKey(H, buf, strlen(buf), at));
+			DeleteEntryFromHash(H, at);
+			DeleteHashPos(&at);
+		}
+	}
+	CU_ASSERT_EQUAL(GetCount(H), live);
+	for (i = 0; i < n; i++)
+	{
+		snprintf(buf, sizeof(buf), "session-%d", i);
+		CU_ASSERT_EQUAL(GetHash(H, buf, strlen(buf), &vTest), i >= n - live);
+		if (i >= n - live)
+		{
+			CU_ASSERT_EQUAL(*(int*) vTest, i);
+		}
+	}
+
+	/* ...and their keys have to be intact. */
+	i = 0;
+	at = GetNewHashPos(H, 0);
+	while (GetNextHashPos(H, at, &len, &Key, &vTest))
+	{
+		snprintf(buf, sizeof(buf), "session-%d", *(int*) vTest);
+		CU_ASSERT_STRING_EQUAL(Key, buf);
+		CU_ASSERT_EQUAL(len, strlen(buf));
+		i++;
+	}
+	DeleteHashPos(&at);
+	CU_ASSERT_EQUAL(i, live);
+
+	CU_ASSERT_EQUAL(TestValidateHash(H), 0);
+	DeleteHash(&H);
+}
+
+
+/*
+ * a key we got from walking the list has to stay good while other items
+ * are deleted around it, no matter how much gets cleaned up meanwhile.
+ */
+static void TestHashlistKeyLifetime (void)
+{
+	HashList *H;
+	HashPos *at;
+	void *vTest;
+	long len = 0;
+	const char *Key;
+	const char *Kept = NULL;
+	char buf[64];
+	int i, n;
+
+	n = 5000;
+	H = NewHash(1, NULL);
+	for (i = 0; i < n; i++)
+	{
+		snprintf(buf, sizeof(buf), "item-%d", i);
+		Put(H, buf, strlen(buf), strdup(buf), NULL);
+	}
+
+	at = GetNewHashPos(H, 0);
+	while (GetNextHashPos(H, at, &len, &Key, &vTest))
+	{
+		if (strcmp(Key, "item-4321") == 0)
+			Kept = Key;
+	}
+	DeleteHashPos(&at);
+	CU_ASSERT_PTR_NOT_NULL(Kept);
+
+	for (i = 0; i < n; i++)
+	{
+		if (i == 4321)
+			continue;
+		snprintf(buf, sizeof(buf), "item-%d", i);
+		at = GetNewHashPos(H, 0);
+		CU_ASSERT(GetHashPosFromKey(H, buf, strlen(buf), at));
+		DeleteEntryFromHash(H, at);
+		DeleteHashPos(&at);
+	}
+	CU_ASSERT_EQUAL(GetCount(H), 1);
+	CU_ASSERT_STRING_EQUAL(Kept, "item-4321");
+	CU_ASSERT_EQUAL(TestValidateHash(H), 0);
+	DeleteHash(&H);
+}
+
 
 static void AddHashlistTests(void)
 {
@@ -304,6 +527,10 @@ static void AddHashlistTests(void)
 	pGroup = CU_add_suite("TestStringBufSimpleAppenders", NULL, NULL);
 	pTest = CU_add_test(pGroup, "TestHashListIteratorForward", TestHashlistIteratorForward);
 	pTest = CU_add_test(pGroup, "TestHashlistAddDelete", TestHashlistAddDelete);
+	pTest = CU_add_test(pGroup, "TestHashlistMany", TestHashlistMany);
+	pTest = CU_add_test(pGroup, "TestHashlistInterleaved", TestHashlistInterleaved);
+	pTest = CU_add_test(pGroup, "TestHashlistChurn", TestHashlistChurn);
+	pTest = CU_add_test(pGroup, "TestHashlistKeyLifetime", TestHashlistKeyLifetime);
 	pTest = CU_add_test(pGroup, "TestMSetHashlist", TestMSetHashlist);
 }
 
@@ -0,0 +1,306 @@
+/*
+ *  CUnit - A Unit testing framework library for C.
+ *  Copyright (C) 2001  Anil Kumar
+ *
+ *  This library is open source software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Library General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Library General Public License for more details.
+ */
+
+/*
+ * The streaming JSON writer: escaping, nesting, handing on the output
+ * while writing, and the tree API that sits on top of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stringbuf_test.h"
+#include "../lib/libcitadel.h"
+
+#define NROUNDS 200
+
+
+static void TestJsonEscaping(void)
+{
+	static const struct {
+		const char *In;
+		const char *Plain;
+		const char *Html;
+	} Cases[] = {
+		{"", "\"\"", "\"\""},
+		{"plain", "\"plain\"", "\"plain\""},
+		{"a\"b\\c", "\"a\\\"b\\\\c\"", "\"a\\\"b\\\\c\""},
+		{"l1\nl2\r\tx\b\f", "\"l1\\nl2\\r\\tx\\b\\f\"", "\"l1\\nl2\\r\\tx\\b\\f\""},
+		{"\x01\x1f", "\"\\u0001\\u001f\"", "\"\\u0001\\u001f\""},
+		{"\\u00e4 and \\uzzzz", "\"\\u00e4 and \\\\uzzzz\"", "\"\\u00e4 and \\\\uzzzz\""},
+		{"tail\\u12", "\"tail\\\\u12\"", "\"tail\\\\u12\""},
+		{"<b>&amp;</b>", "\"<b>&amp;</b>\"", "\"&lt;b&gt;&amp;amp;&lt;/b&gt;\""},
+		{"R\xc3\xa4tsel \xe2\x82\xac", "\"R\xc3\xa4tsel \xe2\x82\xac\"", "\"R\xc3\xa4tsel \xe2\x82\xac\""},
+	};
+	StrBuf *Out, *In;
+	JsonWriter *W;
+	int i;
+
+	Out = NewStrBuf();
+	for (i = 0; i < (int)(sizeof(Cases) / sizeof(Cases[0])); i++) {
+		In = NewStrBufPlain(Cases[i].In, -1);
+
+		FlushStrBuf(Out);
+		W = NewJsonWriter(Out);
+		JsonWriteString(W, NULL, 0, In);
+		CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Out), Cases[i].Plain);
+
+		FlushStrBuf(Out);
+		W = NewJsonWriter(Out);
+		JsonWriteHtmlString(W, NULL, 0, In);
+		CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Out), Cases[i].Html);
+
+		/* the tree says the same. */
+		FlushStrBuf(Out);
+		SerializeJson(Out, NewJsonString(NULL, 0, In), 1);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Out), Cases[i].Plain);
+
+		FreeStrBuf(&In);
+	}
+
+	/* keys are escaped like values */
+	FlushStrBuf(Out);
+	W = NewJsonWriter(Out);
+	JsonWriteObjectStart(W, NULL, 0);
+	JsonWriteNumber(W, HKEY("a\"b"), 1);
+	JsonWriteNull(W, NULL, 0);
+	JsonWriteObjectEnd(W);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+	CU_ASSERT_STRING_EQUAL(ChrPtr(Out), "{\"a\\\"b\":1,\"\":null}");
+	FreeStrBuf(&Out);
+}
+
+static void TestJsonNesting(void)
+{
+	StrBuf *Out;
+	JsonWriter *W;
+	int i;
+
+	Out = NewStrBuf();
+	W = NewJsonWriter(Out);
+	JsonWriteObjectStart(W, NULL, 0);
+	JsonWriteNumber(W, HKEY("n"), -42);
+	JsonWriteArrayStart(W, HKEY("list"));
+	JsonWriteBool(W, HKEY("ignored"), 1);
+	JsonWriteBool(W, NULL, 0, 0);
+	JsonWriteObjectStart(W, NULL, 0);
+	JsonWriteObjectEnd(W);
+	JsonWriteArrayStart(W, NULL, 0);
+	JsonWriteArrayEnd(W);
+	JsonWritePlainString(W, NULL, 0, "x", -1);
+	JsonWriteArrayEnd(W);
+	JsonWriteBigNumber(W, HKEY("f"), 0.5);
+	JsonWriteObjectEnd(W);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+	CU_ASSERT_STRING_EQUAL(ChrPtr(Out),
+			       "{\"n\":-42,\"list\":[true,false,{},[],\"x\"],\"f\":0.500000}");
+
+	/* left open */
+	FlushStrBuf(Out);
+	W = NewJsonWriter(Out);
+	JsonWriteArrayStart(W, NULL, 0);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), -1);
+	CU_ASSERT_PTR_EQUAL(W, NULL);
+
+	/* closed the wrong way */
+	FlushStrBuf(Out);
+	W = NewJsonWriter(Out);
+	JsonWriteArrayStart(W, NULL, 0);
+	JsonWriteObjectEnd(W);
+	JsonWriteArrayEnd(W);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), -1);
+
+	/* too deep */
+	FlushStrBuf(Out);
+	W = NewJsonWriter(Out);
+	for (i = 0; i < 100; i++)
+		JsonWriteArrayStart(W, NULL, 0);
+	for (i = 0; i < 100; i++)
+		JsonWriteArrayEnd(W);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), -1);
+
+	FreeStrBuf(&Out);
+}
+
+
+/*
+ * build the same document once as a tree, once through the writer.
+ */
+static JsonValue *BuildTree(long n)
+{
+	JsonValue *Root, *Obj, *List, *Msg;
+	StrBuf *S;
+	long i;
+
+	/* objects come out in hash order, so only one member per object here. */
+	Root = NewJsonArray(NULL, 0);
+	JsonArrayAppend(Root, NewJsonNumber(NULL, 0, n));
+	JsonArrayAppend(Root, NewJsonPlainString(NULL, 0, HKEY("Lobby \"main\"")));
+	JsonArrayAppend(Root, NewJsonNull(NULL, 0));
+	Obj = NewJsonObject(NULL, 0);
+	List = NewJsonArray(HKEY("msgs"));
+	S = NewStrBuf();
+	for (i = 0; i < n; i++) {
+		StrBufPrintf(S, "Re: message\t%ld <x@y>", i);
+		Msg = NewJsonArray(NULL, 0);
+		JsonArrayAppend(Msg, NewJsonNumber(NULL, 0, i * 7));
+		JsonArrayAppend(Msg, NewJsonString(NULL, 0, S));
+		JsonArrayAppend(Msg, NewJsonBigNumber(NULL, 0, i / 4.0));
+		JsonArrayAppend(Msg, NewJsonBool(NULL, 0, i & 1));
+		JsonArrayAppend(List, Msg);
+	}
+	JsonObjectAppend(Obj, List);
+	JsonArrayAppend(Root, Obj);
+	FreeStrBuf(&S);
+	return Root;
+}
+
+static void StreamDocument(JsonWriter *W, long n)
+{
+	StrBuf *S;
+	long i;
+
+	S = NewStrBuf();
+	JsonWriteArrayStart(W, NULL, 0);
+	JsonWriteNumber(W, NULL, 0, n);
+	JsonWritePlainString(W, NULL, 0, HKEY("Lobby \"main\""));
+	JsonWriteNull(W, NULL, 0);
+	JsonWriteObjectStart(W, NULL, 0);
+	JsonWriteArrayStart(W, HKEY("msgs"));
+	for (i = 0; i < n; i++) {
+		StrBufPrintf(S, "Re: message\t%ld <x@y>", i);
+		JsonWriteArrayStart(W, NULL, 0);
+		JsonWriteNumber(W, NULL, 0, i * 7);
+		JsonWriteString(W, NULL, 0, S);
+		JsonWriteBigNumber(W, NULL, 0, i / 4.0);
+		JsonWriteBool(W, NULL, 0, i & 1);
+		JsonWriteArrayEnd(W);
+	}
+	JsonWriteArrayEnd(W);
+	JsonWriteObjectEnd(W);
+	JsonWriteArrayEnd(W);
+	FreeStrBuf(&S);
+}
+
+typedef struct _FlushSink {
+	StrBuf *Collected;
+	int nCalls;
+	int FailAt;
+} FlushSink;
+
+static int CollectFlush(StrBuf *Buf, void *Ctx)
+{
+	FlushSink *Sink = (FlushSink*) Ctx;
+
+	Sink->nCalls ++;
+	if (Sink->nCalls == Sink->FailAt)
+		return -1;
+	StrBufAppendBuf(Sink->Collected, Buf, 0);
+	return StrLength(Buf);
+}
+
+static void TestJsonTreeVsStream(void)
+{
+	StrBuf *Tree, *Stream;
+	FlushSink Sink;
+	JsonWriter *W;
+	long n;
+
+	Tree = NewStrBuf();
+	Stream = NewStrBuf();
+	memset(&Sink, 0, sizeof(Sink));
+	Sink.Collected = NewStrBuf();
+
+	for (n = 0; n < NROUNDS; n += 1 + n / 4) {
+		FlushStrBuf(Tree);
+		SerializeJson(Tree, BuildTree(n), 1);
+
+		FlushStrBuf(Stream);
+		W = NewJsonWriter(Stream);
+		StreamDocument(W, n);
+		CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+		CU_ASSERT_EQUAL(StrLength(Stream), StrLength(Tree));
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Stream), ChrPtr(Tree));
+
+		/* handed on in pieces, nothing may get lost or reordered */
+		FlushStrBuf(Stream);
+		FlushStrBuf(Sink.Collected);
+		Sink.nCalls = 0;
+		W = NewJsonStreamWriter(Stream, 100, CollectFlush, &Sink);
+		StreamDocument(W, n);
+		CU_ASSERT_EQUAL(FreeJsonWriter(&W), 0);
+		CU_ASSERT_EQUAL(StrLength(Stream), 0);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Sink.Collected), ChrPtr(Tree));
+		if (StrLength(Tree) > 200)
+			CU_ASSERT(Sink.nCalls > 1);
+	}
+
+	/* a failing sink fails the document */
+	FlushStrBuf(Stream);
+	FlushStrBuf(Sink.Collected);
+	Sink.nCalls = 0;
+	Sink.FailAt = 2;
+	W = NewJsonStreamWriter(Stream, 100, CollectFlush, &Sink);
+	StreamDocument(W, 50);
+	CU_ASSERT_EQUAL(FreeJsonWriter(&W), -1);
+	CU_ASSERT_EQUAL(Sink.nCalls, 2);
+
+	FreeStrBuf(&Tree);
+	FreeStrBuf(&Stream);
+	FreeStrBuf(&Sink.Collected);
+}
+
+
+static void AddJsonTests(void)
+{
+	CU_pSuite pGroup = NULL;
+	CU_pTest pTest = NULL;
+
+	pGroup = CU_add_suite("TestJsonWriter", NULL, NULL);
+	pTest = CU_add_test(pGroup, "TestJsonEscaping", TestJsonEscaping);
+	pTest = CU_add_test(pGroup, "TestJsonNesting", TestJsonNesting);
+	pTest = CU_add_test(pGroup, "TestJsonTreeVsStream", TestJsonTreeVsStream);
+}
+
+
+int main(int argc, char* argv[])
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	StartLibCitadel(8);
+	CU_BOOL Run = CU_FALSE ;
+
+	CU_set_output_filename("TestAutomated");
+	if (CU_initialize_registry()) {
+		printf("\nInitialize of test Registry failed.");
+	}
+
+	Run = CU_TRUE ;
+	AddJsonTests();
+
+	if (CU_TRUE == Run) {
+		//CU_console_run_tests();
+    printf("\nTests completed with return value %d.\n", CU_basic_run_tests());
+
+    ///CU_automated_run_tests();
+	}
+
+	CU_cleanup_registry();
+
+	return 0;
+}
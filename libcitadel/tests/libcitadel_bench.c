@@ -0,0 +1,600 @@
+/*
+ * Microbenchmarks of the primitives citserver and webcit lean on, with
+ * a baseline to compare against so regressions show up here first.
+ *
+ * usage: libcitadel_bench [-q] [-r rounds] [-m corpusdir] [-o results] [-b baseline] [-t tolerance%]
+ *
+ *  -q  quick: skip the million entry hash lists, fewer rounds
+ *  -r  how many rounds per case; the fastest one counts (default 5)
+ *  -m  the mime corpus (default testdata/mime)
+ *  -o  write the results there; that file can serve as baseline later on
+ *  -b  compare against a baseline written by -o before
+ *  -t  how much slower than the baseline is still OK, in percent (default 15)
+ *
+ * Results are one case per line: name, nanoseconds per op, ops per round.
+ * Timings are only comparable on the same box with the same build flags,
+ * so the baseline is recorded locally (make bench-baseline) and not shipped.
+ * With -b we exit 1 if any case got slower than the tolerance allows.
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "../lib/libcitadel.h"
+
+
+static double Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* keeps the compiler from optimizing our work away */
+static volatile long Sink;
+
+
+/*******************************************************************************
+ *                       The cases                                             *
+ *******************************************************************************/
+
+/*
+ * Each case does n ops and returns the seconds the ops took; setup and
+ * cleanup are not part of it.  Size is the number of entries for the
+ * HashList cases, and unused otherwise.
+ */
+typedef double (*BenchFunc)(long Size, long n);
+
+static double BenchStrBufAppend(long Size, long n)
+{
+	StrBuf *Buf = NewStrBufPlain(NULL, SIZ);
+	double t0, t;
+	long i;
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		StrBufAppendBufPlain(Buf, HKEY("From: Somebody Else <somebody@example.com>\r\n"), 0);
+		if ((i & 1023) == 1023)
+			FlushStrBuf(Buf);
+	}
+	t = Now() - t0;
+	FreeStrBuf(&Buf);
+	return t;
+}
+
+static double BenchStrBufPrintf(long Size, long n)
+{
+	StrBuf *Buf = NewStrBufPlain(NULL, SIZ);
+	double t0, t;
+	long i;
+
+	t0 = Now();
+	for (i = 0; i < n; i++)
+		StrBufPrintf(Buf, "%ld|%s|%d|%s|%ld", i, "Room Name", 42, "user@example.com", i * 7);
+	t = Now() - t0;
+	FreeStrBuf(&Buf);
+	return t;
+}
+
+/* one op is one token */
+static double BenchStrBufTokenize(long Size, long n)
+{
+	StrBuf *Line = NewStrBufPlain(HKEY("MSG4|1234567|1471000000|Somebody Else|example.com|Lobby|"
+					   "user@example.com|0|text/plain|UTF-8|8bit|0|||Subject line here|"
+					   "20|Room|x|y|z"));
+	StrBuf *Token = NewStrBufPlain(NULL, SIZ);
+	const char *Pos = NULL;
+	double t0, t;
+	long i;
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		if (!StrBufHaveNextToken(Line, &Pos))
+			Pos = NULL;
+		StrBufExtract_NextToken(Token, Line, &Pos, '|');
+	}
+	t = Now() - t0;
+	FreeStrBuf(&Line);
+	FreeStrBuf(&Token);
+	return t;
+}
+
+static HashList *BuildHash(long n)
+{
+	HashList *H = NewHash(1, NULL);
+	char Key[64];
+	long i, l;
+
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+		Put(H, Key, l, (void *) i, reference_free_handler);
+	}
+	return H;
+}
+
+/* one op is one Put(); we fill lists of Size entries until we've got n. */
+static double BenchHashInsert(long Size, long n)
+{
+	HashList *H;
+	char Key[64];
+	double t0, t = 0;
+	long i, j, l;
+
+	for (j = 0; j < n; j += Size) {
+		H = NewHash(1, NULL);
+		t0 = Now();
+		for (i = 0; i < Size; i++) {
+			l = snprintf(Key, sizeof(Key), "user%ld@example.com", i);
+			Put(H, Key, l, (void *) i, reference_free_handler);
+		}
+		t += Now() - t0;
+		DeleteHash(&H);
+	}
+	return t;
+}
+
+static double BenchHashLookup(long Size, long n)
+{
+	HashList *H = BuildHash(Size);
+	char Key[64];
+	void *vData;
+	double t0, t;
+	long i, l, found = 0;
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		l = snprintf(Key, sizeof(Key), "user%ld@example.com", (i * 7919) % Size);
+		found += GetHash(H, Key, l, &vData);
+	}
+	t = Now() - t0;
+	Sink = found;
+	DeleteHash(&H);
+	return t;
+}
+
+/* one op is one step of the iterator */
+static double BenchHashIterate(long Size, long n)
+{
+	HashList *H = BuildHash(Size);
+	HashPos *at;
+	const char *HKey;
+	long HKLen, sum = 0;
+	void *vData;
+	double t0, t;
+	long j;
+
+	t0 = Now();
+	for (j = 0; j < n; j += Size) {
+		at = GetNewHashPos(H, 0);
+		while (GetNextHashPos(H, at, &HKLen, &HKey, &vData))
+			sum += HKLen;
+		DeleteHashPos(&at);
+	}
+	t = Now() - t0;
+	Sink = sum;
+	DeleteHash(&H);
+	return t;
+}
+
+/* HashList sizes; a case per size and operation, a million ops each. */
+#define HASH_CASES(Op, Func)						\
+	{"hashlist." Op ".1e3", Func, 1000, 1000000, 0},		\
+	{"hashlist." Op ".1e4", Func, 10000, 1000000, 0},		\
+	{"hashlist." Op ".1e5", Func, 100000, 1000000, 0},		\
+	{"hashlist." Op ".1e6", Func, 1000000, 1000000, 1}
+
+
+#define CODEC_SIZE (64 * 1024)
+
+/* one op is a 64k buffer */
+static double BenchBase64Encode(long Size, long n)
+{
+	char *Plain = malloc(CODEC_SIZE);
+	char *Code = malloc(CODEC_SIZE * 2);
+	double t0, t;
+	long i;
+
+	for (i = 0; i < CODEC_SIZE; i++)
+		Plain[i] = (i * 131) & 0xff;
+	t0 = Now();
+	for (i = 0; i < n; i++)
+		Sink = CtdlEncodeBase64(Code, Plain, CODEC_SIZE, 1);
+	t = Now() - t0;
+	free(Plain);
+	free(Code);
+	return t;
+}
+
+static double BenchBase64Decode(long Size, long n)
+{
+	char *Plain = malloc(CODEC_SIZE * 2);	/* the decoder may write a partial byte past the end */
+	char *Code = malloc(CODEC_SIZE * 2);
+	double t0, t;
+	long i, nCode;
+
+	for (i = 0; i < CODEC_SIZE; i++)
+		Plain[i] = (i * 131) & 0xff;
+	nCode = CtdlEncodeBase64(Code, Plain, CODEC_SIZE, 1);
+	t0 = Now();
+	for (i = 0; i < n; i++)
+		Sink = CtdlDecodeBase64(Plain, Code, nCode);
+	t = Now() - t0;
+	free(Plain);
+	free(Code);
+	return t;
+}
+
+static double BenchQPDecode(long Size, long n)
+{
+	char *QP = malloc(CODEC_SIZE * 2);
+	char *Out = malloc(CODEC_SIZE * 2);
+	double t0, t;
+	long i, nQP;
+
+	/* mostly text, some of it escaped, soft linebreaks every 76 */
+	for (i = 0, nQP = 0; nQP < CODEC_SIZE; i++) {
+		if (nQP % 78 == 75)
+			nQP += sprintf(QP + nQP, "=\r\n");
+		if (i % 23 == 0)
+			nQP += sprintf(QP + nQP, "=%02X", (int)(0x80 + i % 0x7f));
+		else
+			QP[nQP++] = 'a' + i % 26;
+	}
+	t0 = Now();
+	for (i = 0; i < n; i++)
+		Sink = CtdlDecodeQuotedPrintable(Out, QP, nQP);
+	t = Now() - t0;
+	free(QP);
+	free(Out);
+	return t;
+}
+
+/* one op is one header line with three encoded words in different charsets */
+static double BenchRFC2047Decode(long Size, long n)
+{
+	StrBuf *Header = NewStrBufPlain(HKEY(
+		"=?iso-8859-1?Q?Gr=FC=DFe_aus_M=FCnchen?= und =?UTF-8?B?w6TDtsO8IMOEw5bDnA==?= "
+		"=?koi8-r?B?8NLJ18XU?= (Re: Fwd: the usual)"));
+	StrBuf *Target = NewStrBufPlain(NULL, SIZ);
+	StrBuf *Default = NewStrBufPlain(HKEY("UTF-8"));
+	StrBuf *Found = NewStrBufPlain(NULL, SIZ);
+	StrBuf *Conv = NewStrBufPlain(NULL, SIZ);
+	StrBuf *Conv2 = NewStrBufPlain(NULL, SIZ);
+	double t0, t;
+	long i;
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		FlushStrBuf(Target);
+		StrBuf_RFC822_2_Utf8(Target, Header, Default, Found, Conv, Conv2);
+	}
+	t = Now() - t0;
+	FreeStrBuf(&Header);
+	FreeStrBuf(&Target);
+	FreeStrBuf(&Default);
+	FreeStrBuf(&Found);
+	FreeStrBuf(&Conv);
+	FreeStrBuf(&Conv2);
+	return t;
+}
+
+/* one op is a ~16k html mail */
+static double BenchHtmlToAscii(long Size, long n)
+{
+	StrBuf *Html = NewStrBufPlain(HKEY("<html><head><style>p {color: red}</style></head><body>\n"));
+	char *Ascii;
+	double t0, t;
+	long i;
+
+	while (StrLength(Html) < 16 * 1024)
+		StrBufAppendBufPlain(Html, HKEY(
+			"<p>Some <b>bold</b> words &amp; an &quot;entity&quot; or two &auml;&ouml;&uuml;, "
+			"<a href=\"http://example.com/\">a link</a><br>\n"
+			"<blockquote>quoted text that will be wrapped at the screen width, quoted text "
+			"that will be wrapped</blockquote>\n"
+			"<table><tr><td>cell</td><td>cell</td></tr></table></p>\n"), 0);
+	StrBufAppendBufPlain(Html, HKEY("</body></html>\n"), 0);
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		Ascii = html_to_ascii(ChrPtr(Html), StrLength(Html), 80, 0);
+		free(Ascii);
+	}
+	t = Now() - t0;
+	FreeStrBuf(&Html);
+	return t;
+}
+
+/* one op is loading a vCard and looking up its mail address, the way autocompletion does. */
+static double BenchVCardParse(long Size, long n)
+{
+	char VCard[] =
+		"BEGIN:VCARD\r\n"
+		"VERSION:2.1\r\n"
+		"N:Else;Somebody;;Dr.;\r\n"
+		"FN:Dr. Somebody Else\r\n"
+		"ORG:Example Inc.;Engineering\r\n"
+		"TITLE:Head of Things\r\n"
+		"TEL;WORK;VOICE:+1 555 1234\r\n"
+		"TEL;HOME;VOICE:+1 555 4321\r\n"
+		"ADR;WORK:;;1 Main St;Springfield;XX;12345;USA\r\n"
+		"EMAIL;PREF;INTERNET:somebody@example.com\r\n"
+		"EMAIL;INTERNET:somebody.else@example.org\r\n"
+		"NOTE;ENCODING=QUOTED-PRINTABLE:first line=0D=0Asecond line\r\n"
+		"REV:20160101T000000Z\r\n"
+		"END:VCARD\r\n";
+	struct vCard *v;
+	double t0, t;
+	long i;
+
+	t0 = Now();
+	for (i = 0; i < n; i++) {
+		v = vcard_load(VCard);
+		Sink = (long) vcard_get_prop(v, "email", 1, 0, 0);
+		vcard_free(v);
+	}
+	t = Now() - t0;
+	return t;
+}
+
+/* the corpus is loaded once; one op parses all of it. */
+typedef struct _MimeCorpus {
+	char **Msgs;
+	long *Lens;
+	int n;
+} MimeCorpus;
+
+static MimeCorpus Corpus;
+
+static void mime_count_part(char *name, char *filename, char *partnum, char *disp,
+			    void *content, char *cbtype, char *cbcharset, size_t length,
+			    char *encoding, char *cbid, void *userdata)
+{
+	*(long *)userdata += length;
+}
+
+static int LoadCorpus(const char *Dir)
+{
+	struct dirent *d;
+	char Filename[PATH_MAX];
+	const char *Err;
+	struct stat st;
+	StrBuf *Buf;
+	DIR *dp;
+	int fd;
+
+	dp = opendir(Dir);
+	if (dp == NULL) {
+		perror(Dir);
+		return -1;
+	}
+	while ((d = readdir(dp)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(Filename, sizeof Filename, "%s/%s", Dir, d->d_name);
+		fd = open(Filename, O_RDONLY);
+		if ((fd < 0) || (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+		Buf = NewStrBufPlain(NULL, st.st_size + 1);
+		StrBufReadBLOB(Buf, &fd, 1, st.st_size, &Err);
+		if (fd >= 0)
+			close(fd);
+		Corpus.Msgs = realloc(Corpus.Msgs, sizeof(char *) * (Corpus.n + 1));
+		Corpus.Lens = realloc(Corpus.Lens, sizeof(long) * (Corpus.n + 1));
+		Corpus.Lens[Corpus.n] = StrLength(Buf);
+		Corpus.Msgs[Corpus.n] = SmashStrBuf(&Buf);
+		Corpus.n++;
+	}
+	closedir(dp);
+	return Corpus.n;
+}
+
+static void FreeCorpus(void)
+{
+	int i;
+
+	for (i = 0; i < Corpus.n; i++)
+		free(Corpus.Msgs[i]);
+	free(Corpus.Msgs);
+	free(Corpus.Lens);
+}
+
+static double BenchMimeParse(long Size, long n)
+{
+	double t0, t;
+	long i, Bytes = 0;
+	int j;
+
+	t0 = Now();
+	for (i = 0; i < n; i++)
+		for (j = 0; j < Corpus.n; j++)
+			mime_parser(Corpus.Msgs[j], Corpus.Msgs[j] + Corpus.Lens[j],
+				    mime_count_part, NULL, NULL, &Bytes, 0);
+	t = Now() - t0;
+	Sink = Bytes;
+	return t;
+}
+
+
+typedef struct _BenchCase {
+	const char *Name;
+	BenchFunc Func;
+	long Size;
+	long N;			/* ops per round */
+	int Slow;		/* skipped with -q */
+} BenchCase;
+
+static BenchCase Cases[] = {
+	{"strbuf.append", BenchStrBufAppend, 0, 1000000, 0},
+	{"strbuf.printf", BenchStrBufPrintf, 0, 200000, 0},
+	{"strbuf.tokenize", BenchStrBufTokenize, 0, 1000000, 0},
+	HASH_CASES("insert", BenchHashInsert),
+	HASH_CASES("lookup", BenchHashLookup),
+	HASH_CASES("iterate", BenchHashIterate),
+	{"base64.encode.64k", BenchBase64Encode, 0, 200, 0},
+	{"base64.decode.64k", BenchBase64Decode, 0, 200, 0},
+	{"qp.decode.64k", BenchQPDecode, 0, 200, 0},
+	{"rfc2047.decode", BenchRFC2047Decode, 0, 20000, 0},
+	{"html_to_ascii.16k", BenchHtmlToAscii, 0, 5, 0},
+	{"vcard.parse", BenchVCardParse, 0, 20000, 0},
+	{"mime.parse.corpus", BenchMimeParse, 0, 20, 0},
+	{NULL, NULL, 0, 0, 0}
+};
+
+
+/*******************************************************************************
+ *                       Baselines                                             *
+ *******************************************************************************/
+
+static HashList *LoadBaseline(const char *Filename)
+{
+	HashList *Baseline;
+	char Line[SIZ];
+	char Name[SIZ];
+	double *NsPerOp;
+	double v;
+	FILE *fp;
+
+	fp = fopen(Filename, "r");
+	if (fp == NULL) {
+		perror(Filename);
+		return NULL;
+	}
+	Baseline = NewHash(1, NULL);
+	while (fgets(Line, sizeof Line, fp) != NULL) {
+		if ((Line[0] == '#') || (sscanf(Line, "%s %lf", Name, &v) != 2))
+			continue;
+		NsPerOp = malloc(sizeof(double));
+		*NsPerOp = v;
+		Put(Baseline, Name, strlen(Name), NsPerOp, NULL);
+	}
+	fclose(fp);
+	return Baseline;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const char *CorpusDir = "testdata/mime";
+	const char *OutFile = NULL;
+	const char *BaselineFile = NULL;
+	HashList *Baseline = NULL;
+	FILE *Out = NULL;
+	BenchCase *c;
+	void *vBase;
+	double Tolerance = 15.0;
+	double t, Best, NsPerOp, Delta;
+	int Rounds = 5;
+	int Quick = 0;
+	int Regressions = 0;
+	int a, r;
+
+	while ((a = getopt(argc, argv, "qr:m:o:b:t:")) != EOF)
+	{
+		switch (a) {
+		case 'q':
+			Quick = 1;
+			Rounds = 2;
+			break;
+		case 'r':
+			Rounds = atoi(optarg);
+			break;
+		case 'm':
+			CorpusDir = optarg;
+			break;
+		case 'o':
+			OutFile = optarg;
+			break;
+		case 'b':
+			BaselineFile = optarg;
+			break;
+		case 't':
+			Tolerance = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-q] [-r rounds] [-m corpusdir] [-o results] [-b baseline] [-t tolerance%%]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (Rounds < 1)
+		Rounds = 1;
+
+	StartLibCitadel(8);
+	if (LoadCorpus(CorpusDir) <= 0)
+		return 2;
+	if (BaselineFile != NULL) {
+		Baseline = LoadBaseline(BaselineFile);
+		if (Baseline == NULL)
+			return 2;
+	}
+	if (OutFile != NULL) {
+		Out = fopen(OutFile, "w");
+		if (Out == NULL) {
+			perror(OutFile);
+			return 2;
+		}
+		fprintf(Out, "# name ns/op ops/round\n");
+	}
+
+	printf("# %-26s %14s %10s", "name", "ns/op", "ops/round");
+	if (Baseline != NULL)
+		printf(" %14s %8s", "baseline", "delta%");
+	printf("\n");
+
+	for (c = Cases; c->Name != NULL; c++) {
+		if (Quick && c->Slow)
+			continue;
+		Best = -1;
+		for (r = 0; r < Rounds; r++) {
+			t = c->Func(c->Size, c->N);
+			if ((Best < 0) || (t < Best))
+				Best = t;
+		}
+		NsPerOp = Best * 1e9 / c->N;
+		printf("%-28s %14.2f %10ld", c->Name, NsPerOp, c->N);
+		if (Out != NULL)
+			fprintf(Out, "%s %.2f %ld\n", c->Name, NsPerOp, c->N);
+
+		if ((Baseline != NULL) && GetHash(Baseline, c->Name, strlen(c->Name), &vBase)) {
+			Delta = (NsPerOp / *(double *)vBase - 1.0) * 100.0;
+			printf(" %14.2f %+8.1f", *(double *)vBase, Delta);
+			if (Delta > Tolerance) {
+				printf(" SLOWER");
+				Regressions++;
+			}
+		}
+		else if (Baseline != NULL) {
+			printf(" %14s %8s", "-", "-");
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	if (Out != NULL)
+		fclose(Out);
+	if (Baseline != NULL) {
+		printf("# %d case(s) slower than the baseline by more than %.1f%%\n", Regressions, Tolerance);
+		DeleteHash(&Baseline);
+	}
+	FreeCorpus();
+	ShutDownLibCitadel();
+	return (Regressions > 0) ? 1 : 0;
+}
@@ -200,6 +200,118 @@ void mime_spew_section(char *name,
 
 
 
+/*
+ * Run the message through the streaming parser, feeding it ChunkSize bytes
+ * at a time, and hand what it finds to the same callbacks mime_parser() uses.
+ */
+static void stream_parser(char *MimeStr, long MimeLen, long ChunkSize,
+			  MimeParserCallBackType CallBack,
+			  MimeParserCallBackType PreMultiPartCallBack,
+			  MimeParserCallBackType PostMultiPartCallBack,
+			  void *userdata,
+			  int dont_decode)
+{
+	struct ma_info *ma = (struct ma_info *)userdata;
+	MimeStreamParser *P;
+	MimePartInfo *Info;
+	eMimeEvent Event;
+	StrBuf *Body;
+	const char *Data;
+	char *Chunk;
+	char encoding[256];
+	long Fed = 0;
+	long len;
+	int decode;
+
+	P = NewMimeStreamParser();
+	Body = NewStrBuf();
+	/* one buffer for all chunks, so the parser can't get away with keeping pointers into old ones */
+	Chunk = malloc(ChunkSize);
+
+	while ((Event = MimeStreamNext(P, &Info)) != eMimeEnd) {
+		switch (Event) {
+		case eMimeNeedMore:
+			len = MimeLen - Fed;
+			if (len > ChunkSize)
+				len = ChunkSize;
+			if (len == 0) {
+				MimeStreamDone(P);
+				break;
+			}
+			memcpy(Chunk, MimeStr + Fed, len);
+			Fed += len;
+			MimeStreamFeed(P, Chunk, len);
+			break;
+		case eMimeMultipartStart:
+			if (PreMultiPartCallBack != NULL)
+				PreMultiPartCallBack("", "", Info->PartNum, "", NULL,
+						     Info->ContentType, Info->Charset, 0,
+						     Info->Encoding, Info->Id, userdata);
+			break;
+		case eMimeMultipartEnd:
+			if (PostMultiPartCallBack != NULL)
+				PostMultiPartCallBack("", "", Info->PartNum, "", NULL,
+						      Info->ContentType, Info->Charset, 0,
+						      Info->Encoding, Info->Id, userdata);
+			break;
+		case eMimePart:
+			if (CallBack == NULL)
+				break;
+			/*
+			 * The stream parser only looks into an encapsulated message if
+			 * nobody read it; so we don't, unless it's the one to print.
+			 */
+			if (!strcasecmp(Info->ContentType, "message/rfc822") &&
+			    ((ma->printme == NULL) || strcasecmp(ma->printme, Info->PartNum))) {
+				CallBack(Info->Name, Info->Filename, Info->PartNum, Info->Disposition,
+					 NULL, Info->ContentType, Info->Charset,
+					 0, Info->Encoding, Info->Id, userdata);
+				break;
+			}
+			decode = !dont_decode && !IsEmptyStr(Info->Encoding);
+			/* mime_parser() drops parts in encodings it doesn't know */
+			if (decode &&
+			    strcasecmp(Info->Encoding, "base64") &&
+			    strcasecmp(Info->Encoding, "quoted-printable"))
+				break;
+			FlushStrBuf(Body);
+			while (1) {
+				if (decode)
+					len = MimeStreamDecodedBody(P, Body);
+				else if ((len = MimeStreamRawBody(P, &Data)) > 0)
+					StrBufAppendBufPlain(Body, Data, len, 0);
+				if (len == 0)
+					break;
+				if (len < 0) {
+					len = MimeLen - Fed;
+					if (len > ChunkSize)
+						len = ChunkSize;
+					if (len == 0) {
+						MimeStreamDone(P);
+						continue;
+					}
+					memcpy(Chunk, MimeStr + Fed, len);
+					Fed += len;
+					MimeStreamFeed(P, Chunk, len);
+				}
+			}
+			if (decode && (StrLength(Body) == 0))
+				break;
+			/* the callbacks may scribble on it */
+			snprintf(encoding, sizeof encoding, "%s", (decode) ? "binary" : Info->Encoding);
+			CallBack(Info->Name, Info->Filename, Info->PartNum, Info->Disposition,
+				 (void *)ChrPtr(Body), Info->ContentType, Info->Charset,
+				 StrLength(Body), encoding, Info->Id, userdata);
+			break;
+		case eMimeEnd:
+			break;
+		}
+	}
+	free(Chunk);
+	FreeStrBuf(&Body);
+	FreeMimeStreamParser(&P);
+}
+
 int main(int argc, char* argv[])
 {
 	char a;
@@ -214,11 +326,12 @@ int main(int argc, char* argv[])
 	struct ma_info ma;
 	int do_proto = 0;
 	int dont_decode = 1;
+	long ChunkSize = 0;
 
 	setvbuf(stdout, NULL, _IONBF, 0);
 	memset(&ma, 0, sizeof(struct ma_info));
 
-	while ((a = getopt(argc, argv, "dpf:P:")) != EOF)
+	while ((a = getopt(argc, argv, "dpf:P:s:")) != EOF)
 	{
 		switch (a) {
 		case 'f':
@@ -232,6 +345,10 @@ int main(int argc, char* argv[])
 			break;
 		case 'P':
 			ma.printme = optarg;
+			break;
+		case 's':
+			ChunkSize = atol(optarg);
+			break;
 		}
 	}
 	StartLibCitadel(8);
@@ -258,7 +375,18 @@ int main(int argc, char* argv[])
 	MimeLen = StrLength(MimeBuf);
 	MimeStr = SmashStrBuf(&MimeBuf);
 
-	if (ma.printme == NULL)
+	if (ChunkSize > 0) {
+		if (ma.printme == NULL)
+			stream_parser(MimeStr, MimeLen, ChunkSize,
+				      (do_proto ? *list_this_part : NULL),
+				      (do_proto ? *list_this_pref : NULL),
+				      (do_proto ? *list_this_suff : NULL),
+				      (void *)&ma, dont_decode);
+		else
+			stream_parser(MimeStr, MimeLen, ChunkSize,
+				      *mime_download, NULL, NULL, (void *)&ma, dont_decode);
+	}
+	else if (ma.printme == NULL)
 		mime_parser(MimeStr, MimeStr + MimeLen,
 			    (do_proto ? *list_this_part : NULL),
 			    (do_proto ? *list_this_pref : NULL),
@@ -32,6 +32,10 @@ esac
 
 echo running wildfire tests
 $RUN_TEST ./wildfire_test
+
+echo running JSON writer tests
+$RUN_TEST ./json_test
+
 echo running XDG-mimetype lookup tests
 
 for i in ../../webcit/static/bgcolor.gif  ../../webcit/static/resizecorner.png ../../webcit/static/roomops.js ./mimeparser_test.c; do 
@@ -54,6 +58,9 @@ cat testdata/emailaddresses/email_recipientstrings.txt |$RUN_TEST ./stringbuf_co
 echo running general stringbuffer tests
 $RUN_TEST ./stringbuf_test
 
+echo running base64 and quoted-printable tests
+$RUN_TEST ./base64_test
+
 echo running string tools tests
 $RUN_TEST ./stripallbut_test
 
@@ -69,3 +76,18 @@ for i in testdata/mime/*; do
 done
 
 
+echo running streaming mimeparser tests
+# it has to find the same parts, no matter how the input is chunked.
+# message/rfc822 sizes are masked: it only looks into those when nobody read them.
+MASK_RFC822="s;|message/rfc822|[0-9]*|;|message/rfc822|-|;"
+for i in testdata/mime/*; do 
+	./mimeparser_test -p -d -f $i |sed "$MASK_RFC822" > /tmp/mimeparser_test.$$
+	for s in 1 7 4096; do 
+	    $RUN_TEST ./mimeparser_test -p -d -s $s -f $i |sed "$MASK_RFC822" |cmp -s - /tmp/mimeparser_test.$$ || echo "$i differs with chunks of $s"
+	done
+	for j in `grep part= /tmp/mimeparser_test.$$ |sed "s;part=.*|.*|\([0-9\.]*\)|.*|.*|.*|.*|;\1;"`; do 
+	    ./mimeparser_test -d -f $i -P $j |cmp -s - <($RUN_TEST ./mimeparser_test -d -s 7 -f $i -P $j) || echo "$i part $j differs"
+	done
+done
+rm -f /tmp/mimeparser_test.$$
+
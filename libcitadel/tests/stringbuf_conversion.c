@@ -18,6 +18,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <iconv.h>
 
 #include "stringbuf_test.h"
 #include "../lib/libcitadel.h"
@@ -105,6 +106,103 @@ static void TestRFC822Decode(void)
 }
 
 
+/*
+ * what decoding one RFC2047 segment did before descriptors were pooled
+ * and UTF-8 / ASCII got passed through: always ask iconv.
+ */
+static void RefDecodeSegment(StrBuf *Target, const char *charset, const char *in, long len)
+{
+	iconv_t ic;
+	char out[1024];
+	char *ibuf = (char*) in;
+	char *obuf = out;
+	size_t ibuflen = len;
+	size_t obuflen = sizeof(out);
+
+	ic = iconv_open("UTF-8", charset);
+	if (ic == (iconv_t)(-1)) {
+		StrBufAppendBufPlain(Target, HKEY("(unreadable)"), 0);
+		return;
+	}
+	iconv(ic, &ibuf, &ibuflen, &obuf, &obuflen);
+	StrBufAppendBufPlain(Target, out, sizeof(out) - obuflen, 0);
+	iconv_close(ic);
+}
+
+static void TestRFC822DecodeCharsets(void)
+{
+	const char *Charsets[] = {
+		"UTF-8", "utf-8", "us-ascii", "iso-8859-1", "ISO-8859-15",
+		"koi8-r", "windows-1252", "ISO-2022-JP", "x-no-such-charset"
+	};
+	const char *Texts[] = {
+		"plain ascii text",
+		"caf\xc3\xa9 \xe2\x82\xac 5 \xf0\x9f\x98\x80",	/* valid UTF-8 */
+		"over\xc0\xaflong",					/* invalid UTF-8 ... */
+		"surrogate \xed\xa0\x80",
+		"too big \xf4\x90\x80\x80",
+		"cut short \xe2\x82",
+		"G\xf6nd\xfc\xdf",					/* latin1 */
+		"\x1b$B$3$s$K$A$O\x1b(B",				/* ISO-2022-JP */
+		"more than eight bytes of ascii and then \xc3\xa9 and more ascii after it"
+	};
+	StrBuf *Source, *Target, *Expect, *Encoded, *DefaultCharset, *FoundCharset;
+	iconv_t ic1, ic2, ic3;
+	int i, j, round;
+
+	Source = NewStrBuf();
+	Target = NewStrBuf();
+	Expect = NewStrBuf();
+	Encoded = NewStrBuf();
+	DefaultCharset = NewStrBufPlain(HKEY("UTF-8"));
+	FoundCharset = NewStrBuf();
+
+	/* the second round gets its descriptors from the pool */
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < sizeof(Charsets) / sizeof(char*); i++) {
+			for (j = 0; j < sizeof(Texts) / sizeof(char*); j++) {
+				FlushStrBuf(Encoded);
+				StrBufBase64Append(Encoded, NULL, Texts[j], -1, 0);
+				FlushStrBuf(Source);
+				StrBufPrintf(Source, "=?%s?B?%s?=", Charsets[i], ChrPtr(Encoded));
+
+				FlushStrBuf(Expect);
+				RefDecodeSegment(Expect, Charsets[i], Texts[j], strlen(Texts[j]));
+				FlushStrBuf(Target);
+				StrBuf_RFC822_to_Utf8(Target, Source, DefaultCharset, FoundCharset);
+
+				CU_ASSERT_EQUAL(StrLength(Target), StrLength(Expect));
+				CU_ASSERT(strcmp(ChrPtr(Target), ChrPtr(Expect)) == 0);
+			}
+		}
+	}
+
+	/* nested use gets two descriptors; released ones come back, reset */
+	ctdl_iconv_acquire("UTF-8", "ISO-2022-JP", &ic1);
+	ctdl_iconv_acquire("UTF-8", "iso-2022-jp", &ic2);
+	CU_ASSERT(ic1 != (iconv_t)(-1));
+	CU_ASSERT(ic2 != (iconv_t)(-1));
+	CU_ASSERT(ic1 != ic2);
+	ic3 = ic2;
+	ctdl_iconv_release(&ic2);
+	CU_ASSERT(ic2 == (iconv_t)(-1));
+	ctdl_iconv_acquire("UTF-8", "ISO-2022-JP", &ic2);
+	CU_ASSERT(ic2 == ic3);
+	ctdl_iconv_release(&ic1);
+	ctdl_iconv_release(&ic2);
+	ctdl_iconv_acquire("UTF-8", "x-no-such-charset", &ic1);
+	CU_ASSERT(ic1 == (iconv_t)(-1));
+	ctdl_iconv_release(&ic1);
+
+	FreeStrBuf(&Source);
+	FreeStrBuf(&Target);
+	FreeStrBuf(&Expect);
+	FreeStrBuf(&Encoded);
+	FreeStrBuf(&DefaultCharset);
+	FreeStrBuf(&FoundCharset);
+}
+
+
 static void TestRFC822DecodeStdin(void)
 {
 	int fdin = 0;// STDIN
@@ -395,6 +493,7 @@ static void AddStrBufSimlpeTests(void)
 			pTest = CU_add_test(pGroup, "testRFC822Decode1", TestRFC822Decode);
 			pTest = CU_add_test(pGroup, "testRFC822Decode2", TestRFC822Decode);
 			pTest = CU_add_test(pGroup, "testRFC822Decode3", TestRFC822Decode);
+			pTest = CU_add_test(pGroup, "testRFC822DecodeCharsets", TestRFC822DecodeCharsets);
 		}
 		else
 		{
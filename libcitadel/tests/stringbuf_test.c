@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <zlib.h>
 
 #include "stringbuf_test.h"
 #define SHOW_ME_VAPPEND_PRINTF
@@ -525,6 +526,289 @@ static void TestNextLine_LongLine(void)
 }
 
 
+/*
+ * the scanners have to find the same things whichever code path we run;
+ * random needles at random places and alignments, across the vector widths.
+ */
+static void TestScanImpls(void)
+{
+	const char Alphabet[] = "ab,|\r\n\0";
+	char Buf[1024];
+	const char *Ref;
+	eScanImpl Impl, Got;
+	size_t i, n, RefCount;
+	int j, Off;
+
+	srand(4711);
+	for (Impl = eScanScalar; Impl < eScanBest; Impl ++) {
+		Got = CtdlScanSelectImpl(Impl);
+		if (Got != Impl)
+			continue;
+		for (j = 0; j < 2000; j++) {
+			Off = rand() % 32;
+			n = rand() % (sizeof(Buf) - 32);
+			for (i = 0; i < n; i++)
+				Buf[Off + i] = (rand() % 8 == 0) ? 
+					Alphabet[rand() % (sizeof(Alphabet) - 1)] : 'x';
+
+			Ref = NULL;
+			RefCount = 0;
+			for (i = 0; i < n; i++) {
+				if ((Ref == NULL) && ((Buf[Off + i] == '\r') || (Buf[Off + i] == '\n')))
+					Ref = &Buf[Off + i];
+				RefCount += (Buf[Off + i] == ',');
+			}
+			CU_ASSERT_PTR_EQUAL(ctdl_memchr2(&Buf[Off], '\r', '\n', n), Ref);
+			CU_ASSERT_EQUAL(ctdl_memcount(&Buf[Off], ',', n), RefCount);
+		}
+	}
+
+	/* more hits than the per byte counters can hold. */
+	for (Impl = eScanScalar; Impl < eScanBest; Impl ++) {
+		char *Many;
+
+		if (CtdlScanSelectImpl(Impl) != Impl)
+			continue;
+		Many = malloc(100000);
+		memset(Many, ',', 100000);
+		CU_ASSERT_EQUAL(ctdl_memcount(Many, ',', 100000), 100000);
+		CU_ASSERT_PTR_NULL(ctdl_memchr2(Many, '\r', '\n', 100000));
+		free(Many);
+	}
+	CtdlScanSelectImpl(eScanBest);
+}
+
+/*
+ * build a random token string; empty tokens, long tokens, separators at both ends.
+ */
+static void RandomTokenString(char *Buf, int n, char Sep)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		Buf[i] = (rand() % 5 == 0) ? Sep : 'a' + rand() % 26;
+	Buf[n] = '\0';
+}
+
+/*
+ * the reference we walk by hand: token parmnum of a char* string
+ */
+static long RefToken(char *dest, const char *s, int parmnum, char Sep)
+{
+	const char *e;
+
+	while (parmnum-- > 0) {
+		s = strchr(s, Sep);
+		if (s == NULL) {
+			*dest = '\0';
+			return -1;
+		}
+		s++;
+	}
+	e = strchr(s, Sep);
+	if (e == NULL)
+		e = s + strlen(s);
+	memcpy(dest, s, e - s);
+	dest[e - s] = '\0';
+	return e - s;
+}
+
+static void TestTokenizerRandom(void)
+{
+	char Source[600];
+	char Ref[600];
+	char Got[600];
+	const char *Pos;
+	const char *pStart;
+	StrBuf *Buf, *Token;
+	eScanImpl Impl;
+	int i, j, n, NTokens;
+	long len;
+
+	srand(1174);
+	Token = NewStrBuf();
+	for (Impl = eScanScalar; Impl < eScanBest; Impl ++) {
+		if (CtdlScanSelectImpl(Impl) != Impl)
+			continue;
+		for (j = 0; j < 500; j++) {
+			n = rand() % (sizeof(Source) - 1);
+			RandomTokenString(Source, n, '|');
+			Buf = NewStrBufPlain(Source, n);
+
+			NTokens = 1;
+			for (i = 0; i < n; i++)
+				NTokens += (Source[i] == '|');
+			CU_ASSERT_EQUAL(num_tokens(Source, '|'), NTokens);
+			CU_ASSERT_EQUAL(StrBufNum_tokens(Buf, '|'), (n == 0) ? 0 : NTokens);
+
+			/* indexed access, and the iterators have to agree with it. */
+			Pos = Source;
+			pStart = NULL;
+			for (i = 0; i <= NTokens; i++) {
+				len = RefToken(Ref, Source, i, '|');
+				CU_ASSERT_EQUAL(extract_token(Got, Source, i, '|', sizeof(Got)), len);
+				CU_ASSERT_STRING_EQUAL(Got, Ref);
+				CU_ASSERT_EQUAL(extract_next_token(Got, &Pos, '|', sizeof(Got)), len);
+				CU_ASSERT_STRING_EQUAL(Got, Ref);
+				if (n == 0)
+					continue;
+
+				CU_ASSERT_EQUAL(StrBufExtract_token(Token, Buf, i, '|'), len);
+				CU_ASSERT_STRING_EQUAL(ChrPtr(Token), Ref);
+				if (i < NTokens) {
+					CU_ASSERT(StrBufHaveNextToken(Buf, &pStart));
+					CU_ASSERT_EQUAL(StrBufExtract_NextToken(Token, Buf, &pStart, '|'), len);
+					CU_ASSERT_STRING_EQUAL(ChrPtr(Token), Ref);
+				}
+				else {
+					CU_ASSERT(!StrBufHaveNextToken(Buf, &pStart));
+				}
+			}
+
+			/* truncation into small buffers */
+			len = RefToken(Ref, Source, 0, '|');
+			extract_token(Got, Source, 0, '|', 5);
+			CU_ASSERT_EQUAL((long)strlen(Got), (len < 4) ? len : 4);
+			CU_ASSERT(strncmp(Got, Ref, 4) == 0);
+
+			FreeStrBuf(&Buf);
+		}
+	}
+	CtdlScanSelectImpl(eScanBest);
+
+	/* NUL bytes end the token search of the indexed tokenizer, but not the iterator */
+	Buf = NewStrBufPlain(HKEY("ab|c\0d|ef"));
+	CU_ASSERT_EQUAL(StrBufExtract_token(Token, Buf, 1, '|'), 1);
+	CU_ASSERT_STRING_EQUAL(ChrPtr(Token), "c");
+	CU_ASSERT_EQUAL(StrBufExtract_token(Token, Buf, 2, '|'), -1);
+	pStart = NULL;
+	StrBufSkip_NTokenS(Buf, &pStart, '|', 1);
+	CU_ASSERT_EQUAL(StrBufExtract_NextToken(Token, Buf, &pStart, '|'), 2);
+	CU_ASSERT_STRING_EQUAL(ChrPtr(Token), "cd");
+	FreeStrBuf(&Buf);
+
+	/* the stack buffers of the number extractors don't grow; we must not run over them. */
+	Buf = NewStrBuf();
+	StrBufAppendBufPlain(Buf, HKEY("1|"), 0);
+	for (i = 0; i < 20; i++)
+		StrBufAppendBufPlain(Buf, HKEY("1234567890"), 0);
+	CU_ASSERT_EQUAL(StrBufExtract_int(Buf, 0, '|'), 1);
+	StrBufExtract_long(Buf, 1, '|');
+	pStart = NULL;
+	StrBufExtractNext_int(Buf, &pStart, '|');
+	StrBufExtractNext_long(Buf, &pStart, '|');
+	FreeStrBuf(&Buf);
+
+	FreeStrBuf(&Token);
+}
+
+/*
+ * the line splitter we walk by hand: CR, LF and CRLF end a line, LFCR ends two.
+ */
+static int RefLines(const char *Text, int n, const char **Lines, int *LineLen)
+{
+	const char *p = Text;
+	const char *e = Text + n;
+	int nLines = 0;
+
+	while (p < e) {
+		Lines[nLines] = p;
+		while ((p < e) && (*p != '\r') && (*p != '\n'))
+			p++;
+		LineLen[nLines] = p - Lines[nLines];
+		nLines ++;
+		if ((p < e) && (*p == '\r'))
+			p++;
+		if ((p < e) && (*p == '\n'))
+			p++;
+	}
+	return nLines;
+}
+
+static void TestNextLine_Random(void)
+{
+	char Text[700];
+	const char *Lines[700];
+	int LineLen[700];
+	const char *Ptr;
+	StrBuf *Buf, *Line;
+	IOBuffer FB;
+	eScanImpl Impl;
+	eReadState State;
+	int i, j, n, nLines, Pending, Fed, Chunk, Remain;
+	long Offset;
+
+	srand(815);
+	Line = NewStrBuf();
+	for (Impl = eScanScalar; Impl < eScanBest; Impl ++) {
+		if (CtdlScanSelectImpl(Impl) != Impl)
+			continue;
+		for (j = 0; j < 500; j++) {
+			n = rand() % (sizeof(Text) - 1);
+			for (i = 0; i < n; i++)
+				Text[i] = (rand() % 10 == 0) ? "\r\n"[rand() % 2] : 'a' + rand() % 26;
+			Text[n] = '\0';
+			nLines = RefLines(Text, n, Lines, LineLen);
+			Pending = (n > 0) && (Text[n - 1] != '\r') && (Text[n - 1] != '\n');
+
+			Buf = NewStrBufPlain(Text, n);
+			Ptr = NULL;
+			for (i = 0; i < nLines; i++) {
+				Remain = StrBufSipLine(Line, Buf, &Ptr);
+				CU_ASSERT_EQUAL(StrLength(Line), LineLen[i]);
+				CU_ASSERT(memcmp(ChrPtr(Line), Lines[i], LineLen[i]) == 0);
+				if (i == nLines - 1) {
+					CU_ASSERT_EQUAL(Remain, Pending ? -1 : 0);
+					CU_ASSERT_PTR_EQUAL(Ptr, StrBufNOTNULL);
+				}
+			}
+			FreeStrBuf(&Buf);
+
+			/*
+			 * now feed it in chunks; LF line ends only, since a CR at
+			 * the end of a chunk completes its line right away.
+			 */
+			for (i = 0; i < n; i++)
+				if (Text[i] == '\r')
+					Text[i] = '\n';
+			nLines = RefLines(Text, n, Lines, LineLen);
+
+			memset(&FB, 0, sizeof(FB));
+			FB.Buf = NewStrBuf();
+			Fed = 0;
+			i = 0;
+			while (Fed < n) {
+				Chunk = 1 + rand() % 40;
+				if (Chunk > n - Fed)
+					Chunk = n - Fed;
+				Offset = (FB.ReadWritePointer != NULL) ? FB.ReadWritePointer - ChrPtr(FB.Buf) : -1;
+				StrBufAppendBufPlain(FB.Buf, Text + Fed, Chunk, 0);
+				if (Offset >= 0)
+					FB.ReadWritePointer = ChrPtr(FB.Buf) + Offset;
+				Fed += Chunk;
+				while ((i < nLines) &&
+				       ((State = StrBufChunkSipLine(Line, &FB)) == eReadSuccess))
+				{
+					CU_ASSERT_EQUAL(StrLength(Line), LineLen[i]);
+					CU_ASSERT(memcmp(ChrPtr(Line), Lines[i], LineLen[i]) == 0);
+					i++;
+				}
+			}
+			/* the unterminated last line is still waiting for its linebreak */
+			CU_ASSERT_EQUAL(i, nLines - Pending);
+			if (Pending) {
+				CU_ASSERT_EQUAL(StrBufChunkSipLine(Line, &FB), eMustReadMore);
+				CU_ASSERT_EQUAL(StrLength(Line), LineLen[nLines - 1]);
+				CU_ASSERT(memcmp(ChrPtr(Line), Lines[nLines - 1], LineLen[nLines - 1]) == 0);
+			}
+			FreeStrBuf(&FB.Buf);
+		}
+	}
+	CtdlScanSelectImpl(eScanBest);
+	FreeStrBuf(&Line);
+}
+
+
 static void TestStrBufRemove_token_NotThere(void)
 {
 //	StrBuf *Test = NewStrBufPlain(HKEY(" 127.0.0.1"));
@@ -548,6 +832,259 @@ static void TestStrBufUrlescAppend(void)
 	FreeStrBuf(&Out);
 }
 
+/*
+ * short lived buffers should come out of our slabs instead of malloc.
+ */
+static void TestStrBufSlabs(void)
+{
+	StrBufAllocStats Slab, Malloc;
+	StrBuf *Bufs[100];
+	int i, j;
+	eStrBufAlloc Strategy;
+
+	for (Strategy = eStrBufMalloc; Strategy <= eStrBufSlab; Strategy ++) {
+		StrBufSetAllocStrategy(Strategy);
+		StrBufGetAllocStats(NULL, 1);
+		for (j = 0; j < 10; j++) {
+			for (i = 0; i < 100; i++) {
+				Bufs[i] = NewStrBufPlain(HKEY("some short lived string"));
+				StrBufAppendPrintf(Bufs[i], "%d: the quick brown fox jumps over the lazy dog", i);
+			}
+			for (i = 0; i < 100; i++) {
+				CU_ASSERT(strncmp(ChrPtr(Bufs[i]), HKEY("some short lived string")) == 0);
+				FreeStrBuf(&Bufs[i]);
+			}
+		}
+		StrBufGetAllocStats((Strategy == eStrBufSlab) ? &Slab : &Malloc, 1);
+	}
+	if (!Quiet) printf("malloc: %ld mallocs %ld reallocs; slab: %ld mallocs %ld reallocs %ld hits\n",
+			   Malloc.Mallocs, Malloc.Reallocs,
+			   Slab.Mallocs, Slab.Reallocs, Slab.SlabHits);
+	CU_ASSERT(Slab.Mallocs + Slab.Reallocs <= Malloc.Mallocs + Malloc.Reallocs);
+
+	/* and they're still malloc'ed memory, so smashing them works out. */
+	Bufs[0] = NewStrBufPlain(HKEY("smash me"));
+	free(SmashStrBuf(&Bufs[0]));
+}
+
+/*
+ * StrBufs in arenas have to behave like all others, until the arena goes away.
+ */
+static void TestStrBufArena(void)
+{
+	StrBufArena *Arena;
+	StrBuf *Bufs[100];
+	StrBuf *Heap;
+	char *Smashed;
+	int i, j;
+
+	Arena = NewStrBufArena(1024);
+	Heap = NewStrBufPlain(HKEY("I live longer"));
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < 100; i++) {
+			Bufs[i] = NewStrBufArenaPlain(Arena, HKEY("request scoped"));
+			/* let some of them outgrow the arena */
+			if ((i % 10) == 0)
+				StrBufAppendBufPlain(Bufs[i], HKEY(" but not much"), 0);
+			if ((i % 20) == 0)
+				while (StrLength(Bufs[i]) < 2000)
+					StrBufAppendBufPlain(Bufs[i], HKEY(" and growing"), 0);
+		}
+		for (i = 0; i < 100; i++)
+			CU_ASSERT(strncmp(ChrPtr(Bufs[i]), HKEY("request scoped")) == 0);
+
+		/* some we free early, some go away with the arena */
+		for (i = 0; i < 100; i += 3)
+			FreeStrBuf(&Bufs[i]);
+
+		/* swapping a buffer into a longer living one mustn't leave it in the arena */
+		SwapBuffers(Heap, Bufs[1]);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Heap), "request scoped");
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Bufs[1]), "I live longer");
+		SwapBuffers(Heap, Bufs[1]);
+
+		Smashed = SmashStrBuf(&Bufs[2]);
+		CU_ASSERT_STRING_EQUAL(Smashed, "request scoped");
+
+		FlushStrBufArena(Arena);
+		CU_ASSERT_STRING_EQUAL(ChrPtr(Heap), "I live longer");
+		CU_ASSERT_STRING_EQUAL(Smashed, "request scoped");
+		free(Smashed);
+	}
+	FreeStrBufArena(&Arena);
+	CU_ASSERT_PTR_NULL(Arena);
+	FreeStrBuf(&Heap);
+}
+
+/*
+ * inflate what the gzip stream gave us so far; with MustEnd it has to be complete.
+ */
+static long Gunzip(const StrBuf *In, char *Out, long OutSize, int MustEnd)
+{
+	z_stream z;
+	int err;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK)
+		return -1;
+	z.next_in = (Bytef*) ChrPtr(In);
+	z.avail_in = StrLength(In);
+	z.next_out = (Bytef*) Out;
+	z.avail_out = OutSize;
+	err = inflate(&z, Z_SYNC_FLUSH);
+	inflateEnd(&z);
+	if ((err == Z_STREAM_END) || (!MustEnd && (err == Z_OK)))
+		return z.total_out;
+	return -1;
+}
+
+static void TestStreamGzip(void)
+{
+	const char *Chars = "abcdefgh <tr><td>\n\t";
+	const char *Err = NULL;
+	vStreamT *SC;
+	IOBuffer In, Out;
+	char *Plain, *Back;
+	long len = 300000;
+	long i, n, sent, nPieces;
+	int round, Flush;
+
+	Plain = malloc(len);
+	Back = malloc(len);
+	for (i = 0; i < len; i++)
+		Plain[i] = Chars[rand() % 20];
+
+	memset(&In, 0, sizeof(IOBuffer));
+	memset(&Out, 0, sizeof(IOBuffer));
+	In.Buf = NewStrBuf();
+	Out.Buf = NewStrBuf();
+	SC = StrBufNewStreamContext(eZLibEncode, &Err);
+	CU_ASSERT_PTR_NOT_NULL(SC);
+
+	/* round 0 feeds through In, round 1 through pIn; the context has to be reusable. */
+	for (round = 0; round < 2; round++) {
+		FlushStrBuf(Out.Buf);
+		nPieces = 0;
+		for (sent = 0; sent < len; sent += n) {
+			n = 1 + rand() % 9000;
+			if (n > len - sent)
+				n = len - sent;
+			Flush = ((++nPieces % 5) == 0) ? STREAM_FLUSH : STREAM_MORE;
+			if (round == 0) {
+				StrBufAppendBufPlain(In.Buf, Plain + sent, n, 0);
+				CU_ASSERT_EQUAL(StrBufStreamTranscode(eZLibEncode, &Out, &In, NULL, -1, SC, Flush, &Err), 0);
+				CU_ASSERT_EQUAL(StrLength(In.Buf), 0);
+			}
+			else {
+				CU_ASSERT_EQUAL(StrBufStreamTranscode(eZLibEncode, &Out, NULL, Plain + sent, n, SC, Flush, &Err), 0);
+			}
+
+			/* after a flush, everything up to here has to be in the output */
+			if (Flush == STREAM_FLUSH) {
+				CU_ASSERT_EQUAL(Gunzip(Out.Buf, Back, len, 0), sent + n);
+				CU_ASSERT(memcmp(Back, Plain, sent + n) == 0);
+			}
+		}
+		CU_ASSERT_EQUAL(StrBufStreamTranscode(eZLibEncode, &Out, NULL, NULL, 0, SC, STREAM_LAST, &Err), 0);
+		CU_ASSERT(StrLength(Out.Buf) < len * 3 / 4);
+		CU_ASSERT_EQUAL(Gunzip(Out.Buf, Back, len, 1), len);
+		CU_ASSERT(memcmp(Back, Plain, len) == 0);
+	}
+
+	CU_ASSERT_EQUAL(StrBufDestroyStreamContext(eZLibEncode, &SC, &Err), 0);
+	CU_ASSERT_PTR_NULL(SC);
+	FreeStrBuf(&In.Buf);
+	FreeStrBuf(&Out.Buf);
+	free(Plain);
+	free(Back);
+}
+
+/*
+ * the reference we search by hand: ASCII only, first match wins.
+ */
+static const char *RefCaseSearch(const char *Text, long TextLen, const char *Pattern, long PatLen)
+{
+	long i;
+
+	for (i = 0; i + PatLen <= TextLen; i++)
+		if (strncasecmp(Text + i, Pattern, PatLen) == 0)
+			return Text + i;
+	return NULL;
+}
+
+static void TestCaseSearch(void)
+{
+	const char Alphabet[] = "eEaAbBxX ";
+	char Text[2048];
+	char Pattern[40];
+	CasePattern *P;
+	eScanImpl Impl;
+	long n, m, i;
+	int j;
+
+	srand(1337);
+	for (Impl = eScanScalar; Impl < eScanBest; Impl ++) {
+		if (CtdlScanSelectImpl(Impl) != Impl)
+			continue;
+		for (j = 0; j < 2000; j++) {
+			n = rand() % (sizeof(Text) - 1);
+			m = 1 + rand() % (sizeof(Pattern) - 2);
+			for (i = 0; i < n; i++)
+				Text[i] = Alphabet[rand() % (sizeof(Alphabet) - 1)];
+			Text[n] = '\0';
+			/* short needles get found, long ones mostly not; take one out of the text now and then. */
+			if ((n > m) && (rand() % 2))
+				memcpy(Pattern, Text + rand() % (n - m), m);
+			else
+				for (i = 0; i < m; i++)
+					Pattern[i] = Alphabet[rand() % (sizeof(Alphabet) - 1)];
+			Pattern[m] = '\0';
+
+			P = NewCasePattern(Pattern, -1);
+			CU_ASSERT_EQUAL(CasePatternLen(P), m);
+			CU_ASSERT_PTR_EQUAL(CasePatternFind(P, Text, n), RefCaseSearch(Text, n, Pattern, m));
+			CU_ASSERT_PTR_EQUAL(cbmstrcasestr(Text, Pattern), RefCaseSearch(Text, n, Pattern, m));
+			FreeCasePattern(&P);
+			CU_ASSERT_PTR_NULL(P);
+		}
+	}
+	CtdlScanSelectImpl(eScanBest);
+
+	/* lots of false hits on the first byte; the skip table has to take over. */
+	memset(Text, 'e', sizeof(Text) - 1);
+	Text[sizeof(Text) - 1] = '\0';
+	memcpy(Text + sizeof(Text) - 10, "EXAMPLE", 7);
+	P = NewCasePattern("example", -1);
+	CU_ASSERT_PTR_EQUAL(CasePatternFind(P, Text, -1), Text + sizeof(Text) - 10);
+	Text[sizeof(Text) - 9] = 'Y';
+	CU_ASSERT_PTR_NULL(CasePatternFind(P, Text, -1));
+	CU_ASSERT_PTR_NULL(CasePatternFind(P, NULL, 0));
+	FreeCasePattern(&P);
+
+	/* the empty needle is everywhere. */
+	P = NewCasePattern("", 0);
+	CU_ASSERT_PTR_EQUAL(CasePatternFind(P, Text, -1), Text);
+	FreeCasePattern(&P);
+
+	/* UTF-8: Latin-1 and Latin Extended-A fold, the rest matches exactly. */
+	P = NewCasePattern("m\xc3\xbcller", -1);	/* müller */
+	CU_ASSERT_PTR_NOT_NULL(CasePatternFind(P, "Hans M\xc3\x9cLLER", -1));
+	CU_ASSERT_PTR_NOT_NULL(CasePatternFind(P, "hans m\xc3\xbcller", -1));
+	CU_ASSERT_PTR_NULL(CasePatternFind(P, "hans muller", -1));
+	FreeCasePattern(&P);
+
+	P = NewCasePattern("\xc5\x81\xc3\x93\x44\xc5\xb9", -1);	/* ŁÓDŹ */
+	CU_ASSERT_PTR_NOT_NULL(CasePatternFind(P, "w \xc5\x82\xc3\xb3\x64\xc5\xba", -1));
+	CU_ASSERT_PTR_NOT_NULL(cbmstrcasestr("w \xc5\x82\xc3\xb3\x64\xc5\xba", "\xc5\x81\xc3\x93\x44\xc5\xb9"));
+	FreeCasePattern(&P);
+
+	/* × and ÷ are no case pair, neither are İ and ı. */
+	CU_ASSERT_PTR_NULL(cbmstrcasestr("\xc3\xb7", "\xc3\x97"));
+	CU_ASSERT_PTR_NULL(cbmstrcasestr("\xc4\xb1", "\xc4\xb0"));
+	/* a continuation byte only folds behind its lead byte */
+	CU_ASSERT_PTR_NULL(cbmstrcasestr("\xd0\xa0", "\xd0\x80"));
+}
+
 /*
 Some samples from the original...
 	CU_ASSERT_EQUAL(10, 10);
@@ -592,6 +1129,8 @@ static void AddStrBufSimpleTests(void)
 	pTest = CU_add_test(pGroup, "TestBufNumbers", TestBufNumbers);
 	pTest = CU_add_test(pGroup, "TestStrBufPeek", TestStrBufPeek);
 	pTest = CU_add_test(pGroup, "TestBufStringManipulation", TestBufStringManipulation);
+	pTest = CU_add_test(pGroup, "TestStrBufSlabs", TestStrBufSlabs);
+	pTest = CU_add_test(pGroup, "TestStrBufArena", TestStrBufArena);
 
 
 	pGroup = CU_add_suite("TestStringTokenizer", NULL, NULL);
@@ -602,6 +1141,9 @@ static void AddStrBufSimpleTests(void)
 	pTest = CU_add_test(pGroup, "testNextTokenizer_TwoEmpty", TestNextTokenizer_TwoEmpty);
 	pTest = CU_add_test(pGroup, "testNextTokenizer_One", TestNextTokenizer_One);
 	pTest = CU_add_test(pGroup, "testNextTokenizer_Sequence", TestNextTokenizer_Sequence);
+	pTest = CU_add_test(pGroup, "TestScanImpls", TestScanImpls);
+	pTest = CU_add_test(pGroup, "TestCaseSearch", TestCaseSearch);
+	pTest = CU_add_test(pGroup, "TestTokenizerRandom", TestTokenizerRandom);
 
 
 	pGroup = CU_add_suite("TestStrBufSipLine", NULL, NULL);
@@ -610,12 +1152,16 @@ static void AddStrBufSimpleTests(void)
 	pTest = CU_add_test(pGroup, "TestNextLine_TwoLinesMissingCR", TestNextLine_TwoLinesMissingCR);
 	pTest = CU_add_test(pGroup, "TestNextLine_twolines", TestNextLine_twolines);
  	pTest = CU_add_test(pGroup, "TestNextLine_LongLine", TestNextLine_LongLine);
+	pTest = CU_add_test(pGroup, "TestNextLine_Random", TestNextLine_Random);
 	
 	pGroup = CU_add_suite("TestStrBufRemove_token", NULL, NULL);
 	pTest = CU_add_test(pGroup, "TestStrBufRemove_token_NotThere", TestStrBufRemove_token_NotThere);
 
 	pGroup = CU_add_suite("TestStrBuf_escapers", NULL, NULL);
 	pTest = CU_add_test(pGroup, "TestStrBufUrlescAppend", TestStrBufUrlescAppend);
+
+	pGroup = CU_add_suite("TestStrBufStreamCodecs", NULL, NULL);
+	pTest = CU_add_test(pGroup, "TestStreamGzip", TestStreamGzip);
 }
 
 
@@ -633,7 +1179,8 @@ int main(int argc, char* argv[])
 	CU_set_output_filename("TestAutomated");
 	if (CU_initialize_registry()) {
 		printf("\nInitialize of test Registry failed.");
-//	}
+		return 1;
+	}
 	
 	Run = CU_TRUE ;
 	AddStrBufSimpleTests();
@@ -646,6 +1193,5 @@ int main(int argc, char* argv[])
 	}
 	
 	CU_cleanup_registry();
-	}
 	return 0;
 }
@@ -0,0 +1,303 @@
+/*
+ * Throughput of the line and token scanners over IMAP/SMTP session traces,
+ * per code path, against the byte at a time loops they used to be.
+ *
+ * usage: tokenizer_bench [tracefile...]
+ * without arguments it uses the traces in testdata/protocol/.
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../lib/libcitadel.h"
+
+
+/*
+ * The old ways
+ */
+static int old_num_tokens(const char *source, char tok)
+{
+	int count = 1;
+	const char *ptr = source;
+
+	while (*ptr != '\0') {
+		if (*ptr++ == tok) {
+			++count;
+		}
+	}
+	return (count);
+}
+
+static long old_extract_token(char *dest, const char *source, int parmnum, char separator, int maxlen)
+{
+	const char *s = source;
+	int len = 0;
+	int current_token = 0;
+
+	dest[0] = 0;
+	maxlen--;
+	while (*s) {
+		if (*s == separator) {
+			++current_token;
+		}
+		if ( (current_token == parmnum) &&
+		     (*s != separator) &&
+		     (len < maxlen) ) {
+			dest[len] = *s;
+			++len;
+		}
+		else if ((current_token > parmnum) || (len >= maxlen)) {
+			break;
+		}
+		++s;
+	}
+	dest[len] = '\0';
+	if (current_token < parmnum) {
+		return(-1);
+	}
+	return(len);
+}
+
+static int OldSipLine(char *Line, int LineSize, const char *Buf, long BufUsed, const char **Ptr)
+{
+	const char *ptr, *eptr;
+	char *optr, *xptr;
+
+	ptr = (*Ptr == NULL) ? Buf : *Ptr;
+	optr = Line;
+	eptr = Buf + BufUsed;
+	xptr = Line + LineSize - 1;
+
+	while ((ptr <= eptr) &&
+	       (*ptr != '\n') &&
+	       (*ptr != '\r') &&
+	       (optr < xptr))
+	{
+		*optr++ = *ptr++;
+	}
+	if ((ptr >= eptr) && (optr > Line))
+		optr --;
+	*optr = '\0';
+	if ((ptr <= eptr) && (*ptr == '\r'))
+		ptr ++;
+	if ((ptr <= eptr) && (*ptr == '\n'))
+		ptr ++;
+	*Ptr = (ptr < eptr) ? ptr : StrBufNOTNULL;
+	return optr - Line;
+}
+
+
+static double Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+#define MB(n, t) ((n) / (t) / (1024.0 * 1024.0))
+
+static long LoadTrace(StrBuf *Trace, const char *Filename)
+{
+	const char *Err;
+	struct stat st;
+	int fd;
+
+	fd = open(Filename, O_RDONLY);
+	if ((fd < 0) || (fstat(fd, &st) != 0)) {
+		perror(Filename);
+		return -1;
+	}
+	StrBufReadBLOB(Trace, &fd, 1, st.st_size, &Err);
+	if (fd >= 0)
+		close(fd);
+	return StrLength(Trace);
+}
+
+int main(int argc, char* argv[])
+{
+	static const char *Names[] = {"scalar", "SSE2", "AVX2"};
+	static const char *Default[] = {"testdata/protocol/imap_session.txt", "testdata/protocol/smtp_session.txt"};
+	const char **Files = (argc > 1) ? (const char **)&argv[1] : Default;
+	int nFiles = (argc > 1) ? argc - 1 : 2;
+	long size = 8 * 1024 * 1024;
+	int rounds = 10;
+	StrBuf *One, *Trace, *Line, *Token;
+	IOBuffer FB;
+	char LineC[SIZ], TokenC[SIZ];
+	char *Seen;
+	const char *Ptr, *Pos;
+	long i, n, nSeen;
+	long nLines = 0, nTokens = 0;
+	int t, NTok;
+	eScanImpl Impl;
+	double t0, tm;
+
+	StartLibCitadel(8);
+	Trace = NewStrBufPlain(NULL, size + SIZ);
+	One = NewStrBuf();
+	for (i = 0; i < nFiles; i++) {
+		FlushStrBuf(One);
+		if (LoadTrace(One, Files[i]) <= 0)
+			return 1;
+		StrBufAppendBuf(Trace, One, 0);
+	}
+	FreeStrBuf(&One);
+	One = NewStrBufDup(Trace);
+	while (StrLength(Trace) < size)
+		StrBufAppendBuf(Trace, One, 0);
+	size = StrLength(Trace);
+	Line = NewStrBufPlain(NULL, SIZ);
+	Token = NewStrBufPlain(NULL, SIZ);
+
+	printf("%ld bytes of session traces, MB/s\n", size);
+	printf("%-8s %10s %10s %10s %10s %10s\n", "", "SipLine", "ChunkSip", "tok/index", "tok/next", "StrBufNext");
+
+	/* old: line by line, each token by index */
+	t0 = Now();
+	for (n = 0; n < rounds; n++) {
+		Ptr = NULL;
+		while (Ptr != StrBufNOTNULL)
+			OldSipLine(LineC, sizeof LineC, ChrPtr(Trace), size, &Ptr);
+	}
+	tm = Now() - t0;
+	printf("%-8s %10.1f %10s", "old", MB(size * rounds, tm), "-");
+	t0 = Now();
+	for (n = 0; n < rounds; n++) {
+		Ptr = NULL;
+		while (Ptr != StrBufNOTNULL) {
+			OldSipLine(LineC, sizeof LineC, ChrPtr(Trace), size, &Ptr);
+			NTok = old_num_tokens(LineC, ' ');
+			for (t = 0; t < NTok; t++)
+				old_extract_token(TokenC, LineC, t, ' ', sizeof TokenC);
+		}
+	}
+	tm = Now() - t0;
+	printf(" %10.1f %10s %10s\n", MB(size * rounds, tm), "-", "-");
+
+	for (Impl = eScanScalar; Impl <= eScanAVX2; Impl++) {
+		if (CtdlScanSelectImpl(Impl) != Impl)
+			continue;
+
+		t0 = Now();
+		nLines = 0;
+		for (n = 0; n < rounds; n++) {
+			Ptr = NULL;
+			while (Ptr != StrBufNOTNULL) {
+				StrBufSipLine(Line, Trace, &Ptr);
+				nLines ++;
+			}
+		}
+		tm = Now() - t0;
+		printf("%-8s %10.1f", Names[Impl], MB(size * rounds, tm));
+
+		/* the way the event driven clients see it: 4k at a time */
+		t0 = Now();
+		for (n = 0; n < rounds; n++) {
+			memset(&FB, 0, sizeof(FB));
+			FB.Buf = NewStrBufPlain(NULL, SIZ * 2);
+			for (i = 0; i < size; i += SIZ) {
+				StrBufAppendBufPlain(FB.Buf, ChrPtr(Trace) + i, (size - i < SIZ) ? size - i : SIZ, 0);
+				while (StrBufChunkSipLine(Line, &FB) == eReadSuccess)
+					;
+			}
+			FreeStrBuf(&FB.Buf);
+		}
+		tm = Now() - t0;
+		printf(" %10.1f", MB(size * rounds, tm));
+
+		t0 = Now();
+		for (n = 0; n < rounds; n++) {
+			Ptr = NULL;
+			while (Ptr != StrBufNOTNULL) {
+				StrBufSipLine(Line, Trace, &Ptr);
+				NTok = num_tokens(ChrPtr(Line), ' ');
+				for (t = 0; t < NTok; t++)
+					extract_token(TokenC, ChrPtr(Line), t, ' ', sizeof TokenC);
+			}
+		}
+		tm = Now() - t0;
+		printf(" %10.1f", MB(size * rounds, tm));
+
+		t0 = Now();
+		nTokens = 0;
+		for (n = 0; n < rounds; n++) {
+			Ptr = NULL;
+			while (Ptr != StrBufNOTNULL) {
+				StrBufSipLine(Line, Trace, &Ptr);
+				Pos = ChrPtr(Line);
+				while (extract_next_token(TokenC, &Pos, ' ', sizeof TokenC) >= 0)
+					nTokens ++;
+			}
+		}
+		tm = Now() - t0;
+		printf(" %10.1f", MB(size * rounds, tm));
+
+		t0 = Now();
+		for (n = 0; n < rounds; n++) {
+			Ptr = NULL;
+			while (Ptr != StrBufNOTNULL) {
+				StrBufSipLine(Line, Trace, &Ptr);
+				Pos = NULL;
+				while (StrBufHaveNextToken(Line, &Pos))
+					StrBufExtract_NextToken(Token, Line, &Pos, ' ');
+			}
+		}
+		tm = Now() - t0;
+		printf(" %10.1f\n", MB(size * rounds, tm));
+	}
+	printf("(%ld lines, %ld tokens per round)\n", nLines / rounds, nTokens / rounds);
+
+	/*
+	 * an IMAP \Seen set of a big room, the way imap_set_seen_flags() walks it;
+	 * by index thats quadratic in the number of ranges.
+	 */
+	Seen = malloc(20 * 20000);
+	for (i = 0, nSeen = 0; i < 20000; i++)
+		nSeen += sprintf(Seen + nSeen, "%ld:%ld,", i * 10, i * 10 + 7);
+	Seen[nSeen - 1] = '\0';
+
+	printf("\n\\Seen set with 20000 ranges, ms per walk\n");
+	t0 = Now();
+	NTok = old_num_tokens(Seen, ',');
+	for (t = 0; t < NTok; t++)
+		old_extract_token(TokenC, Seen, t, ',', sizeof TokenC);
+	tm = Now() - t0;
+	printf("%-8s %10.2f\n", "old", tm * 1000.0);
+
+	CtdlScanSelectImpl(eScanBest);
+	t0 = Now();
+	NTok = num_tokens(Seen, ',');
+	for (t = 0; t < NTok; t++)
+		extract_token(TokenC, Seen, t, ',', sizeof TokenC);
+	tm = Now() - t0;
+	printf("%-8s %10.2f\n", "index", tm * 1000.0);
+
+	t0 = Now();
+	Pos = Seen;
+	while (extract_next_token(TokenC, &Pos, ',', sizeof TokenC) >= 0)
+		;
+	tm = Now() - t0;
+	printf("%-8s %10.2f\n", "next", tm * 1000.0);
+
+	free(Seen);
+	FreeStrBuf(&One);
+	FreeStrBuf(&Trace);
+	FreeStrBuf(&Line);
+	FreeStrBuf(&Token);
+	ShutDownLibCitadel();
+	return 0;
+}
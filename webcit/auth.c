@@ -518,7 +518,6 @@ void monitor(void)
 
 	hprintf("Content-type: text/plain\r\n"
 		"Server: " PACKAGE_STRING "\r\n"
-		"Connection: close\r\n"
 	);
 	begin_burst();
 
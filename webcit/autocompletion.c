@@ -25,7 +25,6 @@ void recp_autocomplete(char *partial) {
 
 	hprintf("Content-type: text/html\r\n"
 		"Server: %s\r\n"
-		"Connection: close\r\n"
 		"Pragma: no-cache\r\n"
 		"Cache-Control: no-store\r\n"
 		"Expires: -1\r\n"
@@ -783,6 +783,119 @@ void load_ical_object(long msgnum, int unread,
 	icalmemory_free_ring();
 }
 
+typedef struct _ical_batch {
+	icalcomponent_kind which_kind;
+	IcalCallbackFunc CallBack;
+	calview *calv;
+} ical_batch;
+
+/*
+ * load_msg_batch() callback: hand the calendar part of one message to the view
+ */
+void load_ical_batch_item(message_summary *Msg, void *userdata)
+{
+	wcsession *WCC = WC;
+	ical_batch *Batch = (ical_batch *) userdata;
+	void *vSumm;
+	int n = Msg->msgnum;
+	int unread = 0;
+
+	if ((Msg->MsgBody == NULL) || (StrLength(Msg->MsgBody->Data) == 0))
+		return;
+
+	if (GetHash(WCC->summ, IKEY(n), &vSumm) && (vSumm != NULL))
+		unread = (((message_summary*)vSumm)->Flags & MSGFLAG_READ) != 0;
+
+	process_ical_object(Msg->msgnum, unread,
+			    (char*) ((Msg->from != NULL) ? ChrPtr(Msg->from) : ""),
+			    (char*) ChrPtr(Msg->MsgBody->Data),
+			    Batch->which_kind,
+			    Batch->CallBack,
+			    Batch->calv);
+	icalmemory_free_ring();
+}
+
+/*
+ * Ask the server which messages of the current room have events between
+ * lower_bound and upper_bound, and return them as a list for MSGB SET.
+ * NULL if the server can't tell us.
+ */
+StrBuf *load_ical_range(time_t lower_bound, time_t upper_bound, long startmsg)
+{
+	StrBuf *Buf;
+	StrBuf *MsgList;
+	long msgnum;
+
+	Buf = NewStrBuf();
+	serv_printf("ICAL range|%ld|%ld", (long)lower_bound, (long)upper_bound);
+	StrBuf_ServGetln(Buf);
+	if (GetServerStatus(Buf, NULL) != 1) {
+		FreeStrBuf(&Buf);
+		return NULL;
+	}
+
+	MsgList = NewStrBuf();
+	while (StrBuf_ServGetln(Buf) >= 0) {
+		if ( (StrLength(Buf) == 3) && 
+		     !strcmp(ChrPtr(Buf), "000")) 
+			break;
+		msgnum = StrTol(Buf);
+		if (msgnum >= startmsg)
+			StrBufAppendPrintf(MsgList, "%ld\n", msgnum);
+	}
+	StrBufAppendBufPlain(MsgList, HKEY("000\n"), 0);
+	FreeStrBuf(&Buf);
+	return MsgList;
+}
+
+/*
+ * Load the icalendar objects of all the messages in the readloop's message list
+ * with one MSGB command, instead of a MSG4 per message.  Returns 0 if the server
+ * can't do that; callers have to fall back to load_ical_object() then.
+ */
+int load_ical_objects(SharedMessageStatus *Stat,
+		      icalcomponent_kind which_kind,
+		      IcalCallbackFunc CallBack,
+		      calview *calv)
+{
+	wcsession *WCC = WC;
+	ical_batch Batch;
+	StrBuf *MsgList;
+	HashPos *at;
+	const char *HashKey;
+	long HKLen;
+	void *vMsg;
+	int rc;
+
+	Batch.which_kind = which_kind;
+	Batch.CallBack = CallBack;
+	Batch.calv = calv;
+
+	/* If we know which days we're going to show, the server can leave out the rest. */
+	MsgList = NULL;
+	if ((calv != NULL) && (calv->upper_bound > 0))
+		MsgList = load_ical_range(calv->lower_bound, calv->upper_bound, Stat->startmsg);
+
+	if (MsgList == NULL) {
+		MsgList = NewStrBufPlain(NULL, GetCount(WCC->summ) * 12 + 4);
+		at = GetNewHashPos(WCC->summ, 0);
+		while (GetNextHashPos(WCC->summ, at, &HKLen, &HashKey, &vMsg)) {
+			message_summary *Msg = (message_summary*) vMsg;
+			if (Msg->msgnum >= Stat->startmsg)
+				StrBufAppendPrintf(MsgList, "%ld\n", Msg->msgnum);
+		}
+		DeleteHashPos(&at);
+		StrBufAppendBufPlain(MsgList, HKEY("000\n"), 0);
+	}
+
+	rc = load_msg_batch("SET", MsgList,
+			    "text/calendar,application/ics,text/vtodo,text/todo",
+			    "from",
+			    load_ical_batch_item, &Batch);
+	FreeStrBuf(&MsgList);
+	return rc >= 0;
+}
+
 /*
  * Display a calendar item
  */
@@ -793,7 +906,11 @@ int calendar_LoadMsgFromServer(SharedMessageStatus *Stat,
 			       int i)
 {
 	calview *c = (calview*) *ViewSpecific;
-	load_ical_object(Msg->msgnum, is_new, (-1), display_individual_cal, c, 1);
+
+	if (c->batch_loaded == 0)
+		c->batch_loaded = load_ical_objects(Stat, (-1), display_individual_cal, c) ? 1 : -1;
+	if (c->batch_loaded < 0)
+		load_ical_object(Msg->msgnum, is_new, (-1), display_individual_cal, c, 1);
 	return 0;
 }
 
@@ -31,6 +31,7 @@ typedef struct _calview {
 	int day;
 	time_t lower_bound;
 	time_t upper_bound;
+	int batch_loaded;	/* 1: MSGB got us all messages at once, -1: load them one by one */
 }calview;
 
 typedef void (*IcalCallbackFunc)(icalcomponent *, long, char*, int, calview *);
@@ -42,6 +43,11 @@ void load_ical_object(long msgnum, int unread,
 		      calview *calv,
 		      int RenderAsync
 	);
+StrBuf *load_ical_range(time_t lower_bound, time_t upper_bound, long startmsg);
+int load_ical_objects(SharedMessageStatus *Stat,
+		      icalcomponent_kind which_kind,
+		      IcalCallbackFunc CallBack,
+		      calview *calv);
 
 int calendar_LoadMsgFromServer(SharedMessageStatus *Stat, 
 			       void **ViewSpecific, 
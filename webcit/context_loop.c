@@ -19,10 +19,35 @@
 #include "webserver.h"
 #include "modules_init.h"
 
-/* Only one thread may manipulate SessionList at a time... */
-pthread_mutex_t SessionListMutex;
+/*
+ * Sessions are found by their ID or by their http-auth credentials through
+ * these hashes.  They're split up into shards, so lookups don't all queue
+ * up behind one lock.
+ */
+#define SESSION_SHARDS 16
+
+typedef struct SessionShard {
+	pthread_mutex_t Mutex;
+	HashList *ById;			/* wc_session -> wcsession */
+	HashList *ByAuth;		/* lowercased "user:password" -> wcsession */
+} SessionShard;
 
-wcsession *SessionList = NULL;	/* Linked list of all webcit sessions */
+SessionShard SessionShards[SESSION_SHARDS];
+
+/*
+ * Every session we own sits in one slot of this timer wheel; a slot holds
+ * the sessions which may have timed out by the time housekeeping gets to it.
+ * Requests don't move sessions around in here; do_housekeeping() puts the
+ * ones that were busy in the meantime back where they belong now.
+ * This mutex also covers the list of sessions which may be reused.
+ */
+#define SESSION_WHEEL_SLOTS ((WEBCIT_TIMEOUT / HOUSEKEEPING) + 4)
+
+pthread_mutex_t SessionWheelMutex;
+wcsession *SessionWheel[SESSION_WHEEL_SLOTS];
+time_t SessionWheelTick = 0;		/* the last tick do_housekeeping() swept */
+int SessionWheelSweepAll = 0;		/* we're shutting down; everybody goes. */
+wcsession *ReusableSessions = NULL;	/* unbound sessions, see context_loop() */
 
 pthread_key_t MyConKey;         /* TSD key for MySession() */
 HashList *HttpReqTypes = NULL;
@@ -46,63 +71,281 @@ void DestroyHttpHeaderHandler(void *V)
 	free(pHdr);
 }
 
+/*
+ * Put a session into the wheel slot that comes due at 'when'.
+ * Caller must hold SessionWheelMutex.
+ */
+static void WheelInsert(wcsession *sptr, time_t when)
+{
+	int slot = (when / HOUSEKEEPING) % SESSION_WHEEL_SLOTS;
+
+	sptr->prev = NULL;
+	sptr->next = SessionWheel[slot];
+	if (sptr->next != NULL)
+		sptr->next->prev = sptr;
+	SessionWheel[slot] = sptr;
+	sptr->wheel_slot = slot;
+}
+
+/*
+ * Take a session out of its wheel slot.  Caller must hold SessionWheelMutex.
+ */
+static void WheelRemove(wcsession *sptr)
+{
+	if (sptr->wheel_slot < 0)
+		return;
+	if (sptr->prev != NULL)
+		sptr->prev->next = sptr->next;
+	else
+		SessionWheel[sptr->wheel_slot] = sptr->next;
+	if (sptr->next != NULL)
+		sptr->next->prev = sptr->prev;
+	sptr->next = sptr->prev = NULL;
+	sptr->wheel_slot = (-1);
+}
+
+/*
+ * Offer an unbound session for reuse, or take it back.
+ * Caller must hold SessionWheelMutex.
+ */
+static void ReusablePush(wcsession *sptr)
+{
+	sptr->reuse_prev = NULL;
+	sptr->reuse_next = ReusableSessions;
+	if (sptr->reuse_next != NULL)
+		sptr->reuse_next->reuse_prev = sptr;
+	ReusableSessions = sptr;
+}
+
+static void ReusableRemove(wcsession *sptr)
+{
+	if ((sptr->reuse_prev == NULL) && (ReusableSessions != sptr))
+		return;
+	if (sptr->reuse_prev != NULL)
+		sptr->reuse_prev->reuse_next = sptr->reuse_next;
+	else
+		ReusableSessions = sptr->reuse_next;
+	if (sptr->reuse_next != NULL)
+		sptr->reuse_next->reuse_prev = sptr->reuse_prev;
+	sptr->reuse_next = sptr->reuse_prev = NULL;
+}
+
+static SessionShard *IdShard(int wc_session)
+{
+	return &SessionShards[((unsigned int) wc_session) % SESSION_SHARDS];
+}
+
+static SessionShard *AuthShard(StrBuf *AuthKey)
+{
+	return &SessionShards[((unsigned int) HashLittle(ChrPtr(AuthKey), StrLength(AuthKey))) % SESSION_SHARDS];
+}
+
+/*
+ * http-auth compares user and password case insensitive; so do we.
+ */
+static void MakeAuthKey(StrBuf *Key, const StrBuf *User, const StrBuf *Pass)
+{
+	FlushStrBuf(Key);
+	StrBufAppendBuf(Key, User, 0);
+	StrBufAppendBufPlain(Key, HKEY(":"), 0);
+	StrBufAppendBuf(Key, Pass, 0);
+	StrBufLowerCase(Key);
+}
+
+/*
+ * Remove a session from one of the shard hashes - if it's still us in there;
+ * a re-created session with the same key may already have taken our place.
+ */
+static void ShardForget(SessionShard *Shard, HashList *Hash, const char *Key, long len, wcsession *sptr)
+{
+	HashPos *at;
+	void *vSession;
+
+	CtdlLogResult(pthread_mutex_lock(&Shard->Mutex));
+	if (GetHash(Hash, Key, len, &vSession) && (vSession == sptr)) {
+		at = GetNewHashPos(Hash, 0);
+		if (GetHashPosFromKey(Hash, Key, len, at))
+			DeleteEntryFromHash(Hash, at);
+		DeleteHashPos(&at);
+	}
+	CtdlLogResult(pthread_mutex_unlock(&Shard->Mutex));
+}
+
+static void SessionForgetId(wcsession *sptr)
+{
+	SessionShard *Shard;
+
+	if (sptr->wc_session == 0)
+		return;
+	Shard = IdShard(sptr->wc_session);
+	ShardForget(Shard, Shard->ById, IKEY(sptr->wc_session), sptr);
+}
+
+static void SessionForgetAuth(wcsession *sptr)
+{
+	SessionShard *Shard;
+
+	if (sptr->AuthKey == NULL)
+		return;
+	Shard = AuthShard(sptr->AuthKey);
+	ShardForget(Shard, Shard->ByAuth, SKEY(sptr->AuthKey), sptr);
+	FreeStrBuf(&sptr->AuthKey);
+}
+
+/*
+ * (re)file a session under the credentials it holds now; they may have
+ * changed during the transaction (login, logout, password change).
+ */
+static void SessionIndexAuth(wcsession *sptr)
+{
+	SessionShard *Shard;
+	StrBuf *Key;
+
+	if (StrLength(sptr->wc_username) == 0) {
+		SessionForgetAuth(sptr);
+		return;
+	}
+
+	Key = NewStrBufPlain(NULL, StrLength(sptr->wc_username) + StrLength(sptr->wc_password) + 1);
+	MakeAuthKey(Key, sptr->wc_username, sptr->wc_password);
+	if ((sptr->AuthKey != NULL) && (!strcmp(ChrPtr(Key), ChrPtr(sptr->AuthKey)))) {
+		FreeStrBuf(&Key);
+		return;
+	}
+	SessionForgetAuth(sptr);
+
+	sptr->AuthKey = Key;
+	Shard = AuthShard(Key);
+	CtdlLogResult(pthread_mutex_lock(&Shard->Mutex));
+	Put(Shard->ByAuth, SKEY(Key), sptr, reference_free_handler);
+	CtdlLogResult(pthread_mutex_unlock(&Shard->Mutex));
+}
+
+static void SessionIndexId(wcsession *sptr)
+{
+	SessionShard *Shard;
+
+	Shard = IdShard(sptr->wc_session);
+	CtdlLogResult(pthread_mutex_lock(&Shard->Mutex));
+	Put(Shard->ById, IKEY(sptr->wc_session), sptr, reference_free_handler);
+	CtdlLogResult(pthread_mutex_unlock(&Shard->Mutex));
+}
+
+/*
+ * A transaction is done with this session; update where it may be found.
+ */
+static void SessionRequestDone(wcsession *sptr, int Reusable)
+{
+	if (sptr->killthis) {
+		/* nobody may find it anymore; the next housekeeping run takes it away. */
+		SessionForgetId(sptr);
+		SessionForgetAuth(sptr);
+		CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+		WheelRemove(sptr);
+		WheelInsert(sptr, time(NULL) + HOUSEKEEPING);
+		CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
+		return;
+	}
+
+	if (Reusable) {
+		SessionForgetId(sptr);
+		sptr->wc_session = 0;			/* flag as available for re-use */
+		sptr->selected_language = -1;		/* clear any non-default language setting */
+	}
+
+	SessionIndexAuth(sptr);
+
+	if (Reusable) {
+		CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+		ReusablePush(sptr);
+		CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
+	}
+}
+
 void shutdown_sessions(void)
 {
 	wcsession *sptr;
-	
-	for (sptr = SessionList; sptr != NULL; sptr = sptr->next) {
-		sptr->killthis = 1;
+	int i;
+
+	CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+	SessionWheelSweepAll = 1;
+	for (i = 0; i < SESSION_WHEEL_SLOTS; i++) {
+		for (sptr = SessionWheel[i]; sptr != NULL; sptr = sptr->next) {
+			sptr->killthis = 1;
+		}
 	}
+	CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
 }
 
 void do_housekeeping(void)
 {
-	wcsession *sptr, *ss;
+	wcsession *sptr, *due;
 	wcsession *sessions_to_kill = NULL;
 	time_t the_time;
+	time_t tick;
+	long i, nSlots;
+	int slot;
 
 	/*
-	 * Lock the session list, moving any candidates for euthanasia into
-	 * a separate list.
+	 * Lock the wheel and look at the slots which came due since our last
+	 * run, moving any candidates for euthanasia into a separate list.
 	 */
-	the_time = 0;
-	CtdlLogResult(pthread_mutex_lock(&SessionListMutex));
-	for (sptr = SessionList; sptr != NULL; sptr = sptr->next) {
-		if (the_time == 0)
-			the_time = time(NULL);
-		/* Kill idle sessions */
-		if ((sptr->inuse == 0) && 
-		    ((the_time - (sptr->lastreq)) > (time_t) WEBCIT_TIMEOUT))
-		{
-			syslog(LOG_DEBUG, "Timeout session %d", sptr->wc_session);
-			sptr->killthis = 1;
-		}
-
-		/* Remove sessions flagged for kill */
-		if (sptr->killthis) {
-
-			/* remove session from linked list */
-			if (sptr == SessionList) {
-				SessionList = SessionList->next;
+	the_time = time(NULL);
+	tick = the_time / HOUSEKEEPING;
+	CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+	nSlots = tick - SessionWheelTick;
+	if ((SessionWheelSweepAll) || (nSlots > SESSION_WHEEL_SLOTS))
+		nSlots = SESSION_WHEEL_SLOTS;
+
+	for (i = 0; i < nSlots; i++) {
+		slot = (tick - i) % SESSION_WHEEL_SLOTS;
+		due = SessionWheel[slot];
+		SessionWheel[slot] = NULL;
+
+		while (due != NULL) {
+			sptr = due;
+			due = due->next;
+			sptr->wheel_slot = (-1);
+
+			if (	(SessionWheelSweepAll)
+				|| ((sptr->inuse == 0) && (sptr->killthis))
+			) {
+				sptr->next = sessions_to_kill;
+				sessions_to_kill = sptr;
 			}
-			else for (ss=SessionList;ss!=NULL;ss=ss->next) {
-				if (ss->next == sptr) {
-					ss->next = ss->next->next;
-				}
+			/* Kill idle sessions */
+			else if ((sptr->inuse == 0) && 
+				 ((the_time - (sptr->lastreq)) > (time_t) WEBCIT_TIMEOUT))
+			{
+				syslog(LOG_DEBUG, "Timeout session %d", sptr->wc_session);
+				sptr->killthis = 1;
+				sptr->next = sessions_to_kill;
+				sessions_to_kill = sptr;
+			}
+			/* still busy? look again next time. */
+			else if (sptr->killthis) {
+				WheelInsert(sptr, the_time + HOUSEKEEPING);
+			}
+			else {
+				WheelInsert(sptr, sptr->lastreq + WEBCIT_TIMEOUT + 1 + HOUSEKEEPING);
 			}
-
-			sptr->next = sessions_to_kill;
-			sessions_to_kill = sptr;
 		}
 	}
-	CtdlLogResult(pthread_mutex_unlock(&SessionListMutex));
+	SessionWheelTick = tick;
+
+	for (sptr = sessions_to_kill; sptr != NULL; sptr = sptr->next) {
+		ReusableRemove(sptr);
+	}
+	CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
 
 	/*
-	 * Now free up and destroy the culled sessions.
+	 * Now make them unfindable, then free up and destroy the culled sessions.
 	 */
 	while (sessions_to_kill != NULL) {
 		syslog(LOG_DEBUG, "Destroying session %d", sessions_to_kill->wc_session);
 		sptr = sessions_to_kill->next;
+		SessionForgetId(sessions_to_kill);
+		SessionForgetAuth(sessions_to_kill);
 		session_destroy_modules(&sessions_to_kill);
 		sessions_to_kill = sptr;
 	}
@@ -158,65 +401,77 @@ int GenerateSessionID(void)
 	return ++seq;
 }
 
-wcsession *FindSession(wcsession **wclist, ParsedHttpHdrs *Hdr, pthread_mutex_t *ListMutex)
+wcsession *FindSession(ParsedHttpHdrs *Hdr)
 {
-	wcsession *sptr = NULL;
 	wcsession *TheSession = NULL;	
+	SessionShard *Shard;
+	StrBuf *Key;
+	void *vSession;
 	
-	if (Hdr->HR.got_auth == AUTH_BASIC) {
-		GetAuthBasic(Hdr);
-	}
-
-	CtdlLogResult(pthread_mutex_lock(ListMutex));
-	for (sptr = *wclist; ((sptr != NULL) && (TheSession == NULL)); sptr = sptr->next) {
-		
+	switch (Hdr->HR.got_auth)
+	{
+	case AUTH_BASIC:
 		/* If HTTP-AUTH, look for a session with matching credentials */
-		switch (Hdr->HR.got_auth)
-		{
-		case AUTH_BASIC:
-			if (	(!strcasecmp(ChrPtr(Hdr->c_username), ChrPtr(sptr->wc_username)))
-				&& (!strcasecmp(ChrPtr(Hdr->c_password), ChrPtr(sptr->wc_password)))
-				&& (sptr->killthis == 0)
-			) {
-				if (verbose)
-					syslog(LOG_DEBUG, "Matched a session with the same http-auth");
-				TheSession = sptr;
-			}
-			break;
-		case AUTH_COOKIE:
-			/* If cookie-session, look for a session with matching session ID */
-			if (	(Hdr->HR.desired_session != 0)
-				&& (sptr->wc_session == Hdr->HR.desired_session)
+		GetAuthBasic(Hdr);
+		Key = NewStrBuf();
+		MakeAuthKey(Key, Hdr->c_username, Hdr->c_password);
+		Shard = AuthShard(Key);
+		CtdlLogResult(pthread_mutex_lock(&Shard->Mutex));
+		if (GetHash(Shard->ByAuth, SKEY(Key), &vSession) && (vSession != NULL)) {
+			TheSession = (wcsession *) vSession;
+			/* the hash only told us the hash values are the same... */
+			if (	(strcasecmp(ChrPtr(Hdr->c_username), ChrPtr(TheSession->wc_username)))
+				|| (strcasecmp(ChrPtr(Hdr->c_password), ChrPtr(TheSession->wc_password)))
+				|| (TheSession->killthis != 0)
 			) {
-				if (verbose)
-					syslog(LOG_DEBUG, "Matched a session with the same cookie");
-				TheSession = sptr;
-			}
-			break;			     
-		case NO_AUTH:
-			/* Any unbound session is a candidate */
-			if ( (sptr->wc_session == 0) && (sptr->inuse == 0) ) {
-				if (verbose)
-					syslog(LOG_DEBUG, "Reusing an unbound session");
-				TheSession = sptr;
+				TheSession = NULL;
 			}
+			else if (verbose)
+				syslog(LOG_DEBUG, "Matched a session with the same http-auth");
+		}
+		CtdlLogResult(pthread_mutex_unlock(&Shard->Mutex));
+		FreeStrBuf(&Key);
+		break;
+	case AUTH_COOKIE:
+		/* If cookie-session, look for a session with matching session ID */
+		if (Hdr->HR.desired_session == 0)
 			break;
+		Shard = IdShard(Hdr->HR.desired_session);
+		CtdlLogResult(pthread_mutex_lock(&Shard->Mutex));
+		if (GetHash(Shard->ById, IKEY(Hdr->HR.desired_session), &vSession) && (vSession != NULL)) {
+			if (verbose)
+				syslog(LOG_DEBUG, "Matched a session with the same cookie");
+			TheSession = (wcsession *) vSession;
+		}
+		CtdlLogResult(pthread_mutex_unlock(&Shard->Mutex));
+		break;			     
+	case NO_AUTH:
+		/* Any unbound session is a candidate */
+		CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+		TheSession = ReusableSessions;
+		if (TheSession != NULL) {
+			ReusableRemove(TheSession);
+			TheSession->lastreq = time(NULL);	/* don't let housekeeping take it from under us */
+			if (verbose)
+				syslog(LOG_DEBUG, "Reusing an unbound session");
 		}
+		CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
+		break;
 	}
-	CtdlLogResult(pthread_mutex_unlock(ListMutex));
 	if (TheSession == NULL) {
 		syslog(LOG_DEBUG, "No existing session was matched");
 	}
 	return TheSession;
 }
 
-wcsession *CreateSession(int Lockable, int Static, wcsession **wclist, ParsedHttpHdrs *Hdr, pthread_mutex_t *ListMutex)
+wcsession *CreateSession(int Lockable, int Static, ParsedHttpHdrs *Hdr)
 {
 	wcsession *TheSession;
 	TheSession = (wcsession *) malloc(sizeof(wcsession));
 	memset(TheSession, 0, sizeof(wcsession));
 	TheSession->Hdr = Hdr;
 	TheSession->serv_sock = (-1);
+	TheSession->wheel_slot = (-1);
 	TheSession->lastreq = time(NULL);;
 
 	pthread_setspecific(MyConKey, (void *)TheSession);
@@ -240,17 +495,13 @@ wcsession *CreateSession(int Lockable, int Static, wcsession **wclist, ParsedHtt
 
 	if (Lockable) {
 		pthread_mutex_init(&TheSession->SessionMutex, NULL);
+		TheSession->nonce = rand();
 
-		if (ListMutex != NULL)
-			CtdlLogResult(pthread_mutex_lock(ListMutex));
+		SessionIndexId(TheSession);
 
-		if (wclist != NULL) {
-			TheSession->nonce = rand();
-			TheSession->next = *wclist;
-			*wclist = TheSession;
-		}
-		if (ListMutex != NULL)
-			CtdlLogResult(pthread_mutex_unlock(ListMutex));
+		CtdlLogResult(pthread_mutex_lock(&SessionWheelMutex));
+		WheelInsert(TheSession, TheSession->lastreq + WEBCIT_TIMEOUT + 1 + HOUSEKEEPING);
+		CtdlLogResult(pthread_mutex_unlock(&SessionWheelMutex));
 	}
 	return TheSession;
 }
@@ -265,6 +516,18 @@ void do_404(void)
 	end_burst();
 }
 
+/*
+ * We can't tell where the request body ends; since whatever follows it
+ * would be taken for the next request, we refuse it and hang up.
+ */
+static void do_400_framing(void)
+{
+	hprintf("HTTP/1.1 400 Bad Request\r\n");
+	hprintf("Content-Type: text/plain\r\n");
+	wc_printf("Transfer-Encoding is not supported, and Content-Length must be unambiguous\r\n");
+	end_burst();
+}
+
 int ReadHttpSubject(ParsedHttpHdrs *Hdr, StrBuf *Line, StrBuf *Buf)
 {
 	const char *Args;
@@ -293,6 +556,7 @@ int ReadHttpSubject(ParsedHttpHdrs *Hdr, StrBuf *Line, StrBuf *Buf)
 		Hdr->HR.eReqType = eGET;
 		return 1;
 	}
+	Hdr->HR.http_1_1 = !strcmp(ChrPtr(Buf), "HTTP/1.1");
 
 	StrBufAppendBuf(Hdr->this_page, Hdr->HR.ReqLine, 0);
 
@@ -346,11 +610,13 @@ int ReadHttpSubject(ParsedHttpHdrs *Hdr, StrBuf *Line, StrBuf *Buf)
 	else {
 		/* If this is a "flat" request for the root, display the configured landing page. */
 		int return_value;
+		int http_1_1 = Hdr->HR.http_1_1;
 		StrBuf *NewLine = NewStrBuf();
 		Hdr->HR.DontNeedAuth = 1;
 		StrBufAppendPrintf(NewLine, "GET /landing?go=%s?failvisibly=1 HTTP/1.0", ChrPtr(Buf));
 		if (verbose) syslog(LOG_DEBUG, "Replacing with: %s", ChrPtr(NewLine));
 		return_value = ReadHttpSubject(Hdr, NewLine, Buf);
+		Hdr->HR.http_1_1 = http_1_1;	/* the client still speaks what it spoke */
 		FreeStrBuf(&NewLine);
 		return return_value;
 	}
@@ -388,6 +654,7 @@ int ReadHTTPRequest (ParsedHttpHdrs *Hdr)
 	OneHttpHeader *pHdr;
 	StrBuf *Line, *LastLine, *HeaderName;
 	int nLine = 0;
+	int nEmpty = 0;
 	void *vF;
 	int isbogus = 0;
 
@@ -395,7 +662,7 @@ int ReadHTTPRequest (ParsedHttpHdrs *Hdr)
 	LastLine = NULL;
 	do {
 		nLine ++;
-		Line = NewStrBufPlain(NULL, SIZ / 4);
+		Line = NewStrBufArenaPlain(Hdr->Arena, NULL, SIZ / 4);
 
 		if (ClientGetLine(Hdr, Line) < 0) {
 			FreeStrBuf(&Line);
@@ -405,7 +672,12 @@ int ReadHTTPRequest (ParsedHttpHdrs *Hdr)
 
 		if (StrLength(Line) == 0) {
 			FreeStrBuf(&Line);
-			continue;
+			/* clients may send a stray CRLF after a request body; skip it in front of the next one. */
+			if ((nLine == 1) && (nEmpty++ < 4)) {
+				nLine = 0;
+				continue;
+			}
+			break;
 		}
 		if (nLine == 1) {
 			Hdr->HTTPHeaders = NewHash(1, NULL);
@@ -447,6 +719,15 @@ int ReadHTTPRequest (ParsedHttpHdrs *Hdr)
 
 		StrBufUpCase(HeaderName);
 
+		/* a second Content-Length replaces the first below; only OK if they agree. */
+		if (!strcmp(ChrPtr(HeaderName), "CONTENT-LENGTH") &&
+		    GetHash(Hdr->HTTPHeaders, SKEY(HeaderName), &vF) &&
+		    (vF != NULL) &&
+		    (strcmp(ChrPtr(((OneHttpHeader*)vF)->Val), ChrPtr(Line)) != 0))
+		{
+			Hdr->HR.bad_framing = 1;
+		}
+
 		pHdr = (OneHttpHeader*) malloc(sizeof(OneHttpHeader));
 		memset(pHdr, 0, sizeof(OneHttpHeader));
 		pHdr->Val = Line;
@@ -460,9 +741,11 @@ int ReadHTTPRequest (ParsedHttpHdrs *Hdr)
 		}
 		Put(Hdr->HTTPHeaders, SKEY(HeaderName), pHdr, DestroyHttpHeaderHandler);
 		LastLine = Line;
-	} while (Line != NULL);
+	} while (1);
 
 	FreeStrBuf(&HeaderName);
+	if (Hdr->HTTPHeaders == NULL)
+		isbogus = 1;
 
 	return isbogus;
 }
@@ -483,6 +766,28 @@ void OverrideRequest(ParsedHttpHdrs *Hdr, const char *Line, long len)
 	FreeStrBuf(&Buf);
 }
 
+/*
+ * Shall this connection carry another request after this one?
+ * HTTP/1.1 says yes unless the client says close; HTTP/1.0 clients have to ask for it.
+ */
+static void DecideKeepAlive(ParsedHttpHdrs *Hdr)
+{
+	int wanted;
+
+	if ((Hdr->HR.keep_alive < 0) || (Hdr->HR.bad_framing) || (Hdr->peer_closed))
+		wanted = 0;
+	else
+		wanted = Hdr->HR.http_1_1 || (Hdr->HR.keep_alive > 0);
+
+	Hdr->HR.keep_alive = wanted &&
+		(Hdr->nRequests < KEEPALIVE_MAX_REQUESTS) &&
+		(Hdr->HR.eReqType != eHEAD) &&			/* we'd send a body anyways */
+#ifndef HAVE_SYS_EPOLL_H
+		(num_threads_executing < MAX_WORKER_THREADS * 3 / 4) &&	/* idle connections block a worker */
+#endif
+		(!time_to_die);
+}
+
 /*
  * handle one request
  *
@@ -506,16 +811,25 @@ void context_loop(ParsedHttpHdrs *Hdr)
 	time_t now;
 	
 	gettimeofday(&tx_start, NULL);		/* start a stopwatch for performance timing */
+	StrBufGetAllocStats(NULL, 1);		/* ...and count our allocations */
 
 	/*
 	 * Find out what it is that the web browser is asking for
 	 */
 	isbogus = ReadHTTPRequest(Hdr);
 
+	/* the client closed a kept alive connection instead of sending another request */
+	if (isbogus && (Hdr->HTTPHeaders == NULL) && (Hdr->nRequests > 0))
+		return;
+	Hdr->nRequests ++;
+
 	Hdr->HR.dav_depth = 32767; /* TODO: find a general way to have non-0 defaults */
 
 	if (!isbogus) {
 		isbogus = AnalyseHeaders(Hdr);
+		DecideKeepAlive(Hdr);
+		if (Hdr->HR.bad_framing)
+			isbogus = 1;
 	}
 
 	if (	(isbogus)
@@ -523,9 +837,14 @@ void context_loop(ParsedHttpHdrs *Hdr)
 		&& ((Hdr->HR.Handler->Flags & BOGUS) != 0))
 	) {
 		wcsession *Bogus;
-		Bogus = CreateSession(0, 1, NULL, Hdr, NULL);
-		do_404();
-		syslog(LOG_WARNING, "HTTP: 404 [%ld.%06ld] %s %s",
+		Hdr->HR.keep_alive = 0;
+		Bogus = CreateSession(0, 1, Hdr);
+		if (Hdr->HR.bad_framing)
+			do_400_framing();
+		else
+			do_404();
+		syslog(LOG_WARNING, "HTTP: %d [%ld.%06ld] %s %s",
+			(Hdr->HR.bad_framing) ? 400 : 404,
 			((tx_finish.tv_sec*1000000 + tx_finish.tv_usec) - (tx_start.tv_sec*1000000 + tx_start.tv_usec)) / 1000000,
 			((tx_finish.tv_sec*1000000 + tx_finish.tv_usec) - (tx_start.tv_sec*1000000 + tx_start.tv_usec)) % 1000000,
 			ReqStrs[Hdr->HR.eReqType],
@@ -539,7 +858,9 @@ void context_loop(ParsedHttpHdrs *Hdr)
 	if ((Hdr->HR.Handler != NULL) && ((Hdr->HR.Handler->Flags & ISSTATIC) != 0))
 	{
 		wcsession *Static;
-		Static = CreateSession(0, 1, NULL, Hdr, NULL);
+		if (Hdr->HR.ContentLength > 0)
+			Hdr->HR.keep_alive = 0;		/* nobody reads the body */
+		Static = CreateSession(0, 1, Hdr);
 		
 		Hdr->HR.Handler->F();
 
@@ -572,13 +893,13 @@ void context_loop(ParsedHttpHdrs *Hdr)
 	 * - A matching http-auth username and password
 	 * - An unbound session flagged as reusable
 	 */
-	TheSession = FindSession(&SessionList, Hdr, &SessionListMutex);
+	TheSession = FindSession(Hdr);
 
 	/*
 	 * If there were no qualifying sessions, then create a new one.
 	 */
 	if ((TheSession == NULL) || (TheSession->killthis != 0)) {
-		TheSession = CreateSession(1, 0, &SessionList, Hdr, &SessionListMutex);
+		TheSession = CreateSession(1, 0, Hdr);
 	}
 
 	/*
@@ -639,6 +960,19 @@ void context_loop(ParsedHttpHdrs *Hdr)
 			);
 	}
 	session_detach_modules(TheSession);
+	ServPoolRelease();
+
+	if (verbose) {
+		StrBufAllocStats Stats;
+
+		StrBufGetAllocStats(&Stats, 1);
+		syslog(LOG_DEBUG, "HTTP: StrBufs did %ld mallocs, %ld reallocs, %ld slab hits, %ld arena allocations",
+		       Stats.Mallocs,
+		       Stats.Reallocs,
+		       Stats.SlabHits,
+		       Stats.ArenaAllocs
+		);
+	}
 
 	/* If *this* very transaction did not explicitly specify a session cookie,
 	 * and it did not log in, we want to flag the session as a candidate for
@@ -646,10 +980,7 @@ void context_loop(ParsedHttpHdrs *Hdr)
 	 * table from getting bombarded with new sessions when, for example, a web
 	 * spider crawls the site without using cookies.
 	 */
-	if ((session_may_be_reused) && (!TheSession->logged_in)) {
-		TheSession->wc_session = 0;		/* flag as available for re-use */
-		TheSession->selected_language = -1;	/* clear any non-default language setting */
-	}
+	SessionRequestDone(TheSession, (session_may_be_reused) && (!TheSession->logged_in));
 
 	TheSession->Hdr = NULL;
 	TheSession->inuse = 0;					/* mark the session as unbound */
@@ -670,7 +1001,16 @@ void tmplput_current_user(StrBuf *Target, WCTemplputParams *TP)
 
 void Header_HandleContentLength(StrBuf *Line, ParsedHttpHdrs *hdr)
 {
+	StrBufTrim(Line);
 	hdr->HR.ContentLength = StrToi(Line);
+	if (!StrBufIsNumber(Line) || (hdr->HR.ContentLength < 0))
+		hdr->HR.bad_framing = 1;	/* "5, 5", "-1", "0x10"... */
+}
+
+void Header_HandleTransferEncoding(StrBuf *Line, ParsedHttpHdrs *hdr)
+{
+	/* we never read a chunked (or otherwise encoded) body */
+	hdr->HR.bad_framing = 1;
 }
 
 void Header_HandleContentType(StrBuf *Line, ParsedHttpHdrs *hdr)
@@ -718,14 +1058,68 @@ void Header_HandleIfModSince(StrBuf *Line, ParsedHttpHdrs *hdr)
 	hdr->HR.if_modified_since = httpdate_to_timestamp(Line);
 }
 
+void Header_HandleIfNoneMatch(StrBuf *Line, ParsedHttpHdrs *hdr)
+{
+	hdr->HR.if_none_match = Line;
+}
+
+void Header_HandleConnection(StrBuf *Line, ParsedHttpHdrs *hdr)
+{
+	StrBuf *Token = NewStrBufPlain(NULL, StrLength(Line));
+	const char *Pos = NULL;
+
+	/* close beats keep-alive; either may come along with other options. */
+	while (StrBufHaveNextToken(Line, &Pos)) {
+		StrBufExtract_NextToken(Token, Line, &Pos, ',');
+		StrBufTrim(Token);
+		if (!strcasecmp(ChrPtr(Token), "close"))
+			hdr->HR.keep_alive = -1;
+		else if (!strcasecmp(ChrPtr(Token), "keep-alive") && (hdr->HR.keep_alive == 0))
+			hdr->HR.keep_alive = 1;
+	}
+	FreeStrBuf(&Token);
+}
+
 void Header_HandleAcceptEncoding(StrBuf *Line, ParsedHttpHdrs *hdr)
 {
+	StrBuf *Token = NewStrBufPlain(NULL, StrLength(Line));
+	StrBuf *Coding = NewStrBufPlain(NULL, StrLength(Line));
+	StrBuf *Param = NewStrBufPlain(NULL, StrLength(Line));
+	const char *Pos = NULL;
+	const char *PPos;
+	int gzip = -1, br = -1, any = -1;	/* -1: not mentioned, 0: refused, 1: welcome */
+	int ok;
+
 	/*
-	 * Can we compress?
+	 * Can we compress? Static files may also have a brotli variant ready.
+	 * Each coding may come with a weight; "q=0" means "not this one".
 	 */
-	if (strstr(&ChrPtr(Line)[16], "gzip")) {
-		hdr->HR.gzip_ok = 1;
+	while (StrBufHaveNextToken(Line, &Pos)) {
+		StrBufExtract_NextToken(Token, Line, &Pos, ',');
+		PPos = NULL;
+		ok = 1;
+		StrBufExtract_NextToken(Coding, Token, &PPos, ';');
+		StrBufTrim(Coding);
+		while (StrBufHaveNextToken(Token, &PPos)) {
+			StrBufExtract_NextToken(Param, Token, &PPos, ';');
+			StrBufTrim(Param);
+			if (!strncasecmp(ChrPtr(Param), "q=", 2))
+				ok = (atof(ChrPtr(Param) + 2) > 0.0);
+		}
+
+		if (!strcasecmp(ChrPtr(Coding), "gzip") || !strcasecmp(ChrPtr(Coding), "x-gzip"))
+			gzip = ok;
+		else if (!strcasecmp(ChrPtr(Coding), "br"))
+			br = ok;
+		else if (!strcmp(ChrPtr(Coding), "*"))
+			any = ok;
 	}
+	hdr->HR.gzip_ok = (gzip >= 0) ? gzip : (any > 0);
+	hdr->HR.br_ok = (br >= 0) ? br : (any > 0);
+
+	FreeStrBuf(&Param);
+	FreeStrBuf(&Coding);
+	FreeStrBuf(&Token);
 }
 
 void Header_HandleContentRange(StrBuf *Line, ParsedHttpHdrs *hdr)
@@ -770,6 +1164,16 @@ ServerStartModule_CONTEXT
 (void)
 {
 	long *v;
+	int i;
+
+	for (i = 0; i < SESSION_SHARDS; i++) {
+		pthread_mutex_init(&SessionShards[i].Mutex, NULL);
+		SessionShards[i].ById = NewHash(1, Flathash);
+		SessionShards[i].ByAuth = NewHash(1, NULL);
+	}
+	pthread_mutex_init(&SessionWheelMutex, NULL);
+	SessionWheelTick = time(NULL) / HOUSEKEEPING;
+
 	HttpReqTypes = NewHash(1, NULL);
 	HttpHeaderHandler = NewHash(1, NULL);
 
@@ -818,8 +1222,14 @@ void
 ServerShutdownModule_CONTEXT
 (void)
 {
+	int i;
+
 	DeleteHash(&HttpReqTypes);
 	DeleteHash(&HttpHeaderHandler);
+	for (i = 0; i < SESSION_SHARDS; i++) {
+		DeleteHash(&SessionShards[i].ById);
+		DeleteHash(&SessionShards[i].ByAuth);
+	}
 }
 
 void RegisterHeaderHandler(const char *Name, long Len, Header_Evaluator F)
@@ -838,6 +1248,7 @@ InitModule_CONTEXT
 {
 	RegisterHeaderHandler(HKEY("RANGE"), Header_HandleContentRange);
 	RegisterHeaderHandler(HKEY("CONTENT-LENGTH"), Header_HandleContentLength);
+	RegisterHeaderHandler(HKEY("TRANSFER-ENCODING"), Header_HandleTransferEncoding);
 	RegisterHeaderHandler(HKEY("CONTENT-TYPE"), Header_HandleContentType);
 	RegisterHeaderHandler(HKEY("X-FORWARDED-HOST"), Header_HandleXFFHost); /* Apache way... */
 	RegisterHeaderHandler(HKEY("X-REAL-IP"), Header_HandleXFFHost);        /* NGinX way... */
@@ -845,6 +1256,8 @@ InitModule_CONTEXT
 	RegisterHeaderHandler(HKEY("X-FORWARDED-FOR"), Header_HandleXFF);
 	RegisterHeaderHandler(HKEY("ACCEPT-ENCODING"), Header_HandleAcceptEncoding);
 	RegisterHeaderHandler(HKEY("IF-MODIFIED-SINCE"), Header_HandleIfModSince);
+	RegisterHeaderHandler(HKEY("IF-NONE-MATCH"), Header_HandleIfNoneMatch);
+	RegisterHeaderHandler(HKEY("CONNECTION"), Header_HandleConnection);
 
 	RegisterNamespace("CURRENT_USER", 0, 1, tmplput_current_user, NULL, CTX_NONE);
 	RegisterNamespace("NONCE", 0, 0, tmplput_nonce, NULL, 0);
@@ -869,6 +1282,7 @@ HttpNewModule_CONTEXT
 {
 	httpreq->PlainArgs = NewStrBufPlain(NULL, SIZ);
 	httpreq->this_page = NewStrBufPlain(NULL, SIZ);
+	httpreq->Arena = NewStrBufArena(SIZ * 16);
 }
 
 void 
@@ -880,6 +1294,11 @@ HttpDetachModule_CONTEXT
 	FlushStrBuf(httpreq->this_page);
 	FlushStrBuf(httpreq->PlainArgs);
 	DeleteHash(&httpreq->HTTPHeaders);
+	FlushStrBufArena(httpreq->Arena);
+	httpreq->HaveRange = 0;
+	httpreq->RangeStart = 0;
+	httpreq->RangeTil = 0;
+	httpreq->TotalBytes = 0;
 	memset(&httpreq->HR, 0, sizeof(HdrRefs));
 }
 
@@ -893,5 +1312,6 @@ HttpDestroyModule_CONTEXT
 	FreeStrBuf(&httpreq->PlainArgs);
 	FreeStrBuf(&httpreq->HostHeader);
 	DeleteHash(&httpreq->HTTPHeaders);
+	FreeStrBufArena(&httpreq->Arena);
 
 }
@@ -37,6 +37,8 @@ void euid_escapize(char *, const char *);
 void euid_unescapize(char *, const char *);
 void dav_identify_host(void);
 void dav_identify_hosthdr(void);
+void dav_collection_item(long msgnum, const char *uid, time_t modified);
+void dav_collection_item_batch(message_summary *Msg, void *userdata);
 
 void RegisterDAVNamespace(const char * UrlString, 
 			  long UrlSLen, 
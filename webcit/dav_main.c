@@ -31,8 +31,7 @@ HashList *DavNamespaces = NULL;
  */
 void dav_common_headers(void) {
 	hprintf(
-		"Server: %s / %s\r\n"
-		"Connection: close\r\n",
+		"Server: %s / %s\r\n",
 		PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software)
 	);
 }
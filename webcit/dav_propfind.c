@@ -456,6 +456,60 @@ void propfind_xml_end(void *data, const char *supplied_el) {
 
 
 
+/*
+ * Output one item of a collection listing
+ */
+void dav_collection_item(long msgnum, const char *uid, time_t modified)
+{
+	wcsession *WCC = WC;
+	char encoded_uid[256];
+	char datestring[256];
+
+	wc_printf("<D:response>");
+		wc_printf("<D:href>");
+			dav_identify_host();
+			wc_printf("/groupdav/");
+			urlescputs(ChrPtr(WCC->CurRoom.name));
+			euid_escapize(encoded_uid, uid);
+			wc_printf("/%s", encoded_uid);
+		wc_printf("</D:href>");
+		switch(WCC->CurRoom.defview) {
+		case VIEW_CALENDAR:
+			wc_printf("<D:getcontenttype>text/x-ical</D:getcontenttype>");
+			break;
+		case VIEW_TASKS:
+			wc_printf("<D:getcontenttype>text/x-ical</D:getcontenttype>");
+			break;
+		case VIEW_ADDRESSBOOK:
+			wc_printf("<D:getcontenttype>text/x-vcard</D:getcontenttype>");
+			break;
+		}
+		wc_printf("<D:propstat>");
+			wc_printf("<D:status>HTTP/1.1 200 OK</D:status>");
+			wc_printf("<D:prop>");
+				wc_printf("<D:getetag>\"%ld\"</D:getetag>", msgnum);
+			if (modified > 0L) {
+				http_datestring(datestring, sizeof datestring, modified);
+				wc_printf("<D:getlastmodified>");
+				escputs(datestring);
+				wc_printf("</D:getlastmodified>");
+			}
+			wc_printf("</D:prop>");
+		wc_printf("</D:propstat>");
+	wc_printf("</D:response>");
+}
+
+/*
+ * load_msg_batch() callback for the collection listing
+ */
+void dav_collection_item_batch(message_summary *Msg, void *userdata)
+{
+	if (StrLength(Msg->euid) > 0) {
+		dav_collection_item(Msg->msgnum, ChrPtr(Msg->euid), Msg->date);
+	}
+}
+
+
 /*
  * The pathname is always going to be /groupdav/room_name/msg_num
  */
@@ -689,7 +743,10 @@ void dav_propfind(void)
 
 	/* If a depth greater than zero was specified, transmit the collection listing */
 
-	if (WCC->Hdr->HR.dav_depth > 0) {
+	if ((WCC->Hdr->HR.dav_depth > 0) &&
+	    (load_msg_batch("ALL", NULL, "", "", dav_collection_item_batch, NULL) < 0))
+	{
+		/* the server doesn't know MSGB; fetch the headers one by one. */
 		MsgNum = NewStrBuf();
 		serv_puts("MSGS ALL");
 	
@@ -724,38 +781,7 @@ void dav_propfind(void)
 			}
 	
 			if (!IsEmptyStr(uid)) {
-				wc_printf("<D:response>");
-					wc_printf("<D:href>");
-						dav_identify_host();
-						wc_printf("/groupdav/");
-						urlescputs(ChrPtr(WCC->CurRoom.name));
-						euid_escapize(encoded_uid, uid);
-						wc_printf("/%s", encoded_uid);
-					wc_printf("</D:href>");
-					switch(WCC->CurRoom.defview) {
-					case VIEW_CALENDAR:
-						wc_printf("<D:getcontenttype>text/x-ical</D:getcontenttype>");
-						break;
-					case VIEW_TASKS:
-						wc_printf("<D:getcontenttype>text/x-ical</D:getcontenttype>");
-						break;
-					case VIEW_ADDRESSBOOK:
-						wc_printf("<D:getcontenttype>text/x-vcard</D:getcontenttype>");
-						break;
-					}
-					wc_printf("<D:propstat>");
-						wc_printf("<D:status>HTTP/1.1 200 OK</D:status>");
-						wc_printf("<D:prop>");
-							wc_printf("<D:getetag>\"%ld\"</D:getetag>", msgs[i]);
-						if (now > 0L) {
-							http_datestring(datestring, sizeof datestring, now);
-							wc_printf("<D:getlastmodified>");
-							escputs(datestring);
-							wc_printf("</D:getlastmodified>");
-						}
-						wc_printf("</D:prop>");
-					wc_printf("</D:propstat>");
-				wc_printf("</D:response>");
+				dav_collection_item(msgs[i], uid, now);
 			}
 		}
 		FreeStrBuf(&MsgNum);
@@ -48,11 +48,570 @@ Content-length: 255
   </C:filter>
 </C:calendar-query>
 
+
+REPORT /groupdav/calendar/ HTTP/1.1
+Content-type: application/xml
+Content-length: 288
+
+<C:calendar-multiget xmlns:C="urn:ietf:params:xml:ns:caldav" xmlns:D="DAV:">
+  <D:prop>
+    <D:getetag/>
+    <C:calendar-data/>
+  </D:prop>
+  <D:href>/groupdav/calendar/20111129T231445Z-1234@example.com</D:href>
+</C:calendar-multiget>
+
 */
 
 #include "webcit.h"
 #include "webserver.h"
 #include "dav.h"
+#include "calendar.h"
+
+
+/*
+ * What we found out about a REPORT request
+ */
+typedef struct _report_query {
+	int is_calendar_query;		/* it's a CalDAV calendar-query */
+	int is_multiget;		/* it's a CalDAV calendar-multiget */
+	int comp_filter;		/* the query filters for a component inside VCALENDAR... */
+	icalcomponent_kind comp_kind;	/* ...of this kind */
+	time_t lower_bound;		/* time-range filter, if there is one */
+	time_t upper_bound;
+
+	int prop_depth;			/* nesting level inside <D:prop> */
+	int want_props;			/* did the client ask for any properties at all? */
+	int want_etag;
+	int want_lastmodified;
+	int want_contenttype;
+	int want_caldata;
+	StrBuf *UnknownProps;		/* properties we don't have; they get a 404 propstat */
+
+	int in_href;			/* collecting the text of a multiget <D:href> */
+	StrBuf *Href;
+	StrBuf *Hrefs;			/* all of the multiget hrefs, one per line */
+} report_query;
+
+/* how many recurrences of an item we look at, looking for one in the time-range */
+#define REPORT_MAX_RECUR	1000
+
+
+/*
+ * Convert a CalDAV date-time ("20111129T231445Z") to a time_t
+ */
+time_t report_timet(const char *str, time_t deflt)
+{
+	struct icaltimetype t;
+
+	if ((str == NULL) || IsEmptyStr(str)) {
+		return deflt;
+	}
+	t = icaltime_from_string(str);
+	if (icaltime_is_null_time(t)) {
+		return deflt;
+	}
+	return icaltime_as_timet(t);
+}
+
+
+/*
+ * Remember one of the properties listed in <D:prop>.  Expat hands us "namespace|name".
+ */
+void report_want_prop(report_query *Query, const char *el)
+{
+	const char *name;
+	char ns[256];
+
+	Query->want_props = 1;
+	if (!strcasecmp(el, "DAV:|getetag")) {
+		Query->want_etag = 1;
+	}
+	else if (!strcasecmp(el, "DAV:|getlastmodified")) {
+		Query->want_lastmodified = 1;
+	}
+	else if (!strcasecmp(el, "DAV:|getcontenttype")) {
+		Query->want_contenttype = 1;
+	}
+	else if (!strcasecmp(el, "urn:ietf:params:xml:ns:caldav|calendar-data")) {
+		Query->want_caldata = 1;
+	}
+	else {
+		name = strrchr(el, '|');
+		StrBufAppendBufPlain(Query->UnknownProps, HKEY("<X:"), 0);
+		StrEscAppend(Query->UnknownProps, NULL, (name != NULL) ? name + 1 : el, 0, 0);
+		if (name != NULL) {
+			safestrncpy(ns, el, sizeof ns);
+			if ((name - el) < sizeof ns) {
+				ns[name - el] = 0;
+			}
+			StrBufAppendBufPlain(Query->UnknownProps, HKEY(" xmlns:X=\""), 0);
+			StrEscAppend(Query->UnknownProps, NULL, ns, 0, 0);
+			StrBufAppendBufPlain(Query->UnknownProps, HKEY("\""), 0);
+		}
+		StrBufAppendBufPlain(Query->UnknownProps, HKEY("/>"), 0);
+	}
+}
+
+
+void report_xml_start(void *data, const char *supplied_el, const char **attr) {
+	report_query *Query = (report_query *) data;
+	int i;
+
+	/* Everything directly inside <D:prop> is a property the client wants. */
+	if (Query->prop_depth > 0) {
+		if (Query->prop_depth == 1) {
+			report_want_prop(Query, supplied_el);
+		}
+		Query->prop_depth++;
+	}
+	else if (!strcasecmp(supplied_el, "DAV:|prop")) {
+		Query->prop_depth = 1;
+	}
+	else if (!strcasecmp(supplied_el, "DAV:|allprop")) {
+		Query->want_props = 1;
+		Query->want_etag = 1;
+		Query->want_lastmodified = 1;
+		Query->want_contenttype = 1;
+	}
+	else if (!strcasecmp(supplied_el, "DAV:|href")) {
+		Query->in_href = 1;
+		FlushStrBuf(Query->Href);
+	}
+	else if (!strcasecmp(supplied_el, "urn:ietf:params:xml:ns:caldav|calendar-query")) {
+		Query->is_calendar_query = 1;
+	}
+	else if (!strcasecmp(supplied_el, "urn:ietf:params:xml:ns:caldav|calendar-multiget")) {
+		Query->is_multiget = 1;
+	}
+	else if (!strcasecmp(supplied_el, "urn:ietf:params:xml:ns:caldav|comp-filter")) {
+		for (i = 0; attr[i] != NULL; i += 2) {
+			if (!strcasecmp(attr[i], "name") && strcasecmp(attr[i+1], "VCALENDAR")) {
+				Query->comp_filter = 1;
+				Query->comp_kind = icalcomponent_string_to_kind(attr[i+1]);
+			}
+		}
+	}
+	else if (!strcasecmp(supplied_el, "urn:ietf:params:xml:ns:caldav|time-range")) {
+		for (i = 0; attr[i] != NULL; i += 2) {
+			if (!strcasecmp(attr[i], "start")) {
+				Query->lower_bound = report_timet(attr[i+1], 0);
+			}
+			else if (!strcasecmp(attr[i], "end")) {
+				Query->upper_bound = report_timet(attr[i+1], 0);
+			}
+		}
+	}
+}
+
+void report_xml_end(void *data, const char *supplied_el) {
+	report_query *Query = (report_query *) data;
+
+	if (Query->prop_depth > 0) {
+		Query->prop_depth--;
+	}
+	else if ((Query->in_href) && (!strcasecmp(supplied_el, "DAV:|href"))) {
+		Query->in_href = 0;
+		StrBufTrim(Query->Href);
+		if (StrLength(Query->Href) > 0) {
+			StrBufAppendBuf(Query->Hrefs, Query->Href, 0);
+			StrBufAppendBufPlain(Query->Hrefs, HKEY("\n"), 0);
+		}
+	}
+}
+
+void report_xml_data(void *data, const XML_Char *s, int len) {
+	report_query *Query = (report_query *) data;
+
+	if (Query->in_href) {
+		StrBufAppendBufPlain(Query->Href, s, len, 0);
+	}
+}
+
+
+/*
+ * Does one occurrence, from start to end, touch the time-range of the query?
+ * An occurrence without a duration is a point in time.  (RFC 4791 9.9)
+ */
+int report_in_range(report_query *Query, time_t start, time_t end)
+{
+	if ((Query->upper_bound > 0) && (start >= Query->upper_bound)) {
+		return 0;
+	}
+	if (Query->lower_bound > 0) {
+		if (end > start) {
+			return (end > Query->lower_bound);
+		}
+		return (start >= Query->lower_bound);
+	}
+	return 1;
+}
+
+
+/*
+ * Does this component, or any of its recurrences, touch the time-range of the query?
+ */
+int report_comp_in_range(report_query *Query, icalcomponent *comp)
+{
+	icalproperty *p;
+	icalrecur_iterator *ritr;
+	struct icalrecurrencetype recur;
+	struct icaltimetype dtstart = icaltime_null_time();
+	struct icaltimetype next;
+	time_t start;
+	time_t dur = 0;
+	int num_recur = 0;
+	int match;
+
+	if ((Query->lower_bound <= 0) && (Query->upper_bound <= 0)) {
+		return 1;
+	}
+
+	if ((p = icalcomponent_get_first_property(comp, ICAL_DTSTART_PROPERTY)) != NULL) {
+		dtstart = icalproperty_get_dtstart(p);
+	}
+	else if ((p = icalcomponent_get_first_property(comp, ICAL_DUE_PROPERTY)) != NULL) {
+		dtstart = icalproperty_get_due(p);
+	}
+	if (icaltime_is_null_time(dtstart)) {
+		/* a task with neither start nor due date is in any range; anything else in none */
+		return (icalcomponent_isa(comp) == ICAL_VTODO_COMPONENT);
+	}
+	start = icaltime_as_timet(dtstart);
+
+	if ((p = icalcomponent_get_first_property(comp, ICAL_DTEND_PROPERTY)) != NULL) {
+		dur = icaltime_as_timet(icalproperty_get_dtend(p)) - start;
+	}
+	else if ((p = icalcomponent_get_first_property(comp, ICAL_DUE_PROPERTY)) != NULL) {
+		dur = icaltime_as_timet(icalproperty_get_due(p)) - start;
+	}
+	else if ((p = icalcomponent_get_first_property(comp, ICAL_DURATION_PROPERTY)) != NULL) {
+		dur = icaldurationtype_as_int(icalproperty_get_duration(p));
+	}
+	else if (dtstart.is_date) {
+		dur = 86400;			/* an all day event lasts all day */
+	}
+
+	match = report_in_range(Query, start, start + dur);
+	p = icalcomponent_get_first_property(comp, ICAL_RRULE_PROPERTY);
+	if ((match) || (p == NULL)) {
+		return match;
+	}
+
+	/* Let libical iterate the recurrence, until one fits or we're past the end of the range. */
+	recur = icalproperty_get_rrule(p);
+	ritr = icalrecur_iterator_new(recur, dtstart);
+	if (ritr == NULL) {
+		return 0;
+	}
+	while ((!match) && (num_recur++ < REPORT_MAX_RECUR) &&
+	       (next = icalrecur_iterator_next(ritr), !icaltime_is_null_time(next)))
+	{
+		start = icaltime_as_timet(next);
+		if ((Query->upper_bound > 0) && (start >= Query->upper_bound)) {
+			break;
+		}
+		match = report_in_range(Query, start, start + dur);
+	}
+	icalrecur_iterator_free(ritr);
+	return match;
+}
+
+
+/*
+ * Does a candidate match the filter of a calendar-query?  The server's calendar
+ * index only narrows things down (it's deliberately generous), so each item has
+ * to have a component of the kind asked for, which touches the time-range.
+ */
+int report_matches(report_query *Query, StrBuf *ical)
+{
+	icalcomponent *cal;
+	icalcomponent *c;
+	int match = 0;
+
+	if ((!Query->is_calendar_query) || (!Query->comp_filter)) {
+		return 1;
+	}
+	if ((StrLength(ical) == 0) || (Query->comp_kind == ICAL_NO_COMPONENT)) {
+		return 0;
+	}
+	cal = icalcomponent_new_from_string(ChrPtr(ical));
+	if (cal == NULL) {
+		return 0;
+	}
+	ical_dezonify(cal);
+
+	if (icalcomponent_isa(cal) == Query->comp_kind) {
+		match = report_comp_in_range(Query, cal);
+	}
+	for (c = icalcomponent_get_first_component(cal, Query->comp_kind);
+	     (c != NULL) && (!match);
+	     c = icalcomponent_get_next_component(cal, Query->comp_kind))
+	{
+		match = report_comp_in_range(Query, c);
+	}
+
+	icalcomponent_free(cal);
+	return match;
+}
+
+
+/*
+ * Output the response for one calendar item, with the properties the client asked for.
+ * If it didn't name any, it gets the ETag.
+ */
+void report_item(report_query *Query, long msgnum, const char *uid, time_t modified, StrBuf *ical)
+{
+	wcsession *WCC = WC;
+	char encoded_uid[256];
+	char datestring[256];
+	int no_lastmodified = 0;
+	int no_caldata = 0;
+
+	wc_printf("<D:response>");
+		wc_printf("<D:href>");
+			dav_identify_host();
+			wc_printf("/groupdav/");
+			urlescputs(ChrPtr(WCC->CurRoom.name));
+			euid_escapize(encoded_uid, uid);
+			wc_printf("/%s", encoded_uid);
+		wc_printf("</D:href>");
+		wc_printf("<D:propstat>");
+			wc_printf("<D:status>HTTP/1.1 200 OK</D:status>");
+			wc_printf("<D:prop>");
+			if ((Query->want_etag) || (!Query->want_props)) {
+				wc_printf("<D:getetag>\"%ld\"</D:getetag>", msgnum);
+			}
+			if (Query->want_lastmodified) {
+				if (modified > 0L) {
+					http_datestring(datestring, sizeof datestring, modified);
+					wc_printf("<D:getlastmodified>");
+					escputs(datestring);
+					wc_printf("</D:getlastmodified>");
+				}
+				else {
+					no_lastmodified = 1;
+				}
+			}
+			if (Query->want_contenttype) {
+				wc_printf("<D:getcontenttype>text/calendar</D:getcontenttype>");
+			}
+			if (Query->want_caldata) {
+				if (StrLength(ical) > 0) {
+					wc_printf("<C:calendar-data>");
+					StrEscAppend(WCC->WBuf, ical, NULL, 0, 0);
+					wc_printf("</C:calendar-data>");
+				}
+				else {
+					no_caldata = 1;
+				}
+			}
+			wc_printf("</D:prop>");
+		wc_printf("</D:propstat>");
+
+		if ((no_lastmodified) || (no_caldata) || (StrLength(Query->UnknownProps) > 0)) {
+			wc_printf("<D:propstat>");
+				wc_printf("<D:status>HTTP/1.1 404 Not Found</D:status>");
+				wc_printf("<D:prop>");
+				if (no_lastmodified) {
+					wc_printf("<D:getlastmodified/>");
+				}
+				if (no_caldata) {
+					wc_printf("<C:calendar-data/>");
+				}
+				StrBufAppendBuf(WCC->WBuf, Query->UnknownProps, 0);
+				wc_printf("</D:prop>");
+			wc_printf("</D:propstat>");
+		}
+	wc_printf("</D:response>");
+}
+
+
+/*
+ * load_msg_batch() callback for REPORT
+ */
+void report_item_batch(message_summary *Msg, void *userdata)
+{
+	report_query *Query = (report_query *) userdata;
+
+	StrBuf *ical = (Msg->MsgBody != NULL) ? Msg->MsgBody->Data : NULL;
+
+	if ((StrLength(Msg->euid) > 0) && (report_matches(Query, ical))) {
+		report_item(Query, Msg->msgnum, ChrPtr(Msg->euid), Msg->date, ical);
+	}
+}
+
+
+/*
+ * mime_parser() callback: keep the first calendar part we see
+ */
+void report_extract_ical(char *name, char *filename, char *partnum, char *disp,
+			 void *content, char *cbtype, char *cbcharset,
+			 size_t length, char *encoding, char *cbid, void *userdata)
+{
+	StrBuf *ical = (StrBuf *) userdata;
+
+	if (StrLength(ical) > 0) return;
+	if ((!strcasecmp(cbtype, "text/calendar")) || (!strcasecmp(cbtype, "application/ics"))) {
+		StrBufAppendBufPlain(ical, content, length, 0);
+	}
+}
+
+
+/*
+ * Output one item the slow way, for servers which don't know MSGB:
+ * MSG0 for the EUID and timestamp, and MSG2 for the calendar data if it was asked
+ * for or we need it to check the filter.
+ */
+void report_item_fetch(report_query *Query, long msgnum, StrBuf *Buf)
+{
+	StrBuf *Msg;
+	StrBuf *ical = NULL;
+	char uid[256];
+	time_t modified = (-1);
+	long BufLen;
+
+	strcpy(uid, "");
+	serv_printf("MSG0 %ld|3", msgnum);
+	StrBuf_ServGetln(Buf);
+	if (GetServerStatus(Buf, NULL) == 1)
+		while (BufLen = StrBuf_ServGetln(Buf), 
+		       ((BufLen >= 0) && 
+			((BufLen != 3) || strcmp(ChrPtr(Buf), "000")) ))
+		{
+			if (!strncasecmp(ChrPtr(Buf), "exti=", 5)) {
+				safestrncpy(uid, &ChrPtr(Buf)[5], sizeof uid);
+			}
+			else if (!strncasecmp(ChrPtr(Buf), "time=", 5)) {
+				modified = atol(&ChrPtr(Buf)[5]);
+			}
+		}
+	if (IsEmptyStr(uid)) {
+		return;
+	}
+
+	if ((Query->want_caldata) || (Query->comp_filter)) {
+		ical = NewStrBuf();
+		serv_printf("MSG2 %ld", msgnum);
+		StrBuf_ServGetln(Buf);
+		if (GetServerStatus(Buf, NULL) == 1) {
+			Msg = NewStrBuf();
+			while (BufLen = StrBuf_ServGetln(Buf), 
+			       ((BufLen >= 0) && 
+				((BufLen != 3) || strcmp(ChrPtr(Buf), "000")) ))
+			{
+				StrBufAppendBuf(Msg, Buf, 0);
+				StrBufAppendBufPlain(Msg, HKEY("\n"), 0);
+			}
+			mime_parser((char *)ChrPtr(Msg), (char *)ChrPtr(Msg) + StrLength(Msg),
+				    report_extract_ical, NULL, NULL, (void *)ical, 0);
+			FreeStrBuf(&Msg);
+		}
+	}
+
+	if (report_matches(Query, ical)) {
+		report_item(Query, msgnum, uid, modified, ical);
+	}
+	FreeStrBuf(&ical);
+}
+
+
+/*
+ * Same as load_msg_batch() with no content types, one message at a time.
+ * MsgList is NULL for all of the messages in the room.
+ */
+void report_items_fetch(report_query *Query, StrBuf *MsgList)
+{
+	StrBuf *Buf;
+	long *msgs = NULL;
+	int num_msgs = 0;
+	const char *pos = NULL;
+	long BufLen;
+	long msgnum;
+	int i;
+
+	Buf = NewStrBuf();
+	if (MsgList != NULL) {
+		while (StrBufExtract_NextToken(Buf, MsgList, &pos, '\n') >= 0) {
+			msgnum = StrTol(Buf);
+			if (msgnum > 0) {
+				msgs = realloc(msgs, ++num_msgs * sizeof(long));
+				msgs[num_msgs-1] = msgnum;
+			}
+		}
+	}
+	else {
+		serv_puts("MSGS ALL");
+		StrBuf_ServGetln(Buf);
+		if (GetServerStatus(Buf, NULL) == 1)
+			while (BufLen = StrBuf_ServGetln(Buf), 
+			       ((BufLen >= 0) && 
+				((BufLen != 3) || strcmp(ChrPtr(Buf), "000"))  ))
+			{
+				msgs = realloc(msgs, ++num_msgs * sizeof(long));
+				msgs[num_msgs-1] = StrTol(Buf);
+			}
+	}
+
+	for (i=0; i<num_msgs; ++i) {
+		report_item_fetch(Query, msgs[i], Buf);
+	}
+
+	FreeStrBuf(&Buf);
+	if (msgs != NULL) {
+		free(msgs);
+	}
+}
+
+
+/*
+ * Look up the hrefs of a calendar-multiget.  The ones we have go into the
+ * returned message list; the ones we don't get their 404 right away.
+ */
+StrBuf *report_multiget_list(report_query *Query)
+{
+	StrBuf *MsgList;
+	StrBuf *Href;
+	StrBuf *Path;
+	StrBuf *Uid;
+	const char *pos = NULL;
+	long msgnum;
+
+	MsgList = NewStrBuf();
+	Href = NewStrBuf();
+	Path = NewStrBuf();
+	Uid = NewStrBuf();
+	while (StrBufExtract_NextToken(Href, Query->Hrefs, &pos, '\n') >= 0) {
+		if (StrLength(Href) == 0) {
+			continue;
+		}
+
+		/* the object is the last part of the path; the 404 echoes the href as the client sent it */
+		FlushStrBuf(Path);
+		StrBufAppendBuf(Path, Href, 0);
+		StrBufStripSlashes(Path, 1);
+		StrBufExtract_token(Uid, Path, StrBufNum_tokens(Path, '/') - 1, '/');
+		StrBufUnescape(Uid, 0);
+
+		msgnum = (StrLength(Uid) > 0) ? locate_message_by_uid(ChrPtr(Uid)) : (-1L);
+		if (msgnum > 0L) {
+			StrBufAppendPrintf(MsgList, "%ld\n", msgnum);
+		}
+		else {
+			wc_printf("<D:response>");
+				wc_printf("<D:href>");
+				StrEscAppend(WC->WBuf, Href, NULL, 0, 0);
+				wc_printf("</D:href>");
+				wc_printf("<D:status>HTTP/1.1 404 Not Found</D:status>");
+			wc_printf("</D:response>");
+		}
+	}
+	StrBufAppendBufPlain(MsgList, HKEY("000\n"), 0);
+	FreeStrBuf(&Uid);
+	FreeStrBuf(&Path);
+	FreeStrBuf(&Href);
+	return MsgList;
+}
 
 
 /*
@@ -60,23 +619,125 @@ Content-length: 255
  */
 void dav_report(void) 
 {
+	wcsession *WCC = WC;
+	report_query Query;
+	StrBuf *dav_roomname;
+	StrBuf *MsgList = NULL;
+	const char *ContentTypes;
 	char datestring[256];
 	time_t now = time(NULL);
+	int parse_success = 0;
+	int i;
 
 	http_datestring(datestring, sizeof datestring, now);
-	const char *req = ChrPtr(WC->upload);
+	const char *req = ChrPtr(WCC->upload);
 
 	syslog(LOG_DEBUG, "REPORT: \033[31m%s\033[0m", req);
 
-	hprintf("HTTP/1.1 500 Internal Server Error\r\n");
+	memset(&Query, 0, sizeof(report_query));
+	Query.UnknownProps = NewStrBuf();
+	Query.Href = NewStrBuf();
+	Query.Hrefs = NewStrBuf();
+	XML_Parser xp = XML_ParserCreateNS(NULL, '|');
+	if (xp) {
+		XML_SetUserData(xp, &Query);
+		XML_SetElementHandler(xp, report_xml_start, report_xml_end);
+		XML_SetCharacterDataHandler(xp, report_xml_data);
+
+		if (req) {
+			req = strchr(req, '<');			/* hunt for the first tag */
+		}
+		if (!req) {
+			req = "ERROR";				/* force it to barf */
+		}
+
+		i = XML_Parse(xp, req, strlen(req), 1);
+		if (!i) {
+			syslog(LOG_DEBUG, "XML_Parse() failed: %s", XML_ErrorString(XML_GetErrorCode(xp)));
+		}
+		else {
+			parse_success = 1;
+		}
+		XML_ParserFree(xp);
+	}
+
+	/* calendar-query and calendar-multiget are the only kinds of report we know how to answer */
+	if ((!parse_success) || ((!Query.is_calendar_query) && (!Query.is_multiget))) {
+		hprintf("HTTP/1.1 500 Internal Server Error\r\n");
+		dav_common_headers();
+		hprintf("Date: %s\r\n", datestring);
+		hprintf("Content-Type: text/plain\r\n");
+		wc_printf("An internal error has occurred at %s:%d.\r\n", __FILE__ , __LINE__ );
+		end_burst();
+		goto done;
+	}
+
+	/* Go to the correct room. */
+	dav_roomname = NewStrBuf();
+	StrBufExtract_token(dav_roomname, WCC->Hdr->HR.ReqLine, 0, '/');
+	if (strcasecmp(ChrPtr(WCC->CurRoom.name), ChrPtr(dav_roomname))) {
+		gotoroom(dav_roomname);
+	}
+	if (strcasecmp(ChrPtr(WCC->CurRoom.name), ChrPtr(dav_roomname))) {
+		hprintf("HTTP/1.1 404 not found\r\n");
+		dav_common_headers();
+		hprintf("Date: %s\r\n", datestring);
+		hprintf("Content-Type: text/plain\r\n");
+		wc_printf("There is no folder called \"%s\" on this server.\r\n", ChrPtr(dav_roomname));
+		end_burst();
+		FreeStrBuf(&dav_roomname);
+		goto done;
+	}
+	FreeStrBuf(&dav_roomname);
+
+	/* If there is a time range on events, let the server's calendar index pick the candidates. */
+	if ((Query.is_calendar_query) && (Query.comp_kind == ICAL_VEVENT_COMPONENT) &&
+	    ((Query.lower_bound > 0) || (Query.upper_bound > 0)))
+	{
+		MsgList = load_ical_range(Query.lower_bound, Query.upper_bound, 0);
+	}
+
+	hprintf("HTTP/1.0 207 Multi-Status\r\n");
 	dav_common_headers();
 	hprintf("Date: %s\r\n", datestring);
-	hprintf("Content-Type: text/plain\r\n");
-	wc_printf("An internal error has occurred at %s:%d.\r\n", __FILE__ , __LINE__ );
+	hprintf("Content-type: text/xml\r\n");
+	if (DisableGzip || (!WCC->Hdr->HR.gzip_ok)) {
+		hprintf("Content-encoding: identity\r\n");
+	}
+	begin_burst();
+
+	wc_printf("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+     		"<D:multistatus "
+			"xmlns:D=\"DAV:\" "
+			"xmlns:C=\"urn:ietf:params:xml:ns:caldav\""
+		">"
+	);
+
+	if (Query.is_multiget) {
+		MsgList = report_multiget_list(&Query);
+	}
+
+	/* Only ask the server for message bodies if the client wants to see them, or we need them to filter. */
+	ContentTypes = ((Query.want_caldata) || (Query.comp_filter)) ? "text/calendar,application/ics" : "";
+	if ((MsgList != NULL) && (!strcmp(ChrPtr(MsgList), "000\n"))) {
+		/* nothing matched, nothing to ask for */
+	}
+	else if (load_msg_batch((MsgList != NULL) ? "SET" : "ALL", MsgList,
+				ContentTypes, "", report_item_batch, &Query) < 0)
+	{
+		/* the server doesn't know MSGB; fetch the items one by one. */
+		report_items_fetch(&Query, MsgList);
+	}
+	FreeStrBuf(&MsgList);
+
+	wc_printf("</D:multistatus>\n");
 	end_burst();
-	return;
-}
 
+done:
+	FreeStrBuf(&Query.UnknownProps);
+	FreeStrBuf(&Query.Href);
+	FreeStrBuf(&Query.Hrefs);
+}
 
 
 extern int ParseMessageListHeaders_EUID(StrBuf *Line, 
@@ -95,7 +95,7 @@ void utf8ify_rfc822_string(char **buf) {
 		get_preference("default_header_charset", &default_header_charset);
 		if ( (strcasecmp(ChrPtr(default_header_charset), "UTF-8")) && 
 		     (strcasecmp(ChrPtr(default_header_charset), "us-ascii")) ) {
-			ctdl_iconv_open("UTF-8", ChrPtr(default_header_charset), &ic);
+			ctdl_iconv_acquire("UTF-8", ChrPtr(default_header_charset), &ic);
 			if (ic != (iconv_t)(-1) ) {
 				ibuf = malloc(1024);
 				isav = ibuf;
@@ -108,7 +108,7 @@ void utf8ify_rfc822_string(char **buf) {
 				osav[1023-obuflen] = 0;
 				free(*buf);
 				*buf = osav;
-				iconv_close(ic);
+				ctdl_iconv_release(&ic);
 				free(isav);
 			}
 		}
@@ -196,7 +196,7 @@ void utf8ify_rfc822_string(char **buf) {
 			ibuflen = strlen(istr);
 		}
 
-		ctdl_iconv_open("UTF-8", charset, &ic);
+		ctdl_iconv_acquire("UTF-8", charset, &ic);
 		if (ic != (iconv_t)(-1) ) {
 			obuflen = 1024;
 			obuf = (char *) malloc(obuflen);
@@ -217,7 +217,7 @@ void utf8ify_rfc822_string(char **buf) {
 			strcpy(*buf, newbuf);
 			
 			free(osav);
-			iconv_close(ic);
+			ctdl_iconv_release(&ic);
 		}
 		else {
 			end = start;
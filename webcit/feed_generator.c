@@ -197,7 +197,6 @@ void feed_rss(void) {
 	hprintf("Content-type: text/xml; charset=utf-8\r\n");
 	hprintf(
 		"Server: %s / %s\r\n"
-		"Connection: close\r\n"
 	,
 		PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software)
 	);
@@ -297,7 +297,7 @@ void output_html(const char *supplied_charset, int treat_as_wiki, int msgnum, St
 			&& (strcasecmp(charset, ""))
 	   ) {
 		syslog(LOG_DEBUG, "Converting %s to UTF-8\n", charset);
-		ctdl_iconv_open("UTF-8", charset, &ic);
+		ctdl_iconv_acquire("UTF-8", charset, &ic);
 		if (ic == (iconv_t)(-1) ) {
 			syslog(LOG_WARNING, "%s:%d iconv_open() failed: %s\n",
 					__FILE__, __LINE__, strerror(errno));
@@ -315,7 +315,7 @@ void output_html(const char *supplied_charset, int treat_as_wiki, int msgnum, St
 			osav[content_length] = 0;
 			free(msg);
 			msg = osav;
-			iconv_close(ic);
+			ctdl_iconv_release(&ic);
 		}
 	}
 	else {
@@ -323,7 +323,7 @@ void output_html(const char *supplied_charset, int treat_as_wiki, int msgnum, St
 			StrBuf *Buf = NewStrBufPlain(NULL, StrLength(Source) + 8096);;
 			StrBufConvert(Source, Buf, &ic);
 			FreeStrBuf(&Buf);
-			iconv_close(ic);
+			ctdl_iconv_release(&ic);
 			msg = (char*)ChrPtr(Source); /* TODO: get rid of this. */
 		}
 	}
@@ -0,0 +1,489 @@
+/*
+ * Event driven HTTP front end.
+ *
+ * One thread accepts the connections and watches them with epoll while
+ * they're idle; a plain HTTP connection is handed to the worker threads
+ * once its request headers are complete, a TLS connection once there's
+ * something to read. After the response, kept alive connections come back
+ * here instead of blocking their worker until the client sends more.
+ *
+ * Copyright (c) 1996-2015 by the citadel.org team
+ *
+ * This program is open source software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "webcit.h"
+#include "webserver.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+
+#define POLLER_MAX_EVENTS	64		/* events we take from epoll at once */
+#define POLLER_MAX_HEADERS	(SIZ * 16)	/* hand it on unfinished; it's broken anyways */
+
+struct _HttpConn {
+	HttpConn *next;				/* parked list or ready queue */
+	HttpConn *prev;
+	int sock;
+	int nRequests;				/* requests served on this connection so far */
+	int peer_closed;			/* we read EOF after a complete request */
+	time_t Since;				/* when did it start waiting? */
+	StrBuf *ReadBuf;			/* what we read ahead; unread bytes start at the front */
+#ifdef HAVE_OPENSSL
+	SSL *ssl;				/* the TLS session while no thread owns it */
+#endif
+};
+
+static int PollFD = -1;
+static int ListenSock = -1;
+static pthread_mutex_t PollerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PollerReady = PTHREAD_COND_INITIALIZER;
+static HttpConn *Parked = NULL;			/* waiting for the client, in epoll */
+static HttpConn *ReadyHead = NULL;		/* waiting for a worker */
+static HttpConn *ReadyTail = NULL;
+
+
+static HttpConn *NewHttpConn(int sock)
+{
+	HttpConn *Conn;
+
+	Conn = (HttpConn*) malloc(sizeof(HttpConn));
+	memset(Conn, 0, sizeof(HttpConn));
+	Conn->sock = sock;
+	Conn->Since = time(NULL);
+	Conn->ReadBuf = NewStrBufPlain(NULL, SIZ * 4);
+	return Conn;
+}
+
+/*
+ * Close a connection no thread is working on.
+ */
+static void CloseHttpConn(HttpConn **pConn)
+{
+	HttpConn *Conn = *pConn;
+
+#ifdef HAVE_OPENSSL
+	if (Conn->ssl != NULL) {
+		pthread_setspecific(ThreadSSL, Conn->ssl);
+		endtls();
+	}
+#endif
+	if (Conn->sock != -1)
+		close(Conn->sock);
+	FreeStrBuf(&Conn->ReadBuf);
+	free(Conn);
+	*pConn = NULL;
+}
+
+/* call these with PollerMutex held. */
+static void ParkConn(HttpConn *Conn)
+{
+	Conn->prev = NULL;
+	Conn->next = Parked;
+	if (Parked != NULL)
+		Parked->prev = Conn;
+	Parked = Conn;
+}
+
+static void UnparkConn(HttpConn *Conn)
+{
+	if (Conn->prev != NULL)
+		Conn->prev->next = Conn->next;
+	else
+		Parked = Conn->next;
+	if (Conn->next != NULL)
+		Conn->next->prev = Conn->prev;
+	Conn->next = Conn->prev = NULL;
+}
+
+static void QueueConn(HttpConn *Conn)
+{
+	Conn->next = NULL;
+	Conn->prev = NULL;
+	if (ReadyTail != NULL)
+		ReadyTail->next = Conn;
+	else
+		ReadyHead = Conn;
+	ReadyTail = Conn;
+	pthread_cond_signal(&PollerReady);
+}
+
+
+/*
+ * Do we have a complete header block? That's all a worker needs to get going.
+ */
+static int RequestComplete(const StrBuf *Buf)
+{
+	const char *pch = ChrPtr(Buf);
+	long len = StrLength(Buf);
+
+	return (len >= POLLER_MAX_HEADERS) ||
+		(memmem(pch, len, "\n\r\n", 3) != NULL) ||
+		(memmem(pch, len, "\n\n", 2) != NULL);
+}
+
+/*
+ * Let epoll tell us once the client has got something for us.
+ * (under the lock, so ExpireConns() can't see it half way)
+ */
+static void ArmConn(HttpConn *Conn, int op)
+{
+	struct epoll_event ev;
+	int rc;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.ptr = Conn;
+
+	pthread_mutex_lock(&PollerMutex);
+	ParkConn(Conn);
+	rc = epoll_ctl(PollFD, op, Conn->sock, &ev);
+	if (rc != 0)
+		UnparkConn(Conn);
+	pthread_mutex_unlock(&PollerMutex);
+
+	if (rc != 0) {
+		syslog(LOG_WARNING, "epoll_ctl: %s", strerror(errno));
+		CloseHttpConn(&Conn);
+	}
+}
+
+static void AcceptConns(void)
+{
+	HttpConn *Conn;
+	int ssock;
+	int fdflags;
+
+	while ((ssock = accept(ListenSock, NULL, 0)) >= 0) {
+		/* we read plain requests ahead; TLS sockets stay blocking for the worker's handshake */
+		if (!is_https) {
+			fdflags = fcntl(ssock, F_GETFL);
+			if ((fdflags < 0) || (fcntl(ssock, F_SETFL, fdflags | O_NONBLOCK) < 0))
+				syslog(LOG_WARNING, "unable to set server socket nonblocking flags! %s \n",
+				       strerror(errno));
+		}
+		Conn = NewHttpConn(ssock);
+		ArmConn(Conn, EPOLL_CTL_ADD);
+	}
+	if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		syslog(LOG_WARNING, "accept: %s", strerror(errno));
+}
+
+/*
+ * The client sent something. Read what's there; if that makes a request, off to a worker.
+ */
+static void ConnReadable(HttpConn *Conn)
+{
+	char buf[SIZ * 4];
+	ssize_t rlen = 0;
+
+	pthread_mutex_lock(&PollerMutex);
+	UnparkConn(Conn);
+	pthread_mutex_unlock(&PollerMutex);
+
+#ifdef HAVE_OPENSSL
+	if (is_https) {
+		pthread_mutex_lock(&PollerMutex);
+		QueueConn(Conn);
+		pthread_mutex_unlock(&PollerMutex);
+		return;
+	}
+#endif
+
+	while ((StrLength(Conn->ReadBuf) < POLLER_MAX_HEADERS) &&
+	       ((rlen = read(Conn->sock, buf, sizeof(buf))) > 0))
+	{
+		StrBufAppendBufPlain(Conn->ReadBuf, buf, rlen, 0);
+	}
+
+	if ((rlen < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+	{
+		CloseHttpConn(&Conn);
+		return;
+	}
+	if (rlen == 0) {
+		/*
+		 * The client shut down its sending side.  If it managed to send a
+		 * whole request before, it still wants an answer (HTTP/1.0 tools
+		 * do that); otherwise whatever it sent is incomplete.
+		 */
+		if ((StrLength(Conn->ReadBuf) == 0) || !RequestComplete(Conn->ReadBuf)) {
+			CloseHttpConn(&Conn);
+			return;
+		}
+		Conn->peer_closed = 1;
+	}
+
+	if (RequestComplete(Conn->ReadBuf)) {
+		pthread_mutex_lock(&PollerMutex);
+		QueueConn(Conn);
+		pthread_mutex_unlock(&PollerMutex);
+	}
+	else {
+		ArmConn(Conn, EPOLL_CTL_MOD);
+	}
+}
+
+/*
+ * Hang up on clients that didn't come up with a request in time.
+ */
+static void ExpireConns(time_t now)
+{
+	HttpConn *Conn, *Next, *Expired = NULL;
+
+	pthread_mutex_lock(&PollerMutex);
+	for (Conn = Parked; Conn != NULL; Conn = Next) {
+		Next = Conn->next;
+		if (now - Conn->Since >= KEEPALIVE_TIMEOUT) {
+			UnparkConn(Conn);
+			Conn->next = Expired;
+			Expired = Conn;
+		}
+	}
+	pthread_mutex_unlock(&PollerMutex);
+
+	while (Expired != NULL) {
+		Conn = Expired;
+		Expired = Conn->next;
+		epoll_ctl(PollFD, EPOLL_CTL_DEL, Conn->sock, NULL);
+		CloseHttpConn(&Conn);
+	}
+}
+
+static void http_poller_loop(void)
+{
+	struct epoll_event ev[POLLER_MAX_EVENTS];
+	HttpConn *Conn;
+	time_t now, last = 0;
+	int i, n;
+
+	while (!time_to_die) {
+		n = epoll_wait(PollFD, ev, POLLER_MAX_EVENTS, 1000);
+		if ((n < 0) && (errno != EINTR)) {
+			/*
+			 * Apart from EINTR, epoll_wait() only fails if PollFD
+			 * or ev are broken, so it would fail forever; without
+			 * us nobody accepts or reads anything.  Exit with an
+			 * error, so the watcher process starts a fresh webcit.
+			 */
+			syslog(LOG_CRIT, "HTTP poller: epoll_wait: %s; restarting", strerror(errno));
+			exit(1);
+		}
+		for (i = 0; (i < n) && !time_to_die; i++) {
+			if (ev[i].data.ptr == NULL)
+				AcceptConns();
+			else
+				ConnReadable((HttpConn*) ev[i].data.ptr);
+		}
+
+		now = time(NULL);
+		if (now != last) {
+			ExpireConns(now);
+			last = now;
+		}
+	}
+
+	/* we're going down; tell the workers, and hang up on the rest. */
+	pthread_mutex_lock(&PollerMutex);
+	while (Parked != NULL) {
+		Conn = Parked;
+		UnparkConn(Conn);
+		CloseHttpConn(&Conn);
+	}
+	while (ReadyHead != NULL) {
+		Conn = ReadyHead;
+		ReadyHead = Conn->next;
+		CloseHttpConn(&Conn);
+	}
+	ReadyTail = NULL;
+	pthread_cond_broadcast(&PollerReady);
+	pthread_mutex_unlock(&PollerMutex);
+	syslog(LOG_DEBUG, "HTTP poller exiting.\n");
+}
+
+
+/*
+ * Start the thread which accepts the connections on msock and watches the idle ones.
+ */
+int http_poller_start(int msock)
+{
+	struct epoll_event ev;
+	pthread_attr_t attr;
+	pthread_t PollThread;
+	int fdflags;
+
+	PollFD = epoll_create(1024);
+	if (PollFD < 0) {
+		syslog(LOG_EMERG, "epoll_create: %s", strerror(errno));
+		return -1;
+	}
+	ListenSock = msock;
+
+	/* accept() mustn't block the poller if another process grabbed the connection first */
+	fdflags = fcntl(msock, F_GETFL);
+	if ((fdflags < 0) || (fcntl(msock, F_SETFL, fdflags | O_NONBLOCK) < 0))
+		syslog(LOG_WARNING, "unable to set master socket nonblocking flags! %s \n",
+		       strerror(errno));
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(PollFD, EPOLL_CTL_ADD, msock, &ev) != 0) {
+		syslog(LOG_EMERG, "epoll_ctl: %s", strerror(errno));
+		close(PollFD);
+		PollFD = -1;
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&PollThread, &attr, (void *(*)(void *)) http_poller_loop, NULL) != 0) {
+		syslog(LOG_EMERG, "Can't create thread: %s\n", strerror(errno));
+		pthread_attr_destroy(&attr);
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
+
+
+/*
+ * Worker side: wait for a connection with a request for us, and bind it to Hdr.
+ * Returns the socket, or -1 if we're shutting down or the TLS handshake failed.
+ */
+int http_poller_take(ParsedHttpHdrs *Hdr)
+{
+	struct timespec ts;
+	HttpConn *Conn;
+	StrBuf *Swap;
+
+	pthread_mutex_lock(&PollerMutex);
+	while ((ReadyHead == NULL) && !time_to_die) {
+		/* don't oversleep a shutdown */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&PollerReady, &PollerMutex, &ts);
+	}
+	Conn = ReadyHead;
+	if ((Conn != NULL) && !time_to_die) {
+		ReadyHead = Conn->next;
+		if (ReadyHead == NULL)
+			ReadyTail = NULL;
+		Conn->next = NULL;
+	}
+	else
+		Conn = NULL;
+	pthread_mutex_unlock(&PollerMutex);
+
+	if (Conn == NULL)
+		return -1;
+
+#ifdef HAVE_OPENSSL
+	if (is_https) {
+		if (Conn->ssl != NULL) {
+			pthread_setspecific(ThreadSSL, Conn->ssl);
+			Conn->ssl = NULL;
+		}
+		else if (starttls(Conn->sock) != 0) {
+			CloseHttpConn(&Conn);
+			return -1;
+		}
+	}
+#endif
+
+	/* the buffers change owners; what the poller read ahead is the start of the request. */
+	Swap = Hdr->ReadBuf;
+	Hdr->ReadBuf = Conn->ReadBuf;
+	Conn->ReadBuf = Swap;
+	Hdr->Pos = (StrLength(Hdr->ReadBuf) > 0) ? ChrPtr(Hdr->ReadBuf) : NULL;
+
+	Hdr->Conn = Conn;
+	Hdr->http_sock = Conn->sock;
+	Hdr->nRequests = Conn->nRequests;
+	Hdr->peer_closed = Conn->peer_closed;
+	return Conn->sock;
+}
+
+
+/*
+ * Worker side: the request in Hdr is done. Returns 1 if the next pipelined request
+ * is already there for us to go on with; otherwise the connection goes back to the
+ * poller or is closed, and the worker is free.
+ */
+int http_poller_done(ParsedHttpHdrs *Hdr)
+{
+	HttpConn *Conn = Hdr->Conn;
+	StrBuf *Swap;
+	long Unread = 0;
+
+	if (Hdr->HR.keep_alive &&
+	    Hdr->HR.response_sent &&
+	    (Hdr->http_sock != -1) &&
+	    !time_to_die)
+	{
+		http_detach_modules(Hdr);
+
+		/* move what's left of the buffer to its front; on TLS that's where it is anyways. */
+		if (!is_https) {
+			if ((Hdr->Pos != NULL) && (Hdr->Pos < ChrPtr(Hdr->ReadBuf) + StrLength(Hdr->ReadBuf)))
+				Unread = StrLength(Hdr->ReadBuf) - (Hdr->Pos - ChrPtr(Hdr->ReadBuf));
+			StrBufCutLeft(Hdr->ReadBuf, StrLength(Hdr->ReadBuf) - Unread);
+			Hdr->Pos = (Unread > 0) ? ChrPtr(Hdr->ReadBuf) : NULL;
+		}
+		if ((StrLength(Hdr->ReadBuf) > 0) && RequestComplete(Hdr->ReadBuf))
+			return 1;
+#ifdef HAVE_OPENSSL
+		/* epoll can't see what OpenSSL already took off the socket */
+		if (is_https && (SSL_pending(THREADSSL) > 0))
+			return 1;
+#endif
+
+		Swap = Conn->ReadBuf;
+		Conn->ReadBuf = Hdr->ReadBuf;
+		Hdr->ReadBuf = Swap;
+		Hdr->Pos = NULL;
+		Conn->nRequests = Hdr->nRequests;
+		Conn->Since = time(NULL);
+#ifdef HAVE_OPENSSL
+		if (is_https) {
+			Conn->ssl = THREADSSL;
+			pthread_setspecific(ThreadSSL, NULL);
+		}
+#endif
+		Hdr->Conn = NULL;
+		Hdr->http_sock = -1;
+		ArmConn(Conn, EPOLL_CTL_MOD);
+		return 0;
+	}
+
+	/* Shut down SSL/TLS if required... */
+#ifdef HAVE_OPENSSL
+	if (is_https) {
+		endtls();
+	}
+#endif
+
+	/* ...and close the socket. */
+	if (Hdr->http_sock > 0) {
+		lingering_close(Hdr->http_sock);
+	}
+	Conn->sock = -1;
+	Hdr->http_sock = -1;
+	http_detach_modules(Hdr);
+
+	Swap = Conn->ReadBuf;
+	Conn->ReadBuf = Hdr->ReadBuf;
+	Hdr->ReadBuf = Swap;
+	Hdr->Pos = NULL;
+	Hdr->Conn = NULL;
+	CloseHttpConn(&Conn);
+	return 0;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
@@ -32,18 +32,68 @@ int json_MessageListHdr(SharedMessageStatus *Stat, void **ViewSpecific)
 	hprintf("HTTP/1.1 200 OK\r\n");
 	hprintf("Content-type: application/json; charset=utf-8\r\n");
 	hprintf("Server: %s / %s\r\n", PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software));
-	hprintf("Connection: close\r\n");
 	hprintf("Pragma: no-cache\r\nCache-Control: no-store\r\nExpires:-1\r\n");
-	begin_burst();
+	begin_chunked_burst();
 	return 0;
 }
 
+/*
+ * Write the message list straight into the output buffer; with thousands of
+ * messages in a room going through the template engine (or a JSON tree)
+ * costs a lot more than the list itself.
+ * Big lists go out in chunks while we're still writing them.
+ */
 int json_RenderView_or_Tail(SharedMessageStatus *Stat, 
 			    void **ViewSpecific, 
 			    long oper)
 {
-	DoTemplate(HKEY("mailsummary_json"),NULL, NULL);
-	
+	wcsession *WCC = WC;
+	message_summary *Msg;
+	JsonWriter *W;
+	HashPos *it;
+	const char *Key;
+	long KeyLen;
+	void *vMsg;
+	long StartAt, StopAt, n;
+	char datebuf[64];
+
+	StartAt = (havebstr("startmsg")) ? lbstr("startmsg") : 0;
+	StopAt = (havebstr("stopmsg")) ? lbstr("stopmsg") : -1;
+	if (StopAt < 0)
+		StopAt = GetCount(WCC->summ);
+
+	W = NewJsonWriter(WCC->WBuf);
+	JsonWriteObjectStart(W, NULL, 0);
+	JsonWriteNumber(W, HKEY("nummsgs"), Stat->nummsgs);
+	JsonWriteNumber(W, HKEY("newmsgs"), Stat->numNewmsgs);
+	JsonWriteNumber(W, HKEY("startmsg"), Stat->startmsg);
+	JsonWriteString(W, HKEY("roomname"), WCC->CurRoom.name);
+	JsonWriteArrayStart(W, HKEY("msgs"));
+
+	it = GetNewHashPos(WCC->summ, 0);
+	n = 0;
+	while (GetNextHashPos(WCC->summ, it, &KeyLen, &Key, &vMsg)) {
+		if ((n >= StartAt) && (n <= StopAt)) {
+			Msg = (message_summary*) vMsg;
+			webcit_fmt_date(datebuf, 64, Msg->date, DATEFMT_BRIEF);
+
+			JsonWriteArrayStart(W, NULL, 0);
+			JsonWriteNumber(W, NULL, 0, Msg->msgnum);
+			JsonWriteHtmlString(W, NULL, 0, Msg->subj);
+			JsonWriteHtmlString(W, NULL, 0, Msg->from);
+			JsonWriteNumber(W, NULL, 0, Msg->date);
+			JsonWritePlainString(W, NULL, 0, datebuf, -1);
+			JsonWriteBool(W, NULL, 0, (Msg->Flags & MSGFLAG_READ) != 0);
+			JsonWriteArrayEnd(W);
+			burst_checkpoint(WCC->WBuf);
+		}
+		n++;
+	}
+	DeleteHashPos(&it);
+
+	JsonWriteArrayEnd(W);
+	JsonWriteObjectEnd(W);
+	FreeJsonWriter(&W);
 	return 0;
 }
 
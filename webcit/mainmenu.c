@@ -115,6 +115,7 @@ void display_shutdown(void)
 		StrBuf_ServGetln(Line);
 		GetServerStatusMsg(Line, NULL, 1, 5);
 
+		WC->Hdr->HR.keep_alive = 0;	/* we're hanging up on the client below */
 		begin_burst();
 		output_headers(1, 0, 0, 0, 1, 0);
 		DoTemplate(HKEY("aide_display_serverrestart"), NULL, &NoCtx);
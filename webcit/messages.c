@@ -442,8 +442,7 @@ void print_message(void) {
 	output_headers(0, 0, 0, 0, 0, 0);
 
 	hprintf("Content-type: text/html\r\n"
-		"Server: " PACKAGE_STRING "\r\n"
-		"Connection: close\r\n");
+		"Server: " PACKAGE_STRING "\r\n");
 
 	begin_burst();
 
@@ -463,8 +462,7 @@ void display_headers(void) {
 	output_headers(0, 0, 0, 0, 0, 0);
 
 	hprintf("Content-type: text/plain\r\n"
-		"Server: %s\r\n"
-		"Connection: close\r\n",
+		"Server: %s\r\n",
 		PACKAGE_STRING);
 	begin_burst();
 
@@ -806,21 +804,6 @@ void readloop(long oper, eCustomRoomRenderer ForceRenderer)
 	WCC->maxmsgs = Stat.maxmsgs;
 	WCC->num_displayed = 0;
 
-	/* Put some helpful data in vars for mailsummary_json */
-	{
-		StrBuf *Foo;
-		
-		Foo = NewStrBuf ();
-		StrBufPrintf(Foo, "%ld", Stat.nummsgs);
-		PutBstr(HKEY("__READLOOP:TOTALMSGS"), NewStrBufDup(Foo)); /* keep Foo! */
-
-		StrBufPrintf(Foo, "%ld", Stat.numNewmsgs);
-		PutBstr(HKEY("__READLOOP:NEWMSGS"), NewStrBufDup(Foo)); /* keep Foo! */
-
-		StrBufPrintf(Foo, "%ld", Stat.startmsg);
-		PutBstr(HKEY("__READLOOP:STARTMSG"), Foo); /* store Foo elsewhere, descope it here. */
-	}
-
 	/*
 	 * iterate over each message. if we need to load an attachment, do it here. 
 	 */
@@ -1838,6 +1821,7 @@ void mimepart(int force_download)
 	wcsession *WCC = WC;
 	StrBuf *Buf;
 	off_t bytes;
+	long total;
 	StrBuf *ContentType = NewStrBufPlain(HKEY("application/octet-stream"));
 	const char *CT;
 
@@ -1845,12 +1829,44 @@ void mimepart(int force_download)
 	msgnum = StrBufExtract_long(WCC->Hdr->HR.ReqLine, 0, '/');
 	StrBufExtract_token(att, WCC->Hdr->HR.ReqLine, 1, '/');
 
-	serv_printf("OPNA %ld|%s", msgnum, ChrPtr(att));
+	/*
+	 * DLAT has the server decode the part while sending it, and we pass it on
+	 * as it comes in.  If the browser wants a byte range, the server cuts it.
+	 */
+	if (WCC->Hdr->HaveRange)
+		serv_printf("DLAT %ld|%s|%ld|%ld", msgnum, ChrPtr(att),
+			    WCC->Hdr->RangeStart,
+			    (WCC->Hdr->RangeTil >= WCC->Hdr->RangeStart) ?
+			    WCC->Hdr->RangeTil - WCC->Hdr->RangeStart + 1 : 0);
+	else
+		serv_printf("DLAT %ld|%s", msgnum, ChrPtr(att));
 	StrBuf_ServGetln(Buf);
-	if (GetServerStatus(Buf, &ErrorDetail) == 2) {
+	if (GetServerStatus(Buf, &ErrorDetail) == 6) {
 		StrBufCutLeft(Buf, 4);
 		bytes = StrBufExtract_long(Buf, 0, '|');
 		StrBufExtract_token(ContentType, Buf, 3, '|');
+		if (WCC->Hdr->HaveRange) {
+			if (StrBufNum_tokens(Buf, '|') < 7) {
+				/* older server; it sent us the whole thing */
+				WCC->Hdr->HaveRange = 0;
+			}
+			else {
+				total = StrBufExtract_long(Buf, 5, '|');
+				WCC->Hdr->RangeStart = StrBufExtract_long(Buf, 6, '|');
+				WCC->Hdr->RangeTil = WCC->Hdr->RangeStart + bytes - 1;
+				WCC->Hdr->TotalBytes = total;
+				if ((bytes == 0) && (total > 0)) {
+					hprintf("HTTP/1.1 416 Requested Range Not Satisfiable\r\n");
+					hprintf("Content-Range: bytes */%ld\r\n", total);
+					hprintf("Content-Type: text/plain\r\n");
+					begin_burst();
+					end_burst();
+					FreeStrBuf(&ContentType);
+					FreeStrBuf(&Buf);
+					return;
+				}
+			}
+		}
 		CheckGZipCompressionAllowed (SKEY(ContentType));
 		if (force_download)
 		{
@@ -1865,16 +1881,14 @@ void mimepart(int force_download)
 				CT = GuessMimeByFilename(SKEY(Buf));
 				StrBufPlain(ContentType, CT, -1);
 			}
-			if (!strcasecmp(ChrPtr(ContentType), "application/octet-stream"))
+			/* sniffing only works on the beginning of the part */
+			if ((!strcasecmp(ChrPtr(ContentType), "application/octet-stream")) &&
+			    ((!WCC->Hdr->HaveRange) || (WCC->Hdr->RangeStart == 0)))
 			{
 				detect_mime = 1;
 			}
 		}
-		serv_read_binary_to_http(ContentType, bytes, 0, detect_mime);
-
-		serv_read_binary(WCC->WBuf, bytes, Buf);
-		serv_puts("CLOS");
-		StrBuf_ServGetln(Buf);
+		serv_read_blob_to_http(ContentType, bytes, 0, detect_mime);
 		CT = ChrPtr(ContentType);
 	} else {
 		StrBufCutLeft(Buf, 4);
@@ -1912,6 +1926,118 @@ void mimepart(int force_download)
 }
 
 
+/*
+ * Fetch summaries for a whole bunch of messages with one MSGB command, instead
+ * of doing a MSG0 or MSG4 round trip per message.  'which' selects the messages
+ * like MSGS does; if it is "SET", MsgList has to hold the message numbers, one
+ * per line, terminated by 000.  For each message CallBack gets a summary with
+ * the requested headers filled in; the first MIME part matching ContentTypes
+ * (comma separated) is loaded into Msg->MsgBody.
+ * Returns the number of messages found, or -1 if the server can't do MSGB.
+ */
+int load_msg_batch(const char *which,
+		   StrBuf *MsgList,
+		   const char *ContentTypes,
+		   const char *Fields,
+		   MsgBatchFunc CallBack,
+		   void *userdata)
+{
+	message_summary *Msg = NULL;
+	StrBuf *Buf;
+	StrBuf *HdrToken;
+	StrBuf *FoundCharset;
+	const char *Ptr;
+	long len;
+	int n = 0;
+
+	Buf = NewStrBuf();
+	serv_printf("MSGB %s|0|%s|%s", which, ContentTypes, Fields);
+	StrBuf_ServGetln(Buf);
+	switch (GetServerStatus(Buf, NULL)) {
+	case 1:
+		break;
+	case 8:
+		if (MsgList != NULL)
+			serv_putbuf(MsgList);
+		else
+			serv_puts("000");
+		break;
+	default:
+		FreeStrBuf(&Buf);
+		return -1;
+	}
+
+	HdrToken = NewStrBuf();
+	FoundCharset = NewStrBuf();
+	while (len = StrBuf_ServGetln(Buf),
+	       ((len >= 0) &&
+		((len != 3) || strcmp(ChrPtr(Buf), "000"))))
+	{
+		if (len < 5)
+			continue;
+		StrBufExtract_token(HdrToken, Buf, 0, '=');
+		StrBufCutLeft(Buf, StrLength(HdrToken) + 1);
+
+		if (!strcmp(ChrPtr(HdrToken), "msgn")) {
+			if (Msg != NULL) {
+				CallBack(Msg, userdata);
+				n++;
+				FreeStrBuf(&Msg->euid);
+				if (Msg->MsgBody != NULL)
+					DestroyMime(Msg->MsgBody);
+				DestroyMessageSummary(Msg);
+			}
+			Msg = (message_summary*) malloc(sizeof(message_summary));
+			memset(Msg, 0, sizeof(message_summary));
+			Msg->msgnum = StrTol(Buf);
+		}
+		else if (Msg == NULL) {
+			continue;
+		}
+		else if (!strcmp(ChrPtr(HdrToken), "exti")) {
+			FreeStrBuf(&Msg->euid);
+			Msg->euid = NewStrBufDup(Buf);
+		}
+		else if (!strcmp(ChrPtr(HdrToken), "blob")) {
+			if (Msg->MsgBody != NULL)
+				DestroyMime(Msg->MsgBody);
+			Msg->MsgBody = (wc_mime_attachment*) malloc(sizeof(wc_mime_attachment));
+			memset(Msg->MsgBody, 0, sizeof(wc_mime_attachment));
+			Msg->MsgBody->msgnum = Msg->msgnum;
+			Msg->MsgBody->PartNum = NewStrBuf();
+			Msg->MsgBody->ContentType = NewStrBuf();
+			Msg->MsgBody->Charset = NewStrBuf();
+			Ptr = NULL;
+			StrBufExtract_NextToken(Msg->MsgBody->PartNum, Buf, &Ptr, '|');
+			StrBufExtract_NextToken(Msg->MsgBody->ContentType, Buf, &Ptr, '|');
+			StrBufExtract_NextToken(Msg->MsgBody->Charset, Buf, &Ptr, '|');
+			Msg->MsgBody->length = StrBufExtractNext_long(Buf, &Ptr, '|');
+			Msg->MsgBody->size_known = 1;
+			Msg->MsgBody->Data = NewStrBufPlain(NULL, Msg->MsgBody->length + 1);
+			if (Msg->MsgBody->length > 0)
+				StrBuf_ServGetBLOBBuffered(Msg->MsgBody->Data, Msg->MsgBody->length);
+			/* the blob is followed by a newline */
+			StrBuf_ServGetln(Buf);
+		}
+		else {
+			/* the examine_* functions know the rest. */
+			EvaluateMsgHdr(SKEY(HdrToken), Msg, Buf, FoundCharset);
+		}
+	}
+	if (Msg != NULL) {
+		CallBack(Msg, userdata);
+		n++;
+		FreeStrBuf(&Msg->euid);
+		if (Msg->MsgBody != NULL)
+			DestroyMime(Msg->MsgBody);
+		DestroyMessageSummary(Msg);
+	}
+	FreeStrBuf(&FoundCharset);
+	FreeStrBuf(&HdrToken);
+	FreeStrBuf(&Buf);
+	return n;
+}
+
 /*
  * Read any MIME part of a message, from the server, into memory.
  */
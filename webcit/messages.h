@@ -131,6 +131,14 @@ static inline message_summary* GetMessagePtrAt(int n, HashList *Summ)
 	return (message_summary*) vMsg;
 }
 
+typedef void (*MsgBatchFunc)(message_summary *Msg, void *userdata);
+int load_msg_batch(const char *which,
+		   StrBuf *MsgList,
+		   const char *ContentTypes,
+		   const char *Fields,
+		   MsgBatchFunc CallBack,
+		   void *userdata);
+
 typedef void (*ExamineMsgHeaderFunc)(message_summary *Msg, StrBuf *HdrLine, StrBuf *FoundCharset);
 
 void evaluate_mime_part(StrBuf *Target, WCTemplputParams *TP);
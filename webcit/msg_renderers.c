@@ -1103,7 +1103,7 @@ void render_MAIL_text_plain(StrBuf *Target, WCTemplputParams *TP, StrBuf *FoundC
 			ConvertIt = 0;
 		}
 		else {
-			ctdl_iconv_open("UTF-8", ChrPtr(cs), &ic);
+			ctdl_iconv_acquire("UTF-8", ChrPtr(cs), &ic);
 			if (ic == (iconv_t)(-1) ) {
 				syslog(LOG_WARNING, "%s:%d iconv_open(UTF-8, %s) failed: %s\n",
 					__FILE__, __LINE__, ChrPtr(Mime->Charset), strerror(errno));
@@ -1175,7 +1175,7 @@ void render_MAIL_text_plain(StrBuf *Target, WCTemplputParams *TP, StrBuf *FoundC
 	StrBufAppendBufPlain(TTarget, HKEY("</i><br>"), 0);
 #ifdef HAVE_ICONV
 	if (ic != (iconv_t)(-1) ) {
-		iconv_close(ic);
+		ctdl_iconv_release(&ic);
 	}
 #endif
 
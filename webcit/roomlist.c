@@ -77,6 +77,45 @@ int SortFloorsByNameOrder(const void *vfloor1, const void *vfloor2)
 	return strcmp(ChrPtr(f1->Name), ChrPtr(f2->Name));
 }
 
+/*
+ * Our room and floor lists live as long as the session does.  Once per
+ * request we ask citserver (RLST) whether rooms, floors or our own visits
+ * changed since we loaded them, and only then throw them away.
+ * New messages don't move the stamp, so pages which show which rooms have
+ * unread messages re-read LKRA themselves.
+ * Servers which don't know RLST get their room lists re-read every request.
+ */
+void CheckRoomListStamp(wcsession *WCC)
+{
+	StrBuf *Buf;
+
+	if (WCC->RoomListChecked)
+		return;
+	WCC->RoomListChecked = 1;
+
+	Buf = NewStrBuf();
+	serv_puts("RLST");
+	StrBuf_ServGetln(Buf);
+	if (GetServerStatus(Buf, NULL) == 2) {
+		StrBufCutLeft(Buf, 4);
+		if ((WCC->RoomListStamp == NULL) ||
+		    (strcmp(ChrPtr(Buf), ChrPtr(WCC->RoomListStamp)) != 0))
+		{
+			_FlushRoomListCache(WCC);
+			FreeStrBuf(&WCC->RoomListStamp);
+			WCC->RoomListStamp = Buf;
+			Buf = NULL;
+		}
+	}
+	else {
+		FreeStrBuf(&WCC->RoomListStamp);
+		DeleteHash(&WCC->Rooms);
+		DeleteHash(&WCC->ZappedRooms);
+		DeleteHash(&WCC->PublicRooms);
+	}
+	FreeStrBuf(&Buf);
+}
+
 HashList *GetFloorListHash(StrBuf *Target, WCTemplputParams *TP) 
 {
 	int Done = 0;
@@ -94,6 +133,7 @@ HashList *GetFloorListHash(StrBuf *Target, WCTemplputParams *TP)
 	long HKLen;
 
 
+	CheckRoomListStamp(WCC);
 	if (WCC->Floors != NULL)
 		return WCC->Floors;
 	WCC->Floors = floors = NewHash(1, Flathash);
@@ -144,6 +184,13 @@ HashList *GetFloorListHash(StrBuf *Target, WCTemplputParams *TP)
 	DeleteHashPos(&it);
 	SortByHashKeyStr(floors);
 
+	/* the current room still points into the floors we may have just flushed */
+	if (WCC->CurRoom.name != NULL) {
+		vFloor = NULL;
+		GetHash(floors, IKEY(WCC->CurRoom.floorid), &vFloor);
+		WCC->CurRoom.Floor = (const Floor*) vFloor;
+	}
+
 	return floors;
 }
 
@@ -151,17 +198,19 @@ HashList *GetZappedRoomListHash(StrBuf *Target, WCTemplputParams *TP)
 {
 	wcsession *WCC = WC;
 
-	if (WCC->Floors == NULL)
-		GetFloorListHash(Target, TP);
-	serv_puts("LZRM -1");
-	return GetRoomListHash(Target, TP);
+	GetFloorListHash(Target, TP);
+	if (WCC->ZappedRooms == NULL) 
+	{
+		serv_puts("LZRM -1");
+		WCC->ZappedRooms = GetRoomListHash(Target, TP);
+	}
+	return WCC->ZappedRooms;
 }
 HashList *GetRoomListHashLKRA(StrBuf *Target, WCTemplputParams *TP) 
 {
 	wcsession *WCC = WC;
 
-	if (WCC->Floors == NULL)
-		GetFloorListHash(Target, TP);
+	GetFloorListHash(Target, TP);
 	if (WCC->Rooms == NULL) 
 	{
 		serv_puts("LKRA");
@@ -172,8 +221,15 @@ HashList *GetRoomListHashLKRA(StrBuf *Target, WCTemplputParams *TP)
 
 HashList *GetRoomListHashLPRM(StrBuf *Target, WCTemplputParams *TP) 
 {
-	serv_puts("LPRM");
-	return GetRoomListHash(Target, TP);
+	wcsession *WCC = WC;
+
+	GetFloorListHash(Target, TP);
+	if (WCC->PublicRooms == NULL) 
+	{
+		serv_puts("LPRM");
+		WCC->PublicRooms = GetRoomListHash(Target, TP);
+	}
+	return WCC->PublicRooms;
 }
 
 
@@ -956,8 +1012,8 @@ InitModule_ROOMLIST
 
 	RegisterIterator("LFLR", 0, NULL, GetFloorListHash, NULL, NULL, CTX_FLOORS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
 	RegisterIterator("LKRA", 0, NULL, GetRoomListHashLKRA, NULL, NULL, CTX_ROOMS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
-	RegisterIterator("LZRM", 0, NULL, GetZappedRoomListHash, NULL, DeleteHash, CTX_ROOMS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
-	RegisterIterator("LPRM", 0, NULL, GetRoomListHashLPRM, NULL, DeleteHash, CTX_ROOMS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
+	RegisterIterator("LZRM", 0, NULL, GetZappedRoomListHash, NULL, NULL, CTX_ROOMS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
+	RegisterIterator("LPRM", 0, NULL, GetRoomListHashLPRM, NULL, NULL, CTX_ROOMS, CTX_NONE, IT_FLAG_DETECT_GROUPCHANGE);
 
 
 	REGISTERTokenParamDefine(eNotSet);
@@ -977,3 +1033,18 @@ InitModule_ROOMLIST
 			 CTX_ROOMS);
 
 }
+
+
+void 
+SessionAttachModule_ROOMLIST
+(wcsession *sess)
+{
+	sess->RoomListChecked = 0;
+}
+
+void 
+SessionDestroyModule_ROOMLIST
+(wcsession *sess)
+{
+	FreeStrBuf(&sess->RoomListStamp);
+}
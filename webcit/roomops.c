@@ -349,8 +349,7 @@ void ParseGoto(folder *room, StrBuf *Line)
 		
 	}
 	/* get a pointer to the floor we're on: */
-	if (WCC->Floors == NULL)
-		GetFloorListHash(NULL, NULL);
+	GetFloorListHash(NULL, NULL);
 
 	GetHash(WCC->Floors, IKEY(room->floorid), &vFloor);
 	room->Floor = (const Floor*) vFloor;
@@ -1295,6 +1294,7 @@ void netedit(void) {
  */
 void knrooms(void)
 {
+	/* RLST doesn't move for new messages; this page shows which rooms have them. */
 	DeleteHash(&WC->Rooms);
 	output_headers(1, 1, 1, 0, 0, 0); 
 	do_template("knrooms");
@@ -1398,23 +1398,32 @@ void rename_floor(void) {
 
 void jsonRoomFlr(void) 
 {
+	/* same as knrooms(): the room tree shows which rooms have new messages */
+	DeleteHash(&WC->Rooms);
+
 	/* Send as our own (application/json) content type */
 	hprintf("HTTP/1.1 200 OK\r\n");
 	hprintf("Content-type: application/json; charset=utf-8\r\n");
 	hprintf("Server: %s / %s\r\n", PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software));
-	hprintf("Connection: close\r\n");
 	hprintf("Pragma: no-cache\r\nCache-Control: no-store\r\nExpires:-1\r\n");
 	begin_burst();
 	DoTemplate(HKEY("json_roomflr"),NULL,&NoCtx);
 	end_burst(); 
 }
 
-void _FlushRoomList(wcsession *WCC)
+void _FlushRoomListCache(wcsession *WCC)
 {
-	free_march_list(WCC);
 	DeleteHash(&WCC->Floors);
 	DeleteHash(&WCC->Rooms);
+	DeleteHash(&WCC->ZappedRooms);
+	DeleteHash(&WCC->PublicRooms);
 	DeleteHash(&WCC->FloorsByName);
+}
+
+void _FlushRoomList(wcsession *WCC)
+{
+	free_march_list(WCC);
+	_FlushRoomListCache(WCC);
 	FlushFolder(&WCC->CurRoom);
 }
 
@@ -127,6 +127,7 @@ void FlushFolder(folder *room);
 void FlushIgnetCfgs(folder *room);
 void ParseGoto(folder *proom, StrBuf *Line);
 void FlushRoomlist(void); /* release our caches, so a deleted / zapped room disapears */
+void _FlushRoomListCache(wcsession *WCC); /* same, but leave the current room and march list alone */
 void ReloadCurrentRoom(void); /* Flush cache; reload current state */
 
 HashList *GetFloorListHash(StrBuf *Target, WCTemplputParams *TP);
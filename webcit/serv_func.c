@@ -4,6 +4,7 @@
 
 int is_uds = 0;
 char serv_sock_name[PATH_MAX] = "";
+int ServPoolSize = 0;			/* idle citserver connections to keep; 0: one per session */
 
 HashList *EmbeddableMimes = NULL;
 StrBuf *EmbeddableMimeStrs = NULL;
@@ -40,20 +41,11 @@ void DeleteServInfo(ServInfo **FreeMe)
 }
 
 /*
- * get info about the server we've connected to
- *
- * browser_host		the citadel we want to connect to
- * user_agent		which browser uses our client?
+ * tell the server who's connecting, and how we'd like it to behave.
+ * Returns 0 on success.
  */
-ServInfo *get_serv_info(StrBuf *browser_host, StrBuf *user_agent)
+static int serv_identify(StrBuf *Buf, StrBuf *browser_host, StrBuf *user_agent)
 {
-	ServInfo *info;
-	StrBuf *Buf;
-	int a;
-	int rc;
-
-	Buf = NewStrBuf();
-
 	/* Tell the server what kind of client is connecting */
 	serv_printf("IDEN %d|%d|%d|%s|%s",
 		    DEVELOPER_ID,
@@ -66,8 +58,7 @@ ServInfo *get_serv_info(StrBuf *browser_host, StrBuf *user_agent)
 	if (GetServerStatus(Buf, NULL) != 2) {
 		syslog(LOG_WARNING, "get_serv_info(IDEN): unexpected answer [%s]\n",
 			ChrPtr(Buf));
-		FreeStrBuf(&Buf);
-		return NULL;
+		return 1;
 	}
 
 	/*
@@ -80,6 +71,26 @@ ServInfo *get_serv_info(StrBuf *browser_host, StrBuf *user_agent)
 	if (GetServerStatus(Buf, NULL) != 2) {
 		syslog(LOG_WARNING, "get_serv_info(ICAL sgi|1): unexpected answer [%s]\n",
 			ChrPtr(Buf));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * get info about the server we've connected to
+ *
+ * browser_host		the citadel we want to connect to
+ * user_agent		which browser uses our client?
+ */
+ServInfo *get_serv_info(StrBuf *browser_host, StrBuf *user_agent)
+{
+	ServInfo *info;
+	StrBuf *Buf;
+	int a;
+	int rc;
+
+	Buf = NewStrBuf();
+	if (serv_identify(Buf, browser_host, user_agent) != 0) {
 		FreeStrBuf(&Buf);
 		return NULL;
 	}
@@ -255,6 +266,212 @@ int GetConnected (void)
 }
 
 
+/*
+ * Pooled citserver connections: once a request is through, a logged in
+ * session PARKs its login on the server and hands its connection back to
+ * the pool; the next request takes any connection from there and RSUMs the
+ * login. So citserver has to keep contexts for the requests in flight, not
+ * for every session we know of.
+ */
+typedef struct _ServConn {
+	struct _ServConn *next;
+	int sock;
+	StrBuf *ReadBuf;
+	const char *ReadPos;
+} ServConn;
+
+static ServConn *ServPool = NULL;
+static int ServPoolIdle = 0;
+static int ServPoolUnsupported = 0;	/* the server doesn't know PARK */
+static pthread_mutex_t ServPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * IDEN a pooled connection as ours: from where, with which browser.
+ */
+static int ServPoolIdentify(wcsession *WCC, StrBuf *Buf)
+{
+	StrBuf *Host;
+	int rc;
+
+	if ((follow_xff) && (StrLength(WCC->Hdr->HR.browser_host) > 0)) {
+		Host = NewStrBufDup(WCC->Hdr->HR.browser_host);
+	}
+	else {
+		Host = NewStrBuf();
+		locate_host(Host, WCC->Hdr->http_sock);
+	}
+	rc = serv_identify(Buf, Host, WCC->Hdr->HR.user_agent);
+	FreeStrBuf(&Host);
+	return rc;
+}
+
+/*
+ * take a connection from the pool, or open a new one; bind it to our session.
+ */
+static int ServPoolBorrow(wcsession *WCC, int Fresh)
+{
+	ServConn *Conn = NULL;
+	StrBuf *Buf;
+
+	if (!Fresh) {
+		pthread_mutex_lock(&ServPoolMutex);
+		Conn = ServPool;
+		if (Conn != NULL) {
+			ServPool = Conn->next;
+			ServPoolIdle --;
+		}
+		pthread_mutex_unlock(&ServPoolMutex);
+	}
+
+	if (Conn != NULL) {
+		FreeStrBuf(&WCC->ReadBuf);
+		WCC->serv_sock = Conn->sock;
+		WCC->ReadBuf = Conn->ReadBuf;
+		WCC->ReadPos = Conn->ReadPos;
+		WCC->connected = 1;
+		free(Conn);
+		return 0;
+	}
+
+	if (WCC->ReadBuf == NULL)
+		WCC->ReadBuf = NewStrBufPlain(NULL, SIZ * 4);
+	FlushStrBuf(WCC->ReadBuf);
+	WCC->ReadPos = NULL;
+	if (is_uds)
+		WCC->serv_sock = uds_connectsock(serv_sock_name);
+	else
+		WCC->serv_sock = tcp_connectsock(ctdlhost, ctdlport);
+	if (WCC->serv_sock < 0)
+		return 1;
+	WCC->connected = 1;
+
+	Buf = NewStrBuf();
+	StrBuf_ServGetln(Buf);	/* get the server greeting */
+	if (WCC->connected && (GetServerStatus(Buf, NULL) != 2)) {
+		syslog(LOG_INFO, "citserver won't take another connection: %s", ChrPtr(Buf));
+		close(WCC->serv_sock);
+		WCC->serv_sock = -1;
+		WCC->connected = 0;
+	}
+	/* RSUM brings back the login, not what IDEN and ICAL sgi set up per connection. */
+	else if (WCC->connected && (ServPoolIdentify(WCC, Buf) != 0)) {
+		close(WCC->serv_sock);
+		WCC->serv_sock = -1;
+		WCC->connected = 0;
+	}
+	FreeStrBuf(&Buf);
+	return (WCC->connected) ? 0 : 1;
+}
+
+/*
+ * Pick up our parked login on a pooled connection. If the server lost
+ * it (restart, timeout), we're connected but logged out, and the caller
+ * logs in again if it has the credentials.
+ */
+void ServPoolResume(void)
+{
+	wcsession *WCC = WC;
+	StrBuf *Buf;
+	int tries;
+
+	Buf = NewStrBuf();
+	for (tries = 0; tries < 2; tries ++) {
+		/* an idle connection may have been dropped by citserver; then try a new one. */
+		if (ServPoolBorrow(WCC, tries > 0) != 0)
+			break;
+		serv_printf("RSUM %s", ChrPtr(WCC->ParkToken));
+		if (StrBuf_ServGetln(Buf) >= 0)
+			break;
+	}
+	FlushStrBuf(WCC->ParkToken);
+
+	if (!WCC->connected) {
+		WCC->logged_in = 0;
+	}
+	else if (GetServerStatus(Buf, NULL) != 2) {
+		syslog(LOG_DEBUG, "couldn't resume parked login: %s", ChrPtr(Buf));
+		WCC->logged_in = 0;
+
+		/*
+		 * We'll log in from scratch; a pooled connection still
+		 * carries the IDEN of whoever had it before, so say again
+		 * who we are first.
+		 */
+		if (ServPoolIdentify(WCC, Buf) != 0) {
+			close(WCC->serv_sock);
+			WCC->serv_sock = -1;
+			WCC->connected = 0;
+		}
+	}
+	FreeStrBuf(&Buf);
+}
+
+/*
+ * After the request: park our login and give the connection back.
+ * Sessions that aren't logged in keep theirs, they may be in the midst
+ * of something (like an OpenID login) the server keeps state for.
+ */
+void ServPoolRelease(void)
+{
+	wcsession *WCC = WC;
+	ServConn *Conn;
+	StrBuf *Buf;
+
+	if ((ServPoolSize <= 0) ||
+	    ServPoolUnsupported ||
+	    (WCC == NULL) ||
+	    WCC->killthis ||
+	    !WCC->connected ||
+	    !WCC->logged_in ||
+	    (WCC->serv_sock < 0))
+		return;
+
+	Buf = NewStrBuf();
+	serv_puts("PARK");
+	if (StrBuf_ServGetln(Buf) < 0) {
+		FreeStrBuf(&Buf);
+		return;
+	}
+	if (GetServerStatus(Buf, NULL) != 2) {
+		if (StrToi(Buf) == ERROR + CMD_NOT_SUPPORTED) {
+			syslog(LOG_INFO, "citserver doesn't support PARK; using one connection per session");
+			ServPoolUnsupported = 1;
+		}
+		FreeStrBuf(&Buf);
+		return;
+	}
+	if (WCC->ParkToken == NULL)
+		WCC->ParkToken = NewStrBuf();
+	StrBufPlain(WCC->ParkToken, ChrPtr(Buf) + 4, StrLength(Buf) - 4);
+	FreeStrBuf(&Buf);
+
+	Conn = (ServConn*) malloc(sizeof(ServConn));
+	Conn->sock = WCC->serv_sock;
+	Conn->ReadBuf = WCC->ReadBuf;
+	Conn->ReadPos = WCC->ReadPos;
+	WCC->serv_sock = -1;
+	WCC->ReadBuf = NULL;
+	WCC->ReadPos = NULL;
+	WCC->connected = 0;
+
+	pthread_mutex_lock(&ServPoolMutex);
+	if (ServPoolIdle < ServPoolSize) {
+		Conn->next = ServPool;
+		ServPool = Conn;
+		ServPoolIdle ++;
+		Conn = NULL;
+	}
+	pthread_mutex_unlock(&ServPoolMutex);
+
+	if (Conn != NULL) {
+		/* enough of them idling around already. */
+		close(Conn->sock);
+		FreeStrBuf(&Conn->ReadBuf);
+		free(Conn);
+	}
+}
+
+
 void FmOut(StrBuf *Target, const char *align, const StrBuf *Source)
 {
 	const char *ptr, *pte;
@@ -673,4 +890,23 @@ SessionDestroyModule_SERVFUNC
 (wcsession *sess)
 {
 	DeleteServInfo(&sess->serv_info);
+	FreeStrBuf(&sess->ParkToken);
+}
+
+void
+ServerShutdownModule_SERVFUNC
+(void)
+{
+	ServConn *Conn;
+
+	pthread_mutex_lock(&ServPoolMutex);
+	while (ServPool != NULL) {
+		Conn = ServPool;
+		ServPool = Conn->next;
+		close(Conn->sock);
+		FreeStrBuf(&Conn->ReadBuf);
+		free(Conn);
+	}
+	ServPoolIdle = 0;
+	pthread_mutex_unlock(&ServPoolMutex);
 }
@@ -126,7 +126,6 @@ void sitemap(void) {
 	hprintf("Content-type: text/xml\r\n");
 	hprintf(
 		"Server: %s / %s\r\n"
-		"Connection: close\r\n"
 	,
 		PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software)
 	);
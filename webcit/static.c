@@ -78,16 +78,207 @@ void output_error_pic(const char *ErrMsg1, const char *ErrMsg2)
 	end_burst();
 }
 
+/*
+ * Static files are loaded at startup, along with a gzip'ed (and, if one is
+ * found on disk, a brotli'ed) copy, so we can answer from memory.
+ * Big files only get their stat info cached; they're sent via sendfile().
+ */
+#define STATIC_CACHE_FILE_MAX (1024 * 1024)
+#define STATIC_CACHE_TOTAL_MAX (64 * 1024 * 1024)
+
+typedef struct _StaticAsset {
+	StrBuf *FileName;		/* where it lives on disk */
+	const char *MimeType;
+	time_t mtime;
+	off_t size;
+	ino_t inode;
+	char ETag[64];			/* unquoted; the encoding gets appended */
+	StrBuf *Body;			/* NULL if we don't keep it in memory */
+	StrBuf *GzBody;
+	StrBuf *BrBody;
+} StaticAsset;
+
+static long StaticCacheBytes = 0;
+static long StaticCacheFiles = 0;
+
+void DeleteStaticAsset(void *vAsset)
+{
+	StaticAsset *A = (StaticAsset*) vAsset;
+
+	FreeStrBuf(&A->FileName);
+	FreeStrBuf(&A->Body);
+	FreeStrBuf(&A->GzBody);
+	FreeStrBuf(&A->BrBody);
+	free(A);
+}
+
+static int StaticCompressible(const char *MimeType)
+{
+	return	(strncmp(MimeType, "text/", 5) == 0) ||
+		(strstr(MimeType, "javascript") != NULL) ||
+		(strstr(MimeType, "json") != NULL) ||
+		(strstr(MimeType, "xml") != NULL);
+}
+
+/*
+ * read a whole file into a new buffer, if it is what we expect it to be.
+ */
+static StrBuf *StaticReadFile(const char *FileName, struct stat *statbuf)
+{
+	StrBuf *Buf;
+	const char *Err;
+	int fd;
+
+	fd = open(FileName, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if ((fstat(fd, statbuf) == -1) || !S_ISREG(statbuf->st_mode)) {
+		close(fd);
+		return NULL;
+	}
+	Buf = NewStrBufPlain(NULL, statbuf->st_size + 1);
+	if ((statbuf->st_size > 0) &&
+	    (StrBufReadBLOB(Buf, &fd, 1, statbuf->st_size, &Err) < 0))
+	{
+		syslog(LOG_INFO, "static: can't read %s: %s\n", FileName, Err);
+		FreeStrBuf(&Buf);
+	}
+	if (fd >= 0)
+		close(fd);
+	return Buf;
+}
+
+/*
+ * a variant lying next to the file (foo.js.gz) is only good if it's not older.
+ */
+static StrBuf *StaticReadVariant(StaticAsset *A, const char *Suffix)
+{
+	struct stat statbuf;
+	StrBuf *VariantName;
+	StrBuf *Buf;
+
+	VariantName = NewStrBufDup(A->FileName);
+	StrBufAppendBufPlain(VariantName, Suffix, -1, 0);
+	Buf = StaticReadFile(ChrPtr(VariantName), &statbuf);
+	if ((Buf != NULL) && (statbuf.st_mtime < A->mtime))
+		FreeStrBuf(&Buf);
+	FreeStrBuf(&VariantName);
+	return Buf;
+}
+
+StaticAsset *NewStaticAsset(StrBuf *FileName)
+{
+	StaticAsset *A;
+	struct stat statbuf;
+
+	A = (StaticAsset*) malloc(sizeof(StaticAsset));
+	memset(A, 0, sizeof(StaticAsset));
+	A->FileName = FileName;
+	A->MimeType = GuessMimeByFilename(SKEY(FileName));
+
+	if (stat(ChrPtr(FileName), &statbuf) == -1)
+		return A;
+	A->mtime = statbuf.st_mtime;
+	A->size = statbuf.st_size;
+	A->inode = statbuf.st_ino;
+
+	if ((statbuf.st_size > STATIC_CACHE_FILE_MAX) ||
+	    (StaticCacheBytes + statbuf.st_size > STATIC_CACHE_TOTAL_MAX))
+		return A;
+
+	A->Body = StaticReadFile(ChrPtr(FileName), &statbuf);
+	if (A->Body == NULL)
+		return A;
+	/* it may have changed between the two looks. */
+	A->mtime = statbuf.st_mtime;
+	A->size = StrLength(A->Body);
+	A->inode = statbuf.st_ino;
+	snprintf(A->ETag, sizeof(A->ETag), "%08x-%lx",
+		 (unsigned int) HashLittle(ChrPtr(A->Body), StrLength(A->Body)),
+		 (long) A->size);
+
+	A->GzBody = StaticReadVariant(A, ".gz");
+	if ((A->GzBody == NULL) &&
+	    (A->size > 256) &&
+	    StaticCompressible(A->MimeType))
+	{
+		A->GzBody = NewStrBufDup(A->Body);
+		if ((CompressBuffer(A->GzBody) <= 0) ||
+		    (StrLength(A->GzBody) >= StrLength(A->Body)))
+			FreeStrBuf(&A->GzBody);
+	}
+	A->BrBody = StaticReadVariant(A, ".br");
+
+	StaticCacheBytes += StrLength(A->Body) + StrLength(A->GzBody) + StrLength(A->BrBody);
+	StaticCacheFiles ++;
+	return A;
+}
+
+/*
+ * If-None-Match beats If-Modified-Since, if the client sent both.
+ */
+static int StaticNotModified(const char *ETag, time_t mtime)
+{
+	HdrRefs *HR = &WC->Hdr->HR;
+	const char *Pos = NULL;
+	const char *pch;
+	StrBuf *Token;
+	int match = 0;
+
+	if (HR->if_none_match == NULL)
+		return (HR->if_modified_since > 0) && (mtime <= HR->if_modified_since);
+
+	Token = NewStrBufPlain(NULL, StrLength(HR->if_none_match));
+	while (!match && StrBufHaveNextToken(HR->if_none_match, &Pos)) {
+		StrBufExtract_NextToken(Token, HR->if_none_match, &Pos, ',');
+		StrBufTrim(Token);
+		pch = ChrPtr(Token);
+		if (strncmp(pch, "W/", 2) == 0)
+			pch += 2;
+		match = (strcmp(pch, "*") == 0) || (strcmp(pch, ETag) == 0);
+	}
+	FreeStrBuf(&Token);
+	return match;
+}
+
+static void StaticHeaders(const char *Status, const char *MimeType, const char *ETag, time_t mtime)
+{
+	char httpLastMod[128];
+	char httpTomorow[128];
+
+	http_datestring(httpLastMod, sizeof httpLastMod, mtime);
+	http_datestring(httpTomorow, sizeof httpTomorow, 
+			time(NULL) + 60 * 60 * 24 * 2);
+
+	hprintf("HTTP/1.1 %s\r\n"
+		"Pragma: public\r\n"
+		"Cache-Control: max-age=3600, must-revalidate\r\n"
+		"Last-modified: %s\r\n"
+		"Expires: %s\r\n"
+		"ETag: %s\r\n"
+		"Vary: Accept-Encoding\r\n"
+		"Server: "PACKAGE_STRING"\r\n",
+		Status,
+		httpLastMod,
+		httpTomorow,
+		ETag);
+	if (MimeType != NULL)
+		hprintf("Content-type: %s\r\n", MimeType);
+}
+
 /*
  * dump out static pages from disk
  */
 void output_static(const char *what)
 {
+	wcsession *WCC = WC;
 	int fd;
 	struct stat statbuf;
 	off_t bytes;
 	const char *content_type;
 	int len;
+	int gzip;
+	char ETag[128];
 	const char *Err;
 
 	len = strlen (what);
@@ -128,19 +319,110 @@ void output_static(const char *what)
 
 		bytes = statbuf.st_size;
 
-		if (StrBufReadBLOB(WC->WBuf, &fd, 1, bytes, &Err) < 0)
-		{
-			if (fd > 0) close(fd);
-			syslog(LOG_INFO, "output_static('%s')  -- FREAD FAILED (%s) --\n", what, strerror(errno));
+		/* small text gets gzip'ed, everything else is sent as it is. */
+		gzip =	!DisableGzip && WCC->Hdr->HR.gzip_ok &&
+			(bytes <= STATIC_CACHE_FILE_MAX) &&
+			StaticCompressible(content_type);
+		snprintf(ETag, sizeof(ETag), "\"%lx-%lx-%lx%s\"",
+			 (long) statbuf.st_ino,
+			 (long) statbuf.st_size,
+			 (long) statbuf.st_mtime,
+			 (gzip) ? "-gz" : "");
+
+		if (StaticNotModified(ETag, statbuf.st_mtime)) {
+			close(fd);
+			StaticHeaders("304 Not Modified", NULL, ETag, statbuf.st_mtime);
+			http_send_prepared(NULL, -1, 0);
+		}
+		else if (!gzip) {
+			StaticHeaders("200 OK", content_type, ETag, statbuf.st_mtime);
+			hprintf("Content-length: %ld\r\n", (long) bytes);
+			http_send_prepared(NULL, fd, bytes);
+			close(fd);
+		}
+		else {
+			begin_burst();
+			if (StrBufReadBLOB(WC->WBuf, &fd, 1, bytes, &Err) < 0)
+			{
+				if (fd > 0) close(fd);
+				syslog(LOG_INFO, "output_static('%s')  -- FREAD FAILED (%s) --\n", what, strerror(errno));
+				FlushStrBuf(WCC->HBuf);
 				hprintf("HTTP/1.1 500 internal server error \r\n");
 				hprintf("Content-Type: text/plain\r\n");
+				FlushStrBuf(WCC->WBuf);
 				end_burst();
 				return;
+			}
+			close(fd);
+
+			/* only claim the gzip'ed variant once we have it. */
+			if (CompressBuffer(WCC->WBuf) <= 0) {
+				syslog(LOG_ALERT, "Compression of %s failed; sending it uncompressed\n", what);
+				gzip = 0;
+				snprintf(ETag, sizeof(ETag), "\"%lx-%lx-%lx\"",
+					 (long) statbuf.st_ino,
+					 (long) statbuf.st_size,
+					 (long) statbuf.st_mtime);
+			}
+			StaticHeaders("200 OK", content_type, ETag, statbuf.st_mtime);
+			if (gzip)
+				hprintf("Content-encoding: gzip\r\n");
+			hprintf("Content-length: %ld\r\n", (long) StrLength(WCC->WBuf));
+			http_send_prepared(WCC->WBuf, -1, 0);
+			FlushStrBuf(WCC->WBuf);
 		}
+	}
+	if (yesbstr("force_close_session")) {
+		end_webcit_session();
+	}
+}
 
+/*
+ * serve one of the files we loaded at startup; if it changed on disk since, 
+ * or is too big to be kept, it's read from the disk instead.
+ */
+void output_static_asset(StaticAsset *A)
+{
+	wcsession *WCC = WC;
+	struct stat statbuf;
+	const StrBuf *Body;
+	const char *Encoding = NULL;
+	char ETag[128];
+
+	if ((A->Body == NULL) ||
+	    (stat(ChrPtr(A->FileName), &statbuf) == -1) ||
+	    (statbuf.st_mtime != A->mtime) ||
+	    (statbuf.st_size != A->size) ||
+	    (statbuf.st_ino != A->inode))
+	{
+		output_static(ChrPtr(A->FileName));
+		return;
+	}
 
-		close(fd);
-		http_transmit_thing(content_type, 2);
+	Body = A->Body;
+	if (WCC->Hdr->HR.br_ok && (A->BrBody != NULL)) {
+		Body = A->BrBody;
+		Encoding = "br";
+	}
+	else if (!DisableGzip && WCC->Hdr->HR.gzip_ok && (A->GzBody != NULL)) {
+		Body = A->GzBody;
+		Encoding = "gzip";
+	}
+	snprintf(ETag, sizeof(ETag), "\"%s%s%s\"",
+		 A->ETag,
+		 (Encoding != NULL) ? "-" : "",
+		 (Encoding != NULL) ? Encoding : "");
+
+	if (StaticNotModified(ETag, A->mtime)) {
+		StaticHeaders("304 Not Modified", NULL, ETag, A->mtime);
+		http_send_prepared(NULL, -1, 0);
+	}
+	else {
+		StaticHeaders("200 OK", A->MimeType, ETag, A->mtime);
+		if (Encoding != NULL)
+			hprintf("Content-encoding: %s\r\n", Encoding);
+		hprintf("Content-length: %ld\r\n", (long) StrLength(Body));
+		http_send_prepared(Body, -1, 0);
 	}
 	if (yesbstr("force_close_session")) {
 		end_webcit_session();
@@ -259,7 +541,7 @@ int LoadStaticDir(const char *DirName, HashList *DirList, const char *RelDir)
 				StrBufAppendBufPlain(OneWebName, "/", 1, 0);
 			StrBufAppendBufPlain(OneWebName, filedir_entry->d_name, d_namelen, 0);
 
-			Put(DirList, SKEY(OneWebName), FileName, HFreeStrBuf);
+			Put(DirList, SKEY(OneWebName), NewStaticAsset(FileName), DeleteStaticAsset);
 			/* syslog(LOG_DEBUG, "[%s | %s]\n", ChrPtr(OneWebName), ChrPtr(FileName)); */
 			break;
 		default:
@@ -281,15 +563,13 @@ void output_flat_static(void)
 {
 	wcsession *WCC = WC;
 	void *vFile;
-	StrBuf *File;
 
 	if (WCC->Hdr->HR.Handler == NULL)
 		return;
 	if (GetHash(StaticFilemappings[0], SKEY(WCC->Hdr->HR.Handler->Name), &vFile) &&
 	    (vFile != NULL))
 	{
-		File = (StrBuf*) vFile;
-		output_static(ChrPtr(File));
+		output_static_asset((StaticAsset*) vFile);
 	}
 }
 
@@ -297,14 +577,12 @@ void output_static_safe(HashList *DirList)
 {
 	wcsession *WCC = WC;
 	void *vFile;
-	StrBuf *File;
 	const char *MimeType;
 
 	if (GetHash(DirList, SKEY(WCC->Hdr->HR.ReqLine), &vFile) &&
 	    (vFile != NULL))
 	{
-		File = (StrBuf*) vFile;
-		output_static(ChrPtr(File));
+		output_static_asset((StaticAsset*) vFile);
 	}
 	else {
 		syslog(LOG_INFO, "output_static_safe() file %s not found. \n", 
@@ -345,8 +623,7 @@ void robots_txt(void) {
 	output_headers(0, 0, 0, 0, 0, 0);
 
 	hprintf("Content-type: text/plain\r\n"
-		"Server: %s\r\n"
-		"Connection: close\r\n",
+		"Server: %s\r\n",
 		PACKAGE_STRING);
 	begin_burst();
 
@@ -402,6 +679,8 @@ InitModule_STATIC
 	LoadStaticDir(static_dirs[2], StaticFilemappings[2], "");
 	LoadStaticDir(static_dirs[3], StaticFilemappings[3], "");
 	LoadStaticDir(static_dirs[4], StaticFilemappings[4], "");
+	syslog(LOG_DEBUG, "static: %ld files with %ld bytes kept in memory\n",
+	       StaticCacheFiles, StaticCacheBytes);
 
 	WebcitAddUrlHandler(HKEY("robots.txt"), "", 0, robots_txt, ANONYMOUS|COOKIEUNNEEDED|ISSTATIC|LOGCHATTY);
 	WebcitAddUrlHandler(HKEY("favicon.ico"), "", 0, output_flat_static, ANONYMOUS|COOKIEUNNEEDED|ISSTATIC|LOGCHATTY);
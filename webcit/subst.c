@@ -57,6 +57,33 @@ typedef struct _wcsubst {
 } wcsubst;
 
 
+/*
+ * Templates are compiled into a flat list of these when they're loaded;
+ * rendering then just walks it, without looking anything up.
+ */
+typedef enum _eTemplateOp {
+	eOpText,		/* append a run of constant text */
+	eOpHandler,		/* call the tmplput handler we found at load time */
+	eOpConditional,		/* evaluate the conditional we found at load time */
+	eOpEndConditional,	/* <?!("X", n)>: the end of conditional n */
+	eOpSubTemplate,		/* render the subtemplate we found at load time */
+	eOpToken		/* anything else; let EvaluateToken() sort it out */
+} eTemplateOp;
+
+typedef struct _TemplateOp {
+	eTemplateOp Op;
+	const char *Text;		/* eOpText: where our text is... */
+	long TextAt;			/* ...inside of WCTemplate->Text */
+	long TextLen;			/* ...and how long it is */
+	WCTemplateToken *Token;		/* the token we were compiled from */
+	ContextFilter *Need;		/* the context our handler / conditional requires */
+	WCHandlerFunc Handler;		/* eOpHandler */
+	ConditionalStruct *Cond;	/* eOpConditional */
+	int Neg;			/* eOpConditional: see EvaluateConditional() */
+	int SkipTo;			/* eOpConditional: the op ending us, if we say skip */
+	struct _WCTemplate *SubTemplate;/* eOpSubTemplate; NULL if it doesn't exist */
+} TemplateOp;
+
 typedef struct _WCTemplate {
 	StrBuf *Data;
 	StrBuf *FileName;
@@ -64,6 +91,9 @@ typedef struct _WCTemplate {
 	int TokenSpace;
 	StrBuf *MimeType;
 	WCTemplateToken **Tokens;
+	StrBuf *Text;			/* the constant text of our Ops, merged */
+	TemplateOp *Ops;		/* what's left to do when we're rendered */
+	int nOps;
 } WCTemplate;
 
 typedef struct _HashHandler {
@@ -79,6 +109,10 @@ typedef enum _estate {
 
 void *load_template(StrBuf *Target, WCTemplate *NewTemplate);
 int EvaluateConditional(StrBuf *Target, int Neg, int state, WCTemplputParams **TPP);
+static int DoConditional(StrBuf *Target, ConditionalStruct *Cond, int Neg, int CheckCtx, WCTemplputParams **TPP);
+static const StrBuf *RenderTemplate(WCTemplate *Tmpl, StrBuf *Target, WCTemplputParams *CallingTP, int ContextChecked);
+void tmplput_Comment(StrBuf *Target, WCTemplputParams *TP);
+void tmplput_DefVal(StrBuf *Target, WCTemplputParams *TP);
 
 
 
@@ -450,6 +484,9 @@ void FreeWCTemplate(void *vFreeMe)
 	FreeStrBuf(&FreeMe->FileName);
 	FreeStrBuf(&FreeMe->Data);
 	FreeStrBuf(&FreeMe->MimeType);
+	FreeStrBuf(&FreeMe->Text);
+	if (FreeMe->Ops != NULL)
+		free(FreeMe->Ops);
 	free(FreeMe);
 }
 
@@ -1388,6 +1425,177 @@ void SanityCheckTemplate(StrBuf *Target, WCTemplate *CheckMe)
 	}
 }
 
+/*
+ * Find a template by its name; local ones override the shipped ones.
+ */
+static WCTemplate *LookupTemplate(const char *templatename, long len)
+{
+	void *vTmpl;
+
+	if (!GetHash(LocalTemplateCache, templatename, len, &vTmpl) &&
+	    !GetHash(TemplateCache, templatename, len, &vTmpl))
+		return NULL;
+	return (WCTemplate*) vTmpl;
+}
+
+static int IsConditionalEnd(TemplateOp *Op, long ConditionalID)
+{
+	return (Op->Op == eOpEndConditional) &&
+		(Op->Token->Params[1]->lvalue == ConditionalID);
+}
+
+/*
+ * Add a run of constant text to the template; if the op before was text
+ * too, just make it longer.
+ */
+static void CompileText(WCTemplate *Tmpl, const char *Text, long len)
+{
+	TemplateOp *Op;
+
+	if (len <= 0)
+		return;
+	if ((Tmpl->nOps > 0) && (Tmpl->Ops[Tmpl->nOps - 1].Op == eOpText)) {
+		Tmpl->Ops[Tmpl->nOps - 1].TextLen += len;
+	}
+	else {
+		Op = &Tmpl->Ops[Tmpl->nOps++];
+		Op->Op = eOpText;
+		Op->TextAt = StrLength(Tmpl->Text);
+		Op->TextLen = len;
+	}
+	StrBufAppendBufPlain(Tmpl->Text, Text, len, 0);
+}
+
+/*
+ * Turn the tokens of a freshly parsed template into the list of things to
+ * do when it's rendered: handlers, conditionals and subtemplates are looked
+ * up now, conditionals know where they end, and what's constant becomes text.
+ * All templates are known by name before the first one is loaded, so we can
+ * find our subtemplates here already.
+ */
+static void CompileTemplate(WCTemplate *Tmpl)
+{
+	WCTemplateToken *Token;
+	HashHandler *Handler;
+	TemplateOp *Op;
+	const char *pS, *pData;
+	char buf[32];
+	int i, j, LastToken;
+
+	Tmpl->Text = NewStrBufPlain(NULL, StrLength(Tmpl->Data));
+	/* each token gets at most one op, and maybe some text in front of it. */
+	Tmpl->Ops = (TemplateOp*) malloc(sizeof(TemplateOp) * (2 * Tmpl->nTokensUsed + 1));
+	memset(Tmpl->Ops, 0, sizeof(TemplateOp) * (2 * Tmpl->nTokensUsed + 1));
+	Tmpl->nOps = 0;
+
+	pS = pData = ChrPtr(Tmpl->Data);
+	for (i = 0; i < Tmpl->nTokensUsed; i++) {
+		Token = Tmpl->Tokens[i];
+		CompileText(Tmpl, pData, Token->pTokenStart - pData);
+		pData = Token->pTokenEnd + 1;
+
+		Op = &Tmpl->Ops[Tmpl->nOps];
+		Op->Token = Token;
+		switch (Token->Flags) {
+		case SV_PREEVALUATED:
+			Handler = (HashHandler*) Token->PreEval;
+
+			/* comments only show up while debugging templates */
+			if ((Handler->HandlerFunc == tmplput_Comment) && (LoadTemplates == 0))
+				continue;
+
+			/* a define is what it is, no need to print it each time. */
+			if ((Handler->HandlerFunc == tmplput_DefVal) &&
+			    ((Token->Params[0]->Type == TYPE_LONG) ||
+			     (Token->Params[0]->Type == TYPE_INTDEFINE)))
+			{
+				snprintf(buf, sizeof(buf), "%d", (int) Token->Params[0]->lvalue);
+				CompileText(Tmpl, buf, strlen(buf));
+				continue;
+			}
+
+			Op->Op = eOpHandler;
+			Op->Need = &Handler->Filter;
+			Op->Handler = Handler->HandlerFunc;
+			break;
+		case SV_CONDITIONAL:
+		case SV_NEG_CONDITIONAL:
+			if ((Token->Params[0]->len == 1) &&
+			    (Token->Params[0]->Start[0] == 'X'))
+			{
+				Op->Op = eOpEndConditional;
+			}
+			else if (Token->PreEval != NULL) {
+				Op->Op = eOpConditional;
+				Op->Cond = (ConditionalStruct*) Token->PreEval;
+				Op->Need = &Op->Cond->Filter;
+				Op->Neg = (Token->Flags == SV_CONDITIONAL);
+			}
+			else {
+				Op->Op = eOpToken;
+			}
+			break;
+		case SV_SUBTEMPL:
+			if (Token->nParameters != 1)
+				continue;
+			Op->Op = eOpSubTemplate;
+			Op->SubTemplate = LookupTemplate(Token->Params[0]->Start, Token->Params[0]->len);
+			break;
+		default:
+			Op->Op = eOpToken;
+			break;
+		}
+		Tmpl->nOps++;
+	}
+	CompileText(Tmpl, pData, StrLength(Tmpl->Data) - (pData - pS));
+
+	LastToken = -1;
+	for (i = 0; i < Tmpl->nOps; i++) {
+		Op = &Tmpl->Ops[i];
+		if (Op->Op == eOpText)
+			Op->Text = ChrPtr(Tmpl->Text) + Op->TextAt;
+		else
+			LastToken = i;
+	}
+
+	/* if a conditional tells us to skip, we skip to its end - or past our last token. */
+	for (i = 0; i < Tmpl->nOps; i++) {
+		Op = &Tmpl->Ops[i];
+		if (Op->Op != eOpConditional)
+			continue;
+		Op->SkipTo = LastToken;
+		for (j = i + 1; j < Tmpl->nOps; j++) {
+			if (IsConditionalEnd(&Tmpl->Ops[j], Op->Token->Params[1]->lvalue)) {
+				Op->SkipTo = j;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Will all handlers and conditionals of this template find the context they
+ * need, if rendered with TP?  Iterators ask once, instead of once per row.
+ */
+static int TemplateContextsFound(WCTemplate *Tmpl, WCTemplputParams *TP)
+{
+	WCTemplputParams *TPP;
+	int i;
+
+	for (i = 0; i < Tmpl->nOps; i++) {
+		if ((Tmpl->Ops[i].Need == NULL) ||
+		    (Tmpl->Ops[i].Need->ContextType == CTX_NONE))
+			continue;
+		TPP = TP;
+		while ((TPP != NULL) &&
+		       (Tmpl->Ops[i].Need->ContextType != TPP->Filter.ContextType))
+			TPP = TPP->Super;
+		if (TPP == NULL)
+			return 0;
+	}
+	return 1;
+}
+
 /**
  * \brief Display a variable-substituted template
  * \param templatename template file to load
@@ -1479,6 +1687,7 @@ void *load_template(StrBuf *Target, WCTemplate *NewTemplate)
 	}
 
 	SanityCheckTemplate(NULL, NewTemplate);
+	CompileTemplate(NewTemplate);
 	return NewTemplate;
 }
 
@@ -1798,14 +2007,19 @@ int EvaluateToken(StrBuf *Target, int state, WCTemplputParams **TPP)
 
 
 
-const StrBuf *ProcessTemplate(WCTemplate *Tmpl, StrBuf *Target, WCTemplputParams *CallingTP)
+/*
+ * Render a compiled template.  If ContextChecked is set, the caller already
+ * made sure with TemplateContextsFound() that everybody finds his context in
+ * CallingTP, so we only check the ones run in contexts stacked up in here.
+ */
+static const StrBuf *RenderTemplate(WCTemplate *Tmpl, StrBuf *Target, WCTemplputParams *CallingTP, int ContextChecked)
 {
 	WCTemplate *pTmpl = Tmpl;
-	int done = 0;
-	int i;
-	TemplState state;
-	const char *pData, *pS;
-	long len;
+	TemplateOp *Op;
+	int pc;
+	int TokenRc;
+	int Bursting;
+	wcsession *WCC;
 	WCTemplputParams TP;
 	WCTemplputParams *TPtr = &TP;
 
@@ -1830,81 +2044,81 @@ const StrBuf *ProcessTemplate(WCTemplate *Tmpl, StrBuf *Target, WCTemplputParams
 			FreeWCTemplate(pTmpl);
 			return NULL;
 		}
-
+		ContextChecked = 0;
 	}
 
-	pS = pData = ChrPtr(pTmpl->Data);
-	len = StrLength(pTmpl->Data);
-	i = 0;
-	state = eNext;
-	while (!done) {
-		if (i >= pTmpl->nTokensUsed) {
-			StrBufAppendBufPlain(Target, 
-					     pData, 
-					     len - (pData - pS), 0);
-			done = 1;
-		}
-		else {
-			int TokenRc = 0;
+	/* only the page itself goes out in chunks; see burst_checkpoint() */
+	WCC = WC;
+	Bursting = (WCC != NULL) && (Target == WCC->WBuf);
 
-			StrBufAppendBufPlain(
-				Target, pData, 
-				pTmpl->Tokens[i]->pTokenStart - pData, 0);
-			TPtr->Tokens = pTmpl->Tokens[i];
-			TPtr->nArgs = pTmpl->Tokens[i]->nParameters;
+	for (pc = 0; pc < pTmpl->nOps; pc++) {
+		Op = &pTmpl->Ops[pc];
+		if (Op->Op == eOpText) {
+			StrBufAppendBufPlain(Target, Op->Text, Op->TextLen, 0);
+			continue;
+		}
 
-		        TokenRc = EvaluateToken(Target, TokenRc, &TPtr);
-			if (TokenRc > 0)
+		TPtr->Tokens = Op->Token;
+		TPtr->nArgs = Op->Token->nParameters;
+		TokenRc = 0;
+		switch (Op->Op) {
+		case eOpHandler:
+			if ((Op->Need->ContextType == CTX_NONE) ||
+			    (Op->Need->ContextType == TPtr->Filter.ContextType) ||
+			    ((ContextChecked) && (TPtr == &TP)) ||
+			    (CheckContext(Target, Op->Need, TPtr, "Token")))
 			{
-				state = eSkipTilEnd;
-			}
-			else if (TokenRc < 0)
-			{
-				if ((TPtr != &TP) &&
-				    (TPtr->ExitCTXID == -TokenRc))
-				{
-					UnStackDynamicContext(Target, &TPtr);
-				}
-				TokenRc = 0;
+				Op->Handler(Target, TPtr);
 			}
+			break;
+		case eOpConditional:
+			TokenRc = DoConditional(Target, Op->Cond, Op->Neg,
+						!((ContextChecked) && (TPtr == &TP)),
+						&TPtr);
+			break;
+		case eOpEndConditional:
+			TokenRc = - (Op->Token->Params[1]->lvalue);
+			break;
+		case eOpSubTemplate:
+			if (Op->SubTemplate != NULL)
+				RenderTemplate(Op->SubTemplate, Target, TPtr, 0);
+			else /* let it complain */
+				DoTemplate(Op->Token->Params[0]->Start, Op->Token->Params[0]->len, Target, TPtr);
+			break;
+		default:
+			TokenRc = EvaluateToken(Target, 0, &TPtr);
+			break;
+		}
+		if (Bursting)
+			burst_checkpoint(Target);
 
-			while ((state != eNext) && (i+1 < pTmpl->nTokensUsed)) {
+		if (TokenRc > 0) {
 			/* condition told us to skip till its end condition */
-				i++;
-				TPtr->Tokens = pTmpl->Tokens[i];
-				TPtr->nArgs = pTmpl->Tokens[i]->nParameters;
-				if ((pTmpl->Tokens[i]->Flags == SV_CONDITIONAL) ||
-				    (pTmpl->Tokens[i]->Flags == SV_NEG_CONDITIONAL))
-				{
-					int rc;
-				        rc = EvaluateConditional(
-						Target, 
-						pTmpl->Tokens[i]->Flags, 
-						TokenRc, 
-						&TPtr);
-					if (-rc == TokenRc)
-					{
-						TokenRc = 0;
-						state = eNext;
-						if ((TPtr != &TP) &&
-						    (TPtr->ExitCTXID == - rc))
-						{
-							UnStackDynamicContext(Target, &TPtr);
-						}
-					}
-				}
+			pc = Op->SkipTo;
+			if ((TPtr != &TP) &&
+			    (TPtr->ExitCTXID == TokenRc) &&
+			    (IsConditionalEnd(&pTmpl->Ops[pc], TokenRc)))
+			{
+				UnStackDynamicContext(Target, &TPtr);
+			}
+		}
+		else if (TokenRc < 0) {
+			if ((TPtr != &TP) &&
+			    (TPtr->ExitCTXID == -TokenRc))
+			{
+				UnStackDynamicContext(Target, &TPtr);
 			}
-
-			pData = pTmpl->Tokens[i++]->pTokenEnd + 1;
-			if (i > pTmpl->nTokensUsed)
-				done = 1;
 		}
 	}
 	if (LoadTemplates != 0) {
 		FreeWCTemplate(pTmpl);
 	}
 	return Tmpl->MimeType;
+}
 
+const StrBuf *ProcessTemplate(WCTemplate *Tmpl, StrBuf *Target, WCTemplputParams *CallingTP)
+{
+	return RenderTemplate(Tmpl, Target, CallingTP, 0);
 }
 
 
@@ -1917,9 +2131,7 @@ StrBuf *textPlainType;
 const StrBuf *DoTemplate(const char *templatename, long len, StrBuf *Target, WCTemplputParams *TP) 
 {
 	WCTemplputParams LocalTP;
-	HashList *Static;
-	HashList *StaticLocal;
-	void *vTmpl;
+	WCTemplate *Tmpl;
 	
 	if (Target == NULL)
 		Target = WC->WBuf;
@@ -1928,9 +2140,6 @@ const StrBuf *DoTemplate(const char *templatename, long len, StrBuf *Target, WCT
 		TP = &LocalTP;
 	}
 
-	Static = TemplateCache;
-	StaticLocal = LocalTemplateCache;
-
 	if (len == 0)
 	{
 		syslog(LOG_WARNING, "Can't to load a template with empty name!\n");
@@ -1938,8 +2147,8 @@ const StrBuf *DoTemplate(const char *templatename, long len, StrBuf *Target, WCT
 		return textPlainType;
 	}
 
-	if (!GetHash(StaticLocal, templatename, len, &vTmpl) &&
-	    !GetHash(Static, templatename, len, &vTmpl)) {
+	Tmpl = LookupTemplate(templatename, len);
+	if (Tmpl == NULL) {
 		StrBuf *escapedString = NewStrBufPlain(NULL, len);
 		
 		StrHtmlEcmaEscAppend(escapedString, NULL, templatename, 1, 1);
@@ -1955,9 +2164,7 @@ const StrBuf *DoTemplate(const char *templatename, long len, StrBuf *Target, WCT
 		FreeStrBuf(&escapedString);
 		return textPlainType;
 	}
-	if (vTmpl == NULL) 
-		return textPlainType;
-	return ProcessTemplate(vTmpl, Target, TP);
+	return ProcessTemplate(Tmpl, Target, TP);
 
 }
 
@@ -2088,6 +2295,8 @@ void tmpl_iterate_subtmpl(StrBuf *Target, WCTemplputParams *TP)
 	WCTemplputParams IterateTP;
 	WCTemplputParams SubTP;
 	IterateStruct Status;
+	WCTemplate *SubTmpl;
+	int ContextChecked = 0;
 
 	long StartAt = 0;
 	long StepWidth = 0;
@@ -2152,6 +2361,14 @@ void tmpl_iterate_subtmpl(StrBuf *Target, WCTemplputParams *TP)
 	StackContext (TP, &IterateTP, &Status, CTX_ITERATE, 0, TP->Tokens);
 	{
 		SubBuf = NewStrBuf();
+
+		/* each row sees the same contexts; so look up and check once for all of them. */
+		SubTmpl = LookupTemplate(TKEY(1));
+		if ((SubTmpl != NULL) && (LoadTemplates == 0)) {
+			StackContext(&IterateTP, &SubTP, NULL, It->ContextType, 0, NULL);
+			ContextChecked = TemplateContextsFound(SubTmpl, &SubTP);
+			UnStackContext(&SubTP);
+		}
 	
 		if (HAVE_PARAM(2)) {
 			StartAt = GetTemplateTokenNumber(Target, TP, 2, 0);
@@ -2183,10 +2400,14 @@ void tmpl_iterate_subtmpl(StrBuf *Target, WCTemplputParams *TP)
 				{
 					if (It->DoSubTemplate != NULL)
 						It->DoSubTemplate(SubBuf, &SubTP);
-					DoTemplate(TKEY(1), SubBuf, &SubTP);
+					if (SubTmpl != NULL)
+						RenderTemplate(SubTmpl, SubBuf, &SubTP, ContextChecked);
+					else /* let it complain */
+						DoTemplate(TKEY(1), SubBuf, &SubTP);
 
 					StrBufAppendBuf(Target, SubBuf, 0);
 					FlushStrBuf(SubBuf);
+					burst_checkpoint(Target);
 				}
 				UnStackContext(&SubTP);
 				Status.oddeven = ! Status.oddeven;
@@ -2272,28 +2493,15 @@ int conditional_ITERATE_ISMOD(StrBuf *Target, WCTemplputParams *TP)
 /*-----------------------------------------------------------------------------
  *                      Conditionals
  */
-int EvaluateConditional(StrBuf *Target, int Neg, int state, WCTemplputParams **TPP)
+static int DoConditional(StrBuf *Target, ConditionalStruct *Cond, int Neg, int CheckCtx, WCTemplputParams **TPP)
 {
-	ConditionalStruct *Cond;
 	int rc = 0;
 	int res;
 	WCTemplputParams *TP = *TPP;
 
-	if ((TP->Tokens->Params[0]->len == 1) &&
-	    (TP->Tokens->Params[0]->Start[0] == 'X'))
-	{
-		return - (TP->Tokens->Params[1]->lvalue);
-	}
-	    
-	Cond = (ConditionalStruct *) TP->Tokens->PreEval;
-	if (Cond == NULL) {
-		LogTemplateError(
-			Target, "Conditional", ERR_PARM1, TP,
-			"unknown!");
-		return 0;
-	}
-
-	if (!CheckContext(Target, &Cond->Filter, TP, "Conditional")) {
+	if ((CheckCtx) &&
+	    (Cond->Filter.ContextType != CTX_NONE) &&
+	    (!CheckContext(Target, &Cond->Filter, TP, "Conditional"))) {
 		return 0;
 	}
 
@@ -2313,6 +2521,28 @@ int EvaluateConditional(StrBuf *Target, int Neg, int state, WCTemplputParams **T
 	return rc;
 }
 
+int EvaluateConditional(StrBuf *Target, int Neg, int state, WCTemplputParams **TPP)
+{
+	ConditionalStruct *Cond;
+	WCTemplputParams *TP = *TPP;
+
+	if ((TP->Tokens->Params[0]->len == 1) &&
+	    (TP->Tokens->Params[0]->Start[0] == 'X'))
+	{
+		return - (TP->Tokens->Params[1]->lvalue);
+	}
+	    
+	Cond = (ConditionalStruct *) TP->Tokens->PreEval;
+	if (Cond == NULL) {
+		LogTemplateError(
+			Target, "Conditional", ERR_PARM1, TP,
+			"unknown!");
+		return 0;
+	}
+
+	return DoConditional(Target, Cond, Neg, 1, TPP);
+}
+
 void RegisterContextConditional(const char *Name, long len, 
 				int nParams,
 				WCConditionalFunc CondF, 
@@ -201,8 +201,10 @@ void ShutDownWebcit(void)
 void worker_entry(void)
 {
 	int ssock;
+#ifndef HAVE_SYS_EPOLL_H
 	int i = 0;
 	int fail_this_transaction = 0;
+#endif
 	ParsedHttpHdrs Hdr;
 
 	memset(&Hdr, 0, sizeof(ParsedHttpHdrs));
@@ -210,9 +212,15 @@ void worker_entry(void)
 	http_new_modules(&Hdr);	
 
 	do {
+		ssock = -1; 
+#ifdef HAVE_SYS_EPOLL_H
+		/* The poller accepts the connections; we get the ones with a request waiting. */
+		--num_threads_executing;
+		ssock = http_poller_take(&Hdr);
+		++num_threads_executing;
+#else
 		/* Each worker thread blocks on accept() while waiting for something to do. */
 		fail_this_transaction = 0;
-		ssock = -1; 
 		errno = EAGAIN;
 		do {
 			fd_set wset;
@@ -229,6 +237,7 @@ void worker_entry(void)
 			++num_threads_executing;
 			if (ssock < 0) fail_this_transaction = 1;
 		} while ((msock > 0) && (ssock < 0)  && (time_to_die == 0));
+#endif
 
 		if ((msock == -1)||(time_to_die))
 		{/* ok, we're going down. */
@@ -272,6 +281,12 @@ void worker_entry(void)
 			syslog(LOG_DEBUG, "in between.");
 			pthread_exit(NULL);
 		} else {
+#ifdef HAVE_SYS_EPOLL_H
+			/* The poller did the socket setup; serve requests until the connection is idle. */
+			do {
+				context_loop(&Hdr);
+			} while (http_poller_done(&Hdr) > 0);
+#else
 			/* Got it? do some real work! */
 			/* Set the SO_REUSEADDR socket option */
 			i = 1;
@@ -301,9 +316,17 @@ void worker_entry(void)
 
 			if (fail_this_transaction == 0) {
 				Hdr.http_sock = ssock;
-
-				/* Perform an HTTP transaction... */
-				context_loop(&Hdr);
+				Hdr.nRequests = 0;
+
+				/* Perform HTTP transactions as long as the client keeps the connection open... */
+				while (1) {
+					context_loop(&Hdr);
+					if (!Hdr.HR.keep_alive ||
+					    !Hdr.HR.response_sent ||
+					    (client_wait_request(&Hdr, KEEPALIVE_TIMEOUT) <= 0))
+						break;
+					http_detach_modules(&Hdr);
+				}
 
 				/* Shut down SSL/TLS if required... */
 #ifdef HAVE_OPENSSL
@@ -316,9 +339,11 @@ void worker_entry(void)
 				if (Hdr.http_sock > 0) {
 					lingering_close(ssock);
 				}
+				Hdr.http_sock = -1;
 				http_detach_modules(&Hdr);
 
 			}
+#endif
 
 		}
 
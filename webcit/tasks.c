@@ -674,9 +674,12 @@ int tasks_LoadMsgFromServer(SharedMessageStatus *Stat,
 			    int is_new, 
 			    int i)
 {
-	/* Not (yet?) needed here? calview *c = (calview *) *ViewSpecific; */
+	calview *c = (calview *) *ViewSpecific;
 
-	load_ical_object(Msg->msgnum, is_new, ICAL_VTODO_COMPONENT, load_task, NULL, 0);
+	if (c->batch_loaded == 0)
+		c->batch_loaded = load_ical_objects(Stat, ICAL_VTODO_COMPONENT, load_task, NULL) ? 1 : -1;
+	if (c->batch_loaded < 0)
+		load_ical_object(Msg->msgnum, is_new, ICAL_VTODO_COMPONENT, load_task, NULL, 0);
 	return 0;
 }
 
@@ -730,6 +733,13 @@ int tasks_GetParamsGetServerCall(SharedMessageStatus *Stat,
 				 char *filter,
 				 long flen)
 {
+	calview *c;
+
+	/* we only use it to remember whether MSGB worked */
+	c = (calview*) malloc(sizeof(calview));
+	memset(c, 0, sizeof(calview));
+	*ViewSpecific = (void*)c;
+
 	strcpy(cmd, "MSGS ALL");
 	Stat->maxmsgs = 32767;
 	return 200;
@@ -739,10 +749,8 @@ int tasks_GetParamsGetServerCall(SharedMessageStatus *Stat,
 int tasks_Cleanup(void **ViewSpecific)
 {
 	wDumpContent(1);
-/* Tasks doesn't need the calview struct... 
 	free (*ViewSpecific);
 	*ViewSpecific = NULL;
-	*/
 	return 0;
 }
 
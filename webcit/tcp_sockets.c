@@ -17,6 +17,9 @@
 
 #include "webcit.h"
 #include "webserver.h"
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 
 long MaxRead = -1; /* should we do READ scattered or all at once? */
 
@@ -456,7 +459,7 @@ int serv_read_binary(StrBuf *Ret, size_t total_len, StrBuf *Buf)
 }
 
 
-int client_write(StrBuf *ThisBuf)
+int client_write(const StrBuf *ThisBuf)
 {
 	wcsession *WCC = WC;
         const char *ptr, *eptr;
@@ -501,13 +504,27 @@ read_serv_chunk(
 
 	StrBuf *Buf,
 	size_t total_len,
-	size_t *bytes_read
+	size_t *bytes_read,
+	int from_blob
 	)
 {
 	int rc;
 	int ServerRc;
 	wcsession *WCC = WC;
 
+	/* The server is sending it all at once; just take the next piece. */
+	if (from_blob) {
+		size_t this_block = total_len - *bytes_read;
+
+		if (this_block > SIZ * 4)
+			this_block = SIZ * 4;
+		rc = StrBuf_ServGetBLOBBuffered(WCC->WBuf, this_block);
+		if (rc < 0)
+			return rc;
+		*bytes_read += this_block;
+		return 6;
+	}
+
 	serv_printf("READ "SIZE_T_FMT"|"SIZE_T_FMT, *bytes_read, total_len-(*bytes_read));
 	if ( (rc = StrBuf_ServGetln(Buf) > 0) &&
 	     (ServerRc = GetServerStatus(Buf, NULL), ServerRc == 6) ) 
@@ -534,7 +551,7 @@ read_serv_chunk(
 	return 6;
 }
 
-static inline int send_http(StrBuf *Buf)
+static inline int send_http(const StrBuf *Buf)
 {
 #ifdef HAVE_OPENSSL
 	if (is_https)
@@ -544,10 +561,34 @@ static inline int send_http(StrBuf *Buf)
 		return client_write(Buf);
 }
 /*
- * Read binary data from server into memory using a series of server READ commands.
- * returns the read content as StrBuf
+ * Swallow the rest of a blob the server is sending us, so the next command
+ * on this connection doesn't read it as its reply.  If we can't, the
+ * connection is out of step with us, and nobody may use it again.
  */
-void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static, int detect_mime)
+static void drain_serv_blob(StrBuf *Buf, size_t total_len, size_t *bytes_read, int ServerRc)
+{
+	wcsession *WCC = WC;
+
+	while ((*bytes_read < total_len) && (ServerRc == 6) && (WCC->serv_sock != -1)) {
+		ServerRc = read_serv_chunk(Buf, total_len, bytes_read, 1);
+		FlushStrBuf(WCC->WBuf);
+	}
+	if ((*bytes_read < total_len) && (WCC->serv_sock != -1)) {
+		syslog(LOG_INFO, "Server connection broken while skipping a download\n");
+		close(WCC->serv_sock);
+		WCC->serv_sock = (-1);
+		WCC->connected = 0;
+		WCC->logged_in = 0;
+	}
+}
+
+/*
+ * Relay binary data from the server to the browser, a chunk at a time.
+ * from_blob == 0: it's an open download file, we fetch it with READ commands.
+ * from_blob == 1: the server already said BINARY_FOLLOWS (e.g. DLAT), and any
+ *                 byte range the client asked for was already applied by it.
+ */
+static void relay_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static, int detect_mime, int from_blob)
 {
 	int ServerRc = 6;
 	wcsession *WCC = WC;
@@ -555,6 +596,7 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 	int first = 1;
 	int client_con_state = 0;
 	int chunked = 0;
+	long content_length;
 	int is_gzip = 0;
 	const char *Err = NULL;
 	StrBuf *BufHeader = NULL;
@@ -570,20 +612,23 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 	if (WCC->Hdr->HaveRange)
 	{
 		WCC->Hdr->HaveRange++;
-		WCC->Hdr->TotalBytes = total_len;
-		/* open range? or beyound file border? correct the numbers. */
-		if ((WCC->Hdr->RangeTil == -1) || (WCC->Hdr->RangeTil>= total_len))
-			WCC->Hdr->RangeTil = total_len - 1;
-		bytes_read = WCC->Hdr->RangeStart;
-		total_len = WCC->Hdr->RangeTil;
+		if (!from_blob) {
+			WCC->Hdr->TotalBytes = total_len;
+			/* open range? or beyound file border? correct the numbers. */
+			if ((WCC->Hdr->RangeTil == -1) || (WCC->Hdr->RangeTil>= total_len))
+				WCC->Hdr->RangeTil = total_len - 1;
+			bytes_read = WCC->Hdr->RangeStart;
+			total_len = WCC->Hdr->RangeTil + 1;
+		}
 	}
 	else
-		chunked = total_len > SIZ * 10; /* TODO: disallow for HTTP / 1.0 */
+		chunked = WCC->Hdr->HR.http_1_1 && (total_len > SIZ * 10);
 
 	if (chunked)
 	{
 		BufHeader = NewStrBuf();
 	}
+	content_length = chunked ? -1 : (long)(total_len - bytes_read);
 
 	if ((detect_mime != 0) && (bytes_read != 0))
 	{
@@ -594,10 +639,13 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 		ServerRc = read_serv_chunk(
 			Buf,
 			total_len,
-			&bytes_read);
+			&bytes_read,
+			0);
 
 		if (ServerRc != 6)
 		{
+			if (from_blob)
+				drain_serv_blob(Buf, total_len, &bytes_read, ServerRc);
 			FreeStrBuf(&BufHeader);
 			FreeStrBuf(&Buf);
 			return;
@@ -617,7 +665,10 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 		SC = StrBufNewStreamContext (eZLibEncode, &Err);
 		if (SC == NULL) {
 			syslog(LOG_ERR, "Error while initializing stream context: %s", Err);
+			if (from_blob)
+				drain_serv_blob(Buf, total_len, &bytes_read, 6);
 			FreeStrBuf(&Buf);
+			FreeStrBuf(&BufHeader);
 			return;
 		}
 
@@ -634,10 +685,13 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 
 	if (!detect_mime)
 	{
-		http_transmit_headers(ChrPtr(MimeType), is_static, chunked, is_gzip);
+		http_transmit_headers(ChrPtr(MimeType), is_static, chunked, is_gzip,
+				      content_length);
 		
 		if (send_http(WCC->HBuf) < 0)
 		{
+			if (from_blob)
+				drain_serv_blob(Buf, total_len, &bytes_read, 6);
 			FreeStrBuf(&Buf);
 			FreeStrBuf(&WriteBuffer.Buf);
 			FreeStrBuf(&BufHeader);
@@ -668,7 +722,8 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 		ServerRc = read_serv_chunk(
 			Buf,
 			total_len,
-			&bytes_read);
+			&bytes_read,
+			from_blob);
 		if (ServerRc != 6)
 			break;
 
@@ -683,7 +738,8 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 				CheckGZipCompressionAllowed(SKEY(MimeType));
 				is_gzip = WCC->Hdr->HR.gzip_ok;
 			}
-			http_transmit_headers(ChrPtr(MimeType), is_static, chunked, is_gzip);
+			http_transmit_headers(ChrPtr(MimeType), is_static, chunked, is_gzip,
+					      content_length);
 			
 			client_con_state = send_http(WCC->HBuf);
 		}
@@ -729,6 +785,12 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 		}
 	}
 
+	/* If the browser went away, we still have to swallow the rest of the blob,
+	 * or the next command on this server connection gets to read it.
+	 */
+	if (from_blob)
+		drain_serv_blob(Buf, total_len, &bytes_read, ServerRc);
+
 	if (SC && StrBufDestroyStreamContext(eZLibEncode, &SC, &Err) && Err) {
 		syslog(LOG_ERR, "Error while destroying stream context: %s", Err);
 	}
@@ -743,10 +805,30 @@ void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static,
 			return;
 		}
 	}
+	WCC->Hdr->HR.response_sent = (bytes_read >= total_len) && (ServerRc == 6) && (client_con_state == 0);
 	FreeStrBuf(&BufHeader);
 	FreeStrBuf(&Buf);
 }
 
+/*
+ * Read binary data from server into memory using a series of server READ commands.
+ * returns the read content as StrBuf
+ */
+void serv_read_binary_to_http(StrBuf *MimeType, size_t total_len, int is_static, int detect_mime)
+{
+	relay_binary_to_http(MimeType, total_len, is_static, detect_mime, 0);
+}
+
+/*
+ * Like serv_read_binary_to_http(), but for total_len bytes the server is
+ * sending right after a BINARY_FOLLOWS reply.  The caller has to put any
+ * byte range the server applied into WC->Hdr.
+ */
+void serv_read_blob_to_http(StrBuf *MimeType, size_t total_len, int is_static, int detect_mime)
+{
+	relay_binary_to_http(MimeType, total_len, is_static, detect_mime, 1);
+}
+
 int ClientGetLine(ParsedHttpHdrs *Hdr, StrBuf *Target)
 {
 	const char *Error;
@@ -986,40 +1068,18 @@ int client_read_to(ParsedHttpHdrs *Hdr, StrBuf *Target, int bytes, int timeout)
 
 #ifdef HAVE_OPENSSL
 	if (is_https) {
-		long bufremain = 0;
-		long baselen;
-
-		baselen = StrLength(Target);
-
-		if (Hdr->Pos == NULL)
-			Hdr->Pos = ChrPtr(Hdr->ReadBuf);
-
-		if (StrLength(Hdr->ReadBuf) > 0)
-		{
-			bufremain = StrLength(Hdr->ReadBuf) - (Hdr->Pos - ChrPtr(Hdr->ReadBuf));
-			
-			if (bytes < bufremain)
-				bufremain = bytes;
-			StrBufAppendBufPlain(Target, Hdr->Pos, bufremain, 0);
-			StrBufCutLeft(Hdr->ReadBuf, bufremain);
+		/* the request line reader works on ReadBuf itself, so its start is our position. */
+		while ((StrLength(Hdr->ReadBuf) < bytes) && (retval >= 0))
+			retval = client_read_sslbuffer(Hdr->ReadBuf, timeout);
+		if (retval < 0) {
+			syslog(LOG_INFO, "client_read_ssl() failed\n");
+			return -1;
 		}
 
-		if (bytes > bufremain) 
-		{
-			while ((StrLength(Hdr->ReadBuf) + StrLength(Target) < bytes + baselen) &&
-			       (retval >= 0))
-				retval = client_read_sslbuffer(Hdr->ReadBuf, timeout);
-			if (retval >= 0) {
-				StrBufAppendBuf(Target, Hdr->ReadBuf, 0); /* todo: Buf > bytes? */
-				return 1;
-			}
-			else {
-				syslog(LOG_INFO, "client_read_ssl() failed\n");
-				return -1;
-			}
-		}
-		else 
-			return 1;
+		/* whatever is beyond our bytes belongs to the next request */
+		StrBufAppendBufPlain(Target, ChrPtr(Hdr->ReadBuf), bytes, 0);
+		StrBufCutLeft(Hdr->ReadBuf, bytes);
+		return 1;
 	}
 #endif
 
@@ -1053,8 +1113,162 @@ void begin_burst(void)
 }
 
 
+/*
+ * Big pages don't have to wait until they're complete: once this much is
+ * buffered, we send it as a chunk (gzip'ed as a part of one stream if the
+ * client likes that) and go on.
+ */
+#define BURST_CHUNK_SIZE (SIZ * 16)
+
+enum {
+	eBurstPlain,		/* collect everything, send it with a Content-length */
+	eBurstMayChunk,		/* the headers are complete; chunk if it grows big */
+	eBurstChunking,		/* headers are out, we're sending chunks */
+	eBurstFailed		/* the client went away; drop the rest */
+};
+
+/*
+ * Like begin_burst(), but the page may go out with Transfer-Encoding: chunked
+ * while it's being built. Only call this once all headers are in place, and
+ * don't touch what's already in WBuf afterwards.
+ */
+void begin_chunked_burst(void)
+{
+	wcsession *WCC = WC;
+
+	begin_burst();
+	if (WCC->Hdr->HR.http_1_1 && (WCC->Hdr->BurstChunked == eBurstPlain))
+		WCC->Hdr->BurstChunked = eBurstMayChunk;
+}
+
+static int burst_send_headers(wcsession *WCC)
+{
+	const char *Err = NULL;
+	int rc;
+
+	if (!DisableGzip && (WCC->Hdr->HR.gzip_ok)) {
+		WCC->Hdr->BurstZ = StrBufNewStreamContext(eZLibEncode, &Err);
+		if (WCC->Hdr->BurstZ != NULL)
+			hprintf("Content-encoding: gzip\r\n");
+		else
+			syslog(LOG_ALERT, "Compression failed: %s sending uncompressed\n", Err);
+	}
+
+	/* later wildfire messages are lost, we can't add headers anymore. */
+	if (WCC->WFBuf != NULL) {
+		WildFireSerializePayload(WCC->WFBuf, WCC->HBuf, &WCC->Hdr->nWildfireHeaders, NULL);
+		FreeStrBuf(&WCC->WFBuf);
+	}
+
+	if (WCC->Hdr->HR.prohibit_caching)
+		hprintf("Pragma: no-cache\r\nCache-Control: no-store\r\nExpires:-1\r\n");
+	http_connection_header();
+	hprintf("Transfer-Encoding: chunked\r\n\r\n");
+
+	rc = send_http(WCC->HBuf);
+	FlushStrBuf(WCC->HBuf);
+	WCC->Hdr->BurstChunked = (rc < 0) ? eBurstFailed : eBurstChunking;
+	return rc;
+}
+
+/*
+ * send what's in WBuf as one chunk; the last one closes the gzip stream and the body.
+ */
+static int burst_send_chunk(wcsession *WCC, int Last)
+{
+	const char *Err = NULL;
+	IOBuffer In, Out;
+	StrBuf *Chunk;
+	long len;
+	int rc = 0;
+
+	Chunk = WCC->WBuf;
+	if (WCC->Hdr->BurstZ != NULL) {
+		memset(&In, 0, sizeof(IOBuffer));
+		memset(&Out, 0, sizeof(IOBuffer));
+		In.Buf = WCC->WBuf;
+		Out.Buf = WCC->Hdr->BurstOut;
+		if (StrBufStreamTranscode(eZLibEncode, &Out, &In, NULL, -1,
+					  WCC->Hdr->BurstZ,
+					  (Last) ? STREAM_LAST : STREAM_FLUSH,
+					  &Err) < 0)
+		{
+			syslog(LOG_ALERT, "Compression failed: %s\n", Err);
+			rc = -1;
+		}
+		Chunk = WCC->Hdr->BurstOut;
+	}
+
+	len = StrLength(Chunk);
+	if ((rc == 0) && (len > 0)) {
+		StrBufPrintf(WCC->HBuf, "%lx\r\n", len);
+		StrBufAppendBufPlain(Chunk, HKEY("\r\n"), 0);
+		rc = send_http(WCC->HBuf);
+		if (rc >= 0)
+			rc = send_http(Chunk);
+	}
+	if ((rc >= 0) && Last) {
+		StrBufPlain(WCC->HBuf, HKEY("0\r\n\r\n"));
+		rc = send_http(WCC->HBuf);
+	}
+	FlushStrBuf(WCC->HBuf);
+	FlushStrBuf(WCC->Hdr->BurstOut);
+	FlushStrBuf(WCC->WBuf);
+
+	if (rc < 0)
+		WCC->Hdr->BurstChunked = eBurstFailed;
+	return rc;
+}
+
+/*
+ * A point where the page may be sent on; Target is where the caller writes to,
+ * nothing happens unless that's our output buffer and a chunked burst is allowed.
+ */
+void burst_checkpoint(const StrBuf *Target)
+{
+	wcsession *WCC = WC;
+
+	if ((WCC == NULL) ||
+	    (Target != WCC->WBuf) ||
+	    (WCC->Hdr->BurstChunked == eBurstPlain) ||
+	    (StrLength(WCC->WBuf) < BURST_CHUNK_SIZE))
+		return;
+
+	switch (WCC->Hdr->BurstChunked) {
+	case eBurstMayChunk:
+		if (burst_send_headers(WCC) < 0)
+			break;
+		/* fall through */
+	case eBurstChunking:
+		burst_send_chunk(WCC, 0);
+		break;
+	}
+	if (WCC->Hdr->BurstChunked == eBurstFailed)
+		FlushStrBuf(WCC->WBuf);
+}
+
+static long end_chunked_burst(wcsession *WCC)
+{
+	const char *Err = NULL;
+	long rc = -1;
+
+	if (WCC->Hdr->BurstChunked == eBurstChunking)
+		rc = burst_send_chunk(WCC, 1);
+	FlushStrBuf(WCC->WBuf);
+	WCC->Hdr->HR.response_sent = (rc >= 0);
+
+	if ((WCC->Hdr->BurstZ != NULL) &&
+	    StrBufDestroyStreamContext(eZLibEncode, &WCC->Hdr->BurstZ, &Err) && Err) {
+		syslog(LOG_ERR, "Error while destroying stream context: %s", Err);
+	}
+	WCC->Hdr->BurstChunked = eBurstPlain;
+	return rc;
+}
+
+
 /*
  * Finish buffering HTTP output.  [Compress using zlib and] output with a Content-Length: header.
+ * If the page already went out in chunks, send the rest as the last one.
  */
 long end_burst(void)
 {
@@ -1065,6 +1279,10 @@ long end_burst(void)
         fd_set wset;
         int fdflags;
 
+	if (WCC->Hdr->BurstChunked > eBurstMayChunk)
+		return end_chunked_burst(WCC);
+	WCC->Hdr->BurstChunked = eBurstPlain;
+
 	if (!DisableGzip && (WCC->Hdr->HR.gzip_ok))
 	{
 		if (CompressBuffer(WCC->WBuf) > 0)
@@ -1082,6 +1300,7 @@ long end_burst(void)
 
 	if (WCC->Hdr->HR.prohibit_caching)
 		hprintf("Pragma: no-cache\r\nCache-Control: no-store\r\nExpires:-1\r\n");
+	http_connection_header();
 	hprintf("Content-length: %d\r\n\r\n", StrLength(WCC->WBuf));
 
 	ptr = ChrPtr(WCC->HBuf);
@@ -1090,8 +1309,9 @@ long end_burst(void)
 
 #ifdef HAVE_OPENSSL
 	if (is_https) {
-		client_write_ssl(WCC->HBuf);
-		client_write_ssl(WCC->WBuf);
+		WCC->Hdr->HR.response_sent =
+			(client_write_ssl(WCC->HBuf) >= 0) &&
+			(client_write_ssl(WCC->WBuf) >= 0);
 		return (count);
 	}
 #endif
@@ -1148,10 +1368,162 @@ long end_burst(void)
 		ptr += res;
         }
 
+	WCC->Hdr->HR.response_sent = (WCC->Hdr->http_sock != -1);
 	return StrLength(WCC->WBuf);
 }
 
 
+/*
+ * Copy Bytes bytes of the file fd to the client; plain sockets get them
+ * straight from the page cache via sendfile().
+ */
+static long client_write_file(int fd, off_t Bytes)
+{
+	char Block[SIZ * 4];
+	StrBuf *Buf;
+	off_t offset = 0;
+	ssize_t res;
+#ifdef HAVE_SYS_SENDFILE_H
+	wcsession *WCC = WC;
+	fd_set wset;
+
+#ifdef HAVE_OPENSSL
+	if (!is_https)
+#endif
+	{
+		while ((offset < Bytes) && (WCC->Hdr->http_sock != -1)) {
+			res = sendfile(WCC->Hdr->http_sock, fd, &offset, Bytes - offset);
+			if ((res == -1) && (errno == EAGAIN)) {
+				/* the poller hands us non blocking sockets */
+				FD_ZERO(&wset);
+				FD_SET(WCC->Hdr->http_sock, &wset);
+				if (select(WCC->Hdr->http_sock + 1, NULL, &wset, NULL, NULL) == -1) {
+					syslog(LOG_INFO, "client_write_file: Socket select failed (%s)\n", strerror(errno));
+					return -1;
+				}
+				continue;
+			}
+			if ((res == -1) && (errno == EINTR))
+				continue;
+			if (res <= 0) {
+				syslog(LOG_INFO, "client_write_file: sendfile failed (%s)\n",
+				       (res == 0) ? "file truncated" : strerror(errno));
+				return -1;
+			}
+		}
+		return offset;
+	}
+#endif
+	Buf = NewStrBufPlain(NULL, sizeof(Block));
+	while (offset < Bytes) {
+		res = read(fd, Block, ((Bytes - offset) > (off_t)sizeof(Block)) ? sizeof(Block) : (Bytes - offset));
+		if ((res == -1) && (errno == EINTR))
+			continue;
+		if (res <= 0) {
+			syslog(LOG_INFO, "client_write_file: read failed (%s)\n",
+			       (res == 0) ? "file truncated" : strerror(errno));
+			FreeStrBuf(&Buf);
+			return -1;
+		}
+		StrBufPlain(Buf, Block, res);
+		if (send_http(Buf) < 0) {
+			FreeStrBuf(&Buf);
+			return -1;
+		}
+		offset += res;
+	}
+	FreeStrBuf(&Buf);
+	return offset;
+}
+
+/*
+ * Send a response whose body is ready already: the headers are in HBuf,
+ * the body is Body, or Bytes bytes of the file fd, or nothing (NULL / -1).
+ * The static file code uses this, so its content doesn't need to pass WBuf.
+ */
+long http_send_prepared(const StrBuf *Body, int fd, off_t Bytes)
+{
+	wcsession *WCC = WC;
+	long rc;
+
+	http_connection_header();
+	hprintf("\r\n");
+	rc = send_http(WCC->HBuf);
+	FlushStrBuf(WCC->HBuf);
+
+	if (WCC->Hdr->HR.eReqType != eHEAD) {
+		if ((rc >= 0) && (Body != NULL))
+			rc = send_http(Body);
+		else if ((rc >= 0) && (fd >= 0))
+			rc = client_write_file(fd, Bytes);
+	}
+	WCC->Hdr->HR.response_sent = (rc >= 0) && (WCC->Hdr->http_sock != -1);
+	return rc;
+}
+
+
+/*
+ * Tell the client whether we'll take another request on this connection;
+ * the burst functions add this, so pages don't need to care.
+ */
+void http_connection_header(void)
+{
+	wcsession *WCC = WC;
+
+	if (WCC->Hdr->HR.keep_alive > 0)
+		hprintf("Connection: keep-alive\r\n"
+			"Keep-Alive: timeout=%d, max=%d\r\n",
+			KEEPALIVE_TIMEOUT,
+			KEEPALIVE_MAX_REQUESTS - WCC->Hdr->nRequests);
+	else
+		hprintf("Connection: close\r\n");
+}
+
+
+/*
+ * Did the client already send more than we've read so far, i.e. pipelined requests?
+ */
+static int client_has_pending(ParsedHttpHdrs *Hdr)
+{
+#ifdef HAVE_OPENSSL
+	if (is_https)
+		return StrLength(Hdr->ReadBuf) > 0;
+#endif
+	return (Hdr->Pos != NULL) &&
+		(Hdr->Pos < ChrPtr(Hdr->ReadBuf) + StrLength(Hdr->ReadBuf));
+}
+
+/*
+ * Wait for the next request on a kept alive connection.
+ * Returns 1 if the client sent something, 0 on timeout or shutdown, -1 if the connection broke.
+ */
+int client_wait_request(ParsedHttpHdrs *Hdr, int timeout)
+{
+	struct timeval tv;
+	fd_set rfds;
+	int i, rc;
+
+	if (Hdr->http_sock == -1)
+		return -1;
+	if (client_has_pending(Hdr))
+		return 1;
+
+	/* look once a second, so we don't hold up a shutdown */
+	for (i = 0; (i < timeout) && !time_to_die; i++) {
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		FD_ZERO(&rfds);
+		FD_SET(Hdr->http_sock, &rfds);
+		rc = select(Hdr->http_sock + 1, &rfds, NULL, NULL, &tv);
+		if ((rc < 0) && (errno == EINTR))
+			continue;
+		if (rc != 0)
+			return (rc > 0) ? 1 : -1;
+	}
+	return 0;
+}
+
+
 /*
  * lingering_close() a`la Apache. see
  * http://httpd.apache.org/docs/2.0/misc/fin_wait_2.html for rationale
@@ -1196,6 +1568,7 @@ HttpNewModule_TCPSOCKETS
 {
 
 	httpreq->ReadBuf = NewStrBufPlain(NULL, SIZ * 4);
+	httpreq->BurstOut = NewStrBufPlain(NULL, SIZ * 4);
 }
 
 void
@@ -1203,8 +1576,19 @@ HttpDetachModule_TCPSOCKETS
 (ParsedHttpHdrs *httpreq)
 {
 
-	FlushStrBuf(httpreq->ReadBuf);
-	ReAdjustEmptyBuf(httpreq->ReadBuf, 4 * SIZ, SIZ);
+	const char *Err;
+
+	/* on a kept alive connection, the next request may already be waiting in here. */
+	if ((httpreq->http_sock == -1) || !client_has_pending(httpreq)) {
+		FlushStrBuf(httpreq->ReadBuf);
+		ReAdjustEmptyBuf(httpreq->ReadBuf, 4 * SIZ, SIZ);
+		httpreq->Pos = NULL;
+	}
+	FlushStrBuf(httpreq->BurstOut);
+	ReAdjustEmptyBuf(httpreq->BurstOut, 4 * SIZ, SIZ);
+	if (httpreq->BurstZ != NULL)
+		StrBufDestroyStreamContext(eZLibEncode, &httpreq->BurstZ, &Err);
+	httpreq->BurstChunked = 0;
 }
 
 void
@@ -1212,7 +1596,12 @@ HttpDestroyModule_TCPSOCKETS
 (ParsedHttpHdrs *httpreq)
 {
 
+	const char *Err;
+
 	FreeStrBuf(&httpreq->ReadBuf);
+	FreeStrBuf(&httpreq->BurstOut);
+	if (httpreq->BurstZ != NULL)
+		StrBufDestroyStreamContext(eZLibEncode, &httpreq->BurstZ, &Err);
 }
 
 
@@ -10,9 +10,6 @@
 #include <stdio.h>
 
 
-wcsession *TestSessionList = NULL;
-
-
 ParsedHttpHdrs Hdr;
 wcsession *TheSession;
 
@@ -21,7 +18,7 @@ extern StrBuf *Passvoid;
 
 
 extern int ReadHttpSubject(ParsedHttpHdrs *Hdr, StrBuf *Line, StrBuf *Buf);
-extern wcsession *CreateSession(int Lockable, wcsession **wclist, ParsedHttpHdrs *Hdr, pthread_mutex_t *ListMutex);
+extern wcsession *CreateSession(int Lockable, int Static, ParsedHttpHdrs *Hdr);
 extern void groupdav_main(void);
 
 
@@ -36,7 +33,7 @@ void SetUpContext(void)
 	Hdr.http_sock = 1; /* STDOUT */
 /* Context loop */
 	Hdr.HR.dav_depth = 32767; /* TODO: find a general way to have non-0 defaults */
-	TheSession = CreateSession(1, &TestSessionList, &Hdr, NULL);
+	TheSession = CreateSession(1, 0, &Hdr);
 	TheSession->lastreq = time(NULL);			/* log */
 	TheSession->Hdr = &Hdr;
 	Hdr.HTTPHeaders = NewHash(1, NULL);
@@ -281,6 +278,54 @@ void test_gettext_headerevaluation_ie7(void)
 	test_gettext(HKEY("en-us,x-ns1MvoLpRxbNhu,x-ns2F0f0NnyPOPN"));
 }
 
+
+#define TEMPLATE_BENCH_ROUNDS 100
+
+/*
+ * render every template we have loaded a couple of times, and tell how long 
+ * each of them took. Not much of a test, but it shows whether the compiled
+ * op lists pay off.
+ */
+void test_template_render(void)
+{
+	StrBuf *Target;
+	HashPos *it;
+	const char *Key;
+	long KLen;
+	void *vTmpl;
+	struct timeval tv_start, tv_tmpl, tv_end;
+	long usec;
+	int i;
+
+	SetUpContext();
+	if (SetUpConnection())
+	{
+		SetUpRequest("/");
+		Target = NewStrBufPlain(NULL, SIZ * 4);
+		gettimeofday(&tv_start, NULL);
+		it = GetNewHashPos(TemplateCache, 0);
+		while (GetNextHashPos(TemplateCache, it, &KLen, &Key, &vTmpl)) {
+			gettimeofday(&tv_tmpl, NULL);
+			for (i = 0; i < TEMPLATE_BENCH_ROUNDS; i++) {
+				FlushStrBuf(Target);
+				DoTemplate(Key, KLen, Target, &NoCtx);
+			}
+			gettimeofday(&tv_end, NULL);
+			usec = (tv_end.tv_sec - tv_tmpl.tv_sec) * 1000000 + 
+				tv_end.tv_usec - tv_tmpl.tv_usec;
+			printf("%s: %ld usec for %d rounds\n", Key, usec, TEMPLATE_BENCH_ROUNDS);
+		}
+		DeleteHashPos(&it);
+		gettimeofday(&tv_end, NULL);
+		usec = (tv_end.tv_sec - tv_start.tv_sec) * 1000000 + 
+			tv_end.tv_usec - tv_start.tv_usec;
+		printf("all templates: %ld usec for %d rounds\n", usec, TEMPLATE_BENCH_ROUNDS);
+		FreeStrBuf(&Target);
+		TearDownRequest();
+	}
+	TearDownContext();
+}
+
 static void AddTests(void)
 {
 	CU_pSuite pGroup = NULL;
@@ -296,6 +341,9 @@ static void AddTests(void)
 	pGroup = CU_add_suite("TestUrlPatterns", NULL, NULL);
 	pTest = CU_add_test(pGroup, "Test", test_groupdav_directorycommands);
 
+	pGroup = CU_add_suite("TestTemplateRender", NULL, NULL);
+	pTest = CU_add_test(pGroup, "Bench", test_template_render);
+
 
 }
 
@@ -88,6 +88,7 @@ void wc_printf(const char *format,...)
 #ifdef UBER_VERBOSE_DEBUGGING
 	StrBufAppendPrintf(WCC->WBuf, "]\n");
 #endif
+	burst_checkpoint(WCC->WBuf);
 }
 
 /*
@@ -153,14 +154,12 @@ void output_headers(	int do_httpheaders,	/* 1 = output HTTP headers			  */
 	if (do_httpheaders) {
 		if (WCC->serv_info != NULL)
 			hprintf("Content-type: text/html; charset=utf-8\r\n"
-				"Server: %s / %s\n"
-				"Connection: close\r\n",
+				"Server: %s / %s\n",
 				PACKAGE_STRING, 
 				ChrPtr(WCC->serv_info->serv_software));
 		else
 			hprintf("Content-type: text/html; charset=utf-8\r\n"
-				"Server: %s / [n/a]\n"
-				"Connection: close\r\n",
+				"Server: %s / [n/a]\n",
 				PACKAGE_STRING);
 	}
 
@@ -188,7 +187,7 @@ void output_headers(	int do_httpheaders,	/* 1 = output HTTP headers			  */
 	if (cache < 2) stuff_to_cookie(unset_cookies);
 
 	if (do_htmlhead) {
-		begin_burst();
+		begin_chunked_burst();
 		do_template("head");
 		if ( (WCC->logged_in) && (!unset_cookies) ) {
 			DoTemplate(HKEY("paging"), NULL, &NoCtx);
@@ -207,7 +206,6 @@ void output_custom_content_header(const char *ctype) {
 	hprintf("HTTP/1.1 200 OK\r\n");
 	hprintf("Content-type: %s; charset=utf-8\r\n",ctype);
 	hprintf("Server: %s / %s\r\n", PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software));
-	hprintf("Connection: close\r\n");
 }
 
 
@@ -244,15 +242,14 @@ void http_transmit_thing(const char *content_type, int is_static)
 	output_headers(0, 0, 0, 0, 0, is_static);
 
 	hprintf("Content-type: %s\r\n"
-		"Server: %s\r\n"
-		"Connection: close\r\n",
+		"Server: %s\r\n",
 		content_type,
 		PACKAGE_STRING);
 
 	end_burst();
 }
 
-void http_transmit_headers(const char *content_type, int is_static, long is_chunked, int is_gzip)
+void http_transmit_headers(const char *content_type, int is_static, long is_chunked, int is_gzip, long content_length)
 {
 	wcsession *WCC = WC;
 	if (verbose)
@@ -269,12 +266,18 @@ void http_transmit_headers(const char *content_type, int is_static, long is_chun
 			WCC->Hdr->RangeTil,
 			WCC->Hdr->TotalBytes);
 
+	if (is_chunked)
+		hprintf("Transfer-Encoding: chunked\r\n");
+	else if (content_length >= 0)
+		hprintf("Content-length: %ld\r\n", content_length);
+	else
+		WCC->Hdr->HR.keep_alive = 0;	/* only the end of the connection tells where it ends */
+
 	hprintf("Content-type: %s\r\n"
-		"Server: "PACKAGE_STRING"\r\n"
-		"%s"
-		"Connection: close\r\n\r\n",
-		content_type,
-		(is_chunked)?"Transfer-Encoding: chunked\r\n":"");
+		"Server: "PACKAGE_STRING"\r\n",
+		content_type);
+	http_connection_header();
+	hprintf("\r\n");
 }
 
 
@@ -341,8 +344,7 @@ void authorization_required(void)
 
 	hprintf("HTTP/1.1 401 Authorization Required\r\n");
 	hprintf(
-		"Server: %s / %s\r\n"
-		"Connection: close\r\n",
+		"Server: %s / %s\r\n",
 		PACKAGE_STRING, ChrPtr(WC->serv_info->serv_software)
 	);
 	hprintf("WWW-Authenticate: Basic realm=\"%s\"\r\n", ChrPtr(WC->serv_info->serv_humannode));
@@ -381,7 +383,6 @@ void begin_ajax_response(void) {
 
 	hprintf("Content-type: text/html; charset=UTF-8\r\n"
 		"Server: %s\r\n"
-		"Connection: close\r\n"
 		,
 		PACKAGE_STRING);
 	begin_burst();
@@ -682,7 +683,11 @@ void session_loop(void)
 
 	/*
 	 * If we're not connected to a Citadel server, try to hook up the connection now.
+	 * Our login may be parked, then any pooled connection will do.
 	 */
+	if (!WCC->connected && (StrLength(WCC->ParkToken) > 0)) {
+		ServPoolResume();
+	}
 	if (!WCC->connected) {
 		if (GetConnected()) {
 			hprintf("HTTP/1.1 503 Service Unavailable\r\n");
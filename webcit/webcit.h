@@ -123,6 +123,8 @@ extern char *ssl_cipher_list;
 #endif
 
 #define SLEEPING		180		/* TCP connection timeout */
+#define KEEPALIVE_TIMEOUT	15		/* how long an idle HTTP/1.1 connection is kept open */
+#define KEEPALIVE_MAX_REQUESTS	100		/* how many requests one HTTP connection may carry */
 #define WEBCIT_TIMEOUT		900		/* WebCit session timeout */
 #define PORT_NUM		2000		/* port number to listen on */
 #define DEVELOPER_ID		0
@@ -353,9 +355,14 @@ typedef struct _HdrRefs {
 	long ContentLength;
 	time_t if_modified_since;
 	int gzip_ok;				/* Nonzero if Accept-encoding: gzip */
+	int br_ok;				/* Nonzero if Accept-encoding: br */
 	int prohibit_caching;
+	int http_1_1;				/* Nonzero if the client can take a chunked response */
 	int dav_depth;
 	int Static;
+	int keep_alive;				/* >0 Connection: keep-alive, <0 close; then: may we serve another request? */
+	int bad_framing;			/* Transfer-Encoding or a dubious Content-Length: we can't tell where the body ends */
+	int response_sent;			/* a complete, delimited response went out */
 
 	/* these are references into Hdr->HTTPHeaders, so we don't need to free them. */
 	StrBuf *ContentType;
@@ -366,18 +373,24 @@ typedef struct _HdrRefs {
 	StrBuf *user_agent;
 	StrBuf *plainauth;
 	StrBuf *dav_ifmatch;
+	StrBuf *if_none_match;
 
 	const WebcitHandler *Handler;
 } HdrRefs;
 
+typedef struct _HttpConn HttpConn;		/* a connection, as the poller keeps it; see http_poller.c */
+
 typedef struct _ParsedHttpHdrs {
 	int http_sock;				/* HTTP server socket */
+	HttpConn *Conn;
 	long HaveRange;
 	long RangeStart;
 	long RangeTil;
 	long TotalBytes;
 	const char *Pos;
-	StrBuf *ReadBuf;
+	StrBuf *ReadBuf;			/* may hold the next pipelined request, survives per request cleanup */
+	int nRequests;				/* requests served on this connection so far */
+	int peer_closed;			/* the client is done sending; answer, then hang up */
 
 	StrBuf *c_username;
 	StrBuf *c_password;
@@ -389,7 +402,11 @@ typedef struct _ParsedHttpHdrs {
 
 	HashList *urlstrings;		        /* variables passed to webcit in a URL */
 	HashList *HTTPHeaders;                  /* the headers the client sent us */
+	StrBufArena *Arena;                     /* request scoped StrBufs; flushed after each request */
 	int nWildfireHeaders;                   /* how many wildfire headers did we already send? */
+	int BurstChunked;                       /* may / does the page go out in chunks? see begin_chunked_burst() */
+	vStreamT *BurstZ;                       /* gzip stream of a chunked page */
+	StrBuf *BurstOut;                       /* the compressed chunk on its way out */
 
 	HdrRefs HR;
 } ParsedHttpHdrs;
@@ -401,7 +418,12 @@ typedef struct _ParsedHttpHdrs {
  */
 struct wcsession {
 /* infrastructural members */
-	wcsession *next;			/* Linked list */
+	wcsession *next;			/* Linked list; our slot in the session timer wheel */
+	wcsession *prev;			/* ...doubly, so we can be moved out of it */
+	int wheel_slot;				/* which slot are we in? -1 if none */
+	wcsession *reuse_next;			/* Linked list of unbound sessions to reuse */
+	wcsession *reuse_prev;
+	StrBuf *AuthKey;			/* we're filed under this in the http-auth index */
 	pthread_mutex_t SessionMutex;		/* mutex for exclusive access */
 	int wc_session;				/* WebCit session ID */
 	int killthis;				/* Nonzero == purge this session */
@@ -415,6 +437,7 @@ struct wcsession {
 	StrBuf *ReadBuf;                        /* linebuffered reads from the server */
 	StrBuf *MigrateReadLineBuf;             /* here we buffer legacy server read stuff */
 	const char *ReadPos;                    /* whats our read position in ReadBuf? */
+	StrBuf *ParkToken;			/* our login is parked on the citserver under this; see ServPoolRelease() */
 	int last_chat_seq;			/* When in chat - last message seq# we saw */
 	time_t lastreq;				/* Timestamp of most recent HTTP */
 	time_t last_pager_check;		/* last time we polled for instant msgs */
@@ -473,6 +496,10 @@ struct wcsession {
 	HashList *Floors;                       /* floors our citserver has hashed numeric for quicker access*/
 	HashList *FloorsByName;                 /* same but hashed by its name */
 	HashList *Rooms;                        /* our directory structure as loaded by LKRA */
+	HashList *ZappedRooms;                  /* same for LZRM */
+	HashList *PublicRooms;                  /* same for LPRM */
+	StrBuf *RoomListStamp;                  /* RLST reply the above were loaded with */
+	int RoomListChecked;                    /* did we ask RLST in this request yet? */
 	HashList *summ;                         /* list of messages for mailbox summary view */
   /** Perhaps these should be within a struct instead */
 	long startmsg;                          /* message number to start at */
@@ -672,7 +699,8 @@ extern char *days[];
 long locate_user_vcard_in_this_room(message_summary **VCMsg,
 				    wc_mime_attachment **VCAtt);
 void http_transmit_thing(const char *content_type, int is_static);
-void http_transmit_headers(const char *content_type, int is_static, long is_chunked, int is_gzip);
+void http_transmit_headers(const char *content_type, int is_static, long is_chunked, int is_gzip, long content_length);
+void http_connection_header(void);
 long unescape_input(char *buf);
 void check_thread_pool_size(void);
 void StrEndTab(StrBuf *Target, int tabnum, int num_tabs);
@@ -698,7 +726,10 @@ const char *get_selected_language(void);
 void utf8ify_rfc822_string(char **buf);
 
 void begin_burst(void);
+void begin_chunked_burst(void);
+void burst_checkpoint(const StrBuf *Target);
 long end_burst(void);
+long http_send_prepared(const StrBuf *Body, int fd, off_t Bytes);
 
 void AppendImportantMessage(const char *pch, long len);
 
@@ -723,6 +754,10 @@ void http_datestring(char *buf, size_t n, time_t xtime);
 
 extern int time_to_die;			/* Nonzero if server is shutting down */
 extern int DisableGzip;
+extern int ServPoolSize;
+
+void ServPoolResume(void);
+void ServPoolRelease(void);
 
 void display_summary_page(void);
 
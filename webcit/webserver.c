@@ -21,7 +21,6 @@ int is_https = 0;				/* Nonzero if I am an HTTPS service */
 int follow_xff = 0;				/* Follow X-Forwarded-For: header? */
 int DisableGzip = 0;
 char *default_landing_page = NULL;
-extern pthread_mutex_t SessionListMutex;
 extern pthread_key_t MyConKey;
 
 extern void *housekeeping_loop(void);
@@ -99,9 +98,9 @@ int main(int argc, char **argv)
 
 	/* Parse command line */
 #ifdef HAVE_OPENSSL
-	while ((a = getopt(argc, argv, "u:h:i:p:t:T:B:x:g:dD:G:cfsS:Z:v:")) != EOF)
+	while ((a = getopt(argc, argv, "u:h:i:p:t:T:B:x:g:dD:G:cfsS:Z:v:P:")) != EOF)
 #else
-	while ((a = getopt(argc, argv, "u:h:i:p:t:T:B:x:g:dD:G:cfZ:v:")) != EOF)
+	while ((a = getopt(argc, argv, "u:h:i:p:t:T:B:x:g:dD:G:cfZ:v:P:")) != EOF)
 #endif
 		switch (a) {
 		case 'u':
@@ -191,6 +190,9 @@ int main(int argc, char **argv)
 		case 'v':
 			verbose=1;
 			break;
+		case 'P':
+			ServPoolSize = atoi(optarg);
+			break;
 		default:
 			fprintf(stderr, "usage:\nwebcit "
 				"[-i ip_addr] [-p http_port] "
@@ -200,6 +202,7 @@ int main(int argc, char **argv)
 				"[-u uid] [-h homedirectory] "
 				"[-D daemonizepid] [-v] "
 				"[-g defaultlandingpage] [-B basesize] "
+				"[-P pooled_server_connections] "
 #ifdef HAVE_OPENSSL
 				"[-s] [-S cipher_suites]"
 #endif
@@ -322,8 +325,6 @@ int main(int argc, char **argv)
 	syslog(LOG_INFO, "Listening on socket %d", msock);
 	signal(SIGPIPE, SIG_IGN);
 
-	pthread_mutex_init(&SessionListMutex, NULL);
-
 	/*
 	 * Start up the housekeeping thread
 	 */
@@ -341,6 +342,14 @@ int main(int argc, char **argv)
 #endif
 	drop_root(UID);
 
+#ifdef HAVE_SYS_EPOLL_H
+	/* One thread takes care of all the connections while they're idle... */
+	if (http_poller_start(msock) != 0) {
+		ShutDownWebcit();
+		return 1;
+	}
+#endif
+
 	/* Become a worker thread.  More worker threads will be spawned as they are needed. */
 	worker_entry();
 	ShutDownLibCitadel();
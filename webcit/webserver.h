@@ -19,6 +19,10 @@ extern char *default_landing_page;
 
 int ClientGetLine(ParsedHttpHdrs *Hdr, StrBuf *Target);
 int client_read_to(ParsedHttpHdrs *Hdr, StrBuf *Target, int bytes, int timeout);
+int client_wait_request(ParsedHttpHdrs *Hdr, int timeout);
+int http_poller_start(int msock);
+int http_poller_take(ParsedHttpHdrs *Hdr);
+int http_poller_done(ParsedHttpHdrs *Hdr);
 void wc_backtrace(long LogLevel);
 void ShutDownWebcit(void);
 void shutdown_ssl(void);